@@ -0,0 +1,175 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// the correction pass of the automatic chromatic aberration correction in cacorrect.c,
+// pixel by pixel instead of tile by tile. outside the image the cpu code mirrors the
+// raw data at the first and last row/column, which keeps the colour of the cfa. it
+// fills the corners (and the far borders of odd sized images) a bit differently, so the
+// outermost pixels there don't match exactly.
+
+float
+cacorrect_read(read_only image2d_t in, int x, int y, const int width, const int height)
+{
+  x = x < 0 ? -x : (x >= width ? 2 * width - 2 - x : x);
+  y = y < 0 ? -y : (y >= height ? 2 * height - 2 - y : y);
+  return read_imagef(in, sampleri, (int2)(x, y)).x;
+}
+
+float
+cacorrect_intp(const float a, const float b, const float c)
+{
+  // a * b + (1 - a) * c
+  return a * (b - c) + c;
+}
+
+float
+cacorrect_sqr(const float x)
+{
+  return x * x;
+}
+
+// interpolate G at R/B sites using directional weights from the image gradients
+kernel void
+cacorrect_green(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float eps = 1e-5f;
+  const float pc = read_imagef(in, sampleri, (int2)(x, y)).x;
+
+  if(FC(y, x, filters) == 1)
+  {
+    write_imagef(out, (int2)(x, y), (float4)(pc, 0.0f, 0.0f, 0.0f));
+    return;
+  }
+
+  const float pu1 = cacorrect_read(in, x, y - 1, width, height);
+  const float pu2 = cacorrect_read(in, x, y - 2, width, height);
+  const float pu3 = cacorrect_read(in, x, y - 3, width, height);
+  const float pd1 = cacorrect_read(in, x, y + 1, width, height);
+  const float pd2 = cacorrect_read(in, x, y + 2, width, height);
+  const float pd3 = cacorrect_read(in, x, y + 3, width, height);
+  const float pl1 = cacorrect_read(in, x - 1, y, width, height);
+  const float pl2 = cacorrect_read(in, x - 2, y, width, height);
+  const float pl3 = cacorrect_read(in, x - 3, y, width, height);
+  const float pr1 = cacorrect_read(in, x + 1, y, width, height);
+  const float pr2 = cacorrect_read(in, x + 2, y, width, height);
+  const float pr3 = cacorrect_read(in, x + 3, y, width, height);
+
+  const float wtu = 1.0f / cacorrect_sqr(eps + fabs(pd1 - pu1) + fabs(pc - pu2) + fabs(pu1 - pu3));
+  const float wtd = 1.0f / cacorrect_sqr(eps + fabs(pu1 - pd1) + fabs(pc - pd2) + fabs(pd1 - pd3));
+  const float wtl = 1.0f / cacorrect_sqr(eps + fabs(pr1 - pl1) + fabs(pc - pl2) + fabs(pl1 - pl3));
+  const float wtr = 1.0f / cacorrect_sqr(eps + fabs(pl1 - pr1) + fabs(pc - pr2) + fabs(pr1 - pr3));
+
+  const float g = (wtu * pu1 + wtd * pd1 + wtl * pl1 + wtr * pr1) / (wtu + wtd + wtl + wtr);
+  write_imagef(out, (int2)(x, y), (float4)(g, 0.0f, 0.0f, 0.0f));
+}
+
+// bilinear interpolation of G at the CA shift point of (x, y)
+float
+cacorrect_gint(read_only image2d_t green, const int x, const int y, const int width, const int height,
+               const int4 shift, const float2 frac)
+{
+  // shift = (vertical floor, vertical ceil, horizontal floor, horizontal ceil), frac = (vertical, horizontal)
+  const float ginthfloor = cacorrect_intp(frac.y, cacorrect_read(green, x + shift.w, y + shift.x, width, height),
+                                          cacorrect_read(green, x + shift.z, y + shift.x, width, height));
+  const float ginthceil = cacorrect_intp(frac.y, cacorrect_read(green, x + shift.w, y + shift.y, width, height),
+                                         cacorrect_read(green, x + shift.z, y + shift.y, width, height));
+  return cacorrect_intp(frac.x, ginthceil, ginthfloor);
+}
+
+// move R/B by the shift of their block, by way of the colour differences to G. shifts holds
+// (red vertical, red horizontal, blue vertical, blue horizontal) per block of blocksize pixels.
+kernel void
+cacorrect_apply(read_only image2d_t in, read_only image2d_t green, read_only image2d_t shifts,
+                write_only image2d_t out, const int width, const int height, const unsigned int filters,
+                const int blocksize)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float eps = 1e-5f;
+  const float pc = read_imagef(in, sampleri, (int2)(x, y)).x;
+  const int c = FC(y, x, filters);
+
+  if(c == 1)
+  {
+    write_imagef(out, (int2)(x, y), (float4)(pc, 0.0f, 0.0f, 0.0f));
+    return;
+  }
+
+  const float4 blockshifts = read_imagef(shifts, sampleri, (int2)(x / blocksize, y / blocksize));
+  const float2 s = c == 0 ? blockshifts.xy : blockshifts.zw;
+  const float2 sfloor = floor(s);
+  const int4 shift = (int4)((int)sfloor.x, (int)ceil(s.x), (int)sfloor.y, (int)ceil(s.y));
+  const float2 frac = s - sfloor;
+  const int dv = s.x > 0.0f ? 2 : -2;
+  const int dh = s.y > 0.0f ? 2 : -2;
+
+  // G at the shift points of this pixel and its neighbours of the same colour towards the shift
+  const float gshift0 = cacorrect_gint(green, x, y, width, height, shift, frac);
+  const float gshift1 = cacorrect_gint(green, x - dh, y, width, height, shift, frac);
+  const float gshift2 = cacorrect_gint(green, x, y - dv, width, height, shift, frac);
+  const float gshift3 = cacorrect_gint(green, x - dh, y - dv, width, height, shift, frac);
+  const float grbdiff0 = gshift0 - pc;
+  const float grbdiff1 = gshift1 - cacorrect_read(in, x - dh, y, width, height);
+  const float grbdiff2 = gshift2 - cacorrect_read(in, x, y - dv, width, height);
+  const float grbdiff3 = gshift3 - cacorrect_read(in, x - dh, y - dv, width, height);
+
+  const float g = read_imagef(green, sampleri, (int2)(x, y)).x;
+  const float grbdiffold = g - pc;
+
+  // interpolate colour difference from optical R/B locations to grid locations
+  const float2 frac2 = 0.5f * frac;
+  const float grbdiffinthfloor = cacorrect_intp(frac2.y, grbdiff1, grbdiff0);
+  const float grbdiffinthceil = cacorrect_intp(frac2.y, grbdiff3, grbdiff2);
+  float grbdiffint = cacorrect_intp(frac2.x, grbdiffinthceil, grbdiffinthfloor);
+
+  const float rbint = g - grbdiffint;
+  float pixel = pc;
+
+  if(fabs(rbint - pc) < 0.25f * (rbint + pc))
+  {
+    if(fabs(grbdiffold) > fabs(grbdiffint)) pixel = rbint;
+  }
+  else
+  {
+    // gradient weights using difference from G at CA shift points and G at grid points
+    const float p0 = 1.0f / (eps + fabs(g - gshift0));
+    const float p1 = 1.0f / (eps + fabs(g - gshift1));
+    const float p2 = 1.0f / (eps + fabs(g - gshift2));
+    const float p3 = 1.0f / (eps + fabs(g - gshift3));
+
+    grbdiffint = (p0 * grbdiff0 + p1 * grbdiff1 + p2 * grbdiff2 + p3 * grbdiff3) / (p0 + p1 + p2 + p3);
+
+    if(fabs(grbdiffold) > fabs(grbdiffint)) pixel = g - grbdiffint;
+  }
+
+  // if colour difference interpolation overshot the correction, just desaturate
+  if(grbdiffold * grbdiffint < 0.0f) pixel = g - 0.5f * (grbdiffold + grbdiffint);
+
+  write_imagef(out, (int2)(x, y), (float4)(pixel, 0.0f, 0.0f, 0.0f));
+}
@@ -0,0 +1,156 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+#define GRAIN_OCTAVES 3
+#define GRAIN_LATTICE_FIB2 21
+#define GRAIN_LUT_SIZE 128
+
+constant int grad3[12][3] = { { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+                              { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+                              { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 } };
+
+#define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
+
+float
+simplex_corner(const int g, const float x, const float y, const float z)
+{
+  float t = 0.6f - x * x - y * y - z * z;
+  if(t < 0.0f) return 0.0f;
+  t *= t;
+  return t * t * (grad3[g][0] * x + grad3[g][1] * y + grad3[g][2] * z);
+}
+
+/* same as _simplex_noise() in grain.c: noise at origin + (xin, yin, zin) */
+float
+simplex_noise(const float xin, const float yin, const float zin, global const int *origin, global const int *perm)
+{
+  const float G3 = 1.0f / 6.0f;
+  const float s = (xin + yin + zin) * (1.0f / 3.0f);
+  const int i = FASTFLOOR(xin + s);
+  const int j = FASTFLOOR(yin + s);
+  const int k = FASTFLOOR(zin + s);
+  const float t = (i + j + k) * G3;
+  const float x0 = xin - (i - t);
+  const float y0 = yin - (j - t);
+  const float z0 = zin - (k - t);
+
+  int i1, j1, k1, i2, j2, k2;
+  if(x0 >= y0)
+  {
+    if(y0 >= z0)
+    {
+      i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0;
+    }
+    else if(x0 >= z0)
+    {
+      i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1;
+    }
+    else
+    {
+      i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1;
+    }
+  }
+  else
+  {
+    if(y0 < z0)
+    {
+      i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1;
+    }
+    else if(x0 < z0)
+    {
+      i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1;
+    }
+    else
+    {
+      i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0;
+    }
+  }
+
+  const int ii = (origin[0] + i) & 255;
+  const int jj = (origin[1] + j) & 255;
+  const int kk = (origin[2] + k) & 255;
+  const int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
+  const int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
+  const int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
+  const int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
+
+  return 32.0f * (simplex_corner(gi0, x0, y0, z0)
+                  + simplex_corner(gi1, x0 - i1 + G3, y0 - j1 + G3, z0 - k1 + G3)
+                  + simplex_corner(gi2, x0 - i2 + 2.0f * G3, y0 - j2 + 2.0f * G3, z0 - k2 + 2.0f * G3)
+                  + simplex_corner(gi3, x0 - 0.5f, y0 - 0.5f, z0 - 0.5f));
+}
+
+/* bilinear lookup as dt_lut_lookup_2d_1c() in grain.c */
+float
+lut_lookup_2d(read_only image2d_t lut, const float x, const float y)
+{
+  const float _x = clamp((x + 0.5f) * (GRAIN_LUT_SIZE - 1), 0.0f, (float)(GRAIN_LUT_SIZE - 1));
+  const float _y = clamp(y * (GRAIN_LUT_SIZE - 1), 0.0f, (float)(GRAIN_LUT_SIZE - 1));
+  const int _x0 = _x < GRAIN_LUT_SIZE - 2 ? _x : GRAIN_LUT_SIZE - 2;
+  const int _y0 = _y < GRAIN_LUT_SIZE - 2 ? _y : GRAIN_LUT_SIZE - 2;
+  const float x_diff = _x - _x0;
+  const float y_diff = _y - _y0;
+
+  const float l00 = read_imagef(lut, sampleri, (int2)(_x0, _y0)).x;
+  const float l01 = read_imagef(lut, sampleri, (int2)(_x0 + 1, _y0)).x;
+  const float l10 = read_imagef(lut, sampleri, (int2)(_x0, _y0 + 1)).x;
+  const float l11 = read_imagef(lut, sampleri, (int2)(_x0 + 1, _y0 + 1)).x;
+
+  const float xy0 = (1.0f - y_diff) * l00 + l10 * y_diff;
+  const float xy1 = (1.0f - y_diff) * l01 + l11 * y_diff;
+  return xy0 * (1.0f - x_diff) + xy1 * x_diff;
+}
+
+/*
+ * coords holds per octave the offset of the top left pixel from origin (x, y, z), the step per pixel, the
+ * frequency and the amplitude. lattice holds the x offsets of the rank-1 lattice samples followed by the y
+ * offsets.
+ */
+kernel void
+grain(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+      global const int *perm, global const int *origin, global const float *coords,
+      global const float *lattice, read_only image2d_t lut, const int filter, const float strength)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  const int samples = filter ? GRAIN_LATTICE_FIB2 : 1;
+  float noise = 0.0f;
+  for(int l = 0; l < samples; l++)
+  {
+    const float dx = filter ? lattice[l] : 0.0f;
+    const float dy = filter ? lattice[GRAIN_LATTICE_FIB2 + l] : 0.0f;
+    for(int o = 0; o < GRAIN_OCTAVES; o++)
+    {
+      global const float *c = coords + 8 * o;
+      noise += c[5] * simplex_noise(c[0] + x * c[3] + dx * c[4], c[1] + y * c[3] + dy * c[4], c[2],
+                                    origin + 4 * o, perm);
+    }
+  }
+  noise *= 1.0f / samples;
+
+  pixel.x += lut_lookup_2d(lut, noise * strength, pixel.x / 100.0f);
+
+  write_imagef(out, (int2)(x, y), pixel);
+}
@@ -0,0 +1,174 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/*
+  box filters and the guided filter of common/guided_filter.c. the box filters
+  are separable, one pass per direction, and clip the window at the image border.
+  the radii used here are small, so every work item just loops over its window.
+*/
+
+kernel void
+box_mean_x(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int x0 = max(x - radius, 0), x1 = min(x + radius, width - 1);
+  float4 sum = (float4)0.0f;
+  for(int i = x0; i <= x1; i++) sum += read_imagef(in, sampleri, (int2)(i, y));
+  write_imagef(out, (int2)(x, y), sum / (float)(x1 - x0 + 1));
+}
+
+kernel void
+box_mean_y(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int y0 = max(y - radius, 0), y1 = min(y + radius, height - 1);
+  float4 sum = (float4)0.0f;
+  for(int j = y0; j <= y1; j++) sum += read_imagef(in, sampleri, (int2)(x, j));
+  write_imagef(out, (int2)(x, y), sum / (float)(y1 - y0 + 1));
+}
+
+kernel void
+box_min_x(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float m = INFINITY;
+  for(int i = max(x - radius, 0); i <= min(x + radius, width - 1); i++)
+    m = fmin(m, read_imagef(in, sampleri, (int2)(i, y)).x);
+  write_imagef(out, (int2)(x, y), (float4)(m, 0.0f, 0.0f, 0.0f));
+}
+
+kernel void
+box_min_y(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float m = INFINITY;
+  for(int j = max(y - radius, 0); j <= min(y + radius, height - 1); j++)
+    m = fmin(m, read_imagef(in, sampleri, (int2)(x, j)).x);
+  write_imagef(out, (int2)(x, y), (float4)(m, 0.0f, 0.0f, 0.0f));
+}
+
+kernel void
+box_max_x(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float m = -INFINITY;
+  for(int i = max(x - radius, 0); i <= min(x + radius, width - 1); i++)
+    m = fmax(m, read_imagef(in, sampleri, (int2)(i, y)).x);
+  write_imagef(out, (int2)(x, y), (float4)(m, 0.0f, 0.0f, 0.0f));
+}
+
+kernel void
+box_max_y(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float m = -INFINITY;
+  for(int j = max(y - radius, 0); j <= min(y + radius, height - 1); j++)
+    m = fmax(m, read_imagef(in, sampleri, (int2)(x, j)).x);
+  write_imagef(out, (int2)(x, y), (float4)(m, 0.0f, 0.0f, 0.0f));
+}
+
+// per pixel products of guide and input, to be box filtered
+kernel void
+guided_filter_split(read_only image2d_t guide, read_only image2d_t in, write_only image2d_t mean,
+                    write_only image2d_t cov, write_only image2d_t var1, write_only image2d_t var2,
+                    const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 g = read_imagef(guide, sampleri, (int2)(x, y));
+  const float p = read_imagef(in, sampleri, (int2)(x, y)).x;
+  write_imagef(mean, (int2)(x, y), (float4)(g.x, g.y, g.z, p));
+  write_imagef(cov, (int2)(x, y), (float4)(g.x * p, g.y * p, g.z * p, 0.0f));
+  write_imagef(var1, (int2)(x, y), (float4)(g.x * g.x, g.x * g.y, g.x * g.z, 0.0f));
+  write_imagef(var2, (int2)(x, y), (float4)(g.y * g.y, g.y * g.z, g.z * g.z, 0.0f));
+}
+
+// linear coefficients a (rgb) and b (alpha) from the box filtered products
+kernel void
+guided_filter_solve(read_only image2d_t mean, read_only image2d_t cov, read_only image2d_t var1,
+                    read_only image2d_t var2, write_only image2d_t ab, const int width, const int height,
+                    const float eps)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 m = read_imagef(mean, sampleri, (int2)(x, y));
+  const float4 c = read_imagef(cov, sampleri, (int2)(x, y)) - m.w * m;
+  const float4 v1 = read_imagef(var1, sampleri, (int2)(x, y));
+  const float4 v2 = read_imagef(var2, sampleri, (int2)(x, y));
+
+  // symmetric coefficient matrix, solved via cramer's rule
+  const float s00 = v1.x - (m.x * m.x - eps), s01 = v1.y - m.x * m.y, s02 = v1.z - m.x * m.z;
+  const float s11 = v2.x - (m.y * m.y - eps), s12 = v2.y - m.y * m.z, s22 = v2.z - (m.z * m.z - eps);
+  const float det0 = s00 * (s11 * s22 - s12 * s12) - s01 * (s01 * s22 - s02 * s12) + s02 * (s01 * s12 - s02 * s11);
+  float4 a = (float4)0.0f;
+  // leave a at zero if the linear system is singular
+  if(fabs(det0) > 4.0f * FLT_EPSILON)
+  {
+    a.x = (c.x * (s11 * s22 - s12 * s12) - s01 * (c.y * s22 - c.z * s12) + s02 * (c.y * s12 - c.z * s11)) / det0;
+    a.y = (s00 * (c.y * s22 - c.z * s12) - c.x * (s01 * s22 - s02 * s12) + s02 * (s01 * c.z - s02 * c.y)) / det0;
+    a.z = (s00 * (s11 * c.z - s12 * c.y) - s01 * (s01 * c.z - s02 * c.y) + c.x * (s01 * s12 - s02 * s11)) / det0;
+  }
+  a.w = m.w - a.x * m.x - a.y * m.y - a.z * m.z;
+  write_imagef(ab, (int2)(x, y), a);
+}
+
+kernel void
+guided_filter_apply(read_only image2d_t guide, read_only image2d_t ab, write_only image2d_t out,
+                    const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 g = read_imagef(guide, sampleri, (int2)(x, y));
+  const float4 c = read_imagef(ab, sampleri, (int2)(x, y));
+  write_imagef(out, (int2)(x, y), (float4)(c.x * g.x + c.y * g.y + c.z * g.z + c.w, 0.0f, 0.0f, 0.0f));
+}
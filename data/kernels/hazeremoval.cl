@@ -0,0 +1,49 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+kernel void
+hazeremoval_transition_map(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                           const float4 A0, const float strength)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y)) / A0;
+  const float m = fmin(fmin(pixel.x, pixel.y), pixel.z);
+  write_imagef(out, (int2)(x, y), (float4)(1.0f - m * strength, 0.0f, 0.0f, 0.0f));
+}
+
+kernel void
+hazeremoval_dehaze(read_only image2d_t in, read_only image2d_t trans_map, write_only image2d_t out,
+                   const int width, const int height, const float4 A0, const float t_min)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float t = fmax(read_imagef(trans_map, sampleri, (int2)(x, y)).x, t_min);
+  float4 dehazed = (pixel - A0) / t + A0;
+  dehazed.w = pixel.w;
+  write_imagef(out, (int2)(x, y), dehazed);
+}
@@ -0,0 +1,120 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable
+
+#include "common.h"
+
+// the cpu code of hotpixels.c fixes a pixel and then marks the sites of the same colour
+// up to 10 pixels to its left and right with the value of the hot one, in the order of
+// the row. here every pixel looks for the rightmost hot pixel that would have written
+// it last instead, which gives the same result without any races.
+
+// whether the pixel at (x, y) is hot, with its replacement in fix. offsets holds the
+// x/y offsets of the four nearest neighbours of the same colour for every site of the
+// 2x2 or 6x6 cfa.
+int
+hotpixels_test(read_only image2d_t in, const int x, const int y, const int width, const int height,
+               const float threshold, const float multiplier, const int min_neighbours,
+               global const int *offsets, const int period, float *fix)
+{
+  if(x < 2 || y < 2 || x >= width - 2 || y >= height - 2) return 0;
+
+  const float pixel = read_imagef(in, sampleri, (int2)(x, y)).x;
+  if(!(pixel > threshold)) return 0;
+
+  const float mid = pixel * multiplier;
+  global const int *o = offsets + 8 * ((y % period) * period + x % period);
+  int count = 0;
+  float maxin = 0.0f;
+  for(int n = 0; n < 4; n++)
+  {
+    const float other = read_imagef(in, sampleri, (int2)(x + o[2 * n], y + o[2 * n + 1])).x;
+    if(mid > other)
+    {
+      count++;
+      if(other > maxin) maxin = other;
+    }
+  }
+  *fix = maxin;
+  return count >= min_neighbours;
+}
+
+// filters is 9 for x-trans, then the marks go to the sites of the same colour in xtrans.
+// bayer sites two pixels apart have the same colour.
+kernel void
+hotpixels(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+          const float threshold, const float multiplier, const int min_neighbours, const int markfixed,
+          global const int *offsets, const unsigned int filters, const int r_x, const int r_y,
+          global const unsigned char (*const xtrans)[6], global int *fixed)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int period = filters == 9u ? 6 : 2;
+  const int step = filters == 9u ? 1 : 2;
+  const int c = filters == 9u ? FCxtrans(y + r_y, x + r_x, xtrans) : 0;
+
+  float pixel = read_imagef(in, sampleri, (int2)(x, y)).x;
+  float fix;
+  const int hot = hotpixels_test(in, x, y, width, height, threshold, multiplier, min_neighbours, offsets,
+                                 period, &fix);
+  if(hot) atomic_inc(fixed);
+
+  int mark = 0;
+  if(markfixed)
+  {
+    // marks from the right are written after our own fix
+    for(int k = 10; k >= 2 && !mark; k -= step)
+    {
+      float unused;
+      if(hotpixels_test(in, x + k, y, width, height, threshold, multiplier, min_neighbours, offsets, period,
+                        &unused)
+         && (filters != 9u || FCxtrans(y + r_y, x + k + r_x, xtrans) == c))
+      {
+        pixel = read_imagef(in, sampleri, (int2)(x + k, y)).x;
+        mark = 1;
+      }
+    }
+  }
+
+  if(!mark && hot)
+  {
+    pixel = fix;
+    mark = 1;
+  }
+
+  if(markfixed)
+  {
+    for(int k = -2; k >= -10 && !mark; k -= step)
+    {
+      float unused;
+      if(hotpixels_test(in, x + k, y, width, height, threshold, multiplier, min_neighbours, offsets, period,
+                        &unused)
+         && (filters != 9u || FCxtrans(y + r_y, x + k + r_x, xtrans) == c))
+      {
+        pixel = read_imagef(in, sampleri, (int2)(x + k, y)).x;
+        mark = 1;
+      }
+    }
+  }
+
+  write_imagef(out, (int2)(x, y), (float4)(pixel, 0.0f, 0.0f, 0.0f));
+}
@@ -0,0 +1,169 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// the wavelet denoising of rawdenoise.c, one colour plane at a time. a plane holds the
+// square roots of one cfa site of the bayer pattern at half size, or of one colour of the
+// x-trans pattern at full size. it is decomposed with the a trous hat transform, and the
+// detail of every level is soft thresholded into the accumulator.
+
+// mirror at the first and last element without repeating them, as hat_transform() does
+int
+rawdenoise_mirror(int i, const int n)
+{
+  i = i < 0 ? -i : i;
+  i = i >= n ? 2 * n - 2 - i : i;
+  return clamp(i, 0, n - 1);
+}
+
+// the plane of the bayer site at (cx, cy), accumulator set to zero
+kernel void
+rawdenoise_bayer_split(read_only image2d_t in, write_only image2d_t plane, write_only image2d_t acc,
+                       const int width, const int height, const int cx, const int cy)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float pixel = read_imagef(in, sampleri, (int2)(2 * x + cx, 2 * y + cy)).x;
+  write_imagef(plane, (int2)(x, y), (float4)(sqrt(fmax(0.0f, pixel)), 0.0f, 0.0f, 0.0f));
+  write_imagef(acc, (int2)(x, y), (float4)(0.0f, 0.0f, 0.0f, 0.0f));
+}
+
+// the plane of colour c, where the other colours are filled in from their nearest
+// neighbour of colour c. the cpu code writes the value of every site of colour c to its
+// neighbours in the order of the rows, so here a pixel takes the one written last. the
+// outermost pixels, which the cpu code leaves as they were, take their own value.
+kernel void
+rawdenoise_xtrans_split(read_only image2d_t in, write_only image2d_t plane, write_only image2d_t acc,
+                        const int width, const int height, const int c, const int r_x, const int r_y,
+                        global const unsigned char (*const xtrans)[6])
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  int2 src = (int2)(x, y);
+  if(c == 1)
+  {
+    // green sites write themselves, right and below, on rows and columns up to the last but one
+    const int2 cand[3] = { (int2)(x, y), (int2)(x - 1, y), (int2)(x, y - 1) };
+    for(int k = 0; k < 3; k++)
+    {
+      const int2 q = cand[k];
+      if(q.x >= 0 && q.y >= 0 && q.x < width - 1 && q.y < height - 1
+         && FCxtrans(q.y + r_y, q.x + r_x, xtrans) == 1)
+      {
+        src = q;
+        break;
+      }
+    }
+  }
+  else
+  {
+    // red and blue sites write their 3x3 neighbourhood, away from the outermost pixels
+    int found = 0;
+    for(int j = 1; j >= -1 && !found; j--)
+      for(int i = 1; i >= -1 && !found; i--)
+      {
+        const int2 q = (int2)(x + i, y + j);
+        if(q.x >= 1 && q.y >= 1 && q.x < width - 1 && q.y < height - 1
+           && FCxtrans(q.y + r_y, q.x + r_x, xtrans) == c)
+        {
+          src = q;
+          found = 1;
+        }
+      }
+  }
+
+  const float pixel = read_imagef(in, sampleri, src).x;
+  write_imagef(plane, (int2)(x, y), (float4)(sqrt(fmax(0.0f, pixel)), 0.0f, 0.0f, 0.0f));
+  write_imagef(acc, (int2)(x, y), (float4)(0.0f, 0.0f, 0.0f, 0.0f));
+}
+
+// vertical pass of the hat transform at scale, in -> out
+kernel void
+rawdenoise_hat_v(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                 const int scale)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float p0 = read_imagef(in, sampleri, (int2)(x, y)).x;
+  const float pm = read_imagef(in, sampleri, (int2)(x, rawdenoise_mirror(y - scale, height))).x;
+  const float pp = read_imagef(in, sampleri, (int2)(x, rawdenoise_mirror(y + scale, height))).x;
+  write_imagef(out, (int2)(x, y), (float4)((p0 * 2.0f + pm + pp) * 0.25f, 0.0f, 0.0f, 0.0f));
+}
+
+// horizontal pass of the hat transform at scale, tmp -> out. the detail between the input
+// of the level and out, soft thresholded by thold, is added to the accumulator.
+kernel void
+rawdenoise_hat_h(read_only image2d_t tmp, read_only image2d_t in, read_only image2d_t acc_in,
+                 write_only image2d_t out, write_only image2d_t acc_out, const int width, const int height,
+                 const int scale, const float thold)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float p0 = read_imagef(tmp, sampleri, (int2)(x, y)).x;
+  const float pm = read_imagef(tmp, sampleri, (int2)(rawdenoise_mirror(x - scale, width), y)).x;
+  const float pp = read_imagef(tmp, sampleri, (int2)(rawdenoise_mirror(x + scale, width), y)).x;
+  const float coarse = (p0 * 2.0f + pm + pp) * 0.25f;
+  const float diff = read_imagef(in, sampleri, (int2)(x, y)).x - coarse;
+  const float sum
+      = read_imagef(acc_in, sampleri, (int2)(x, y)).x + copysign(fmax(fabs(diff) - thold, 0.0f), diff);
+
+  write_imagef(out, (int2)(x, y), (float4)(coarse, 0.0f, 0.0f, 0.0f));
+  write_imagef(acc_out, (int2)(x, y), (float4)(sum, 0.0f, 0.0f, 0.0f));
+}
+
+// denoised plane of the bayer site at (cx, cy) back into out
+kernel void
+rawdenoise_bayer_merge(read_only image2d_t acc, read_only image2d_t coarse, write_only image2d_t out,
+                       const int width, const int height, const int cx, const int cy)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float d = read_imagef(acc, sampleri, (int2)(x, y)).x + read_imagef(coarse, sampleri, (int2)(x, y)).x;
+  write_imagef(out, (int2)(2 * x + cx, 2 * y + cy), (float4)(d * d, 0.0f, 0.0f, 0.0f));
+}
+
+// denoised plane of colour c back into the sites of that colour in out
+kernel void
+rawdenoise_xtrans_merge(read_only image2d_t acc, read_only image2d_t coarse, write_only image2d_t out,
+                        const int width, const int height, const int c, const int r_x, const int r_y,
+                        global const unsigned char (*const xtrans)[6])
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height || FCxtrans(y + r_y, x + r_x, xtrans) != c) return;
+
+  const float d = read_imagef(acc, sampleri, (int2)(x, y)).x + read_imagef(coarse, sampleri, (int2)(x, y)).x;
+  write_imagef(out, (int2)(x, y), (float4)(d * d, 0.0f, 0.0f, 0.0f));
+}
@@ -0,0 +1,37 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// blend the source of one spot over the width x height destination at (x, y), reading the output so far
+// from tmp. the source starts at (sx, sy) of the input, the weights of the spot at weight + offset.
+kernel void
+spots_clone(read_only image2d_t in, read_only image2d_t tmp, write_only image2d_t out,
+            global const float *weight, const int offset, const int x, const int y, const int width,
+            const int height, const int sx, const int sy)
+{
+  const int i = get_global_id(0);
+  const int j = get_global_id(1);
+
+  if(i >= width || j >= height) return;
+
+  const float f = weight[offset + mad24(j, width, i)];
+  const float4 dst = read_imagef(tmp, sampleri, (int2)(x + i, y + j));
+  const float4 src = read_imagef(in, sampleri, (int2)(sx + i, sy + j));
+  write_imagef(out, (int2)(x + i, y + j), dst * (1.0f - f) + src * f);
+}
@@ -0,0 +1,411 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * darktable-bench runs the export pixelpipe of one image a couple of times with
+ * different CPU settings and stores the fastest configuration per module in the
+ * tuning profile (see common/tuning.h). the search is a simple coordinate descent:
+ * first the codepath, then the number of threads, then the tile size, each one
+ * measured with the best values found so far for the others.
+ */
+
+#include "common/darktable.h"
+#include "common/exif.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/mipmap_cache.h"
+#include "common/tuning.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <float.h>
+#include <libintl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// tile sizes in MB we try, 0 meaning only tile when running out of memory
+static const int _tile_sizes[] = { 0, 16, 64, 256 };
+
+// a tiled configuration has to be at least that much faster to be picked, tiling has a price in quality
+// for some modules and the measurements are noisy
+#define DT_BENCH_TILING_GAIN 0.95
+
+typedef struct dt_bench_t
+{
+  dt_develop_t dev;
+  dt_dev_pixelpipe_t pipe;
+  int runs;
+  float *scales;
+  int num_scales;
+  gboolean dry_run;
+
+  // per module best configuration found so far and its time
+  GHashTable *best;      // op -> dt_tuning_module_t
+  GHashTable *best_time; // op -> double
+} dt_bench_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s <input file> [<xmp file>] [--runs <n>] [--scales <s1,s2,...>] [--dry-run] "
+                  "[--core <darktable options>]\n",
+          progname);
+}
+
+/** process the whole pipe with the given settings forced on all modules, timings end up in darktable.tuning */
+static void _bench_run(dt_bench_t *b, const dt_tuning_module_t *config)
+{
+  dt_tuning_t *t = darktable.tuning;
+  t->forced = *config;
+  t->override = TRUE;
+  dt_tuning_reset_timings(t);
+  t->measure = TRUE;
+
+  for(int r = 0; r < b->runs; r++)
+    for(int s = 0; s < b->num_scales; s++)
+    {
+      const float scale = b->scales[s];
+      const int width = scale * b->pipe.processed_width;
+      const int height = scale * b->pipe.processed_height;
+      // make sure nothing is served from the cache
+      dt_dev_pixelpipe_flush_caches(&b->pipe);
+      dt_dev_pixelpipe_process_no_gamma(&b->pipe, &b->dev, 0, 0, width, height, scale);
+    }
+
+  t->measure = FALSE;
+  t->override = FALSE;
+}
+
+/** compare timings of the last run against the best ones so far and remember the winners */
+static void _bench_collect(dt_bench_t *b, const dt_tuning_module_t *config, const double gain)
+{
+  for(GList *nodes = b->pipe.nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    const char *op = piece->module->op;
+    const double time = dt_tuning_get_timing(darktable.tuning, op);
+    if(time < 0.0) continue;
+
+    const double *best_time = (double *)g_hash_table_lookup(b->best_time, op);
+    if(best_time && time >= *best_time * gain) continue;
+
+    dt_tuning_module_t *m = (dt_tuning_module_t *)g_malloc(sizeof(dt_tuning_module_t));
+    *m = *config;
+    double *d = (double *)g_malloc(sizeof(double));
+    *d = time;
+    g_hash_table_replace(b->best, g_strdup(op), m);
+    g_hash_table_replace(b->best_time, g_strdup(op), d);
+  }
+}
+
+int main(int argc, char *arg[])
+{
+  bindtextdomain(GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
+  bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+  textdomain(GETTEXT_PACKAGE);
+
+  if(!gtk_parse_args(&argc, &arg)) exit(1);
+
+  char *input_filename = NULL;
+  char *xmp_filename = NULL;
+  int file_counter = 0;
+  int runs = 3;
+  gboolean dry_run = FALSE;
+  gchar **scales = NULL;
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(arg[k][0] == '-')
+    {
+      if(!strcmp(arg[k], "--help"))
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      else if(!strcmp(arg[k], "--runs") && argc > k + 1)
+      {
+        k++;
+        runs = MAX(atoi(arg[k]), 1);
+      }
+      else if(!strcmp(arg[k], "--scales") && argc > k + 1)
+      {
+        k++;
+        g_strfreev(scales);
+        scales = g_strsplit(arg[k], ",", -1);
+      }
+      else if(!strcmp(arg[k], "--dry-run"))
+      {
+        dry_run = TRUE;
+      }
+      else if(!strcmp(arg[k], "--core"))
+      {
+        // everything from here on should be passed to the core
+        k++;
+        break;
+      }
+    }
+    else
+    {
+      if(file_counter == 0)
+        input_filename = arg[k];
+      else if(file_counter == 1)
+        xmp_filename = arg[k];
+      file_counter++;
+    }
+  }
+
+  if(file_counter < 1 || file_counter > 2)
+  {
+    usage(arg[0]);
+    g_strfreev(scales);
+    exit(1);
+  }
+
+  int m_argc = 0;
+  char **m_arg = malloc((6 + argc - k + 1) * sizeof(char *));
+  m_arg[m_argc++] = "darktable-bench";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  // the profile only covers the cpu path
+  m_arg[m_argc++] = "--disable-opencl";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui and without data.db:
+  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+  {
+    free(m_arg);
+    g_strfreev(scales);
+    exit(1);
+  }
+
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(input_filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int id = dt_image_import(filmid, input_filename, TRUE);
+  if(!id)
+  {
+    fprintf(stderr, _("error: can't open file %s"), input_filename);
+    fprintf(stderr, "\n");
+    free(m_arg);
+    g_strfreev(scales);
+    exit(1);
+  }
+
+  if(xmp_filename)
+  {
+    dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
+    if(dt_exif_xmp_read(image, xmp_filename, 1) != 0)
+    {
+      fprintf(stderr, _("error: can't open xmp file %s"), xmp_filename);
+      fprintf(stderr, "\n");
+      free(m_arg);
+      g_strfreev(scales);
+      exit(1);
+    }
+    // don't write new xmp:
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+  }
+
+  dt_bench_t b;
+  memset(&b, 0, sizeof(b));
+  b.runs = runs;
+  b.dry_run = dry_run;
+  b.best = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  b.best_time = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  if(scales)
+  {
+    b.num_scales = g_strv_length(scales);
+    b.scales = (float *)calloc(MAX(b.num_scales, 1), sizeof(float));
+    for(int s = 0; s < b.num_scales; s++) b.scales[s] = CLAMP(g_ascii_strtod(scales[s], NULL), 0.01, 1.0);
+    g_strfreev(scales);
+  }
+  else
+  {
+    // a preview sized, a screen sized and a full sized run
+    static const float default_scales[] = { 0.125f, 0.5f, 1.0f };
+    b.num_scales = G_N_ELEMENTS(default_scales);
+    b.scales = (float *)malloc(sizeof(default_scales));
+    memcpy(b.scales, default_scales, sizeof(default_scales));
+  }
+
+  dt_dev_init(&b.dev, 0);
+  dt_dev_load_image(&b.dev, id);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  if(!buf.buf || !buf.width || !buf.height)
+  {
+    fprintf(stderr, _("error: can't open file %s"), input_filename);
+    fprintf(stderr, "\n");
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    dt_dev_cleanup(&b.dev);
+    free(b.scales);
+    free(m_arg);
+    exit(1);
+  }
+
+  dt_dev_pixelpipe_init_export(&b.pipe, buf.width, buf.height, IMAGEIO_RGB | IMAGEIO_FLOAT);
+  dt_dev_pixelpipe_set_input(&b.pipe, &b.dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(&b.pipe, &b.dev);
+  dt_dev_pixelpipe_synch_all(&b.pipe, &b.dev);
+  // every module on its own: fused runs and bands don't time the modules one by one, nor do they tile as told
+  b.pipe.fuse_pointwise = FALSE;
+  b.pipe.wavefront_band = 0;
+  dt_dev_pixelpipe_get_dimensions(&b.pipe, &b.dev, b.pipe.iwidth, b.pipe.iheight, &b.pipe.processed_width,
+                                  &b.pipe.processed_height);
+
+  const int max_threads = dt_get_num_threads();
+  dt_tuning_module_t config = { 0, DT_TUNING_CODEPATH_DEFAULT, 0 };
+
+  // 1) codepath, with all threads and no forced tiling
+  if(darktable.codepath.SSE2)
+  {
+    config.codepath = DT_TUNING_CODEPATH_SSE2;
+    _bench_run(&b, &config);
+    _bench_collect(&b, &config, 1.0);
+  }
+  config.codepath = DT_TUNING_CODEPATH_PLAIN;
+  _bench_run(&b, &config);
+  _bench_collect(&b, &config, 1.0);
+
+  // 2) number of threads, once per codepath that won for some module. only the modules that picked that
+  //    codepath take part in the comparison.
+  for(int threads = 1; threads < max_threads; threads *= 2)
+  {
+    GHashTableIter iter;
+    gpointer key, value;
+    GHashTable *candidates = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    for(int c = DT_TUNING_CODEPATH_SSE2; c <= DT_TUNING_CODEPATH_PLAIN; c++)
+    {
+      if(c == DT_TUNING_CODEPATH_SSE2 && !darktable.codepath.SSE2) continue;
+      // only run codepaths that won for at least one module
+      gboolean used = FALSE;
+      g_hash_table_iter_init(&iter, b.best);
+      while(g_hash_table_iter_next(&iter, &key, &value))
+        if(((dt_tuning_module_t *)value)->codepath == c) used = TRUE;
+      if(!used) continue;
+
+      const dt_tuning_module_t trial = { threads, (dt_tuning_codepath_t)c, 0 };
+      _bench_run(&b, &trial);
+      g_hash_table_iter_init(&iter, b.best);
+      while(g_hash_table_iter_next(&iter, &key, &value))
+      {
+        if(((dt_tuning_module_t *)value)->codepath != c) continue;
+        double *d = (double *)g_malloc(sizeof(double));
+        *d = dt_tuning_get_timing(darktable.tuning, (const char *)key);
+        if(*d < 0.0)
+          g_free(d);
+        else
+          g_hash_table_replace(candidates, g_strdup((const char *)key), d);
+      }
+    }
+    g_hash_table_iter_init(&iter, candidates);
+    while(g_hash_table_iter_next(&iter, &key, &value))
+    {
+      double *best_time = (double *)g_hash_table_lookup(b.best_time, key);
+      dt_tuning_module_t *m = (dt_tuning_module_t *)g_hash_table_lookup(b.best, key);
+      if(best_time && m && *(double *)value < *best_time)
+      {
+        *best_time = *(double *)value;
+        m->threads = threads;
+      }
+    }
+    g_hash_table_destroy(candidates);
+  }
+
+  // 3) tile size. trying it with every module's own codepath and thread count would need one run per
+  //    module, so use the most common codepath with all threads and only accept clear gains.
+  {
+    int votes[DT_TUNING_CODEPATH_PLAIN + 1] = { 0 };
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, b.best);
+    while(g_hash_table_iter_next(&iter, &key, &value)) votes[((dt_tuning_module_t *)value)->codepath]++;
+    config.codepath = votes[DT_TUNING_CODEPATH_SSE2] >= votes[DT_TUNING_CODEPATH_PLAIN]
+                          ? DT_TUNING_CODEPATH_SSE2
+                          : DT_TUNING_CODEPATH_PLAIN;
+    if(!darktable.codepath.SSE2) config.codepath = DT_TUNING_CODEPATH_PLAIN;
+    config.threads = 0;
+    for(int s = 1; s < (int)G_N_ELEMENTS(_tile_sizes); s++)
+    {
+      config.tile_size = _tile_sizes[s];
+      _bench_run(&b, &config);
+      for(GList *nodes = b.pipe.nodes; nodes; nodes = g_list_next(nodes))
+      {
+        const char *op = ((dt_dev_pixelpipe_iop_t *)nodes->data)->module->op;
+        const double time = dt_tuning_get_timing(darktable.tuning, op);
+        double *best_time = (double *)g_hash_table_lookup(b.best_time, op);
+        dt_tuning_module_t *m = (dt_tuning_module_t *)g_hash_table_lookup(b.best, op);
+        if(time < 0.0 || !best_time || !m || m->codepath != config.codepath) continue;
+        if(time < *best_time * DT_BENCH_TILING_GAIN)
+        {
+          *best_time = time;
+          m->threads = config.threads;
+          m->tile_size = config.tile_size;
+        }
+      }
+    }
+  }
+
+  // report and store
+  printf("%-20s %8s %8s %10s %12s\n", "module", "codepath", "threads", "tile (MB)", "time (s)");
+  for(GList *nodes = b.pipe.nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const char *op = ((dt_dev_pixelpipe_iop_t *)nodes->data)->module->op;
+    const dt_tuning_module_t *m = (dt_tuning_module_t *)g_hash_table_lookup(b.best, op);
+    const double *time = (double *)g_hash_table_lookup(b.best_time, op);
+    if(!m || !time) continue;
+    printf("%-20s %8s %8d %10d %12.4f\n", op, m->codepath == DT_TUNING_CODEPATH_SSE2 ? "sse2" : "plain",
+           m->threads ? m->threads : max_threads, m->tile_size, *time / b.runs);
+    if(!b.dry_run) dt_tuning_set(darktable.tuning, op, m);
+  }
+
+  int res = 0;
+  if(!b.dry_run)
+  {
+    res = dt_tuning_save(darktable.tuning);
+    if(!res) printf("%s `%s'\n", _("tuning profile written to"), darktable.tuning->filename);
+  }
+
+  dt_dev_pixelpipe_cleanup(&b.pipe);
+  dt_dev_cleanup(&b.dev);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  g_hash_table_destroy(b.best);
+  g_hash_table_destroy(b.best_time);
+  free(b.scales);
+
+  dt_cleanup();
+
+  free(m_arg);
+  return res;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
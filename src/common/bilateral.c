@@ -17,11 +17,15 @@
 */
 
 #include "common/bilateral.h"
+#include "common/bufferpool.h"
 #include "common/darktable.h" // for CLAMPS, dt_alloc_align, dt_free_align
 #include <glib.h>             // for MIN, MAX
 #include <math.h>             // for roundf
 #include <stdlib.h>           // for size_t, free, malloc, NULL
 #include <string.h>           // for memset
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 // these clamp away insane memory requirements.
 // they should reasonably faithfully represent the
@@ -30,6 +34,12 @@
 #define DT_COMMON_BILATERAL_MAX_RES_S 6000
 #define DT_COMMON_BILATERAL_MAX_RES_R 50
 
+// stripes of rows dt_bilateral_splat() cuts the image into, one per thread of the team
+static inline int splat_stripes(const int height)
+{
+  return MAX(MIN(omp_get_max_threads(), height), 1);
+}
+
 #ifndef HAVE_OPENCL
 // function definition on opencl path takes precedence
 size_t dt_bilateral_memory_use(const int width,     // width of input image
@@ -47,13 +57,17 @@ size_t dt_bilateral_memory_use(const int width,     // width of input image
   return size_x * size_y * size_z * sizeof(float);
 }
 
-// for the CPU path this is just an alias as no additional temp buffer is needed
+// the CPU path splats into slabs of the grid, one per stripe, which together hold the grid and two more rows
+// of it per stripe
 size_t dt_bilateral_memory_use2(const int width,
                                 const int height,
                                 const float sigma_s,
                                 const float sigma_r)
 {
-  return dt_bilateral_memory_use(width, height, sigma_s, sigma_r);
+  const size_t grid = dt_bilateral_memory_use(width, height, sigma_s, sigma_r);
+  const size_t size_y = CLAMPS((int)roundf(height / sigma_s), 4, DT_COMMON_BILATERAL_MAX_RES_S) + 1;
+  const int stripes = splat_stripes(height);
+  return stripes == 1 ? grid : 2 * grid + grid / size_y * 2 * stripes;
 }
 
 size_t dt_bilateral_singlebuffer_size(const int width,     // width of input image
@@ -81,14 +95,6 @@ size_t dt_bilateral_singlebuffer_size2(const int width,
 }
 #endif
 
-static void image_to_grid(const dt_bilateral_t *const b, const int i, const int j, const float L, float *x,
-                          float *y, float *z)
-{
-  *x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
-  *y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
-  *z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
-}
-
 dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
                                   const int height,    // height of input image
                                   const float sigma_s, // spatial sigma (blur pixel coords)
@@ -109,7 +115,7 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   b->height = height;
   b->sigma_s = MAX(height / (b->size_y - 1.0f), width / (b->size_x - 1.0f));
   b->sigma_r = 100.0f / (b->size_z - 1.0f);
-  b->buf = dt_alloc_align(16, b->size_x * b->size_y * b->size_z * sizeof(float));
+  b->buf = dt_bufferpool_alloc(darktable.bufferpool, b->size_x * b->size_y * b->size_z * sizeof(float));
 
   memset(b->buf, 0, b->size_x * b->size_y * b->size_z * sizeof(float));
 #if 0
@@ -120,31 +126,49 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   return b;
 }
 
-void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
+// grid x coordinate of every column, split into cell and fraction as image_to_grid() would
+static void grid_columns(const dt_bilateral_t *const b, int *const xi, float *const xf)
 {
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
-// splat into downsampled grid
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(b)
-#endif
-  for(int j = 0; j < b->height; j++)
+  for(int i = 0; i < b->width; i++)
+  {
+    const float x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
+    xi[i] = MIN((int)x, (int)b->size_x - 2);
+    xf[i] = x - xi[i];
+  }
+}
+
+// the lower of the two grid rows row j splats into
+static inline int grid_row(const dt_bilateral_t *const b, const int j)
+{
+  return MIN((int)CLAMPS(j / b->sigma_s, 0, b->size_y - 1), (int)b->size_y - 2);
+}
+
+// splat rows j0..j1-1 into slab, which holds the grid rows y0..y0+ny-1 of all grid columns and layers
+static void splat_rows(const dt_bilateral_t *const b, const float *const in, const int *const xi,
+                       const float *const xf, const int j0, const int j1, float *const slab, const int y0,
+                       const int ny)
+{
+  const size_t ox = 1;
+  const size_t oy = b->size_x;
+  const size_t oz = (size_t)ny * b->size_x;
+  const float norm = 100.0f / (b->sigma_s * b->sigma_s);
+  for(int j = j0; j < j1; j++)
   {
-    size_t index = 4 * j * b->width;
+    const float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
+    const int yi = MIN((int)y, (int)b->size_y - 2);
+    const float yf = y - yi;
+    const float *in_row = in + (size_t)4 * j * b->width;
     for(int i = 0; i < b->width; i++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
+      const float L = in_row[4 * i];
+      const float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
+      const int zi = MIN((int)z, (int)b->size_z - 2);
       const float zf = z - zi;
+      const float wx[2] = { 1.0f - xf[i], xf[i] };
+      const float wy[2] = { 1.0f - yf, yf };
+      const float wz[2] = { 1.0f - zf, zf };
       // nearest neighbour splatting:
-      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
+      const size_t grid_index = xi[i] + b->size_x * ((yi - y0) + (size_t)ny * zi);
       // sum up payload here, doesn't have to be same as edge stopping data
       // for cross bilateral applications.
       // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
@@ -152,16 +176,78 @@ void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
       for(int k = 0; k < 8; k++)
       {
         const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
-        const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
-                              * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / (b->sigma_s * b->sigma_s);
+        slab[ii] += wx[k & 1] * wy[(k >> 1) & 1] * wz[k >> 2] * norm;
+      }
+    }
+  }
+}
+
+void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
+{
+  // the image is cut into one stripe of rows per thread. every stripe splats into a slab of its own that
+  // covers just the grid rows it touches, and the slabs are summed into the grid afterwards. neighbouring
+  // stripes share a grid row or two, everything else is only written by one thread, without atomics. a
+  // single thread, or one without memory for the slabs, splats straight into the grid.
+  const int stripes = splat_stripes(b->height);
+  int *const xi = dt_alloc_align(64, sizeof(int) * b->width);
+  float *const xf = dt_alloc_align(64, sizeof(float) * b->width);
+  grid_columns(b, xi, xf);
+
+  if(stripes == 1)
+  {
+    splat_rows(b, in, xi, xf, 0, b->height, b->buf, 0, b->size_y);
+    dt_free_align(xi);
+    dt_free_align(xf);
+    return;
+  }
+
+  int j0[stripes + 1], y0[stripes], ny[stripes];
+  size_t offset[stripes + 1];
+  offset[0] = 0;
+  for(int t = 0; t <= stripes; t++) j0[t] = (int)((size_t)b->height * t / stripes);
+  for(int t = 0; t < stripes; t++)
+  {
+    y0[t] = grid_row(b, j0[t]);
+    ny[t] = grid_row(b, j0[t + 1] - 1) + 2 - y0[t];
+    offset[t + 1] = offset[t] + (size_t)ny[t] * b->size_x * b->size_z;
+  }
+  float *const slabs = dt_bufferpool_alloc(darktable.bufferpool, sizeof(float) * offset[stripes]);
+  if(!slabs)
+  {
+    splat_rows(b, in, xi, xf, 0, b->height, b->buf, 0, b->size_y);
+    dt_free_align(xi);
+    dt_free_align(xf);
+    return;
+  }
+
 #ifdef _OPENMP
-#pragma omp atomic
+#pragma omp parallel for default(none) shared(b, j0, y0, ny, offset) schedule(static, 1)
 #endif
-        b->buf[ii] += contrib;
+  for(int t = 0; t < stripes; t++)
+  {
+    memset(slabs + offset[t], 0, sizeof(float) * (offset[t + 1] - offset[t]));
+    splat_rows(b, in, xi, xf, j0[t], j0[t + 1], slabs + offset[t], y0[t], ny[t]);
+  }
+
+  // sum the slabs up, grid row by grid row
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(b, y0, ny, offset) collapse(2)
+#endif
+  for(int z = 0; z < (int)b->size_z; z++)
+    for(int y = 0; y < (int)b->size_y; y++)
+    {
+      float *const out = b->buf + b->size_x * (y + b->size_y * z);
+      for(int t = 0; t < stripes; t++)
+      {
+        if(y < y0[t] || y >= y0[t] + ny[t]) continue;
+        const float *const slab = slabs + offset[t] + b->size_x * ((y - y0[t]) + (size_t)ny[t] * z);
+        for(size_t x = 0; x < b->size_x; x++) out[x] += slab[x];
       }
-      index += 4;
     }
-  }
+
+  dt_bufferpool_free(darktable.bufferpool, slabs);
+  dt_free_align(xi);
+  dt_free_align(xf);
 }
 
 static void blur_line_z(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
@@ -252,96 +338,143 @@ void dt_bilateral_blur(dt_bilateral_t *b)
 }
 
 
-void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
+// trilinear lookup of the grid at (xi + xf, yi + yf, z), with the cells of the row yi starting at row
+static inline float grid_lookup(const dt_bilateral_t *const b, const float *const row, const int xi,
+                                const float xf, const float yf, const float L)
 {
-  // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
-  const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
+  const size_t ox = 1;
+  const size_t oy = b->size_x;
+  const size_t oz = b->size_y * b->size_x;
+  const float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
+  const int zi = MIN((int)z, (int)b->size_z - 2);
+  const float zf = z - zi;
+  const float *const g = row + xi + oz * zi;
+  return g[0] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf) + g[ox] * (xf) * (1.0f - yf) * (1.0f - zf)
+         + g[oy] * (1.0f - xf) * (yf) * (1.0f - zf) + g[ox + oy] * (xf) * (yf) * (1.0f - zf)
+         + g[oz] * (1.0f - xf) * (1.0f - yf) * (zf) + g[ox + oz] * (xf) * (1.0f - yf) * (zf)
+         + g[oy + oz] * (1.0f - xf) * (yf) * (zf) + g[ox + oy + oz] * (xf) * (yf) * (zf);
+}
+
+static void slice(const dt_bilateral_t *const b, const float *const in, float *out, const float norm,
+                  const int to_output)
+{
+  int *const xi = dt_alloc_align(64, sizeof(int) * b->width);
+  float *const xf = dt_alloc_align(64, sizeof(float) * b->width);
+  grid_columns(b, xi, xf);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(out)
 #endif
   for(int j = 0; j < b->height; j++)
   {
-    size_t index = 4 * j * b->width;
+    const float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
+    const int yi = MIN((int)y, (int)b->size_y - 2);
+    const float yf = y - yi;
+    const float *const row = b->buf + b->size_x * yi;
+    size_t index = (size_t)4 * j * b->width;
     for(int i = 0; i < b->width; i++)
     {
-      float x, y, z;
       const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = L
-                         + norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                   + b->buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                   + b->buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                   + b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
-      out[index] = Lout;
-      // and copy color and mask
-      out[index + 1] = in[index + 1];
-      out[index + 2] = in[index + 2];
-      out[index + 3] = in[index + 3];
+      const float Lout = norm * grid_lookup(b, row, xi[i], xf[i], yf, L);
+      if(to_output)
+        out[index] = MAX(0.0f, out[index] + Lout);
+      else
+      {
+        out[index] = L + Lout;
+        // and copy color and mask
+        out[index + 1] = in[index + 1];
+        out[index + 2] = in[index + 2];
+        out[index + 3] = in[index + 3];
+      }
       index += 4;
     }
   }
+  dt_free_align(xi);
+  dt_free_align(xf);
 }
 
-void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *const in, float *out,
-                                  const float detail)
+#if defined(__SSE__)
+static void slice_sse(const dt_bilateral_t *const b, const float *const in, float *out, const float norm,
+                      const int to_output)
 {
-  // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
-  const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
+  int *const xi = dt_alloc_align(64, sizeof(int) * b->width);
+  float *const xf = dt_alloc_align(64, sizeof(float) * b->width);
+  grid_columns(b, xi, xf);
+  const size_t oy = b->size_x;
+  const size_t oz = b->size_y * b->size_x;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(out)
 #endif
   for(int j = 0; j < b->height; j++)
   {
-    size_t index = 4 * j * b->width;
+    const float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
+    const int yi = MIN((int)y, (int)b->size_y - 2);
+    const float yf = y - yi;
+    // weights of the cells (x, y), (x+1, y), (x, y+1), (x+1, y+1) are wx * wy
+    const __m128 wy = _mm_set_ps(yf, yf, 1.0f - yf, 1.0f - yf);
+    const float *const row = b->buf + b->size_x * yi;
+    size_t index = (size_t)4 * j * b->width;
     for(int i = 0; i < b->width; i++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
+      const __m128 pixel = _mm_load_ps(in + index);
+      const float L = _mm_cvtss_f32(pixel);
+      const float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
+      const int zi = MIN((int)z, (int)b->size_z - 2);
       const float zf = z - zi;
-      const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                 + b->buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                 + b->buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                 + b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
-      out[index] = MAX(0.0f, out[index] + Lout);
+      const float *const g = row + xi[i] + oz * zi;
+      // two cells next to each other in x are next to each other in memory
+      const __m128 c0 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)g), (const __m64 *)(g + oy));
+      const __m128 c1
+          = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(g + oz)), (const __m64 *)(g + oy + oz));
+      const __m128 wx = _mm_set_ps(xf[i], 1.0f - xf[i], xf[i], 1.0f - xf[i]);
+      const __m128 cz = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(1.0f - zf)), _mm_mul_ps(c1, _mm_set1_ps(zf)));
+      __m128 sum = _mm_mul_ps(cz, _mm_mul_ps(wx, wy));
+      sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+      sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+      const float Lout = norm * _mm_cvtss_f32(sum);
+      if(to_output)
+        out[index] = MAX(0.0f, out[index] + Lout);
+      else
+        // and copy color and mask
+        _mm_store_ps(out + index, _mm_move_ss(pixel, _mm_set_ss(L + Lout)));
       index += 4;
     }
   }
+  dt_free_align(xi);
+  dt_free_align(xf);
+}
+#endif
+
+static void slice_dispatch(const dt_bilateral_t *const b, const float *const in, float *out, const float norm,
+                           const int to_output)
+{
+  if(darktable.codepath.OPENMP_SIMD) return slice(b, in, out, norm, to_output);
+#if defined(__SSE__)
+  else if(darktable.codepath.SSE2)
+    return slice_sse(b, in, out, norm, to_output);
+#endif
+  else
+    dt_unreachable_codepath();
+}
+
+void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
+{
+  // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
+  const float norm = -detail * b->sigma_r * 0.04f;
+  slice_dispatch(b, in, out, norm, 0);
+}
+
+void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *const in, float *out,
+                                  const float detail)
+{
+  // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
+  const float norm = -detail * b->sigma_r * 0.04f;
+  slice_dispatch(b, in, out, norm, 1);
 }
 
 void dt_bilateral_free(dt_bilateral_t *b)
 {
   if(!b) return;
-  dt_free_align(b->buf);
+  dt_bufferpool_free(darktable.bufferpool, b->buf);
   free(b);
 }
 
@@ -0,0 +1,227 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/box_filters.h"
+#include "common/darktable.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// rows or columns filtered at once
+#define BOX_LANES 16
+
+typedef enum dt_box_op_t
+{
+  DT_BOX_MEAN = 0,
+  DT_BOX_MIN = 1,
+  DT_BOX_MAX = 2
+} dt_box_op_t;
+
+size_t dt_box_filter_scratch_size(const int width, const int height, const int radius)
+{
+  // input and output lanes plus the two block arrays of min/max, see _minmax_lanes()
+  const size_t n = MAX(width, height);
+  return (size_t)BOX_LANES * (4 * n + 8 * (size_t)radius + 4);
+}
+
+// running mean along n positions of L interleaved lanes, x -> y
+static inline void _mean_lanes(const float *const x, float *const y, const int n, const int L, const int r)
+{
+  double acc[BOX_LANES] = { 0.0 };
+  int cnt = 0;
+  for(int i = 0; i <= MIN(r, n - 1); i++, cnt++)
+    for(int l = 0; l < L; l++) acc[l] += x[(size_t)i * L + l];
+  for(int i = 0; i < n; i++)
+  {
+    const double norm = 1.0 / cnt;
+    float *const yi = y + (size_t)i * L;
+    for(int l = 0; l < L; l++) yi[l] = acc[l] * norm;
+    if(i - r >= 0)
+    {
+      const float *const xo = x + (size_t)(i - r) * L;
+      for(int l = 0; l < L; l++) acc[l] -= xo[l];
+      cnt--;
+    }
+    if(i + r + 1 < n)
+    {
+      const float *const xi = x + (size_t)(i + r + 1) * L;
+      for(int l = 0; l < L; l++) acc[l] += xi[l];
+      cnt++;
+    }
+  }
+}
+
+static inline float _minmax(const float a, const float b, const int find_max)
+{
+  return find_max ? fmaxf(a, b) : fminf(a, b);
+}
+
+// running min or max along n positions of L interleaved lanes, x -> y. the input is
+// padded by r neutral elements on both sides and cut into blocks of k = 2r+1: g holds
+// the extremum from the start of each block, h the one up to its end. every window of
+// k elements is the end of one block plus the start of the next, so it takes three
+// comparisons per element whatever the radius.
+static inline void _minmax_lanes(const float *const x, float *const y, const int n, const int L, const int r,
+                                 float *const g, float *const h, const int find_max)
+{
+  const float pad = find_max ? -INFINITY : INFINITY;
+  const int k = 2 * r + 1;
+  const int m = (n + 2 * r + k - 1) / k * k;
+  for(int p = 0; p < m; p++)
+  {
+    const int i = p - r;
+    float *const gp = g + (size_t)p * L;
+    const int inside = i >= 0 && i < n;
+    const float *const xi = inside ? x + (size_t)i * L : x;
+    if(p % k == 0)
+      for(int l = 0; l < L; l++) gp[l] = inside ? xi[l] : pad;
+    else if(inside)
+      for(int l = 0; l < L; l++) gp[l] = _minmax(gp[l - L], xi[l], find_max);
+    else
+      for(int l = 0; l < L; l++) gp[l] = gp[l - L];
+  }
+  for(int p = m - 1; p >= 0; p--)
+  {
+    const int i = p - r;
+    float *const hp = h + (size_t)p * L;
+    const int inside = i >= 0 && i < n;
+    const float *const xi = inside ? x + (size_t)i * L : x;
+    if(p % k == k - 1)
+      for(int l = 0; l < L; l++) hp[l] = inside ? xi[l] : pad;
+    else if(inside)
+      for(int l = 0; l < L; l++) hp[l] = _minmax(hp[l + L], xi[l], find_max);
+    else
+      for(int l = 0; l < L; l++) hp[l] = hp[l + L];
+  }
+  for(int i = 0; i < n; i++)
+  {
+    const float *const hi = h + (size_t)i * L;
+    const float *const gi = g + (size_t)(i + 2 * r) * L;
+    float *const yi = y + (size_t)i * L;
+    for(int l = 0; l < L; l++) yi[l] = _minmax(hi[l], gi[l], find_max);
+  }
+}
+
+static inline void _filter_lanes(const float *const x, float *const y, const int n, const int L, const int r,
+                                 const dt_box_op_t op, float *const scratch)
+{
+  float *const g = scratch, *const h = scratch + (size_t)BOX_LANES * (n + 4 * r + 1);
+  // spelled out so that each variant gets its own inlined loops
+  if(op == DT_BOX_MEAN)
+    _mean_lanes(x, y, n, L, r);
+  else if(op == DT_BOX_MAX)
+    _minmax_lanes(x, y, n, L, r, g, h, 1);
+  else
+    _minmax_lanes(x, y, n, L, r, g, h, 0);
+}
+
+// horizontal pass over the rows starting at j0, as many as fit into the lanes
+static void _box_rows(float *const buf, const int width, const int height, const int ch, const int r,
+                      const dt_box_op_t op, const int j0, float *const scratch)
+{
+  const int rows = MIN(MAX(BOX_LANES / ch, 1), height - j0);
+  const int L = rows * ch;
+  const size_t n = MAX(width, height);
+  float *const x = scratch;
+  float *const y = x + BOX_LANES * n;
+  for(int k = 0; k < rows; k++)
+  {
+    const float *const in = buf + (size_t)(j0 + k) * width * ch;
+    for(int i = 0; i < width; i++)
+      for(int c = 0; c < ch; c++) x[(size_t)i * L + k * ch + c] = in[(size_t)i * ch + c];
+  }
+  _filter_lanes(x, y, width, L, r, op, y + BOX_LANES * n);
+  for(int k = 0; k < rows; k++)
+  {
+    float *const out = buf + (size_t)(j0 + k) * width * ch;
+    for(int i = 0; i < width; i++)
+      for(int c = 0; c < ch; c++) out[(size_t)i * ch + c] = y[(size_t)i * L + k * ch + c];
+  }
+}
+
+// vertical pass over the strip of floats starting at f0 of every row
+static void _box_cols(float *const buf, const int width, const int height, const int ch, const int r,
+                      const dt_box_op_t op, const size_t f0, float *const scratch)
+{
+  const size_t stride = (size_t)width * ch;
+  const int L = MIN(BOX_LANES, stride - f0);
+  const size_t n = MAX(width, height);
+  float *const x = scratch;
+  float *const y = x + BOX_LANES * n;
+  for(int j = 0; j < height; j++) memcpy(x + (size_t)j * L, buf + j * stride + f0, sizeof(float) * L);
+  _filter_lanes(x, y, height, L, r, op, y + BOX_LANES * n);
+  for(int j = 0; j < height; j++) memcpy(buf + j * stride + f0, y + (size_t)j * L, sizeof(float) * L);
+}
+
+static int _box_filter(float *const buf, const int width, const int height, const int ch, const int radius,
+                       const dt_box_op_t op, float *const scratch)
+{
+  assert(ch >= 1 && ch <= DT_BOX_FILTER_MAX_CHANNELS);
+  const int rows = MAX(BOX_LANES / ch, 1);
+  const int num_rows = (height + rows - 1) / rows;
+  const int num_cols = ((size_t)width * ch + BOX_LANES - 1) / BOX_LANES;
+
+  if(scratch)
+  {
+    for(int b = 0; b < num_rows; b++) _box_rows(buf, width, height, ch, radius, op, b * rows, scratch);
+    for(int b = 0; b < num_cols; b++) _box_cols(buf, width, height, ch, radius, op, (size_t)b * BOX_LANES, scratch);
+    return 0;
+  }
+
+  const size_t size = dt_box_filter_scratch_size(width, height, radius);
+  float *const mem = dt_alloc_align(64, sizeof(float) * size * dt_get_num_threads());
+  if(!mem)
+  {
+    fprintf(stderr, "[box filter] could not allocate temporary buffers\n");
+    return 1;
+  }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int b = 0; b < num_rows; b++)
+    _box_rows(buf, width, height, ch, radius, op, b * rows, mem + size * dt_get_thread_num());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int b = 0; b < num_cols; b++)
+    _box_cols(buf, width, height, ch, radius, op, (size_t)b * BOX_LANES, mem + size * dt_get_thread_num());
+  dt_free_align(mem);
+  return 0;
+}
+
+int dt_box_mean(float *const buf, const int width, const int height, const int ch, const int radius,
+                float *const scratch)
+{
+  return _box_filter(buf, width, height, ch, radius, DT_BOX_MEAN, scratch);
+}
+
+int dt_box_min(float *const buf, const int width, const int height, const int radius, float *const scratch)
+{
+  return _box_filter(buf, width, height, 1, radius, DT_BOX_MIN, scratch);
+}
+
+int dt_box_max(float *const buf, const int width, const int height, const int radius, float *const scratch)
+{
+  return _box_filter(buf, width, height, 1, radius, DT_BOX_MAX, scratch);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
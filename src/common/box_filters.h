@@ -0,0 +1,54 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * box filters over a (2*radius+1) x (2*radius+1) window, in place.
+ *
+ * buffers are row major with ch floats per pixel (min and max work on a single
+ * channel). near the borders the window is clipped to the image, the mean is
+ * taken over the pixels inside. all of them are running filters, the cost per
+ * pixel does not depend on the radius: sums are slid along rows and columns in
+ * double precision, min and max use the van herk/gil-werman block scheme. both
+ * passes work on up to 16 rows or columns at once, which keeps the inner loops
+ * contiguous for the compiler to vectorize.
+ *
+ * with scratch == NULL the work is spread over all threads and memory is
+ * allocated internally. code that runs in parallel already can instead pass
+ * dt_box_filter_scratch_size() floats of scratch, then the filter is done
+ * single threaded on that memory. they return non-zero, with buf untouched,
+ * if the internal memory could not be allocated.
+ */
+
+#define DT_BOX_FILTER_MAX_CHANNELS 16
+
+size_t dt_box_filter_scratch_size(const int width, const int height, const int radius);
+
+int dt_box_mean(float *const buf, const int width, const int height, const int ch, const int radius,
+                float *const scratch);
+
+int dt_box_min(float *const buf, const int width, const int height, const int radius, float *const scratch);
+
+int dt_box_max(float *const buf, const int width, const int height, const int radius, float *const scratch);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
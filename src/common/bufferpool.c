@@ -0,0 +1,252 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/bufferpool.h"
+#include "common/darktable.h"
+#include "control/conf.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// requests smaller than 2^DT_BUFFERPOOL_MIN_SHIFT bytes are not pooled
+#define DT_BUFFERPOOL_MIN_SHIFT 18
+// size and alignment of a transparent huge page
+#define DT_BUFFERPOOL_HUGEPAGE ((size_t)2 << 20)
+
+typedef struct dt_bufferpool_buffer_t
+{
+  void *mem;
+  size_t size; // of its size class
+  dt_bufferpool_stats_t *scope;
+} dt_bufferpool_buffer_t;
+
+// where buffers taken by this thread are accounted, besides the pool itself
+static __thread dt_bufferpool_stats_t *_scope = NULL;
+
+// four size classes per power of two: with 2^e <= size, round up to a multiple of 2^(e-2)
+static size_t _class_size(const size_t size)
+{
+  int e = DT_BUFFERPOOL_MIN_SHIFT;
+  while(e < 62 && ((size_t)1 << (e + 1)) <= size) e++;
+  const size_t step = (size_t)1 << (e - 2);
+  return ((size + step - 1) / step) * step;
+}
+
+static void _account(dt_bufferpool_stats_t *stats, const size_t size, const gboolean taken)
+{
+  if(!stats) return;
+  if(taken)
+  {
+    stats->used += size;
+    stats->peak = MAX(stats->peak, stats->used);
+  }
+  else
+    stats->used -= MIN(size, stats->used);
+}
+
+static void *_alloc(const dt_bufferpool_t *pool, const size_t size)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if(pool->hugepages && size >= DT_BUFFERPOOL_HUGEPAGE)
+  {
+    void *mem = dt_alloc_align(DT_BUFFERPOOL_HUGEPAGE, size);
+    // only a hint, the kernel might not do it
+    if(mem) madvise(mem, size, MADV_HUGEPAGE);
+    return mem;
+  }
+#endif
+  return dt_alloc_align(64, size);
+}
+
+static void _free_buffers(GList *buffers)
+{
+  for(GList *l = buffers; l; l = g_list_next(l))
+  {
+    dt_bufferpool_buffer_t *buffer = (dt_bufferpool_buffer_t *)l->data;
+    dt_free_align(buffer->mem);
+    g_free(buffer);
+  }
+  g_list_free(buffers);
+}
+
+void dt_bufferpool_init(dt_bufferpool_t *pool)
+{
+  dt_pthread_mutex_init(&pool->lock, NULL);
+  pool->limit = (size_t)MAX(dt_conf_get_int("bufferpool_size"), 0) * 1024 * 1024;
+  pool->hugepages = dt_conf_get_bool("bufferpool_hugepages");
+  pool->kept = 0;
+  pool->free = g_queue_new();
+  pool->taken = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  memset(&pool->stats, 0, sizeof(pool->stats));
+  pool->hits = pool->misses = 0;
+}
+
+void dt_bufferpool_cleanup(dt_bufferpool_t *pool)
+{
+  dt_bufferpool_trim(pool);
+  dt_print(DT_DEBUG_MEMORY,
+           "[bufferpool] peak usage %zu MB, %" PRIu64 " buffers reused, %" PRIu64 " allocated\n",
+           pool->stats.peak >> 20, pool->hits, pool->misses);
+  // nothing should hold a buffer anymore, whoever still does must not use it after this
+  const guint taken = g_hash_table_size(pool->taken);
+  if(taken)
+    dt_print(DT_DEBUG_MEMORY, "[bufferpool] %u buffers still taken at cleanup, %zu MB freed\n", taken,
+             pool->stats.used >> 20);
+  GList *buffers = g_hash_table_get_values(pool->taken);
+  for(GList *l = buffers; l; l = g_list_next(l)) dt_free_align(((dt_bufferpool_buffer_t *)l->data)->mem);
+  g_list_free(buffers);
+  g_hash_table_destroy(pool->taken);
+  g_queue_free(pool->free);
+  dt_pthread_mutex_destroy(&pool->lock);
+}
+
+void *dt_bufferpool_alloc(dt_bufferpool_t *pool, const size_t size)
+{
+  if(!pool || size < ((size_t)1 << DT_BUFFERPOOL_MIN_SHIFT)) return dt_alloc_align(64, size);
+
+  const size_t class_size = _class_size(size);
+  dt_bufferpool_buffer_t *buffer = NULL;
+
+  dt_pthread_mutex_lock(&pool->lock);
+  for(GList *l = pool->free->head; l; l = g_list_next(l))
+  {
+    dt_bufferpool_buffer_t *b = (dt_bufferpool_buffer_t *)l->data;
+    if(b->size != class_size) continue;
+    g_queue_delete_link(pool->free, l);
+    pool->kept -= b->size;
+    buffer = b;
+    break;
+  }
+  if(buffer)
+    pool->hits++;
+  else
+    pool->misses++;
+  dt_pthread_mutex_unlock(&pool->lock);
+
+  if(!buffer)
+  {
+    void *mem = _alloc(pool, class_size);
+    if(!mem)
+    {
+      // what we keep might be just what's missing
+      dt_bufferpool_trim(pool);
+      mem = _alloc(pool, class_size);
+      if(!mem) return NULL;
+    }
+    buffer = (dt_bufferpool_buffer_t *)g_malloc(sizeof(dt_bufferpool_buffer_t));
+    buffer->mem = mem;
+    buffer->size = class_size;
+  }
+  buffer->scope = _scope;
+
+  dt_pthread_mutex_lock(&pool->lock);
+  g_hash_table_insert(pool->taken, buffer->mem, buffer);
+  _account(&pool->stats, buffer->size, TRUE);
+  _account(buffer->scope, buffer->size, TRUE);
+  dt_pthread_mutex_unlock(&pool->lock);
+
+  return buffer->mem;
+}
+
+void dt_bufferpool_free(dt_bufferpool_t *pool, void *mem)
+{
+  if(!mem) return;
+  if(!pool)
+  {
+    dt_free_align(mem);
+    return;
+  }
+
+  dt_pthread_mutex_lock(&pool->lock);
+  dt_bufferpool_buffer_t *buffer = (dt_bufferpool_buffer_t *)g_hash_table_lookup(pool->taken, mem);
+  if(!buffer)
+  {
+    // not one of ours
+    dt_pthread_mutex_unlock(&pool->lock);
+    dt_free_align(mem);
+    return;
+  }
+  g_hash_table_steal(pool->taken, mem);
+  _account(&pool->stats, buffer->size, FALSE);
+  _account(buffer->scope, buffer->size, FALSE);
+  buffer->scope = NULL;
+
+  g_queue_push_head(pool->free, buffer);
+  pool->kept += buffer->size;
+
+  // keeping too much, the buffers given back longest ago go
+  GList *drop = NULL;
+  while(pool->kept > pool->limit && !g_queue_is_empty(pool->free))
+  {
+    dt_bufferpool_buffer_t *b = (dt_bufferpool_buffer_t *)g_queue_pop_tail(pool->free);
+    pool->kept -= b->size;
+    drop = g_list_prepend(drop, b);
+  }
+  dt_pthread_mutex_unlock(&pool->lock);
+
+  // outside the lock, munmap() takes a while
+  _free_buffers(drop);
+}
+
+void dt_bufferpool_trim(dt_bufferpool_t *pool)
+{
+  if(!pool) return;
+
+  dt_pthread_mutex_lock(&pool->lock);
+  GList *drop = NULL;
+  while(!g_queue_is_empty(pool->free)) drop = g_list_prepend(drop, g_queue_pop_head(pool->free));
+  pool->kept = 0;
+  dt_pthread_mutex_unlock(&pool->lock);
+
+  _free_buffers(drop);
+}
+
+dt_bufferpool_stats_t *dt_bufferpool_scope_enter(dt_bufferpool_stats_t *stats)
+{
+  dt_bufferpool_stats_t *previous = _scope;
+  _scope = stats;
+  return previous;
+}
+
+void dt_bufferpool_scope_leave(dt_bufferpool_stats_t *previous)
+{
+  _scope = previous;
+}
+
+static void _forget_scope(gpointer key, gpointer value, gpointer user_data)
+{
+  dt_bufferpool_buffer_t *buffer = (dt_bufferpool_buffer_t *)value;
+  if(buffer->scope == user_data) buffer->scope = NULL;
+}
+
+void dt_bufferpool_scope_forget(dt_bufferpool_t *pool, dt_bufferpool_stats_t *stats)
+{
+  if(!pool) return;
+
+  dt_pthread_mutex_lock(&pool->lock);
+  g_hash_table_foreach(pool->taken, _forget_scope, stats);
+  dt_pthread_mutex_unlock(&pool->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,79 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+#include <glib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * pool for the large scratch buffers that modules and tiling take and give back on every process().
+ *
+ * straight from the system allocator, buffers of hundreds of MB mean mmap/munmap, page faults and zeroed
+ * pages on every call. buffers given back to the pool are kept instead, up to bufferpool_size MB, and handed
+ * out again for requests of the same size class. size classes are a quarter of a power of two apart, so at
+ * most a quarter of a buffer is wasted. smaller requests go to dt_alloc_align() directly. large buffers may
+ * be backed by transparent huge pages (bufferpool_hugepages).
+ *
+ * buffers in use are accounted globally, and to the scope of the thread that took them, see
+ * dt_bufferpool_scope_enter(). the pixelpipe accounts what it takes while processing to itself that way.
+ *
+ * buffers from dt_bufferpool_alloc() have to be given back with dt_bufferpool_free(), which also takes
+ * buffers from dt_alloc_align(). both work with a NULL pool, they just don't pool anything then.
+ */
+
+typedef struct dt_bufferpool_stats_t
+{
+  size_t used; // bytes in buffers taken and not given back yet
+  size_t peak; // high-water mark of used
+} dt_bufferpool_stats_t;
+
+typedef struct dt_bufferpool_t
+{
+  dt_pthread_mutex_t lock;
+  size_t limit;        // bytes of free buffers to keep at most
+  size_t kept;         // bytes of free buffers kept right now
+  gboolean hugepages;
+  GQueue *free;        // dt_bufferpool_buffer_t of free buffers, most recently given back first
+  GHashTable *taken;   // buffer -> dt_bufferpool_buffer_t of the buffers taken from the pool
+  dt_bufferpool_stats_t stats;
+  uint64_t hits, misses;
+} dt_bufferpool_t;
+
+void dt_bufferpool_init(dt_bufferpool_t *pool);
+void dt_bufferpool_cleanup(dt_bufferpool_t *pool);
+
+/** a buffer of at least size bytes, aligned to 64 bytes. NULL if out of memory. */
+void *dt_bufferpool_alloc(dt_bufferpool_t *pool, const size_t size);
+/** give a buffer back, NULL is fine. */
+void dt_bufferpool_free(dt_bufferpool_t *pool, void *mem);
+/** free all buffers kept in the pool. */
+void dt_bufferpool_trim(dt_bufferpool_t *pool);
+
+/** account buffers taken by this thread to stats as well, until the scope is left. returns the scope to go
+  * back to, for dt_bufferpool_scope_leave(). */
+dt_bufferpool_stats_t *dt_bufferpool_scope_enter(dt_bufferpool_stats_t *stats);
+void dt_bufferpool_scope_leave(dt_bufferpool_stats_t *previous);
+/** stats is going away, buffers still taken in its scope stop being accounted to it. */
+void dt_bufferpool_scope_forget(dt_bufferpool_t *pool, dt_bufferpool_stats_t *stats);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
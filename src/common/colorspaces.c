@@ -966,6 +966,8 @@ static dt_colorspaces_color_profile_t *_create_profile(dt_colorspaces_color_prof
 // this function is basically thread safe, at least when not called on the global darktable.color_profiles
 static void _update_display_transforms(dt_colorspaces_t *self)
 {
+  self->display_transforms_generation++;
+
   if(self->transform_srgb_to_display) cmsDeleteTransform(self->transform_srgb_to_display);
   self->transform_srgb_to_display = NULL;
 
@@ -96,6 +96,8 @@ typedef struct dt_colorspaces_t
   dt_colorspaces_color_mode_t mode;
 
   cmsHTRANSFORM transform_srgb_to_display, transform_adobe_rgb_to_display;
+  // bumped whenever the two transforms above are rebuilt, anything drawn with them is stale then
+  uint32_t display_transforms_generation;
 
 } dt_colorspaces_t;
 
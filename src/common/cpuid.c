@@ -100,6 +100,18 @@ dt_cpu_flags_t dt_detect_cpu_features()
         if(cx & 0x00000200) cpuflags |= CPU_FLAG_SSSE3;
         if(cx & 0x00040000) cpuflags |= CPU_FLAG_SSE4_1;
         if(cx & 0x00080000) cpuflags |= CPU_FLAG_SSE4_2;
+
+        // avx and f16c need the os to save the ymm registers (osxsave, then xcr0)
+        if((cx & 0x08000000) && (cx & 0x10000000))
+        {
+          guint32 xcr0_lo, xcr0_hi;
+          __asm volatile(".byte 0x0f, 0x01, 0xd0" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+          if((xcr0_lo & 0x6) == 0x6)
+          {
+            cpuflags |= CPU_FLAG_AVX;
+            if(cx & 0x20000000) cpuflags |= CPU_FLAG_F16C;
+          }
+        }
       }
 
       /* Are there extensions? */
@@ -134,6 +146,7 @@ dt_cpu_flags_t dt_detect_cpu_features()
     report("SSE4.1", CPU_FLAG_SSE4_1);
     report("SSE4.2", CPU_FLAG_SSE4_2);
     report("AVX", CPU_FLAG_AVX);
+    report("F16C", CPU_FLAG_F16C);
 #undef report
   }
 #endif
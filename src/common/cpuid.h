@@ -33,7 +33,8 @@ typedef enum dt_cpu_flags_t
   CPU_FLAG_SSSE3 = 1 << 8,
   CPU_FLAG_SSE4_1 = 1 << 9,
   CPU_FLAG_SSE4_2 = 1 << 10,
-  CPU_FLAG_AVX = 1 << 11
+  CPU_FLAG_AVX = 1 << 11,
+  CPU_FLAG_F16C = 1 << 12
 } dt_cpu_flags_t;
 
 dt_cpu_flags_t dt_detect_cpu_features();
@@ -39,17 +39,20 @@
 #include "common/camera_control.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/bufferpool.h"
 #include "common/cpuid.h"
 #include "common/film.h"
 #include "common/grealpath.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
+#include "common/interpolation.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
 #include "common/resource_limits.h"
+#include "common/tuning.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -284,12 +287,17 @@ static void dt_codepaths_init()
 #else
     dt_cpu_flags_t flags = dt_detect_cpu_features();
     darktable.codepath.SSE2 = ((flags & (CPU_FLAG_SSE)) && (flags & (CPU_FLAG_SSE2)));
+#endif
+#if defined(__SSE__)
+    // not all compilers know about f16c in __builtin_cpu_supports()
+    darktable.codepath.F16C = darktable.codepath.SSE2 && (dt_detect_cpu_features() & CPU_FLAG_F16C);
 #endif
   }
 
   // second, apply overrides from conf
   // NOTE: all intrinsics sets can only be overridden to OFF
   if(!dt_conf_get_bool("codepaths/sse2")) darktable.codepath.SSE2 = 0;
+  if(!dt_conf_get_bool("codepaths/f16c") || !darktable.codepath.SSE2) darktable.codepath.F16C = 0;
 
   // last: do we have any intrinsics sets enabled?
   darktable.codepath._no_intrinsics = !(darktable.codepath.SSE2);
@@ -879,6 +887,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.points = (dt_points_t *)calloc(1, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
+  darktable.tuning = (dt_tuning_t *)calloc(1, sizeof(dt_tuning_t));
+  dt_tuning_init(darktable.tuning);
+
+  darktable.bufferpool = (dt_bufferpool_t *)calloc(1, sizeof(dt_bufferpool_t));
+  dt_bufferpool_init(darktable.bufferpool);
+
   darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
 
   // must come before mipmap_cache, because that one will need to access
@@ -1073,7 +1087,13 @@ void dt_cleanup()
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
   free(darktable.points);
+  dt_tuning_cleanup(darktable.tuning);
+  free(darktable.tuning);
+  dt_bufferpool_cleanup(darktable.bufferpool);
+  free(darktable.bufferpool);
+  darktable.bufferpool = NULL;
   dt_iop_unload_modules_so();
+  dt_interpolation_cleanup();
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
 #ifdef HAVE_GPHOTO2
@@ -182,6 +182,7 @@ typedef enum dt_debug_thread_t
 typedef struct dt_codepath_t
 {
   unsigned int SSE2 : 1;
+  unsigned int F16C : 1; // half float conversion, see common/half.h
   unsigned int _no_intrinsics : 1;
   unsigned int OPENMP_SIMD : 1; // always stays the last one
 } dt_codepath_t;
@@ -216,6 +217,8 @@ typedef struct darktable_t
   struct dt_dbus_t *dbus;
   struct dt_undo_t *undo;
   struct dt_colorspaces_t *color_profiles;
+  struct dt_tuning_t *tuning;
+  struct dt_bufferpool_t *bufferpool;
   dt_pthread_mutex_t db_insert;
   dt_pthread_mutex_t plugin_threadsafe;
   dt_pthread_mutex_t capabilities_threadsafe;
@@ -22,6 +22,7 @@
 #if defined(__SSE__)
 #include <xmmintrin.h>
 #endif
+#include "common/bufferpool.h"
 #include "common/gaussian.h"
 #include "common/opencl.h"
 
@@ -141,13 +142,13 @@ dt_gaussian_t *dt_gaussian_init(const int width,    // width of input image
     g->min[k] = min[k];
   }
 
-  g->buf = dt_alloc_align(64, (size_t)width * height * channels * sizeof(float));
+  g->buf = dt_bufferpool_alloc(darktable.bufferpool, (size_t)width * height * channels * sizeof(float));
   if(!g->buf) goto error;
 
   return g;
 
 error:
-  dt_free_align(g->buf);
+  dt_bufferpool_free(darktable.bufferpool, g->buf);
   free(g->max);
   free(g->min);
   free(g);
@@ -490,7 +491,7 @@ void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const o
 void dt_gaussian_free(dt_gaussian_t *g)
 {
   if(!g) return;
-  dt_free_align(g->buf);
+  dt_bufferpool_free(darktable.bufferpool, g->buf);
   free(g->min);
   free(g->max);
   free(g);
@@ -0,0 +1,320 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/guided_filter.h"
+#include "common/box_filters.h"
+#include "common/darktable.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+// side length of the tiles, including the overlap of 2*radius on every side
+#define GF_TILE 512
+
+// guide, input and their products per pixel: I, p, I*p, and the upper triangle of I*I^T
+#define GF_CHANNELS 13
+
+// side length of the part of a tile that is written to the output
+static inline int _target_size(const int radius)
+{
+  return MAX(GF_TILE - 4 * radius, 64);
+}
+
+static inline size_t _tile_buffer_size(const int radius)
+{
+  const size_t source = _target_size(radius) + 4 * radius;
+  return GF_CHANNELS * source * source + dt_box_filter_scratch_size(source, source, radius);
+}
+
+size_t dt_guided_filter_memory_use(const int radius)
+{
+  return sizeof(float) * _tile_buffer_size(radius) * dt_get_num_threads();
+}
+
+// filter the target rectangle [left, right) x [lower, upper). the box means are taken
+// over the target grown by 2*radius, the reach of the two box filters in a row, so the
+// result does not depend on the tiling.
+static void _guided_filter_tile(const float *const guide, const int guide_ch, const float *const in,
+                                float *const out, const int width, const int height, const int left,
+                                const int right, const int lower, const int upper, const int radius,
+                                const float eps, float *const buf)
+{
+  const int src_left = MAX(left - 2 * radius, 0), src_right = MIN(right + 2 * radius, width);
+  const int src_lower = MAX(lower - 2 * radius, 0), src_upper = MIN(upper + 2 * radius, height);
+  const int w = src_right - src_left, h = src_upper - src_lower;
+  const size_t size = (size_t)w * h;
+  const int source = _target_size(radius) + 4 * radius;
+  float *const scratch = buf + (size_t)GF_CHANNELS * source * source;
+
+  for(int j = 0; j < h; j++)
+  {
+    const size_t l0 = (size_t)(src_lower + j) * width + src_left;
+    float *const row = buf + (size_t)GF_CHANNELS * j * w;
+    for(int i = 0; i < w; i++)
+    {
+      const float *const pixel = guide + (l0 + i) * guide_ch;
+      const float p = in[l0 + i];
+      float *const b = row + (size_t)GF_CHANNELS * i;
+      b[0] = pixel[0];
+      b[1] = pixel[1];
+      b[2] = pixel[2];
+      b[3] = p;
+      b[4] = pixel[0] * p;
+      b[5] = pixel[1] * p;
+      b[6] = pixel[2] * p;
+      b[7] = pixel[0] * pixel[0];
+      b[8] = pixel[0] * pixel[1];
+      b[9] = pixel[0] * pixel[2];
+      b[10] = pixel[1] * pixel[1];
+      b[11] = pixel[1] * pixel[2];
+      b[12] = pixel[2] * pixel[2];
+    }
+  }
+  dt_box_mean(buf, w, h, GF_CHANNELS, radius, scratch);
+
+  // linear coefficients a (3x3 system solved via cramer's rule) and b per pixel,
+  // packed in place into the first 4 floats of every pixel
+  for(size_t k = 0; k < size; k++)
+  {
+    const float *const m = buf + GF_CHANNELS * k;
+    const float mean_r = m[0], mean_g = m[1], mean_b = m[2], mean_p = m[3];
+    const float cov_r = m[4] - mean_r * mean_p;
+    const float cov_g = m[5] - mean_g * mean_p;
+    const float cov_b = m[6] - mean_b * mean_p;
+    // symmetric coefficient matrix
+    const float s00 = m[7] - (mean_r * mean_r - eps);
+    const float s01 = m[8] - mean_r * mean_g;
+    const float s02 = m[9] - mean_r * mean_b;
+    const float s11 = m[10] - (mean_g * mean_g - eps);
+    const float s12 = m[11] - mean_g * mean_b;
+    const float s22 = m[12] - (mean_b * mean_b - eps);
+    const float det0 = s00 * (s11 * s22 - s12 * s12) - s01 * (s01 * s22 - s02 * s12)
+                       + s02 * (s01 * s12 - s02 * s11);
+    float a_r = 0.0f, a_g = 0.0f, a_b = 0.0f;
+    // leave a at zero if the linear system is singular
+    if(fabsf(det0) > 4.f * FLT_EPSILON)
+    {
+      const float det1 = cov_r * (s11 * s22 - s12 * s12) - s01 * (cov_g * s22 - cov_b * s12)
+                         + s02 * (cov_g * s12 - cov_b * s11);
+      const float det2 = s00 * (cov_g * s22 - cov_b * s12) - cov_r * (s01 * s22 - s02 * s12)
+                         + s02 * (s01 * cov_b - s02 * cov_g);
+      const float det3 = s00 * (s11 * cov_b - s12 * cov_g) - s01 * (s01 * cov_b - s02 * cov_g)
+                         + cov_r * (s01 * s12 - s02 * s11);
+      a_r = det1 / det0;
+      a_g = det2 / det0;
+      a_b = det3 / det0;
+    }
+    float *const ab = buf + 4 * k;
+    ab[0] = a_r;
+    ab[1] = a_g;
+    ab[2] = a_b;
+    ab[3] = mean_p - a_r * mean_r - a_g * mean_g - a_b * mean_b;
+  }
+  dt_box_mean(buf, w, h, 4, radius, scratch);
+
+  for(int j = lower; j < upper; j++)
+  {
+    const float *const ab = buf + 4 * ((size_t)(j - src_lower) * w + left - src_left);
+    const size_t l0 = (size_t)j * width;
+    for(int i = left; i < right; i++)
+    {
+      const float *const pixel = guide + (l0 + i) * guide_ch;
+      const float *const c = ab + 4 * (i - left);
+      out[l0 + i] = c[0] * pixel[0] + c[1] * pixel[1] + c[2] * pixel[2] + c[3];
+    }
+  }
+}
+
+int dt_guided_filter(const float *const guide, const int guide_ch, const float *const in, float *const out,
+                     const int width, const int height, const int radius, const float eps)
+{
+  const int tile = _target_size(radius);
+  const int tiles_x = (width + tile - 1) / tile;
+  const int num_tiles = tiles_x * ((height + tile - 1) / tile);
+  const size_t buf_size = _tile_buffer_size(radius);
+  float *const mem = dt_alloc_align(64, sizeof(float) * buf_size * dt_get_num_threads());
+  if(!mem)
+  {
+    fprintf(stderr, "[guided filter] could not allocate temporary buffers\n");
+    return 1;
+  }
+#ifdef _OPENMP
+// use dynamic load balancing as tiles may have varying size
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for(int t = 0; t < num_tiles; t++)
+  {
+    const int i = (t % tiles_x) * tile, j = (t / tiles_x) * tile;
+    _guided_filter_tile(guide, guide_ch, in, out, width, height, i, MIN(i + tile, width), j,
+                        MIN(j + tile, height), radius, eps, mem + buf_size * dt_get_thread_num());
+  }
+  dt_free_align(mem);
+  return 0;
+}
+
+#ifdef HAVE_OPENCL
+dt_guided_filter_cl_global_t *dt_guided_filter_init_cl_global()
+{
+  dt_guided_filter_cl_global_t *g = (dt_guided_filter_cl_global_t *)malloc(sizeof(dt_guided_filter_cl_global_t));
+
+  const int program = 21; // guided_filter.cl, from programs.conf
+  g->kernel_box_mean_x = dt_opencl_create_kernel(program, "box_mean_x");
+  g->kernel_box_mean_y = dt_opencl_create_kernel(program, "box_mean_y");
+  g->kernel_box_min_x = dt_opencl_create_kernel(program, "box_min_x");
+  g->kernel_box_min_y = dt_opencl_create_kernel(program, "box_min_y");
+  g->kernel_box_max_x = dt_opencl_create_kernel(program, "box_max_x");
+  g->kernel_box_max_y = dt_opencl_create_kernel(program, "box_max_y");
+  g->kernel_guided_filter_split = dt_opencl_create_kernel(program, "guided_filter_split");
+  g->kernel_guided_filter_solve = dt_opencl_create_kernel(program, "guided_filter_solve");
+  g->kernel_guided_filter_apply = dt_opencl_create_kernel(program, "guided_filter_apply");
+  return g;
+}
+
+void dt_guided_filter_free_cl_global(dt_guided_filter_cl_global_t *g)
+{
+  if(!g) return;
+  dt_opencl_free_kernel(g->kernel_box_mean_x);
+  dt_opencl_free_kernel(g->kernel_box_mean_y);
+  dt_opencl_free_kernel(g->kernel_box_min_x);
+  dt_opencl_free_kernel(g->kernel_box_min_y);
+  dt_opencl_free_kernel(g->kernel_box_max_x);
+  dt_opencl_free_kernel(g->kernel_box_max_y);
+  dt_opencl_free_kernel(g->kernel_guided_filter_split);
+  dt_opencl_free_kernel(g->kernel_guided_filter_solve);
+  dt_opencl_free_kernel(g->kernel_guided_filter_apply);
+  free(g);
+}
+
+// one separable pass: kernel reads in and writes out
+static cl_int _box_pass_cl(const int devid, const int kernel, cl_mem in, cl_mem out, const int width,
+                           const int height, const int radius, const size_t *sizes)
+{
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&in);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&out);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&radius);
+  return dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+}
+
+static cl_int _box_separable_cl(const int devid, const int kernel_x, const int kernel_y, cl_mem dev_buf,
+                                 cl_mem dev_tmp, const int width, const int height, const int radius)
+{
+  const size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  cl_int err = _box_pass_cl(devid, kernel_x, dev_buf, dev_tmp, width, height, radius, sizes);
+  if(err != CL_SUCCESS) return err;
+  return _box_pass_cl(devid, kernel_y, dev_tmp, dev_buf, width, height, radius, sizes);
+}
+
+// box mean of an rgba buffer, in place
+static cl_int _box_mean_cl(const int devid, cl_mem dev_buf, cl_mem dev_tmp, const int width, const int height,
+                           const int radius)
+{
+  const dt_guided_filter_cl_global_t *gf = darktable.opencl->guided_filter;
+  return _box_separable_cl(devid, gf->kernel_box_mean_x, gf->kernel_box_mean_y, dev_buf, dev_tmp, width, height,
+                           radius);
+}
+
+cl_int dt_box_min_cl(const int devid, cl_mem dev_buf, cl_mem dev_tmp, const int width, const int height,
+                     const int radius)
+{
+  const dt_guided_filter_cl_global_t *gf = darktable.opencl->guided_filter;
+  return _box_separable_cl(devid, gf->kernel_box_min_x, gf->kernel_box_min_y, dev_buf, dev_tmp, width, height,
+                           radius);
+}
+
+cl_int dt_box_max_cl(const int devid, cl_mem dev_buf, cl_mem dev_tmp, const int width, const int height,
+                     const int radius)
+{
+  const dt_guided_filter_cl_global_t *gf = darktable.opencl->guided_filter;
+  return _box_separable_cl(devid, gf->kernel_box_max_x, gf->kernel_box_max_y, dev_buf, dev_tmp, width, height,
+                           radius);
+}
+
+cl_int dt_guided_filter_cl(const int devid, cl_mem dev_guide, cl_mem dev_in, cl_mem dev_out, const int width,
+                           const int height, const int radius, const float eps)
+{
+  const dt_guided_filter_cl_global_t *gf = darktable.opencl->guided_filter;
+  cl_int err = -999;
+  const size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  // means of the guide and input, their covariance and the variance of the guide
+  cl_mem dev_mean = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  cl_mem dev_cov = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  cl_mem dev_var1 = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  cl_mem dev_var2 = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  cl_mem dev_tmp = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(!dev_mean || !dev_cov || !dev_var1 || !dev_var2 || !dev_tmp) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_split, 0, sizeof(cl_mem), (void *)&dev_guide);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_split, 1, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_split, 2, sizeof(cl_mem), (void *)&dev_mean);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_split, 3, sizeof(cl_mem), (void *)&dev_cov);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_split, 4, sizeof(cl_mem), (void *)&dev_var1);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_split, 5, sizeof(cl_mem), (void *)&dev_var2);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_split, 6, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_split, 7, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gf->kernel_guided_filter_split, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  err = _box_mean_cl(devid, dev_mean, dev_tmp, width, height, radius);
+  if(err != CL_SUCCESS) goto error;
+  err = _box_mean_cl(devid, dev_cov, dev_tmp, width, height, radius);
+  if(err != CL_SUCCESS) goto error;
+  err = _box_mean_cl(devid, dev_var1, dev_tmp, width, height, radius);
+  if(err != CL_SUCCESS) goto error;
+  err = _box_mean_cl(devid, dev_var2, dev_tmp, width, height, radius);
+  if(err != CL_SUCCESS) goto error;
+
+  // linear coefficients into dev_tmp
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_solve, 0, sizeof(cl_mem), (void *)&dev_mean);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_solve, 1, sizeof(cl_mem), (void *)&dev_cov);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_solve, 2, sizeof(cl_mem), (void *)&dev_var1);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_solve, 3, sizeof(cl_mem), (void *)&dev_var2);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_solve, 4, sizeof(cl_mem), (void *)&dev_tmp);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_solve, 5, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_solve, 6, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_solve, 7, sizeof(float), (void *)&eps);
+  err = dt_opencl_enqueue_kernel_2d(devid, gf->kernel_guided_filter_solve, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  err = _box_mean_cl(devid, dev_tmp, dev_mean, width, height, radius);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_apply, 0, sizeof(cl_mem), (void *)&dev_guide);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_apply, 1, sizeof(cl_mem), (void *)&dev_tmp);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_apply, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gf->kernel_guided_filter_apply, 4, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gf->kernel_guided_filter_apply, sizes);
+
+error:
+  if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[guided filter] couldn't enqueue kernel! %d\n", err);
+  dt_opencl_release_mem_object(dev_mean);
+  dt_opencl_release_mem_object(dev_cov);
+  dt_opencl_release_mem_object(dev_var1);
+  dt_opencl_release_mem_object(dev_var2);
+  dt_opencl_release_mem_object(dev_tmp);
+  return err;
+}
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
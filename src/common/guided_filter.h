@@ -0,0 +1,72 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/opencl.h"
+
+#include <stddef.h>
+
+/**
+ * guided filter as described in
+ *
+ *   K. He, J. Sun, and X. Tang, "Guided Image Filtering," Lecture Notes in
+ *   Computer Science, pp. 1-14, 2010. DOI: 10.1007/978-3-642-15549-9_1
+ *
+ * filters the single channel image in into out (width x height), using the
+ * first three channels of guide (guide_ch floats per pixel) as the guide.
+ * radius is the one of the box windows, eps the regularization. the image is
+ * processed in overlapping tiles spread over all threads, so the temporary
+ * memory is bounded by dt_guided_filter_memory_use() whatever the image size.
+ * the box filters it is made of are in common/box_filters.h. returns non-zero,
+ * with out untouched, if that memory could not be allocated.
+ */
+int dt_guided_filter(const float *const guide, const int guide_ch, const float *const in, float *const out,
+                     const int width, const int height, const int radius, const float eps);
+
+/** temporary memory of dt_guided_filter(), in bytes */
+size_t dt_guided_filter_memory_use(const int radius);
+
+#ifdef HAVE_OPENCL
+typedef struct dt_guided_filter_cl_global_t
+{
+  int kernel_box_mean_x, kernel_box_mean_y;
+  int kernel_box_min_x, kernel_box_min_y;
+  int kernel_box_max_x, kernel_box_max_y;
+  int kernel_guided_filter_split, kernel_guided_filter_solve, kernel_guided_filter_apply;
+} dt_guided_filter_cl_global_t;
+
+dt_guided_filter_cl_global_t *dt_guided_filter_init_cl_global(void);
+
+void dt_guided_filter_free_cl_global(dt_guided_filter_cl_global_t *g);
+
+/** dev_in and dev_out single channel, dev_guide rgba. needs five rgba buffers of device memory. */
+cl_int dt_guided_filter_cl(const int devid, cl_mem dev_guide, cl_mem dev_in, cl_mem dev_out, const int width,
+                           const int height, const int radius, const float eps);
+
+/** box min and max of the single channel dev_buf, in place. dev_tmp is of the same size. */
+cl_int dt_box_min_cl(const int devid, cl_mem dev_buf, cl_mem dev_tmp, const int width, const int height,
+                     const int radius);
+
+cl_int dt_box_max_cl(const int devid, cl_mem dev_buf, cl_mem dev_tmp, const int width, const int height,
+                     const int radius);
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
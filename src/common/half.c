@@ -0,0 +1,157 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/half.h"
+#include "common/darktable.h"
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+// elements per work item of the parallel loops
+#define DT_HALF_CHUNK 16384
+
+typedef union dt_half_float_bits_t
+{
+  float f;
+  uint32_t i;
+} dt_half_float_bits_t;
+
+static inline uint16_t _float_to_half(const float f)
+{
+  const dt_half_float_bits_t u = { .f = f };
+  const uint32_t sign = (u.i >> 16) & 0x8000;
+  const uint32_t abs = u.i & 0x7fffffff;
+
+  // inf, and nan which stays quiet
+  if(abs >= 0x7f800000) return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 | ((abs >> 13) & 0x3ff) : 0);
+  // rounds to more than 65504
+  if(abs >= 0x477ff000) return sign | 0x7c00;
+
+  if(abs < 0x38800000)
+  {
+    // below 2^-14 half floats are denormal, half of their smallest step and less rounds to zero
+    if(abs <= 0x33000000) return sign;
+    const uint32_t e = abs >> 23;
+    const uint32_t m = (abs & 0x7fffff) | 0x800000;
+    const int shift = 126 - e;
+    const uint32_t rem = m & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    uint32_t h = m >> shift;
+    if(rem > halfway || (rem == halfway && (h & 1))) h++;
+    return sign | h;
+  }
+
+  // rebias the exponent from 127 to 15 and round the mantissa, a carry moves on into the exponent
+  const uint32_t rem = abs & 0x1fff;
+  uint32_t h = (abs - 0x38000000) >> 13;
+  if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+  return sign | h;
+}
+
+static inline float _half_to_float(const uint16_t h)
+{
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t e = (h >> 10) & 0x1f;
+  const uint32_t m = h & 0x3ff;
+  dt_half_float_bits_t u;
+
+  if(e == 0x1f)
+    u.i = sign | 0x7f800000 | (m << 13);
+  else if(e)
+    u.i = sign | ((e + 112) << 23) | (m << 13);
+  else
+  {
+    // denormal, m * 2^-24 is exact in float
+    u.f = m * (1.0f / 16777216.0f);
+    u.i |= sign;
+  }
+  return u.f;
+}
+
+static void _float_to_half_plain(uint16_t *const out, const float *const in, const size_t n)
+{
+  for(size_t k = 0; k < n; k++) out[k] = _float_to_half(in[k]);
+}
+
+static void _half_to_float_plain(float *const out, const uint16_t *const in, const size_t n)
+{
+  for(size_t k = 0; k < n; k++) out[k] = _half_to_float(in[k]);
+}
+
+#if defined(__SSE__)
+// these are only called when the cpu has F16C, see dt_codepaths_init()
+__attribute__((target("f16c"))) static void _float_to_half_f16c(uint16_t *const out, const float *const in,
+                                                                   const size_t n)
+{
+  size_t k = 0;
+  for(; k + 4 <= n; k += 4)
+    _mm_storel_epi64((__m128i *)(out + k), _mm_cvtps_ph(_mm_loadu_ps(in + k), _MM_FROUND_TO_NEAREST_INT));
+  for(; k < n; k++) out[k] = _float_to_half(in[k]);
+}
+
+__attribute__((target("f16c"))) static void _half_to_float_f16c(float *const out, const uint16_t *const in,
+                                                                   const size_t n)
+{
+  size_t k = 0;
+  for(; k + 4 <= n; k += 4) _mm_storeu_ps(out + k, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(in + k))));
+  for(; k < n; k++) out[k] = _half_to_float(in[k]);
+}
+#endif
+
+void dt_float_to_half(uint16_t *const out, const float *const in, const size_t n)
+{
+  const size_t chunks = (n + DT_HALF_CHUNK - 1) / DT_HALF_CHUNK;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(size_t c = 0; c < chunks; c++)
+  {
+    const size_t offs = c * DT_HALF_CHUNK;
+    const size_t len = MIN(DT_HALF_CHUNK, n - offs);
+#if defined(__SSE__)
+    if(darktable.codepath.F16C)
+      _float_to_half_f16c(out + offs, in + offs, len);
+    else
+#endif
+      _float_to_half_plain(out + offs, in + offs, len);
+  }
+}
+
+void dt_half_to_float(float *const out, const uint16_t *const in, const size_t n)
+{
+  const size_t chunks = (n + DT_HALF_CHUNK - 1) / DT_HALF_CHUNK;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(size_t c = 0; c < chunks; c++)
+  {
+    const size_t offs = c * DT_HALF_CHUNK;
+    const size_t len = MIN(DT_HALF_CHUNK, n - offs);
+#if defined(__SSE__)
+    if(darktable.codepath.F16C)
+      _half_to_float_f16c(out + offs, in + offs, len);
+    else
+#endif
+      _half_to_float_plain(out + offs, in + offs, len);
+  }
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,37 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * half floats (ieee 754 binary16) to store buffers that don't need full float precision.
+ * conversion rounds to nearest even, values beyond 65504 become infinite. it uses the F16C
+ * instructions of the cpu if it has them (see darktable.codepath), with the same results.
+ */
+
+/** convert n floats to half floats. */
+void dt_float_to_half(uint16_t *const out, const float *const in, const size_t n);
+/** convert n half floats back to floats, which is exact. */
+void dt_half_to_float(float *const out, const uint16_t *const in, const size_t n);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
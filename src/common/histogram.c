@@ -19,10 +19,11 @@
 #include <stddef.h>
 #include <stdint.h>
 #if defined(__SSE__)
-#include <xmmintrin.h>
+#include <emmintrin.h>
 #endif
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common/darktable.h"
 #include "common/histogram.h"
@@ -46,8 +47,9 @@ inline static void histogram_helper_cs_RAW(const dt_dev_histogram_collection_par
                                            const void *pixel, uint32_t *histogram, int j)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = MAX(histogram_params->step, 1);
   const float *input = (float *)pixel + roi->width * j + roi->crop_x;
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, input++)
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i += step, input += step)
   {
     histogram_helper_cs_RAW_helper_process_pixel_float(histogram_params, input, histogram);
   }
@@ -67,10 +69,11 @@ inline void dt_histogram_helper_cs_RAW_uint16(const dt_dev_histogram_collection_
                                               const void *pixel, uint32_t *histogram, int j)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = MAX(histogram_params->step, 1);
   uint16_t *in = (uint16_t *)pixel + roi->width * j + roi->crop_x;
 
   // process pixels
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in++)
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i += step, in += step)
     histogram_helper_cs_RAW_helper_process_pixel_uint16(histogram_params, in, histogram);
 }
 
@@ -88,28 +91,28 @@ inline static void __attribute__((__unused__)) histogram_helper_cs_rgb_helper_pr
 }
 
 #if defined(__SSE2__)
-inline static void histogram_helper_cs_rgb_helper_process_pixel_m128(
-    const dt_dev_histogram_collection_params_t *const histogram_params, const float *pixel, uint32_t *histogram)
+// the bins of the three channels of 4 pixels at once, constants and codepath decided once per row
+inline static void histogram_helper_cs_rgb_Lab_row_m128(
+    const dt_dev_histogram_collection_params_t *const params, const float *in, const int n, const int step,
+    uint32_t *histogram, const __m128 shift, const __m128 scale)
 {
-  const __m128 scale = _mm_set1_ps(histogram_params->mul);
   const __m128 val_min = _mm_setzero_ps();
-  const __m128 val_max = _mm_set1_ps(histogram_params->bins_count - 1);
-
-  assert(dt_is_aligned(pixel, 16));
-  const __m128 input = _mm_load_ps(pixel);
-  const __m128 scaled = _mm_mul_ps(input, scale);
-  const __m128 clamped = _mm_max_ps(_mm_min_ps(scaled, val_max), val_min);
-
-  const __m128i indexes = _mm_cvtps_epi32(clamped);
-
-  __m128i values __attribute__((aligned(16)));
-  _mm_store_si128(&values, indexes);
+  const __m128 val_max = _mm_set1_ps(params->bins_count - 1);
+  // the bins are interleaved by channel, add the channel to the bin index
+  const __m128i channel = _mm_set_epi32(3, 2, 1, 0);
 
-  const uint32_t *valuesi = (uint32_t *)(&values);
-
-  histogram[4 * valuesi[0]]++;
-  histogram[4 * valuesi[1] + 1]++;
-  histogram[4 * valuesi[2] + 2]++;
+  assert(dt_is_aligned(in, 16));
+  for(int i = 0; i < n; i += step, in += 4 * step)
+  {
+    const __m128 input = _mm_load_ps(in);
+    const __m128 scaled = _mm_mul_ps(_mm_add_ps(input, shift), scale);
+    const __m128 clamped = _mm_max_ps(_mm_min_ps(scaled, val_max), val_min);
+    const __m128i index = _mm_add_epi32(_mm_slli_epi32(_mm_cvtps_epi32(clamped), 2), channel);
+
+    histogram[_mm_cvtsi128_si32(index)]++;
+    histogram[_mm_cvtsi128_si32(_mm_shuffle_epi32(index, _MM_SHUFFLE(1, 1, 1, 1)))]++;
+    histogram[_mm_cvtsi128_si32(_mm_shuffle_epi32(index, _MM_SHUFFLE(2, 2, 2, 2)))]++;
+  }
 }
 #endif
 
@@ -117,20 +120,22 @@ inline static void histogram_helper_cs_rgb(const dt_dev_histogram_collection_par
                                            const void *pixel, uint32_t *histogram, int j)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = MAX(histogram_params->step, 1);
+  const int n = roi->width - roi->crop_width - roi->crop_x;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
+  if(darktable.codepath.OPENMP_SIMD)
   {
-    if(darktable.codepath.OPENMP_SIMD)
+    for(int i = 0; i < n; i += step, in += 4 * step)
       histogram_helper_cs_rgb_helper_process_pixel_float(histogram_params, in, histogram);
+  }
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
-      histogram_helper_cs_rgb_helper_process_pixel_m128(histogram_params, in, histogram);
+  else if(darktable.codepath.SSE2)
+    histogram_helper_cs_rgb_Lab_row_m128(histogram_params, in, n, step, histogram, _mm_setzero_ps(),
+                                         _mm_set1_ps(histogram_params->mul));
 #endif
-    else
-      dt_unreachable_codepath();
-  }
+  else
+    dt_unreachable_codepath();
 }
 
 //------------------------------------------------------------------------------
@@ -150,61 +155,54 @@ inline static void __attribute__((__unused__)) histogram_helper_cs_Lab_helper_pr
   histogram[4 * b + 2]++;
 }
 
-#if defined(__SSE2__)
-inline static void histogram_helper_cs_Lab_helper_process_pixel_m128(
-    const dt_dev_histogram_collection_params_t *const histogram_params, const float *pixel, uint32_t *histogram)
-{
-  const float fscale = histogram_params->mul;
-
-  const __m128 shift = _mm_set_ps(0.0f, 128.0f, 128.0f, 0.0f);
-  const __m128 scale = _mm_set_ps(fscale / 1.0f, fscale / 256.0f, fscale / 256.0f, fscale / 100.0f);
-  const __m128 val_min = _mm_setzero_ps();
-  const __m128 val_max = _mm_set1_ps(histogram_params->bins_count - 1);
-
-  assert(dt_is_aligned(pixel, 16));
-  const __m128 input = _mm_load_ps(pixel);
-  const __m128 shifted = _mm_add_ps(input, shift);
-  const __m128 scaled = _mm_mul_ps(shifted, scale);
-  const __m128 clamped = _mm_max_ps(_mm_min_ps(scaled, val_max), val_min);
-
-  const __m128i indexes = _mm_cvtps_epi32(clamped);
-
-  __m128i values __attribute__((aligned(16)));
-  _mm_store_si128(&values, indexes);
-
-  const uint32_t *valuesi = (uint32_t *)(&values);
-
-  histogram[4 * valuesi[0]]++;
-  histogram[4 * valuesi[1] + 1]++;
-  histogram[4 * valuesi[2] + 2]++;
-}
-#endif
-
 inline static void histogram_helper_cs_Lab(const dt_dev_histogram_collection_params_t *const histogram_params,
                                            const void *pixel, uint32_t *histogram, int j)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
+  const int step = MAX(histogram_params->step, 1);
+  const int n = roi->width - roi->crop_width - roi->crop_x;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
+  if(darktable.codepath.OPENMP_SIMD)
   {
-    if(darktable.codepath.OPENMP_SIMD)
+    for(int i = 0; i < n; i += step, in += 4 * step)
       histogram_helper_cs_Lab_helper_process_pixel_float(histogram_params, in, histogram);
+  }
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
-      histogram_helper_cs_Lab_helper_process_pixel_m128(histogram_params, in, histogram);
-#endif
-    else
-      dt_unreachable_codepath();
+  else if(darktable.codepath.SSE2)
+  {
+    const float fscale = histogram_params->mul;
+    histogram_helper_cs_rgb_Lab_row_m128(
+        histogram_params, in, n, step, histogram, _mm_set_ps(0.0f, 128.0f, 128.0f, 0.0f),
+        _mm_set_ps(fscale / 1.0f, fscale / 256.0f, fscale / 256.0f, fscale / 100.0f));
   }
+#endif
+  else
+    dt_unreachable_codepath();
 }
 
 //==============================================================================
 
-void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_params,
-                         dt_dev_histogram_stats_t *histogram_stats, const void *const pixel,
-                         uint32_t **histogram, const dt_worker Worker)
+// the colour picker statistics of row j of a 4 channel buffer, as dt_color_picker_helper() gathers them
+static inline void histogram_picker_row(const float *const pixel, const int width, const int j, const float w,
+                                        dt_histogram_picker_t *picker)
+{
+  const float *in = pixel + 4 * ((size_t)width * j + picker->box[0]);
+  for(int i = picker->box[0]; i < picker->box[2]; i++, in += 4)
+  {
+    for(int k = 0; k < 3; k++)
+    {
+      picker->mean[k] += w * in[k];
+      picker->min[k] = fminf(picker->min[k], in[k]);
+      picker->max[k] = fmaxf(picker->max[k], in[k]);
+    }
+  }
+}
+
+// returns whether the statistics of the picker were gathered
+static int histogram_worker(dt_dev_histogram_collection_params_t *const histogram_params,
+                            dt_dev_histogram_stats_t *histogram_stats, const void *const pixel,
+                            uint32_t **histogram, const dt_worker Worker, dt_histogram_picker_t *const picker)
 {
   const int nthreads = omp_get_max_threads();
 
@@ -212,17 +210,41 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
   const size_t buf_size = bins_total * sizeof(uint32_t);
   void *partial_hists = calloc(nthreads, buf_size);
 
+  // one cache line of picker statistics per thread
+  dt_histogram_picker_t *partial_picks
+      = picker ? dt_alloc_align(64, nthreads * sizeof(dt_histogram_picker_t)) : NULL;
+  for(int n = 0; partial_picks && n < nthreads; n++)
+  {
+    memcpy(partial_picks[n].box, picker->box, sizeof(picker->box));
+    for(int k = 0; k < 4; k++)
+    {
+      partial_picks[n].mean[k] = 0.0f;
+      partial_picks[n].min[k] = INFINITY;
+      partial_picks[n].max[k] = -INFINITY;
+    }
+  }
+
   if(histogram_params->mul == 0) histogram_params->mul = (double)(histogram_params->bins_count - 1);
 
   const dt_histogram_roi_t *const roi = histogram_params->roi;
+  const int step = MAX(histogram_params->step, 1);
+  const float w = picker ? 1.0f / ((float)(picker->box[3] - picker->box[1]) * (picker->box[2] - picker->box[0]))
+                         : 0.0f;
 
+  // rows of the picker box are visited even when they are not on the grid of the histogram
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(partial_hists)
+#pragma omp parallel for schedule(static) default(none) shared(partial_hists, partial_picks)
 #endif
   for(int j = roi->crop_y; j < roi->height - roi->crop_height; j++)
   {
-    uint32_t *thread_hist = (uint32_t *)partial_hists + bins_total * omp_get_thread_num();
-    Worker(histogram_params, pixel, thread_hist, j);
+    const int tnum = dt_get_thread_num();
+    if((j - roi->crop_y) % step == 0)
+    {
+      uint32_t *thread_hist = (uint32_t *)partial_hists + bins_total * tnum;
+      Worker(histogram_params, pixel, thread_hist, j);
+    }
+    if(partial_picks && j >= picker->box[1] && j < picker->box[3])
+      histogram_picker_row((const float *)pixel, roi->width, j, w, partial_picks + tnum);
   }
 
 #ifdef _OPENMP
@@ -245,35 +267,62 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
 #endif
   free(partial_hists);
 
+  const int picked = partial_picks != NULL;
+  if(partial_picks)
+  {
+    for(int n = 0; n < nthreads; n++)
+      for(int k = 0; k < 3; k++)
+      {
+        picker->mean[k] += partial_picks[n].mean[k];
+        picker->min[k] = fminf(picker->min[k], partial_picks[n].min[k]);
+        picker->max[k] = fmaxf(picker->max[k], partial_picks[n].max[k]);
+      }
+    dt_free_align(partial_picks);
+  }
+
+  const int width = roi->width - roi->crop_width - roi->crop_x;
+  const int height = roi->height - roi->crop_height - roi->crop_y;
   histogram_stats->bins_count = histogram_params->bins_count;
-  histogram_stats->pixels = (roi->width - roi->crop_width - roi->crop_x)
-                            * (roi->height - roi->crop_height - roi->crop_y);
+  histogram_stats->pixels = (uint32_t)((width + step - 1) / step) * ((height + step - 1) / step);
+  return picked;
+}
+
+void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_params,
+                         dt_dev_histogram_stats_t *histogram_stats, const void *const pixel,
+                         uint32_t **histogram, const dt_worker Worker)
+{
+  histogram_worker(histogram_params, histogram_stats, pixel, histogram, Worker, NULL);
 }
 
 //------------------------------------------------------------------------------
 
-void dt_histogram_helper(dt_dev_histogram_collection_params_t *histogram_params,
-                         dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst,
-                         const void *pixel, uint32_t **histogram)
+int dt_histogram_helper(dt_dev_histogram_collection_params_t *histogram_params,
+                        dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst,
+                        const void *pixel, uint32_t **histogram, dt_histogram_picker_t *picker)
 {
+  int picked = 0;
   switch(cst)
   {
     case iop_cs_RAW:
+      // no picker on 1 channel raw buffers
       dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_RAW);
       histogram_stats->ch = 1u;
       break;
 
     case iop_cs_rgb:
-      dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_rgb);
+      picked = histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_rgb,
+                                picker);
       histogram_stats->ch = 3u;
       break;
 
     case iop_cs_Lab:
     default:
-      dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_Lab);
+      picked = histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_Lab,
+                                picker);
       histogram_stats->ch = 3u;
       break;
   }
+  return picked;
 }
 
 void dt_histogram_max_helper(const dt_dev_histogram_stats_t *const histogram_stats,
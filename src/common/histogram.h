@@ -35,6 +35,18 @@ typedef struct dt_histogram_roi_t
   int width, height, crop_x, crop_y, crop_width, crop_height;
 } dt_histogram_roi_t;
 
+/*
+ * colour picker statistics of the 4 channel buffer of a histogram, gathered in the same pass. box is
+ * (x0, y0) .. (x1, y1) of the buffer, exclusive of the end, every pixel in it is picked even if the
+ * histogram is collected on a subsampled grid. mean, min and max of the first three channels are
+ * accumulated into the values given, like dt_color_picker_helper() does.
+ */
+typedef struct dt_histogram_picker_t
+{
+  int box[4];
+  float mean[4], min[4], max[4];
+} dt_histogram_picker_t;
+
 void dt_histogram_helper_cs_RAW_uint16(const dt_dev_histogram_collection_params_t *histogram_params,
                                        const void *pixel, uint32_t *histogram, int j);
 
@@ -45,9 +57,10 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
                          dt_dev_histogram_stats_t *histogram_stats, const void *const pixel,
                          uint32_t **histogram, const dt_worker Worker);
 
-void dt_histogram_helper(dt_dev_histogram_collection_params_t *histogram_params,
-                         dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst,
-                         const void *pixel, uint32_t **histogram);
+// returns whether the picker was filled in, which it isn't for raw buffers or when out of memory
+int dt_histogram_helper(dt_dev_histogram_collection_params_t *histogram_params,
+                        dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst,
+                        const void *pixel, uint32_t **histogram, dt_histogram_picker_t *picker);
 
 void dt_histogram_max_helper(const dt_dev_histogram_stats_t *const histogram_stats,
                              dt_iop_colorspace_type_t cst, uint32_t **histogram, uint32_t *histogram_max);
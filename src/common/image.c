@@ -31,7 +31,9 @@
 #include "control/conf.h"
 #include "control/control.h"
 #include "control/jobs.h"
+#include "develop/develop.h"
 #include "develop/lightroom.h"
+#include "develop/pyramid.h"
 #ifdef USE_LUA
 #include "lua/image.h"
 #endif
@@ -569,6 +571,12 @@ int32_t dt_image_duplicate_with_version(const int32_t imgid, const int32_t newve
   return newid;
 }
 
+// drop the levels of the darkroom's pyramid of an image which is gone, or whose id now stands for another one
+static void _image_pyramid_remove(const int32_t imgid)
+{
+  if(darktable.develop && darktable.develop->pyramid) dt_dev_pyramid_remove(darktable.develop->pyramid, imgid);
+}
+
 void dt_image_remove(const int32_t imgid)
 {
   // if a local copy exists, remove it
@@ -619,6 +627,7 @@ void dt_image_remove(const int32_t imgid)
   sqlite3_finalize(stmt);
   // also clear all thumbnails in mipmap_cache.
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  _image_pyramid_remove(imgid);
 
   dt_tag_update_used_tags();
 }
@@ -974,6 +983,7 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
 
   // make sure that there are no stale thumbnails left
   dt_mipmap_cache_remove(darktable.mipmap_cache, id);
+  _image_pyramid_remove(id);
 
   // read all sidecar files
   dt_image_read_duplicates(id, normalized_filename);
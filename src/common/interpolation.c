@@ -17,12 +17,14 @@
 * ------------------------------------------------------------------------*/
 
 #include "common/interpolation.h"
+#include "common/bufferpool.h"
 #include "common/darktable.h"
 #include "control/conf.h"
 
 #include <assert.h>
 #include <glib.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -1350,20 +1352,193 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
   return 0;
 }
 
+/* --------------------------------------------------------------------------
+ * Resampling plan cache
+ * ------------------------------------------------------------------------*/
+
+/* zooming, panning and thumbnails ask for the same few resamplings over and
+ * over again, so the plans are kept around. they are shared by all threads,
+ * the least recently used ones go when there are too many of them. a plan
+ * in use when it goes is freed by its last user. */
+
+// Number of plans kept at most
+#define RESAMPLING_PLANS 32
+
+// Memory kept in plans at most
+#define RESAMPLING_PLANS_SIZE ((size_t)64 << 20)
+
+// Devices a plan can be kept on
+#define RESAMPLING_PLAN_DEVICES 8
+
+typedef struct resampling_plan_t
+{
+  // what the plan is for, see prepare_resampling_plan()
+  enum dt_interpolation_type id;
+  int in, in_x0, out, out_x0;
+  float scale;
+  int simd; // the taps of the sse codepath differ in the last bits
+
+  // the plan itself, length is the start of the one allocation
+  int *length;
+  float *kernel;
+  int *index;
+  int *meta;
+  int maxtaps; // largest length
+  size_t size;
+
+  int users;       // callers holding the plan
+  gboolean cached; // still in the cache, freed by the last user otherwise
+  uint64_t used;   // for lru
+
+#ifdef HAVE_OPENCL
+  // the plan on the opencl devices, uploaded on first use
+  cl_mem dev_length[RESAMPLING_PLAN_DEVICES];
+  cl_mem dev_kernel[RESAMPLING_PLAN_DEVICES];
+  cl_mem dev_index[RESAMPLING_PLAN_DEVICES];
+  cl_mem dev_meta[RESAMPLING_PLAN_DEVICES];
+#endif
+} resampling_plan_t;
+
+static struct
+{
+  GMutex lock;
+  resampling_plan_t *plan[RESAMPLING_PLANS];
+  size_t size;
+  uint64_t clock;
+} resampling_plans;
+
+static void free_resampling_plan(resampling_plan_t *plan)
+{
+#ifdef HAVE_OPENCL
+  for(int k = 0; k < RESAMPLING_PLAN_DEVICES; k++)
+  {
+    dt_opencl_release_mem_object(plan->dev_length[k]);
+    dt_opencl_release_mem_object(plan->dev_kernel[k]);
+    dt_opencl_release_mem_object(plan->dev_index[k]);
+    dt_opencl_release_mem_object(plan->dev_meta[k]);
+  }
+#endif
+  dt_free_align(plan->length);
+  free(plan);
+}
+
+// drop a plan from the cache, needs the lock
+static void uncache_resampling_plan(const int k)
+{
+  resampling_plan_t *plan = resampling_plans.plan[k];
+  resampling_plans.plan[k] = NULL;
+  resampling_plans.size -= plan->size;
+  plan->cached = FALSE;
+  if(plan->users == 0) free_resampling_plan(plan);
+}
+
+/** Gets the resampling plan of prepare_resampling_plan(), with meta, from the
+ * cache or makes it. The plan must not be changed and has to be given back
+ * with put_resampling_plan().
+ * @return the plan or NULL if out of memory */
+static resampling_plan_t *get_resampling_plan(const struct dt_interpolation *itor, const int in,
+                                              const int in_x0, const int out, const int out_x0,
+                                              const float scale)
+{
+  g_mutex_lock(&resampling_plans.lock);
+  for(int k = 0; k < RESAMPLING_PLANS; k++)
+  {
+    resampling_plan_t *plan = resampling_plans.plan[k];
+    if(plan && plan->id == itor->id && plan->in == in && plan->in_x0 == in_x0 && plan->out == out
+       && plan->out_x0 == out_x0 && plan->scale == scale && plan->simd == darktable.codepath.OPENMP_SIMD)
+    {
+      plan->users++;
+      plan->used = ++resampling_plans.clock;
+      g_mutex_unlock(&resampling_plans.lock);
+      return plan;
+    }
+  }
+  g_mutex_unlock(&resampling_plans.lock);
+
+  // not there, make it without holding up the others. two threads making the same plan at once keep both,
+  // the spare one just ages out
+  resampling_plan_t *plan = (resampling_plan_t *)calloc(1, sizeof(resampling_plan_t));
+  if(!plan) return NULL;
+  if(prepare_resampling_plan(itor, in, in_x0, out, out_x0, scale, &plan->length, &plan->kernel, &plan->index,
+                             &plan->meta)
+     || !plan->length)
+  {
+    free(plan);
+    return NULL;
+  }
+  plan->id = itor->id;
+  plan->in = in;
+  plan->in_x0 = in_x0;
+  plan->out = out;
+  plan->out_x0 = out_x0;
+  plan->scale = scale;
+  plan->simd = darktable.codepath.OPENMP_SIMD;
+  plan->size = (char *)(plan->meta + 3 * out) - (char *)plan->length;
+  for(int k = 0; k < out; k++) plan->maxtaps = MAX(plan->maxtaps, plan->length[k]);
+  plan->users = 1;
+
+  // a plan as big as that isn't worth keeping
+  plan->cached = plan->size <= RESAMPLING_PLANS_SIZE;
+  if(!plan->cached) return plan;
+
+  g_mutex_lock(&resampling_plans.lock);
+  plan->used = ++resampling_plans.clock;
+  // make room: a free slot, or the one used longest ago, then more until the plans fit
+  int slot = -1;
+  for(int k = 0; k < RESAMPLING_PLANS; k++)
+  {
+    const resampling_plan_t *const other = resampling_plans.plan[k];
+    if(!other)
+    {
+      slot = k;
+      break;
+    }
+    if(slot < 0 || other->used < resampling_plans.plan[slot]->used) slot = k;
+  }
+  if(resampling_plans.plan[slot]) uncache_resampling_plan(slot);
+  while(resampling_plans.size + plan->size > RESAMPLING_PLANS_SIZE)
+  {
+    int oldest = -1;
+    for(int k = 0; k < RESAMPLING_PLANS; k++)
+    {
+      const resampling_plan_t *const other = resampling_plans.plan[k];
+      if(other && (oldest < 0 || other->used < resampling_plans.plan[oldest]->used)) oldest = k;
+    }
+    if(oldest < 0) break;
+    uncache_resampling_plan(oldest);
+  }
+  resampling_plans.plan[slot] = plan;
+  resampling_plans.size += plan->size;
+  g_mutex_unlock(&resampling_plans.lock);
+
+  return plan;
+}
+
+static void put_resampling_plan(resampling_plan_t *plan)
+{
+  if(!plan) return;
+  g_mutex_lock(&resampling_plans.lock);
+  plan->users--;
+  const gboolean gone = !plan->cached && plan->users == 0;
+  g_mutex_unlock(&resampling_plans.lock);
+  if(gone) free_resampling_plan(plan);
+}
+
+void dt_interpolation_cleanup(void)
+{
+  g_mutex_lock(&resampling_plans.lock);
+  for(int k = 0; k < RESAMPLING_PLANS; k++)
+    if(resampling_plans.plan[k]) uncache_resampling_plan(k);
+  g_mutex_unlock(&resampling_plans.lock);
+}
+
 static void dt_interpolation_resample_plain(const struct dt_interpolation *itor, float *out,
                                             const dt_iop_roi_t *const roi_out, const int32_t out_stride,
                                             const float *const in, const dt_iop_roi_t *const roi_in,
                                             const int32_t in_stride)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
-
-  int r;
+  resampling_plan_t *hplan = NULL;
+  resampling_plan_t *vplan = NULL;
 
   debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
              roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
@@ -1399,20 +1574,21 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  // Get the resampling plans once and for all
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan)
   {
     goto exit;
   }
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
-  {
-    goto exit;
-  }
+  const int *const hindex = hplan->index;
+  const int *const hlength = hplan->length;
+  const float *const hkernel = hplan->kernel;
+  const int *const vindex = vplan->index;
+  const int *const vlength = vplan->length;
+  const float *const vkernel = vplan->kernel;
+  const int *const vmeta = vplan->meta;
 
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
@@ -1424,7 +1600,7 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
 
 // Process each output line
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+#pragma omp parallel for default(none) shared(out)
 #endif
   for(int oy = 0; oy < roi_out->height; oy++)
   {
@@ -1500,11 +1676,8 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  put_resampling_plan(hplan);
+  put_resampling_plan(vplan);
 }
 
 #if defined(__SSE2__)
@@ -1513,16 +1686,6 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
                                           const float *const in, const dt_iop_roi_t *const roi_in,
                                           const int32_t in_stride)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
-
-  int r;
-
   debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
              roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
              roi_out->x, roi_out->y, roi_out->scale);
@@ -1557,17 +1720,66 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  float *tmp = NULL;
+  int *bandrows = NULL;
+
+  // Get the resampling plans once and for all
+  resampling_plan_t *hplan
+      = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  resampling_plan_t *vplan
+      = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan)
   {
     goto exit;
   }
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+  const int *const hindex = hplan->index;
+  const int *const hlength = hplan->length;
+  const float *const hkernel = hplan->kernel;
+  const int *const vindex = vplan->index;
+  const int *const vlength = vplan->length;
+  const float *const vkernel = vplan->kernel;
+  const int *const vmeta = vplan->meta;
+
+  /* The filter is separable: the output lines are processed in bands, and
+   * the input lines a band needs are resampled horizontally once into a
+   * scratch buffer of the thread, which is then resampled vertically into
+   * the output. The sums are the same as doing both at once for every output
+   * pixel, in the same order, but the horizontal pass isn't repeated for
+   * every output line an input line contributes to. */
+  const int nthreads = dt_get_num_threads();
+  const int width = roi_out->width;
+  const int band = CLAMP(roi_out->height / (2 * nthreads), 4, 32);
+  const int nbands = (roi_out->height + band - 1) / band;
+
+  // First and last input line of every band
+  bandrows = (int *)malloc(sizeof(int) * 2 * nbands);
+  if(!bandrows)
+  {
+    goto exit;
+  }
+  int maxrows = 0;
+  for(int b = 0; b < nbands; b++)
+  {
+    int first = INT_MAX, last = -1;
+    for(int oy = b * band; oy < MIN((b + 1) * band, roi_out->height); oy++)
+    {
+      const int vl = vlength[vmeta[3 * oy + 0]];
+      const int viidx = vmeta[3 * oy + 2];
+      for(int iy = 0; iy < vl; iy++)
+      {
+        first = MIN(first, vindex[viidx + iy]);
+        last = MAX(last, vindex[viidx + iy]);
+      }
+    }
+    bandrows[2 * b] = first;
+    bandrows[2 * b + 1] = last;
+    maxrows = MAX(maxrows, last - first + 1);
+  }
+
+  const size_t tmp_size = (size_t)maxrows * width * 4;
+  tmp = dt_bufferpool_alloc(darktable.bufferpool, sizeof(float) * tmp_size * nthreads);
+  if(!tmp)
   {
     goto exit;
   }
@@ -1580,43 +1792,31 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   int64_t ts_resampling = getts();
 #endif
 
-// Process each output line
+// Process each band of output lines
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+#pragma omp parallel for default(none) shared(out, bandrows, tmp) schedule(dynamic)
 #endif
-  for(int oy = 0; oy < roi_out->height; oy++)
+  for(int b = 0; b < nbands; b++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
+    float *const lines = tmp + tmp_size * dt_get_thread_num();
+    const int first = bandrows[2 * b];
+    const int last = bandrows[2 * b + 1];
 
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
+    // Horizontal pass over the input lines of the band
+    for(int iy = first; iy <= last; iy++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
+      // This is our input line
+      const float *i = (float *)((char *)in + (size_t)in_stride * iy);
+      float *const l = lines + (size_t)4 * width * (iy - first);
 
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
+      int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
+      int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
+      for(int ox = 0; ox < width; ox++)
       {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
+        // Number of horizontal samples contributing to the output
+        const int hl = hlength[ox]; // H(orizontal) L(ength)
 
         __m128 vhs = _mm_setzero_ps();
-
         for(int ix = 0; ix < hl; ix++)
         {
           // Apply the precomputed filter kernel
@@ -1625,48 +1825,47 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
           __m128 vhtap = _mm_set_ps1(htap);
           vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
         }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
+        _mm_store_ps(l + 4 * ox, vhs);
       }
+    }
 
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      _mm_stream_ps(o, vs);
+    // Vertical pass into the output lines of the band
+    for(int oy = b * band; oy < MIN((b + 1) * band, roi_out->height); oy++)
+    {
+      debug_extra("output %p line % 4d\n", out, oy);
 
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
+      // Initialize column resampling indexes
+      const int vl = vlength[vmeta[3 * oy + 0]]; // V(ertical) L(ength)
+      const int vkidx = vmeta[3 * oy + 1];       // V(ertical) K(ernel) I(n)d(e)x
+      const int viidx = vmeta[3 * oy + 2];       // V(ertical) I(ndex) I(n)d(e)x
 
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
-    }
+      float *const o = (float *)((char *)out + (size_t)oy * out_stride);
+      for(int ox = 0; ox < width; ox++) _mm_store_ps(o + 4 * ox, _mm_setzero_ps());
 
-    // Progress in vertical context
-//     viidx += vl;
-//     vkidx += vl;
+      // Accumulate contribution from each line
+      for(int iy = 0; iy < vl; iy++)
+      {
+        const float *const l = lines + (size_t)4 * width * (vindex[viidx + iy] - first);
+        const __m128 vvtap = _mm_set_ps1(vkernel[vkidx + iy]);
+        for(int ox = 0; ox < width; ox++)
+        {
+          const __m128 vs = _mm_load_ps(o + 4 * ox);
+          _mm_store_ps(o + 4 * ox, _mm_add_ps(vs, _mm_mul_ps(_mm_load_ps(l + 4 * ox), vvtap)));
+        }
+      }
+    }
   }
 
-  _mm_sfence();
-
 #if DEBUG_RESAMPLING_TIMING
   ts_resampling = getts() - ts_resampling;
   fprintf(stderr, "resampling %p plan:%" PRId64 "us resampling:%" PRId64 "us\n", in, ts_plan, ts_resampling);
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  dt_bufferpool_free(darktable.bufferpool, tmp);
+  free(bandrows);
+  put_resampling_plan(hplan);
+  put_resampling_plan(vplan);
 }
 #endif
 
@@ -1740,20 +1939,75 @@ static uint32_t roundToNextPowerOfTwo(uint32_t x)
 /** Applies resampling (re-scaling) on *full* input and output buffers.
  *  roi_in and roi_out define the part of the buffers that is affected.
  */
+// releases the buffers of upload_resampling_plan(), unless they are kept on the device
+static void release_resampling_plan_cl(const int resident, cl_mem length, cl_mem kernel, cl_mem index,
+                                       cl_mem meta)
+{
+  if(resident > 0) return;
+  dt_opencl_release_mem_object(length);
+  dt_opencl_release_mem_object(kernel);
+  dt_opencl_release_mem_object(index);
+  dt_opencl_release_mem_object(meta);
+}
+
+/** Gets a resampling plan into the memory of device devid. Plans are kept
+ * there for the next time, except on devices beyond RESAMPLING_PLAN_DEVICES.
+ * @return 1 if the plan is kept on the device, 0 if the buffers are the
+ * caller's to release, -1 on failure */
+static int upload_resampling_plan(resampling_plan_t *plan, const int devid, cl_mem *length, cl_mem *kernel,
+                                  cl_mem *index, cl_mem *meta)
+{
+  const int keep = devid >= 0 && devid < RESAMPLING_PLAN_DEVICES;
+  if(keep)
+  {
+    g_mutex_lock(&resampling_plans.lock);
+    *length = plan->dev_length[devid];
+    *kernel = plan->dev_kernel[devid];
+    *index = plan->dev_index[devid];
+    *meta = plan->dev_meta[devid];
+    g_mutex_unlock(&resampling_plans.lock);
+    if(*length) return 1;
+  }
+
+  // index, kernel: maxtaps might be too small, so store a bit more than needed
+  const int out = plan->out;
+  *length = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * out, plan->length);
+  *kernel
+      = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * out * (plan->maxtaps + 1), plan->kernel);
+  *index = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * out * (plan->maxtaps + 1), plan->index);
+  *meta = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * out * 3, plan->meta);
+  if(!*length || !*kernel || !*index || !*meta)
+  {
+    release_resampling_plan_cl(0, *length, *kernel, *index, *meta);
+    *length = *kernel = *index = *meta = NULL;
+    return -1;
+  }
+  if(!keep) return 0;
+
+  g_mutex_lock(&resampling_plans.lock);
+  if(plan->dev_length[devid])
+  {
+    // another thread was faster
+    g_mutex_unlock(&resampling_plans.lock);
+    release_resampling_plan_cl(0, *length, *kernel, *index, *meta);
+    return upload_resampling_plan(plan, devid, length, kernel, index, meta);
+  }
+  plan->dev_length[devid] = *length;
+  plan->dev_kernel[devid] = *kernel;
+  plan->dev_index[devid] = *index;
+  plan->dev_meta[devid] = *meta;
+  g_mutex_unlock(&resampling_plans.lock);
+  return 1;
+}
+
 int dt_interpolation_resample_cl(const struct dt_interpolation *itor, int devid, cl_mem dev_out,
                                  const dt_iop_roi_t *const roi_out, cl_mem dev_in,
                                  const dt_iop_roi_t *const roi_in)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *hmeta = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
-
-  int r;
+  resampling_plan_t *hplan = NULL;
+  resampling_plan_t *vplan = NULL;
+  int hresident = 0, vresident = 0;
+
   cl_int err = -999;
 
   cl_mem dev_hindex = NULL;
@@ -1796,24 +2050,15 @@ int dt_interpolation_resample_cl(const struct dt_interpolation *itor, int devid,
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, &hmeta);
-  if(r)
-  {
-    goto error;
-  }
-
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+  // Get the resampling plans once and for all
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan)
   {
     goto error;
   }
 
-  int hmaxtaps = -1, vmaxtaps = -1;
-  for(int k = 0; k < roi_out->width; k++) hmaxtaps = MAX(hmaxtaps, hlength[k]);
-  for(int k = 0; k < roi_out->height; k++) vmaxtaps = MAX(vmaxtaps, vlength[k]);
+  const int hmaxtaps = hplan->maxtaps, vmaxtaps = vplan->maxtaps;
 
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
@@ -1860,33 +2105,11 @@ int dt_interpolation_resample_cl(const struct dt_interpolation *itor, int devid,
   size_t sizes[3] = { ROUNDUPWD(width), ROUNDUP(height * taps, vblocksize), 1 };
   size_t local[3] = { 1, vblocksize, 1 };
 
-  // store resampling plan to device memory
-  // hindex, vindex, hkernel, vkernel: (v|h)maxtaps might be too small, so store a bit more than needed
-  dev_hindex = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * width * (hmaxtaps + 1), hindex);
-  if(dev_hindex == NULL) goto error;
-
-  dev_hlength = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * width, hlength);
-  if(dev_hlength == NULL) goto error;
-
-  dev_hkernel
-      = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * width * (hmaxtaps + 1), hkernel);
-  if(dev_hkernel == NULL) goto error;
-
-  dev_hmeta = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * width * 3, hmeta);
-  if(dev_hmeta == NULL) goto error;
-
-  dev_vindex = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * height * (vmaxtaps + 1), vindex);
-  if(dev_vindex == NULL) goto error;
-
-  dev_vlength = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * height, vlength);
-  if(dev_vlength == NULL) goto error;
-
-  dev_vkernel
-      = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * height * (vmaxtaps + 1), vkernel);
-  if(dev_vkernel == NULL) goto error;
-
-  dev_vmeta = dt_opencl_copy_host_to_device_constant(devid, sizeof(int) * height * 3, vmeta);
-  if(dev_vmeta == NULL) goto error;
+  // get the resampling plans into device memory, if they aren't there from last time
+  hresident = upload_resampling_plan(hplan, devid, &dev_hlength, &dev_hkernel, &dev_hindex, &dev_hmeta);
+  if(hresident < 0) goto error;
+  vresident = upload_resampling_plan(vplan, devid, &dev_vlength, &dev_vkernel, &dev_vindex, &dev_vmeta);
+  if(vresident < 0) goto error;
 
   dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&dev_in);
   dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_out);
@@ -1914,29 +2137,17 @@ int dt_interpolation_resample_cl(const struct dt_interpolation *itor, int devid,
           ts_resampling);
 #endif
 
-  dt_opencl_release_mem_object(dev_hindex);
-  dt_opencl_release_mem_object(dev_hlength);
-  dt_opencl_release_mem_object(dev_hkernel);
-  dt_opencl_release_mem_object(dev_hmeta);
-  dt_opencl_release_mem_object(dev_vindex);
-  dt_opencl_release_mem_object(dev_vlength);
-  dt_opencl_release_mem_object(dev_vkernel);
-  dt_opencl_release_mem_object(dev_vmeta);
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  release_resampling_plan_cl(hresident, dev_hlength, dev_hkernel, dev_hindex, dev_hmeta);
+  release_resampling_plan_cl(vresident, dev_vlength, dev_vkernel, dev_vindex, dev_vmeta);
+  put_resampling_plan(hplan);
+  put_resampling_plan(vplan);
   return CL_SUCCESS;
 
 error:
-  dt_opencl_release_mem_object(dev_hindex);
-  dt_opencl_release_mem_object(dev_hlength);
-  dt_opencl_release_mem_object(dev_hkernel);
-  dt_opencl_release_mem_object(dev_hmeta);
-  dt_opencl_release_mem_object(dev_vindex);
-  dt_opencl_release_mem_object(dev_vlength);
-  dt_opencl_release_mem_object(dev_vkernel);
-  dt_opencl_release_mem_object(dev_vmeta);
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  release_resampling_plan_cl(hresident, dev_hlength, dev_hkernel, dev_hindex, dev_hmeta);
+  release_resampling_plan_cl(vresident, dev_vlength, dev_vkernel, dev_vindex, dev_vmeta);
+  put_resampling_plan(hplan);
+  put_resampling_plan(vplan);
   dt_print(DT_DEBUG_OPENCL, "[opencl_resampling] couldn't enqueue kernel! %d\n", err);
   return err;
 }
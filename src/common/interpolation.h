@@ -111,6 +111,10 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor, const
  */
 const struct dt_interpolation *dt_interpolation_new(enum dt_interpolation_type type);
 
+/** Frees the resampling plans kept for reuse by dt_interpolation_resample() and friends, also the ones kept
+ * on opencl devices. */
+void dt_interpolation_cleanup(void);
+
 /** Image resampler.
  *
  * Resamples the image "in" to "out" according to roi values. Here is the
@@ -16,6 +16,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "common/bufferpool.h"
 #include "common/darktable.h"
 #include "common/locallaplacian.h"
 
@@ -37,48 +38,134 @@ static inline int dl(int size, const int level)
   return size;
 }
 
-// needs a boundary of 1 or 2px around i,j or else it will crash.
-// (translates to a 1px boundary around the corresponding pixel in the coarse buffer)
-// more precisely, 1<=i<wd-1 for even wd and
-//                 1<=i<wd-2 for odd wd (j likewise with ht)
-static inline float ll_expand_gaussian(
+// weights of the separable 5-tap kernel of gauss_reduce. the sse2 code path has always
+// used the binomial 1 4 6 4 1 kernel and the plain one burt and adelson's with a = 0.4,
+// both are kept so results don't depend on this rewrite.
+static const float ll_w_binomial[5] = { 1.0f/16.0f, 4.0f/16.0f, 6.0f/16.0f, 4.0f/16.0f, 1.0f/16.0f };
+static const float ll_w_plain[5] = { 0.05f, 0.25f, 0.4f, 0.25f, 0.05f };
+
+// coarse rows per work item of the streaming reduce
+#define LL_REDUCE_BLOCK 16
+
+// floats of per-thread scratch memory needed for a level of width wd
+static inline size_t ll_scratch_size(const int wd)
+{
+  return 4*(size_t)wd + 256;
+}
+
+static inline size_t ll_row_stride(const int wd)
+{
+  return ((size_t)wd + 15) & ~(size_t)15;
+}
+
+// the remapped input for one gamma, as fed into its laplacian pyramid.
+// the finest level of that pyramid is never stored, rows of it are
+// computed when needed.
+typedef struct ll_curve_t
+{
+  const float *padded;  // padded input
+  int padding;          // the padding is a copy of the outermost remapped pixels
+  float g, sigma, shadows, highlights, clarity;
+}
+ll_curve_t;
+
+static inline float curve_scalar(
+    const float x,
+    const float g,
+    const float sigma,
+    const float shadows,
+    const float highlights,
+    const float clarity)
+{
+  const float c = x-g;
+  float val;
+  // blend in via quadratic bezier
+  if     (c >  2*sigma) val = g + sigma + shadows    * (c-sigma);
+  else if(c < -2*sigma) val = g - sigma + highlights * (c+sigma);
+  else if(c > 0.0f)
+  { // shadow contrast
+    const float t = CLAMPS(c / (2.0f*sigma), 0.0f, 1.0f);
+    const float t2 = t * t;
+    const float mt = 1.0f-t;
+    val = g + sigma * 2.0f*mt*t + t2*(sigma + sigma*shadows);
+  }
+  else
+  { // highlight contrast
+    const float t = CLAMPS(-c / (2.0f*sigma), 0.0f, 1.0f);
+    const float t2 = t * t;
+    const float mt = 1.0f-t;
+    val = g - sigma * 2.0f*mt*t + t2*(- sigma - sigma*highlights);
+  }
+  // midtone local contrast
+  val += clarity * c * dt_fast_expf(-c*c/(2.0*sigma*sigma/3.0f));
+  return val;
+}
+
+// horizontal pass of gauss_reduce: blur one fine row and decimate
+static inline void ll_reduce_row(
+    const float *const in,
+    float *const out,
+    const int cw,
+    const float *const w)
+{
+  for(int i=1;i<cw-1;i++)
+    out[i] = w[0]*in[2*i-2] + w[1]*in[2*i-1] + w[2]*in[2*i] + w[3]*in[2*i+1] + w[4]*in[2*i+2];
+}
+
+// vertical pass of gauss_reduce: blur five horizontally reduced rows into one coarse row
+static inline void ll_reduce_col(
+    float *const out,
+    const float *const r0,
+    const float *const r1,
+    const float *const r2,
+    const float *const r3,
+    const float *const r4,
+    const int cw,
+    const float *const w)
+{
+  for(int i=1;i<cw-1;i++)
+    out[i] = w[0]*r0[i] + w[1]*r1[i] + w[2]*r2[i] + w[3]*r3[i] + w[4]*r4[i];
+}
+
+// one row of the upsampled coarse buffer, at fine row j, for all 0 <= i < wd.
+// the stencil is separable into (1 6 1)/8 at even and (1 1)/2 at odd positions:
+//
+//  case 0:     case 1:     case 2:     case 3:
+//   x . x . x   x . x . x   x . x . x   x . x . x
+//   . . . . .   . . . . .   . .[.]. .   .[.]. . .
+//   x .[x]. x   x[.]x . x   x . x . x   x . x . x
+//   . . . . .   . . . . .   . . . . .   . . . . .
+//   x . x . x   x . x . x   x . x . x   x . x . x
+//
+// the coordinates are clamped to the range where the stencil fits into the coarse
+// buffer. that gives the same border as expanding the interior of the whole buffer and
+// then copying the nearest expanded pixels into the one or two pixel wide boundary.
+// tmp needs room for the coarse width.
+static inline void ll_expand_row(
     const float *const coarse,
-    const int i,
+    float *const out,
+    float *const tmp,
     const int j,
     const int wd,
     const int ht)
 {
-  assert(i > 0);
-  assert(i < wd-1);
-  assert(j > 0);
-  assert(j < ht-1);
-  assert(j/2 + 1 < (ht-1)/2+1);
-  assert(i/2 + 1 < (wd-1)/2+1);
   const int cw = (wd-1)/2+1;
-  const int ind = (j/2)*cw+i/2;
-  // case 0:     case 1:     case 2:     case 3:
-  //  x . x . x   x . x . x   x . x . x   x . x . x
-  //  . . . . .   . . . . .   . .[.]. .   .[.]. . .
-  //  x .[x]. x   x[.]x . x   x . x . x   x . x . x
-  //  . . . . .   . . . . .   . . . . .   . . . . .
-  //  x . x . x   x . x . x   x . x . x   x . x . x
-  switch((i&1) + 2*(j&1))
+  const int jj = CLAMPS(j, 1, ((ht-1)&~1)-1);
+  const float *const c = coarse + (size_t)(jj/2)*cw;
+  // vertical pass
+  if(jj & 1)
+    for(int i=0;i<cw;i++) tmp[i] = 0.5f*(c[i] + c[i+cw]);
+  else
+    for(int i=0;i<cw;i++) tmp[i] = 0.125f*(c[i-cw] + 6.0f*c[i] + c[i+cw]);
+  // horizontal pass, writes out[1 .. last]
+  const int last = ((wd-1)&~1)-1;
+  for(int i=1;2*i-1<=last;i++)
   {
-    case 0: // both are even, 3x3 stencil
-      return 4./256. * (
-          6.0f*(coarse[ind-cw] + coarse[ind-1] + 6.0f*coarse[ind] + coarse[ind+1] + coarse[ind+cw])
-          + coarse[ind-cw-1] + coarse[ind-cw+1] + coarse[ind+cw-1] + coarse[ind+cw+1]);
-    case 1: // i is odd, 2x3 stencil
-      return 4./256. * (
-          24.0*(coarse[ind] + coarse[ind+1]) +
-          4.0*(coarse[ind-cw] + coarse[ind-cw+1] + coarse[ind+cw] + coarse[ind+cw+1]));
-    case 2: // j is odd, 3x2 stencil
-      return 4./256. * (
-          24.0*(coarse[ind] + coarse[ind+cw]) +
-          4.0*(coarse[ind-1] + coarse[ind+1] + coarse[ind+cw-1] + coarse[ind+cw+1]));
-    default: // case 3: // both are odd, 2x2 stencil
-      return .25f * (coarse[ind] + coarse[ind+1] + coarse[ind+cw] + coarse[ind+cw+1]);
+    out[2*i-1] = 0.5f*(tmp[i-1] + tmp[i]);
+    if(2*i <= last) out[2*i] = 0.125f*(tmp[i-1] + 6.0f*tmp[i] + tmp[i+1]);
   }
+  out[0] = out[1];
+  for(int i=last+1;i<wd;i++) out[i] = out[last];
 }
 
 // helper to fill in one pixel boundary by copying it
@@ -93,143 +180,170 @@ static inline void ll_fill_boundary1(
   memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
 }
 
-// helper to fill in two pixels boundary by copying it
-static inline void ll_fill_boundary2(
-    float *const input,
+// row j of the remapped padded input, the way the full buffer used to be
+// written: the padding replicates the outermost remapped pixels.
+static inline void ll_curve_row(
+    const ll_curve_t *const c,
+    const int j,
     const int wd,
-    const int ht)
+    const int ht,
+    float *const out)
 {
-  for(int j=1;j<ht-1;j++) input[j*wd] = input[j*wd+1];
-  if(wd & 1) for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2];
-  else       for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2] = input[j*wd+wd-3];
-  memcpy(input, input+wd, sizeof(float)*wd);
-  if(!(ht & 1)) memcpy(input+wd*(ht-2), input+wd*(ht-3), sizeof(float)*wd);
-  memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
+  const int p = c->padding;
+  const float *const in = c->padded + (size_t)CLAMPS(j, p, ht-p-1)*wd;
+  for(int i=p;i<wd-p;i++)
+    out[i] = curve_scalar(in[i], c->g, c->sigma, c->shadows, c->highlights, c->clarity);
+  for(int i=0;i<p;i++)     out[i] = out[p];
+  for(int i=wd-p;i<wd;i++) out[i] = out[wd-p-1];
 }
 
-static inline void gauss_expand(
-    const float *const input, // coarse input
-    float *const fine,        // upsampled, blurry output
+// blur with the separable 5-tap kernel w and decimate. the fine rows are streamed
+// through a ring buffer of five horizontally reduced rows per thread. if curve is
+// given the input is the remapped padded buffer, which is never stored.
+static void ll_reduce(
+    const float *const input, // fine input buffer, unused if curve is given
+    float *const coarse,      // coarse scale, blurred input buf
     const int wd,             // fine res
-    const int ht)
+    const int ht,
+    const float *const w,
+    const ll_curve_t *const curve)
 {
+  const int cw = (wd-1)/2+1, ch = (ht-1)/2+1;
+  const size_t stride = ll_row_stride(cw), scratch = ll_scratch_size(wd);
+  float *const ws = dt_bufferpool_alloc(darktable.bufferpool, sizeof(float) * scratch * dt_get_num_threads());
+  const int num_blocks = (ch - 2 + LL_REDUCE_BLOCK - 1) / LL_REDUCE_BLOCK;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2)
+#pragma omp parallel for schedule(dynamic)
 #endif
-  for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
-    for(int i=1;i<((wd-1)&~1);i++)
-      fine[j*wd+i] = ll_expand_gaussian(input, i, j, wd, ht);
-  ll_fill_boundary2(fine, wd, ht);
+  for(int blk=0;blk<num_blocks;blk++)
+  {
+    float *const ringbuf = ws + scratch * dt_get_thread_num();
+    float *const fine = ringbuf + 5*stride;
+    const int j0 = 1 + blk*LL_REDUCE_BLOCK, j1 = MIN(j0 + LL_REDUCE_BLOCK, ch-1);
+    int rowj = 2*j0-2; // we initialised rows up to here so far
+    for(int j=j0;j<j1;j++)
+    {
+      // horizontal pass, reusing the rows shared with the previous coarse row
+      for(;rowj<=2*j+2;rowj++)
+      {
+        const float *in = input + (size_t)rowj*wd;
+        if(curve)
+        {
+          ll_curve_row(curve, rowj, wd, ht, fine);
+          in = fine;
+        }
+        ll_reduce_row(in, ringbuf + (rowj % 5)*stride, cw, w);
+      }
+      // vertical pass
+      ll_reduce_col(coarse + (size_t)j*cw,
+          ringbuf + ((2*j-2) % 5)*stride, ringbuf + ((2*j-1) % 5)*stride, ringbuf + ((2*j) % 5)*stride,
+          ringbuf + ((2*j+1) % 5)*stride, ringbuf + ((2*j+2) % 5)*stride, cw, w);
+    }
+  }
+  dt_bufferpool_free(darktable.bufferpool, ws);
+  ll_fill_boundary1(coarse, cw, ch);
 }
 
-#if defined(__SSE2__)
-static inline void gauss_reduce_sse2(
-    const float *const input, // fine input buffer
-    float *const coarse,      // coarse scale, blurred input buf
-    const int wd,             // fine res
-    const int ht)
+// fine += expanded coarse. this is how the output pyramid is assembled.
+static void ll_add_expanded(
+    float *const fine,
+    const float *const coarse,
+    const int wd,
+    const int ht,
+    float *const ws)
 {
-  // blur, store only coarse res
-  const int cw = (wd-1)/2+1, ch = (ht-1)/2+1;
-
-  // this version is inspired by opencv's pyrDown_ :
-  // - allocate 5 rows of ring buffer (aligned)
-  // - for coarse res y
-  //   - fill 5 coarse-res row buffers with 1 4 6 4 1 weights (reuse some from last time)
-  //   - do vertical convolution via sse and write to coarse output buf
-
-  const int stride = ((cw+8)&~7); // assure sse alignment of rows
-  float *ringbuf = dt_alloc_align(16, sizeof(*ringbuf)*stride*5);
-  float *rows[5] = {0};
-  int rowj = 0; // we initialised this many rows so far
-
-  for(int j=1;j<ch-1;j++)
-  {
-    // horizontal pass, convolve with 1 4 6 4 1 kernel and decimate
-    for(;rowj<=2*j+2;rowj++)
-    {
-      float *const row = ringbuf + (rowj % 5)*stride;
-      const float *const in = input + rowj*wd;
+  const size_t scratch = ll_scratch_size(wd);
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none)
+#pragma omp parallel for schedule(static)
 #endif
-      for(int i=1;i<cw-1;i++)
-        row[i] = 6*in[2*i] + 4*(in[2*i-1]+in[2*i+1]) + in[2*i-2] + in[2*i+2];
-    }
+  for(int j=0;j<ht;j++)
+  {
+    float *const row = ws + scratch * dt_get_thread_num();
+    float *const tmp = row + ll_row_stride(wd);
+    ll_expand_row(coarse, row, tmp, j, wd, ht);
+    float *const out = fine + (size_t)j*wd;
+    for(int i=0;i<wd;i++) out[i] += row[i];
+  }
+}
 
-    // init row pointers
-    for(int k=0;k<5;k++)
-      rows[k] = ringbuf + ((2*j-2+k)%5)*stride;
-
-    // vertical pass, convolve and decimate using SIMD:
-    // note that we're ignoring the (1..cw-1) buffer limit, we'll pull in
-    // garbage and fix it later by border filling.
-    float *const out = coarse + j*cw;
-    const float *const row0 = rows[0], *const row1 = rows[1],
-                *const row2 = rows[2], *const row3 = rows[3], *const row4 = rows[4];
-    const __m128 four = _mm_set1_ps(4.f), scale = _mm_set1_ps(1.f/256.f);
+// add the laplacian of the pyramid of gamma[k] at this level to the output, weighted
+// by how close the (padded, blurry) input is to gamma[k]. every pixel gets contributions
+// of exactly the two gammas around its value, summed over all k this is the
+// interpolation between the two laplacians of the original algorithm.
+static void ll_add_laplacian(
+    float *const output,          // output coefficients at this level
+    const float *const padded,    // gaussian pyramid of the padded input at this level
+    const float *const fine,      // gaussian of the remapped input at this level, NULL for
+    const ll_curve_t *const curve,// the finest level, which is remapped on the fly
+    const float *const coarse,    // gaussian of the remapped input one level up
+    const int wd,
+    const int ht,
+    const float *const gamma,
+    const int num_gamma,
+    const int k,
+    float *const ws)
+{
+  const size_t scratch = ll_scratch_size(wd);
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none)
+#pragma omp parallel for schedule(static)
 #endif
-    for(int i=0;i<=cw-8;i+=8)
+  for(int j=0;j<ht;j++)
+  {
+    float *const blur = ws + scratch * dt_get_thread_num();
+    float *const tmp = blur + ll_row_stride(wd);
+    ll_expand_row(coarse, blur, tmp, j, wd, ht);
+    const float *const v = padded + (size_t)j*wd;
+    const float *const f = fine ? fine + (size_t)j*wd : NULL;
+    // finest level: remap only where this gamma contributes, the padding
+    // replicates the outermost remapped pixels
+    const float *const c = curve ? curve->padded + (size_t)CLAMPS(j, curve->padding, ht-curve->padding-1)*wd : NULL;
+    float *const out = output + (size_t)j*wd;
+    for(int i=0;i<wd;i++)
     {
-      __m128 r0, r1, r2, r3, r4, t0, t1;
-      r0 = _mm_load_ps(row0 + i);
-      r1 = _mm_load_ps(row1 + i);
-      r2 = _mm_load_ps(row2 + i);
-      r3 = _mm_load_ps(row3 + i);
-      r4 = _mm_load_ps(row4 + i);
-      r0 = _mm_add_ps(r0, r4);
-      r1 = _mm_add_ps(_mm_add_ps(r1, r3), r2);
-      r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));
-      t0 = _mm_add_ps(r0, _mm_mul_ps(r1, four));
-
-      r0 = _mm_load_ps(row0 + i + 4);
-      r1 = _mm_load_ps(row1 + i + 4);
-      r2 = _mm_load_ps(row2 + i + 4);
-      r3 = _mm_load_ps(row3 + i + 4);
-      r4 = _mm_load_ps(row4 + i + 4);
-      r0 = _mm_add_ps(r0, r4);
-      r1 = _mm_add_ps(_mm_add_ps(r1, r3), r2);
-      r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));
-      t1 = _mm_add_ps(r0, _mm_mul_ps(r1, four));
-
-      t0 = _mm_mul_ps(t0, scale);
-      t1 = _mm_mul_ps(t1, scale);
-
-      _mm_storeu_ps(out + i, t0);
-      _mm_storeu_ps(out + i + 4, t1);
+      int hi = 1;
+      for(;hi<num_gamma-1 && gamma[hi] <= v[i];hi++);
+      const int lo = hi-1;
+      if(k != lo && k != hi) continue;
+      const float a = CLAMPS((v[i] - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
+      const float fi = f ? f[i] :
+        curve_scalar(c[CLAMPS(i, curve->padding, wd-curve->padding-1)],
+                     curve->g, curve->sigma, curve->shadows, curve->highlights, curve->clarity);
+      out[i] += (k == hi ? a : 1.0f-a) * (fi - blur[i]);
     }
-    // process the rest
-    for(int i=cw&~7;i<cw-1;i++)
-      out[i] = (6*row2[i] + 4*(row1[i] + row3[i]) + row0[i] + row4[i])*(1.0f/256.0f);
   }
-  dt_free_align(ringbuf);
-  ll_fill_boundary1(coarse, cw, ch);
 }
-#endif
 
-static inline void gauss_reduce(
-    const float *const input, // fine input buffer
-    float *const coarse,      // coarse scale, blurred input buf
-    const int wd,             // fine res
+int local_laplacian_num_levels(const int width, const int height)
+{
+  // don't divide by 2 more often than we can, 30 matches local_laplacian_boundary_t:
+  return MIN(30, 31-__builtin_clz(MIN(width,height)));
+}
+
+int local_laplacian_level_size(const int size, const int level)
+{
+  return dl(size, level);
+}
+
+void local_laplacian_gauss_reduce(
+    const float *const input,
+    float *const coarse,
+    const int wd,
     const int ht)
 {
-  // blur, store only coarse res
-  const int cw = (wd-1)/2+1, ch = (ht-1)/2+1;
+  ll_reduce(input, coarse, wd, ht, ll_w_binomial, NULL);
+}
 
-  // this is the scalar (non-simd) code:
-  const float a = 0.4f;
-  const float w[5] = {1./4.-a/2., 1./4., a, 1./4., 1./4.-a/2.};
-  memset(coarse, 0, sizeof(float)*cw*ch);
-  // direct 5x5 stencil only on required pixels:
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) collapse(2)
-#endif
-  for(int j=1;j<ch-1;j++) for(int i=1;i<cw-1;i++)
-    for(int jj=-2;jj<=2;jj++) for(int ii=-2;ii<=2;ii++)
-      coarse[j*cw+i] += input[(2*j+jj)*wd+2*i+ii] * w[ii+2] * w[jj+2];
-  ll_fill_boundary1(coarse, cw, ch);
+void local_laplacian_gauss_expand(
+    const float *const coarse,
+    float *const fine,
+    const int wd,
+    const int ht)
+{
+  float *const ws
+      = dt_bufferpool_alloc(darktable.bufferpool, sizeof(float) * ll_scratch_size(wd) * dt_get_num_threads());
+  memset(fine, 0, sizeof(float)*wd*ht);
+  ll_add_expanded(fine, coarse, wd, ht, ws);
+  dt_bufferpool_free(darktable.bufferpool, ws);
 }
 
 // allocate output buffer with monochrome brightness channel from input, padded
@@ -246,7 +360,7 @@ static inline float *ll_pad_input(
   const int stride = 4;
   *wd2 = 2*max_supp + wd;
   *ht2 = 2*max_supp + ht;
-  float *const out = dt_alloc_align(16, *wd2**ht2*sizeof(*out));
+  float *const out = dt_bufferpool_alloc(darktable.bufferpool, *wd2**ht2*sizeof(*out));
 
   if(b && b->mode == 2)
   { // pad by preview buffer
@@ -337,193 +451,6 @@ static inline float *ll_pad_input(
   return out;
 }
 
-static inline float ll_laplacian(
-    const float *const coarse,   // coarse res gaussian
-    const float *const fine,     // fine res gaussian
-    const int i,                 // fine index
-    const int j,
-    const int wd,                // fine width
-    const int ht)                // fine height
-{
-  const float c = ll_expand_gaussian(coarse,
-      CLAMPS(i, 1, ((wd-1)&~1)-1), CLAMPS(j, 1, ((ht-1)&~1)-1), wd, ht);
-  return fine[j*wd+i] - c;
-}
-
-static inline float curve_scalar(
-    const float x,
-    const float g,
-    const float sigma,
-    const float shadows,
-    const float highlights,
-    const float clarity)
-{
-  const float c = x-g;
-  float val;
-  // blend in via quadratic bezier
-  if     (c >  2*sigma) val = g + sigma + shadows    * (c-sigma);
-  else if(c < -2*sigma) val = g - sigma + highlights * (c+sigma);
-  else if(c > 0.0f)
-  { // shadow contrast
-    const float t = CLAMPS(c / (2.0f*sigma), 0.0f, 1.0f);
-    const float t2 = t * t;
-    const float mt = 1.0f-t;
-    val = g + sigma * 2.0f*mt*t + t2*(sigma + sigma*shadows);
-  }
-  else
-  { // highlight contrast
-    const float t = CLAMPS(-c / (2.0f*sigma), 0.0f, 1.0f);
-    const float t2 = t * t;
-    const float mt = 1.0f-t;
-    val = g - sigma * 2.0f*mt*t + t2*(- sigma - sigma*highlights);
-  }
-  // midtone local contrast
-  val += clarity * c * dt_fast_expf(-c*c/(2.0*sigma*sigma/3.0f));
-  return val;
-}
-
-#if defined(__SSE2__)
-static inline __m128 curve_vec4(
-    const __m128 x,
-    const __m128 g,
-    const __m128 sigma,
-    const __m128 shadows,
-    const __m128 highlights,
-    const __m128 clarity)
-{
-  // TODO: pull these non-data depedent constants out of the loop to see
-  // whether the compiler fail to do so
-  const __m128 const0 = _mm_set_ps1(0x3f800000u);
-  const __m128 const1 = _mm_set_ps1(0x402DF854u); // for e^x
-  const __m128 sign_mask = _mm_set1_ps(-0.f); // -0.f = 1 << 31
-  const __m128 one = _mm_set1_ps(1.0f);
-  const __m128 two = _mm_set1_ps(2.0f);
-  const __m128 twothirds = _mm_set1_ps(2.0f/3.0f);
-  const __m128 twosig = _mm_mul_ps(two, sigma);
-  const __m128 sigma2 = _mm_mul_ps(sigma, sigma);
-  const __m128 s22 = _mm_mul_ps(twothirds, sigma2);
-
-  const __m128 c = _mm_sub_ps(x, g);
-  const __m128 select = _mm_cmplt_ps(c, _mm_setzero_ps());
-  // select shadows or highlights as multiplier for linear part, based on c < 0
-  const __m128 shadhi = _mm_or_ps(_mm_andnot_ps(select, shadows), _mm_and_ps(select, highlights));
-  // flip sign bit of sigma based on c < 0 (c < 0 ? - sigma : sigma)
-  const __m128 ssigma = _mm_xor_ps(sigma, _mm_and_ps(select, sign_mask));
-  // this contains the linear parts valid for c > 2*sigma or c < - 2*sigma
-  const __m128 vlin = _mm_add_ps(g, _mm_add_ps(ssigma, _mm_mul_ps(shadhi, _mm_sub_ps(c, ssigma))));
-
-  const __m128 t = _mm_min_ps(one, _mm_max_ps(_mm_setzero_ps(),
-        _mm_div_ps(c, _mm_mul_ps(two, ssigma))));
-  const __m128 t2 = _mm_mul_ps(t, t);
-  const __m128 mt = _mm_sub_ps(one, t);
-
-  // midtone value fading over to linear part, without local contrast:
-  const __m128 vmid = _mm_add_ps(g,
-      _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ssigma, two), _mm_mul_ps(mt, t)),
-        _mm_mul_ps(t2, _mm_add_ps(ssigma, _mm_mul_ps(ssigma, shadhi)))));
-
-  // c > 2*sigma?
-  const __m128 linselect = _mm_cmpgt_ps(_mm_andnot_ps(sign_mask, c), twosig);
-  const __m128 val = _mm_or_ps(_mm_and_ps(linselect, vlin), _mm_andnot_ps(linselect, vmid));
-
-  // midtone local contrast
-  // dt_fast_expf in sse:
-  const __m128 arg = _mm_xor_ps(sign_mask, _mm_div_ps(_mm_mul_ps(c, c), s22));
-  const __m128 k0 = _mm_add_ps(const0, _mm_mul_ps(arg, _mm_sub_ps(const1, const0)));
-  const __m128 k = _mm_max_ps(k0, _mm_setzero_ps());
-  const __m128i ki = _mm_cvtps_epi32(k);
-  const __m128 gauss = _mm_load_ps((float*)&ki);
-  const __m128 vcon = _mm_mul_ps(clarity, _mm_mul_ps(c, gauss));
-  return _mm_add_ps(val, vcon);
-}
-
-// sse (4-wide)
-void apply_curve_sse2(
-    float *const out,
-    const float *const in,
-    const uint32_t w,
-    const uint32_t h,
-    const uint32_t padding,
-    const float g,
-    const float sigma,
-    const float shadows,
-    const float highlights,
-    const float clarity)
-{
-  // TODO: do all this in avx2 8-wide (should be straight forward):
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic)
-#endif
-  for(uint32_t j=padding;j<h-padding;j++)
-  {
-    const float *in2  = in  + j*w + padding;
-    float *out2 = out + j*w + padding;
-    // find 4-byte aligned block in the middle:
-    const float *const beg = (float *)((size_t)(out2+3)&(size_t)0x10ul);
-    const float *const end = (float *)((size_t)(out2+w-padding)&(size_t)0x10ul);
-    const float *const fin = out2+w-padding;
-    const __m128 g4 = _mm_set1_ps(g);
-    const __m128 sig4 = _mm_set1_ps(sigma);
-    const __m128 shd4 = _mm_set1_ps(shadows);
-    const __m128 hil4 = _mm_set1_ps(highlights);
-    const __m128 clr4 = _mm_set1_ps(clarity);
-    for(;out2<beg;out2++,in2++)
-      *out2 = curve_scalar(*in2, g, sigma, shadows, highlights, clarity);
-    for(;out2<end;out2+=4,in2+=4)
-      _mm_stream_ps(out2, curve_vec4(_mm_load_ps(in2), g4, sig4, shd4, hil4, clr4));
-    for(;out2<fin;out2++,in2++)
-      *out2 = curve_scalar(*in2, g, sigma, shadows, highlights, clarity);
-    out2 = out + j*w;
-    for(int i=0;i<padding;i++)   out2[i] = out2[padding];
-    for(int i=w-padding;i<w;i++) out2[i] = out2[w-padding-1];
-  }
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic)
-#endif
-  for(int j=0;j<padding;j++) memcpy(out + w*j, out+padding*w, sizeof(float)*w);
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic)
-#endif
-  for(int j=h-padding;j<h;j++) memcpy(out + w*j, out+w*(h-padding-1), sizeof(float)*w);
-}
-#endif
-
-// scalar version
-void apply_curve(
-    float *const out,
-    const float *const in,
-    const uint32_t w,
-    const uint32_t h,
-    const uint32_t padding,
-    const float g,
-    const float sigma,
-    const float shadows,
-    const float highlights,
-    const float clarity)
-{
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic)
-#endif
-  for(uint32_t j=padding;j<h-padding;j++)
-  {
-    const float *in2  = in  + j*w + padding;
-    float *out2 = out + j*w + padding;
-    for(uint32_t i=padding;i<w-padding;i++)
-      (*out2++) = curve_scalar(*(in2++), g, sigma, shadows, highlights, clarity);
-    out2 = out + j*w;
-    for(int i=0;i<padding;i++)   out2[i] = out2[padding];
-    for(int i=w-padding;i<w;i++) out2[i] = out2[w-padding-1];
-  }
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic)
-#endif
-  for(int j=0;j<padding;j++) memcpy(out + w*j, out+padding*w, sizeof(float)*w);
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic)
-#endif
-  for(int j=h-padding;j<h;j++) memcpy(out + w*j, out+w*(h-padding-1), sizeof(float)*w);
-}
-
 void local_laplacian_internal(
     const float *const input,   // input buffer in some Labx or yuvx format
     float *const out,           // output buffer with colour
@@ -538,8 +465,7 @@ void local_laplacian_internal(
 {
 #define max_levels 30
 #define num_gamma 6
-  // don't divide by 2 more often than we can:
-  const int num_levels = MIN(max_levels, 31-__builtin_clz(MIN(wd,ht)));
+  const int num_levels = local_laplacian_num_levels(wd, ht);
   int last_level = num_levels-1;
   if(b && b->mode == 2) // higher number here makes it less prone to aliasing and slower.
     last_level = num_levels > 4 ? 4 : num_levels-1;
@@ -551,61 +477,59 @@ void local_laplacian_internal(
   else
     padded[0] = ll_pad_input(input, wd, ht, max_supp, &w, &h, 0);
 
-  // allocate pyramid pointers for padded input
-  for(int l=1;l<=last_level;l++)
-    padded[l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
+  // the sse2 path always used the binomial kernel, keep it that way
+  const float *const weights = use_sse2 ? ll_w_binomial : ll_w_plain;
 
-  // allocate pyramid pointers for output
+  // allocate pyramid pointers for padded input. the coarsest level is only
+  // needed to start the output pyramid, it goes there directly.
+  for(int l=1;l<last_level;l++)
+    padded[l] = dt_bufferpool_alloc(darktable.bufferpool, sizeof(float)*dl(w,l)*dl(h,l));
+
+  // allocate pyramid pointers for output, all but the coarsest level accumulate
+  // the laplacians of the remapped images
   float *output[max_levels] = {0};
   for(int l=0;l<=last_level;l++)
-    output[l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
-
-  // create gauss pyramid of padded input, write coarse directly to output
-#if defined(__SSE2__)
-  if(use_sse2)
-  {
-    for(int l=1;l<last_level;l++)
-      gauss_reduce_sse2(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce_sse2(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
-  }
-  else
-#endif
   {
-    for(int l=1;l<last_level;l++)
-      gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
+    output[l] = dt_bufferpool_alloc(darktable.bufferpool, sizeof(float)*dl(w,l)*dl(h,l));
+    if(l < last_level) memset(output[l], 0, sizeof(float)*dl(w,l)*dl(h,l));
   }
 
+  // create gauss pyramid of padded input, write coarse directly to output
+  for(int l=1;l<last_level;l++)
+    ll_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1), weights, NULL);
+  ll_reduce(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1), weights, NULL);
+
   // evenly sample brightness [0,1]:
   float gamma[num_gamma] = {0.0f};
   for(int k=0;k<num_gamma;k++) gamma[k] = (k+.5f)/(float)num_gamma;
   // for(int k=0;k<num_gamma;k++) gamma[k] = k/(num_gamma-1.0f);
 
-  // allocate memory for intermediate laplacian pyramids
-  float *buf[num_gamma][max_levels] = {{0}};
-  for(int k=0;k<num_gamma;k++) for(int l=0;l<=last_level;l++)
-    buf[k][l] = dt_alloc_align(16, sizeof(float)*dl(w,l)*dl(h,l));
+  // one gaussian pyramid of a remapped image, reused for all gammas. its finest
+  // level is computed on the fly from padded[0], and each laplacian is added to
+  // the output as soon as it is known. this way we only ever hold one of the
+  // num_gamma pyramids instead of all of them, the result is the same.
+  float *buf[max_levels] = {0};
+  for(int l=1;l<=last_level;l++)
+    buf[l] = dt_bufferpool_alloc(darktable.bufferpool, sizeof(float)*dl(w,l)*dl(h,l));
+  float *const ws
+      = dt_bufferpool_alloc(darktable.bufferpool, sizeof(float) * ll_scratch_size(w) * dt_get_num_threads());
 
   // the paper says remapping only level 3 not 0 does the trick, too
   // (but i really like the additional octave of sharpness we get,
   // willing to pay the cost).
   for(int k=0;k<num_gamma;k++)
   { // process images
-#if defined(__SSE2__)
-    if(use_sse2)
-      apply_curve_sse2(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
-    else // brackets in next line needed for silly gcc warning:
-#endif
-    {apply_curve(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
+    const ll_curve_t curve = { padded[0], max_supp, gamma[k], sigma, shadows, highlights, clarity };
 
-    // create gaussian pyramids
-    for(int l=1;l<=last_level;l++)
-#if defined(__SSE2__)
-      if(use_sse2)
-        gauss_reduce_sse2(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
-      else
-#endif
-        gauss_reduce(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
+    // create gaussian pyramid
+    ll_reduce(NULL, buf[1], w, h, weights, &curve);
+    for(int l=2;l<=last_level;l++)
+      ll_reduce(buf[l-1], buf[l], dl(w,l-1), dl(h,l-1), weights, NULL);
+
+    // and collect its laplacians where the input is close to gamma[k]
+    ll_add_laplacian(output[0], padded[0], NULL, &curve, buf[1], w, h, gamma, num_gamma, k, ws);
+    for(int l=1;l<last_level;l++)
+      ll_add_laplacian(output[l], padded[l], buf[l], NULL, buf[l+1], dl(w,l), dl(h,l), gamma, num_gamma, k, ws);
   }
 
   // resample output[last_level] from preview
@@ -698,33 +622,10 @@ void local_laplacian_internal(
 
   // assemble output pyramid coarse to fine
   for(int l=last_level-1;l >= 0; l--)
-  {
-    const int pw = dl(w,l), ph = dl(h,l);
+    ll_add_expanded(output[l], output[l+1], dl(w,l), dl(h,l), ws);
 
-    gauss_expand(output[l+1], output[l], pw, ph);
-    // go through all coefficients in the upsampled gauss buffer:
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2) shared(w,h,buf,output,l,gamma,padded)
-#endif
-    for(int j=0;j<ph;j++) for(int i=0;i<pw;i++)
-    {
-      const float v = padded[l][j*pw+i];
-      int hi = 1;
-      for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
-      int lo = hi-1;
-      const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
-      const float l0 = ll_laplacian(buf[lo][l+1], buf[lo][l], i, j, pw, ph);
-      const float l1 = ll_laplacian(buf[hi][l+1], buf[hi][l], i, j, pw, ph);
-      output[l][j*pw+i] += l0 * (1.0f-a) + l1 * a;
-      // we could do this to save on memory (no need for finest buf[][]).
-      // unfortunately it results in a quite noticable loss of sharpness, i think
-      // the extra level is worth it.
-      // else if(l == 0) // use finest scale from input to not amplify noise (and use less memory)
-      //   output[l][j*pw+i] += ll_laplacian(padded[l+1], padded[l], i, j, pw, ph);
-    }
-  }
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic) collapse(2) shared(w,output,buf)
+#pragma omp parallel for schedule(dynamic) collapse(2)
 #endif
   for(int j=0;j<ht;j++) for(int i=0;i<wd;i++)
   {
@@ -745,11 +646,12 @@ void local_laplacian_internal(
   // free all buffers except the ones passed out for preview rendering
   for(int l=0;l<max_levels;l++)
   {
-    if(!b || b->mode != 1 || l)   dt_free_align(padded[l]);
-    if(!b || b->mode != 1)        dt_free_align(output[l]);
-    for(int k=0; k<num_gamma;k++) dt_free_align(buf[k][l]);
+    if(!b || b->mode != 1 || l)   dt_bufferpool_free(darktable.bufferpool, padded[l]);
+    if(!b || b->mode != 1)        dt_bufferpool_free(darktable.bufferpool, output[l]);
+    dt_bufferpool_free(darktable.bufferpool, buf[l]);
   }
-#undef num_levels
+  dt_bufferpool_free(darktable.bufferpool, ws);
+#undef max_levels
 #undef num_gamma
 }
 
@@ -757,21 +659,21 @@ void local_laplacian_internal(
 size_t local_laplacian_memory_use(const int width,     // width of input image
                                   const int height)    // height of input image
 {
-#define max_levels 30
-#define num_gamma 6
-  const int num_levels = MIN(max_levels, 31-__builtin_clz(MIN(width,height)));
+  const int num_levels = local_laplacian_num_levels(width, height);
   const int max_supp = 1<<(num_levels-1);
   const int paddwd = width  + 2*max_supp;
   const int paddht = height + 2*max_supp;
 
+  // padded input and output pyramid, plus one gaussian pyramid of a remapped
+  // image without its finest level
   size_t memory_use = 0;
-
   for(int l=0;l<num_levels;l++)
-    memory_use += (size_t)(2 + num_gamma) * dl(paddwd, l) * dl(paddht, l) * sizeof(float);
+    memory_use += (size_t)(2 + (l > 0)) * dl(paddwd, l) * dl(paddht, l) * sizeof(float);
+
+  // scratch rows of the worker threads
+  memory_use += ll_scratch_size(paddwd) * dt_get_num_threads() * sizeof(float);
 
   return memory_use;
-#undef num_levels
-#undef num_gamma
 }
 
 size_t local_laplacian_singlebuffer_size(const int width,     // width of input image
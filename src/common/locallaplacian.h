@@ -17,6 +17,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "common/bufferpool.h"
 #include "develop/imageop.h"
 
 // struct bundling all the auxiliary buffers
@@ -25,14 +26,14 @@
 typedef struct local_laplacian_boundary_t
 {
   int mode;                // 0-regular, 1-preview/collect, 2-full/read
-  float *pad0;             // padded preview buffer, grey levels (allocated via dt_alloc_align)
+  float *pad0;             // padded preview buffer, grey levels (from dt_bufferpool_alloc)
   int wd;                  // preview width
   int ht;                  // preview height
   int pwd;                 // padded preview width
   int pht;                 // padded preview height
   const dt_iop_roi_t *roi; // roi of current view (pointing to pixelpipe roi)
   const dt_iop_roi_t *buf; // dimensions of full buffer
-  float *output[30];       // output pyramid of preview pass (allocated via dt_alloc_align)
+  float *output[30];       // output pyramid of preview pass (from dt_bufferpool_alloc)
   int num_levels;          // number of levels in preview output pyramid
 }
 local_laplacian_boundary_t;
@@ -40,8 +41,8 @@ local_laplacian_boundary_t;
 void local_laplacian_boundary_free(
     local_laplacian_boundary_t *b)
 {
-  dt_free_align(b->pad0);
-  for(int l=0;l<b->num_levels;l++) dt_free_align(b->output[l]);
+  dt_bufferpool_free(darktable.bufferpool, b->pad0);
+  for(int l=0;l<b->num_levels;l++) dt_bufferpool_free(darktable.bufferpool, b->output[l]);
   memset(b, 0, sizeof(*b));
 }
 
@@ -72,6 +73,7 @@ void local_laplacian(
   local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 0, b);
 }
 
+// peak memory of local_laplacian() for an image of this size, in bytes
 size_t local_laplacian_memory_use(const int width,      // width of input image
                                   const int height);    // height of input image
 
@@ -79,6 +81,31 @@ size_t local_laplacian_memory_use(const int width,      // width of input image
 size_t local_laplacian_singlebuffer_size(const int width,       // width of input image
                                          const int height);     // height of input image
 
+// the gaussian pyramid used by the filter, for other modules to build their own.
+// a level of size wd x ht reduces to (wd-1)/2+1 x (ht-1)/2+1, with the 1 4 6 4 1
+// binomial kernel. buffers hold one float per pixel, rows are streamed and the
+// work is spread over all threads.
+
+// number of levels a pyramid of this image can have
+int local_laplacian_num_levels(const int width, const int height);
+
+// width or height of the given level
+int local_laplacian_level_size(const int size, const int level);
+
+// blur and downsample the fine level input (wd x ht) into coarse
+void local_laplacian_gauss_reduce(
+    const float *const input,   // fine level
+    float *const coarse,        // next coarser level, written
+    const int wd,               // fine res
+    const int ht);
+
+// upsample coarse into fine (wd x ht), the inverse of local_laplacian_gauss_reduce
+void local_laplacian_gauss_expand(
+    const float *const coarse,  // coarse level
+    float *const fine,          // blurry fine level, written
+    const int wd,               // fine res
+    const int ht);
+
 
 #if defined(__SSE2__)
 void local_laplacian_sse2(
@@ -85,6 +85,7 @@ struct dt_mipmap_buffer_dsc
   size_t size;
   dt_mipmap_buffer_dsc_flags flags;
   dt_colorspaces_color_profile_type_t color_space;
+  uint32_t generation; // changes whenever the pixel content has been (re)written
 
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
   // do not touch!
@@ -195,6 +196,16 @@ static inline dt_mipmap_size_t get_size(const uint32_t key)
   return (dt_mipmap_size_t)(key >> 28);
 }
 
+// global counter handing out buffer generations, so clients keeping derived
+// data (such as the converted thumbnail surfaces of the lighttable) can tell
+// when the pixels behind a mip have been replaced.
+static uint32_t _mipmap_generation = 0;
+
+static inline uint32_t next_generation()
+{
+  return __sync_add_and_fetch(&_mipmap_generation, 1);
+}
+
 static int dt_mipmap_cache_get_filename(gchar *mipmapfilename, size_t size)
 {
   int r = -1;
@@ -288,6 +299,7 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   dsc->iscale = 1.0f;
   dsc->color_space = DT_COLORSPACE_NONE;
   dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+  dsc->generation = next_generation();
   buf->buf = (uint8_t *)(dsc + 1);
 
   // fprintf(stderr, "full buffer allocating img %u %d x %d = %u bytes (%p)\n", img->id, img->width,
@@ -406,6 +418,7 @@ read_error:
   if(!loaded_from_disk)
     dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
   else dsc->flags = 0;
+  dsc->generation = next_generation();
 
   // cost is just flat one for the buffer, as the buffers might have different sizes,
   // to make sure quota is meaningful.
@@ -682,6 +695,7 @@ void dt_mipmap_cache_get_with_caller(
       buf->height = dsc->height;
       buf->iscale = dsc->iscale;
       buf->color_space = dsc->color_space;
+      buf->generation = dsc->generation;
       buf->imgid = imgid;
       buf->size = mip;
 
@@ -697,6 +711,7 @@ void dt_mipmap_cache_get_with_caller(
       buf->iscale = 0.0f;
       buf->imgid = 0;
       buf->color_space = DT_COLORSPACE_NONE;
+      buf->generation = 0;
       buf->size = DT_MIPMAP_NONE;
       buf->buf = NULL;
     }
@@ -802,6 +817,7 @@ void dt_mipmap_cache_get_with_caller(
       }
       dsc->color_space = buf->color_space;
       dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+      dsc->generation = next_generation();
     }
 
     // image cache is leaving the write lock in place in case the image has been newly allocated.
@@ -843,6 +859,7 @@ void dt_mipmap_cache_get_with_caller(
     buf->height = dsc->height;
     buf->iscale = dsc->iscale;
     buf->color_space = dsc->color_space;
+    buf->generation = dsc->generation;
     buf->imgid = imgid;
     buf->size = mip;
 
@@ -911,6 +928,7 @@ void dt_mipmap_cache_get_with_caller(
     buf->width = buf->height = 0;
     buf->iscale = 0.0f;
     buf->color_space = DT_COLORSPACE_NONE;
+    buf->generation = 0;
   }
 }
 
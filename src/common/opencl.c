@@ -25,6 +25,7 @@
 #include "common/darktable.h"
 #include "common/dlopencl.h"
 #include "common/gaussian.h"
+#include "common/guided_filter.h"
 #include "common/interpolation.h"
 #include "common/nvidia_gpus.h"
 #include "common/opencl_drivers_blacklist.h"
@@ -154,6 +155,13 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   cl->dev[dev].options = NULL;
   cl->dev[dev].memory_in_use = 0;
   cl->dev[dev].peak_memory = 0;
+  memset(cl->dev[dev].pool, 0, sizeof(cl->dev[dev].pool));
+  cl->dev[dev].speed = 0.0f;
+  cl->dev[dev].users = 0;
+  cl->dev[dev].busy_until = 0.0;
+  cl->dev[dev].locked_at = 0.0;
+  cl->dev[dev].locked_mpix = 0.0f;
+  cl->dev[dev].locked_timed = 0;
   cl_device_id devid = cl->dev[dev].devid = devices[k];
 
   char *infostr = NULL;
@@ -515,6 +523,9 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
   cl->synch_cache = dt_conf_get_bool("opencl_synch_cache");
   cl->micro_nap = dt_conf_get_int("opencl_micro_nap");
   cl->crc = 5781;
+  cl->cpu_speed = 0.0f;
+  cl->cpu_users = 0;
+  cl->cpu_busy_until = 0.0;
   cl->dlocl = NULL;
   cl->dev_priority_image = NULL;
   cl->dev_priority_preview = NULL;
@@ -713,6 +724,7 @@ finally:
     cl->blendop = dt_develop_blend_init_cl_global();
     cl->bilateral = dt_bilateral_init_cl_global();
     cl->gaussian = dt_gaussian_init_cl_global();
+    cl->guided_filter = dt_guided_filter_init_cl_global();
     cl->interpolation = dt_interpolation_init_cl_global();
     cl->local_laplacian = dt_local_laplacian_init_cl_global();
 
@@ -747,9 +759,9 @@ finally:
       }
       else if(cl->num_devs >= 2)
       {
-        // set scheduling profile to "multiple GPUs" if more than one device has been found
-        dt_conf_set_string("opencl_scheduling_profile", "multiple GPUs");
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for multipe GPUs.\n");
+        // set scheduling profile to "dynamic" if more than one device has been found, to keep all of them busy
+        dt_conf_set_string("opencl_scheduling_profile", "dynamic");
+        dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile to dynamic for multiple devices.\n");
         dt_control_log(_("multiple GPUs detected - opencl scheduling profile has been set accordingly."));
       }
       else if(tcpu >= 6.0f * tgpumin)
@@ -815,9 +827,11 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
     dt_develop_blend_free_cl_global(cl->blendop);
     dt_bilateral_free_cl_global(cl->bilateral);
     dt_gaussian_free_cl_global(cl->gaussian);
+    dt_guided_filter_free_cl_global(cl->guided_filter);
     dt_interpolation_free_cl_global(cl->interpolation);
     for(int i = 0; i < cl->num_devs; i++)
     {
+      dt_opencl_pool_flush(i);
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
         if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
@@ -1329,41 +1343,48 @@ static void dt_opencl_update_priorities(const char *configstr)
              cl->mandatory[1], cl->mandatory[2], cl->mandatory[3]);
 }
 
-int dt_opencl_lock_device(const int pipetype)
+// a copy of the priority list of the pipe type, NULL for unknown types
+static int *_priority_list(dt_opencl_t *cl, const int pipetype, int *mandatory)
 {
-  dt_opencl_t *cl = darktable.opencl;
-  if(!cl->inited) return -1;
-
-
-  dt_pthread_mutex_lock(&cl->lock);
-
   size_t prio_size = sizeof(int) * (cl->num_devs + 1);
   int *priority = (int *)malloc(prio_size);
-  int mandatory;
 
   switch(pipetype)
   {
     case DT_DEV_PIXELPIPE_FULL:
       memcpy(priority, cl->dev_priority_image, prio_size);
-      mandatory = cl->mandatory[0];
+      *mandatory = cl->mandatory[0];
       break;
     case DT_DEV_PIXELPIPE_PREVIEW:
       memcpy(priority, cl->dev_priority_preview, prio_size);
-      mandatory = cl->mandatory[1];
+      *mandatory = cl->mandatory[1];
       break;
     case DT_DEV_PIXELPIPE_EXPORT:
       memcpy(priority, cl->dev_priority_export, prio_size);
-      mandatory = cl->mandatory[2];
+      *mandatory = cl->mandatory[2];
       break;
     case DT_DEV_PIXELPIPE_THUMBNAIL:
       memcpy(priority, cl->dev_priority_thumbnail, prio_size);
-      mandatory = cl->mandatory[3];
+      *mandatory = cl->mandatory[3];
       break;
     default:
       free(priority);
       priority = NULL;
-      mandatory = 0;
+      *mandatory = 0;
   }
+  return priority;
+}
+
+int dt_opencl_lock_device(const int pipetype)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return -1;
+
+
+  dt_pthread_mutex_lock(&cl->lock);
+
+  int mandatory;
+  int *priority = _priority_list(cl, pipetype, &mandatory);
 
   dt_pthread_mutex_unlock(&cl->lock);
 
@@ -1414,11 +1435,222 @@ int dt_opencl_lock_device(const int pipetype)
   return -1;
 }
 
+static const char *_pipe_type_name(const int pipetype)
+{
+  switch(pipetype)
+  {
+    case DT_DEV_PIXELPIPE_FULL:
+      return "full";
+    case DT_DEV_PIXELPIPE_PREVIEW:
+      return "preview";
+    case DT_DEV_PIXELPIPE_EXPORT:
+      return "export";
+    case DT_DEV_PIXELPIPE_THUMBNAIL:
+      return "thumbnail";
+    default:
+      return "unknown";
+  }
+}
+
+// darkroom pipes mostly come from the pipe cache, only the times of export and thumbnail pipes say something
+// about the speed of a device or the cpu
+static inline int _pipe_type_timed(const int pipetype)
+{
+  return pipetype == DT_DEV_PIXELPIPE_EXPORT || pipetype == DT_DEV_PIXELPIPE_THUMBNAIL;
+}
+
+// moving average of the seconds per megapixel of the last pipes
+static void _update_speed(float *speed, const float mpix, const double seconds)
+{
+  // runs which took next to nothing came mostly from the pipe cache and say little about the speed
+  if(mpix <= 0.0f || seconds < 0.005) return;
+  const float s = seconds / mpix;
+  *speed = *speed > 0.0f ? 0.7f * *speed + 0.3f * s : s;
+}
+
+// how long a pipe on the image would take on the device by itself, 0 while the device hasn't been measured
+static double _device_time(dt_opencl_t *cl, const int devid, const int width, const int height,
+                           const float mpix)
+{
+  // tiling transfers the image in pieces and processes the overlap of the tiles twice
+  const int fits
+      = width <= 0 || dt_opencl_image_fits_device(devid, width, height, 4 * sizeof(float), 2.0f, 0);
+  return (double)cl->dev[devid].speed * mpix * (fits ? 1.0 : 1.5);
+}
+
+static int _lock_device_for_image(dt_opencl_t *cl, const int pipetype, const int width, const int height,
+                                  const float mpix)
+{
+  if(cl->scheduling_profile != OPENCL_PROFILE_DYNAMIC)
+  {
+    // static priorities, but keep measuring the devices for a switch to the dynamic profile
+    const int devid = dt_opencl_lock_device(pipetype);
+    if(devid >= 0)
+    {
+      const double now = dt_get_wtime();
+      dt_pthread_mutex_lock(&cl->lock);
+      cl->dev[devid].users++;
+      cl->dev[devid].busy_until = now + _device_time(cl, devid, width, height, mpix);
+      cl->dev[devid].locked_at = now;
+      cl->dev[devid].locked_mpix = mpix;
+      cl->dev[devid].locked_timed = _pipe_type_timed(pipetype);
+      dt_pthread_mutex_unlock(&cl->lock);
+    }
+    return devid;
+  }
+
+  dt_pthread_mutex_lock(&cl->lock);
+
+  int mandatory;
+  int *priority = _priority_list(cl, pipetype, &mandatory);
+  if(!priority)
+  {
+    dt_pthread_mutex_unlock(&cl->lock);
+    return dt_opencl_lock_device(pipetype);
+  }
+
+  const double now = dt_get_wtime();
+  char report[512];
+  int len = snprintf(report, sizeof(report), "[opencl_scheduler] %s pipe on %.1f MP:",
+                     _pipe_type_name(pipetype), (double)mpix);
+
+  // the device expected to be done first, counting the pipes already on it or waiting for it. a device
+  // which hasn't been measured yet is tried when it is free, but not waited for
+  int best = -1;
+  double best_time = INFINITY, best_run = 0.0;
+  int any_free = 0;
+  for(const int *prio = priority; *prio != -1; prio++)
+  {
+    const dt_opencl_device_t *device = &cl->dev[*prio];
+    const double run = _device_time(cl, *prio, width, height, mpix);
+    double t;
+    if(device->users == 0)
+      t = run;
+    else if(device->speed > 0.0f)
+      t = MAX(device->busy_until - now, 0.0) + run;
+    else
+      t = mandatory ? 1e6 * device->users : INFINITY;
+    any_free |= device->users == 0;
+
+    if(len < (int)sizeof(report))
+      len += snprintf(report + len, sizeof(report) - len, " device %d %.2fs (%d busy)", *prio, t,
+                      device->users);
+    if(t < best_time)
+    {
+      best = *prio;
+      best_time = t;
+      best_run = run;
+    }
+  }
+  free(priority);
+
+  // the cpu is always there, after the pipes already on it. before it has been measured it only takes the
+  // pipes no free device is left for
+  double cpu_time;
+  if(mandatory)
+    cpu_time = INFINITY;
+  else if(cl->cpu_speed > 0.0f)
+    cpu_time = (cl->cpu_users ? MAX(cl->cpu_busy_until - now, 0.0) : 0.0) + (double)cl->cpu_speed * mpix;
+  else
+    cpu_time = any_free ? INFINITY : 0.0;
+  if(len < (int)sizeof(report))
+    len += snprintf(report + len, sizeof(report) - len, " cpu %.2fs (%d busy)", cpu_time, cl->cpu_users);
+
+  if(best < 0 || cpu_time <= best_time)
+  {
+    dt_pthread_mutex_unlock(&cl->lock);
+    dt_print(DT_DEBUG_OPENCL, "%s -> cpu\n", report);
+    return -1;
+  }
+
+  dt_opencl_device_t *device = &cl->dev[best];
+  const double wait = device->users ? MAX(device->busy_until - now, 0.0) : 0.0;
+  device->users++;
+  device->busy_until = MAX(device->busy_until, now) + best_run;
+  dt_pthread_mutex_unlock(&cl->lock);
+  dt_print(DT_DEBUG_OPENCL, "%s -> device %d\n", report, best);
+
+  // wait our turn, but not forever if the estimate was off
+  const int nloop = MAX(0, dt_conf_get_int("opencl_mandatory_timeout"));
+  const double deadline = now + MAX(2.0 * wait + 1.0, mandatory ? 0.005 * nloop : 0.0);
+  while(dt_pthread_mutex_trylock(&device->lock))
+  {
+    if(dt_get_wtime() > deadline)
+    {
+      dt_pthread_mutex_lock(&cl->lock);
+      device->users--;
+      device->busy_until -= best_run;
+      dt_pthread_mutex_unlock(&cl->lock);
+      dt_print(DT_DEBUG_OPENCL, "[opencl_scheduler] %s pipe gave up waiting for device %d -> cpu\n",
+               _pipe_type_name(pipetype), best);
+      return -1;
+    }
+    dt_iop_nap(5000);
+  }
+
+  dt_pthread_mutex_lock(&cl->lock);
+  device->locked_at = dt_get_wtime();
+  device->locked_mpix = mpix;
+  device->locked_timed = _pipe_type_timed(pipetype);
+  dt_pthread_mutex_unlock(&cl->lock);
+  return best;
+}
+
+int dt_opencl_lock_device_for_image(const int pipetype, const int width, const int height)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return -1;
+
+  const float mpix = (float)width * height * 1e-6f;
+  const int devid = _lock_device_for_image(cl, pipetype, width, height, mpix);
+  if(devid < 0)
+  {
+    // the pipe goes to the cpu, count it there like the pipes on a device
+    const double now = dt_get_wtime();
+    dt_pthread_mutex_lock(&cl->lock);
+    cl->cpu_busy_until = (cl->cpu_users ? MAX(cl->cpu_busy_until, now) : now) + (double)cl->cpu_speed * mpix;
+    cl->cpu_users++;
+    dt_pthread_mutex_unlock(&cl->lock);
+  }
+  return devid;
+}
+
+void dt_opencl_cpu_pipe_done(const int pipetype, const int width, const int height, const double seconds)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return;
+
+  dt_pthread_mutex_lock(&cl->lock);
+  cl->cpu_users = MAX(cl->cpu_users - 1, 0);
+  if(cl->cpu_users == 0) cl->cpu_busy_until = dt_get_wtime();
+  if(_pipe_type_timed(pipetype) && seconds >= 0.0)
+    _update_speed(&cl->cpu_speed, (float)width * height * 1e-6f, seconds);
+  dt_pthread_mutex_unlock(&cl->lock);
+}
+
 void dt_opencl_unlock_device(const int dev)
 {
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited) return;
   if(dev < 0 || dev >= cl->num_devs) return;
+  // the pool is only kept while the device is locked, let the next pipe have the memory
+  dt_opencl_pool_flush(dev);
+
+  // pipes locked by dt_opencl_lock_device_for_image() measure the device
+  dt_pthread_mutex_lock(&cl->lock);
+  dt_opencl_device_t *device = &cl->dev[dev];
+  if(device->locked_at > 0.0)
+  {
+    const double now = dt_get_wtime();
+    if(device->locked_timed) _update_speed(&device->speed, device->locked_mpix, now - device->locked_at);
+    device->users = MAX(device->users - 1, 0);
+    if(device->users == 0) device->busy_until = now;
+    device->locked_at = 0.0;
+    device->locked_mpix = 0.0f;
+    device->locked_timed = 0;
+  }
+  dt_pthread_mutex_unlock(&cl->lock);
+
   dt_pthread_mutex_BAD_unlock(&cl->dev[dev].lock);
 }
 
@@ -2022,6 +2254,65 @@ int dt_opencl_write_host_to_device_raw(const int devid, void *host, void *device
                                                                     rowpitch, 0, host, 0, NULL, eventp);
 }
 
+int dt_opencl_read_host_from_device_raw_event(const int devid, void *host, void *device, const size_t *origin,
+                                              const size_t *region, const int rowpitch, cl_event *event)
+{
+  if(!darktable.opencl->inited || devid < 0) return -1;
+
+  // the event goes to the eventlist as well for profiling, we keep a reference of our own
+  cl_event *eventp = dt_opencl_events_get_slot(devid, "[Read Image (from device to host)]");
+
+  const cl_int err = (darktable.opencl->dlocl->symbols->dt_clEnqueueReadImage)(
+      darktable.opencl->dev[devid].cmd_queue, device, CL_FALSE, origin, region, rowpitch, 0, host, 0, NULL,
+      eventp ? eventp : event);
+  if(err != CL_SUCCESS)
+    *event = NULL;
+  else if(eventp)
+  {
+    *event = *eventp;
+    (darktable.opencl->dlocl->symbols->dt_clRetainEvent)(*event);
+  }
+  return err;
+}
+
+int dt_opencl_write_host_to_device_raw_event(const int devid, void *host, void *device, const size_t *origin,
+                                             const size_t *region, const int rowpitch, cl_event *event)
+{
+  if(!darktable.opencl->inited || devid < 0) return -1;
+
+  cl_event *eventp = dt_opencl_events_get_slot(devid, "[Write Image (from host to device)]");
+
+  const cl_int err = (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteImage)(
+      darktable.opencl->dev[devid].cmd_queue, device, CL_FALSE, origin, region, rowpitch, 0, host, 0, NULL,
+      eventp ? eventp : event);
+  if(err != CL_SUCCESS)
+    *event = NULL;
+  else if(eventp)
+  {
+    *event = *eventp;
+    (darktable.opencl->dlocl->symbols->dt_clRetainEvent)(*event);
+  }
+  return err;
+}
+
+int dt_opencl_wait_for_event(cl_event *event)
+{
+  if(!darktable.opencl->inited) return -1;
+  if(*event == NULL) return CL_SUCCESS;
+
+  cl_int err = (darktable.opencl->dlocl->symbols->dt_clWaitForEvents)(1, event);
+  if(err == CL_SUCCESS)
+  {
+    cl_int status;
+    err = (darktable.opencl->dlocl->symbols->dt_clGetEventInfo)(*event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                                                sizeof(cl_int), &status, NULL);
+    if(err == CL_SUCCESS && status != CL_COMPLETE) err = status;
+  }
+  (darktable.opencl->dlocl->symbols->dt_clReleaseEvent)(*event);
+  *event = NULL;
+  return err;
+}
+
 int dt_opencl_enqueue_copy_image(const int devid, cl_mem src, cl_mem dst, size_t *orig_src, size_t *orig_dst,
                                  size_t *region)
 {
@@ -2276,6 +2567,113 @@ void *dt_opencl_alloc_device_buffer_with_flags(const int devid, const size_t siz
   return buf;
 }
 
+void *dt_opencl_pool_alloc_device(const int devid, const int width, const int height, const int bpp)
+{
+  if(!darktable.opencl->inited || devid < 0) return NULL;
+  dt_opencl_pooled_t *pool = darktable.opencl->dev[devid].pool;
+
+  int free_slot = -1;
+  for(int k = 0; k < DT_OPENCL_POOL_SIZE; k++)
+  {
+    if(pool[k].mem && !pool[k].taken && !pool[k].host && pool[k].width == width && pool[k].height == height
+       && pool[k].bpp == bpp)
+    {
+      pool[k].taken = 1;
+      return pool[k].mem;
+    }
+    if(!pool[k].mem && free_slot < 0) free_slot = k;
+  }
+
+  // idle images of other sizes would only take up device memory the new one may need
+  for(int k = 0; k < DT_OPENCL_POOL_SIZE; k++)
+    if(pool[k].mem && !pool[k].taken && !pool[k].host)
+    {
+      dt_opencl_release_mem_object(pool[k].mem);
+      memset(&pool[k], 0, sizeof(dt_opencl_pooled_t));
+      if(free_slot < 0) free_slot = k;
+    }
+
+  cl_mem mem = dt_opencl_alloc_device(devid, width, height, bpp);
+  if(mem == NULL || free_slot < 0) return mem;
+
+  pool[free_slot]
+      = (dt_opencl_pooled_t){ .mem = mem, .width = width, .height = height, .bpp = bpp, .taken = 1 };
+  return mem;
+}
+
+void *dt_opencl_pool_alloc_pinned(const int devid, const size_t size, void **host)
+{
+  if(!darktable.opencl->inited || devid < 0) return NULL;
+  dt_opencl_pooled_t *pool = darktable.opencl->dev[devid].pool;
+
+  int free_slot = -1;
+  for(int k = 0; k < DT_OPENCL_POOL_SIZE; k++)
+  {
+    if(pool[k].mem && !pool[k].taken && pool[k].host && pool[k].size >= size)
+    {
+      pool[k].taken = 1;
+      *host = pool[k].host;
+      return pool[k].mem;
+    }
+    if(!pool[k].mem && free_slot < 0) free_slot = k;
+  }
+
+  // the idle ones are too small, drop them before pinning more host memory
+  for(int k = 0; k < DT_OPENCL_POOL_SIZE; k++)
+    if(pool[k].mem && !pool[k].taken && pool[k].host)
+    {
+      dt_opencl_unmap_mem_object(devid, pool[k].mem, pool[k].host);
+      dt_opencl_release_mem_object(pool[k].mem);
+      memset(&pool[k], 0, sizeof(dt_opencl_pooled_t));
+      if(free_slot < 0) free_slot = k;
+    }
+  if(free_slot < 0) return NULL;
+
+  cl_mem mem = dt_opencl_alloc_device_buffer_with_flags(devid, size, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+  if(mem == NULL) return NULL;
+
+  void *mapped = dt_opencl_map_buffer(devid, mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size);
+  if(mapped == NULL)
+  {
+    dt_opencl_release_mem_object(mem);
+    return NULL;
+  }
+
+  pool[free_slot] = (dt_opencl_pooled_t){ .mem = mem, .host = mapped, .size = size, .taken = 1 };
+  *host = mapped;
+  return mem;
+}
+
+void dt_opencl_pool_put(const int devid, cl_mem mem)
+{
+  if(!darktable.opencl->inited || mem == NULL) return;
+  if(devid >= 0)
+  {
+    dt_opencl_pooled_t *pool = darktable.opencl->dev[devid].pool;
+    for(int k = 0; k < DT_OPENCL_POOL_SIZE; k++)
+      if(pool[k].mem == mem)
+      {
+        pool[k].taken = 0;
+        return;
+      }
+  }
+  dt_opencl_release_mem_object(mem);
+}
+
+void dt_opencl_pool_flush(const int devid)
+{
+  if(!darktable.opencl->inited || devid < 0) return;
+  dt_opencl_pooled_t *pool = darktable.opencl->dev[devid].pool;
+
+  for(int k = 0; k < DT_OPENCL_POOL_SIZE; k++)
+  {
+    if(!pool[k].mem || pool[k].taken) continue;
+    if(pool[k].host) dt_opencl_unmap_mem_object(devid, pool[k].mem, pool[k].host);
+    dt_opencl_release_mem_object(pool[k].mem);
+    memset(&pool[k], 0, sizeof(dt_opencl_pooled_t));
+  }
+}
+
 size_t dt_opencl_get_mem_object_size(cl_mem mem)
 {
   cl_int err;
@@ -2445,6 +2843,8 @@ static dt_opencl_scheduling_profile_t dt_opencl_get_scheduling_profile(void)
     profile = OPENCL_PROFILE_MULTIPLE_GPUS;
   else if(!strcmp(pstr, "very fast GPU"))
     profile = OPENCL_PROFILE_VERYFAST_GPU;
+  else if(!strcmp(pstr, "dynamic"))
+    profile = OPENCL_PROFILE_DYNAMIC;
 
   g_free(pstr);
 
@@ -2476,6 +2876,11 @@ static void dt_opencl_apply_scheduling_profile(dt_opencl_scheduling_profile_t pr
       dt_opencl_update_priorities("+*/+*/+*/+*");
       dt_opencl_set_synchronization_timeout(0);
       break;
+    case OPENCL_PROFILE_DYNAMIC:
+      // every pipe may go to every device, dt_opencl_lock_device_for_image() picks one
+      dt_opencl_update_priorities("*/*/*/*");
+      dt_opencl_set_synchronization_timeout(20);
+      break;
     case OPENCL_PROFILE_DEFAULT:
     default:
       str = dt_conf_get_string("opencl_device_priority");
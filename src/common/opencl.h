@@ -30,6 +30,7 @@
 #define DT_OPENCL_MAX_EVENTS 256
 #define DT_OPENCL_MAX_ERRORS 5
 #define DT_OPENCL_MAX_INCLUDES 5
+#define DT_OPENCL_POOL_SIZE 8
 
 #ifdef HAVE_OPENCL
 
@@ -57,7 +58,8 @@ typedef enum dt_opencl_scheduling_profile_t
 {
   OPENCL_PROFILE_DEFAULT,
   OPENCL_PROFILE_MULTIPLE_GPUS,
-  OPENCL_PROFILE_VERYFAST_GPU
+  OPENCL_PROFILE_VERYFAST_GPU,
+  OPENCL_PROFILE_DYNAMIC
 } dt_opencl_scheduling_profile_t;
 
 /**
@@ -70,6 +72,19 @@ typedef struct dt_opencl_eventtag_t
   char tag[DT_OPENCL_EVENTNAMELENGTH];
 } dt_opencl_eventtag_t;
 
+/**
+ * a device image or pinned host buffer kept by the device for reuse,
+ * see dt_opencl_pool_alloc_device() and dt_opencl_pool_alloc_pinned().
+ */
+typedef struct dt_opencl_pooled_t
+{
+  cl_mem mem;
+  void *host;             // mapped host memory of a pinned buffer, NULL for images
+  size_t size;            // of a pinned buffer
+  int width, height, bpp; // of an image
+  int taken;
+} dt_opencl_pooled_t;
+
 
 /**
  * to support multi-gpu and mixed systems with cpu support,
@@ -108,9 +123,18 @@ typedef struct dt_opencl_device_t
   float benchmark;
   size_t memory_in_use;
   size_t peak_memory;
+  dt_opencl_pooled_t pool[DT_OPENCL_POOL_SIZE];
+  // for the dynamic scheduling profile, see dt_opencl_lock_device_for_image()
+  float speed;       // measured seconds per megapixel, 0 while unknown
+  int users;         // pipes holding the device or waiting for it
+  double busy_until; // when they are expected to be done
+  double locked_at;  // when the current pipe got the device
+  float locked_mpix; // and how many megapixels it processes
+  int locked_timed;  // and whether its time goes into speed, see _pipe_type_timed()
 } dt_opencl_device_t;
 
 struct dt_bilateral_cl_global_t;
+struct dt_guided_filter_cl_global_t;
 struct dt_local_laplacian_cl_global_t;
 /**
  * main struct, stored in darktable.opencl.
@@ -133,6 +157,9 @@ typedef struct dt_opencl_t
   int error_count;
   int opencl_synchronization_timeout;
   dt_opencl_scheduling_profile_t scheduling_profile;
+  float cpu_speed;       // measured seconds per megapixel of pipes on the cpu, 0 while unknown
+  int cpu_users;         // pipes the dynamic scheduler sent to the cpu which aren't done yet
+  double cpu_busy_until; // when they are expected to be done
   uint32_t crc;
   int mandatory[4];
   int *dev_priority_image;
@@ -151,6 +178,9 @@ typedef struct dt_opencl_t
   // global kernels for gaussian filtering, to be reused by a few plugins.
   struct dt_gaussian_cl_global_t *gaussian;
 
+  // global kernels for box and guided filtering, to be reused by a few plugins.
+  struct dt_guided_filter_cl_global_t *guided_filter;
+
   // global kernels for interpolation resampling.
   struct dt_interpolation_cl_global_t *interpolation;
 
@@ -194,6 +224,16 @@ int dt_opencl_enqueue_barrier(const int devid);
 /** locks a device for your thread's exclusive use */
 int dt_opencl_lock_device(const int pipetype);
 
+/** locks a device for a pipe of type pipetype on width x height pixels, -1 for the cpu. with the dynamic
+  * scheduling profile that is the one expected to be done first, from the measured speed of the devices and
+  * the cpu, the pipes already holding or waiting for each device, and whether the image fits without tiling.
+  * otherwise the same as dt_opencl_lock_device(). */
+int dt_opencl_lock_device_for_image(const int pipetype, const int width, const int height);
+
+/** tell the dynamic scheduler that a pipe dt_opencl_lock_device_for_image() sent to the cpu is done, and
+  * how long it took on width x height pixels. seconds < 0 if it didn't finish. */
+void dt_opencl_cpu_pipe_done(const int pipetype, const int width, const int height, const double seconds);
+
 /** done with your command queue. */
 void dt_opencl_unlock_device(const int dev);
 
@@ -283,6 +323,17 @@ int dt_opencl_write_host_to_device_rowpitch_non_blocking(const int devid, void *
 int dt_opencl_write_host_to_device_raw(const int devid, void *host, void *device, const size_t *origin,
                                        const size_t *region, const int rowpitch, const int blocking);
 
+/** non-blocking transfers like the _raw ones, which hand out an event of their own for the transfer in event.
+  * the host memory must not be touched before dt_opencl_wait_for_event() returned on it. */
+int dt_opencl_read_host_from_device_raw_event(const int devid, void *host, void *device, const size_t *origin,
+                                              const size_t *region, const int rowpitch, cl_event *event);
+
+int dt_opencl_write_host_to_device_raw_event(const int devid, void *host, void *device, const size_t *origin,
+                                             const size_t *region, const int rowpitch, cl_event *event);
+
+/** wait for an event of the _event transfers and release it. a NULL event is done already. */
+int dt_opencl_wait_for_event(cl_event *event);
+
 void *dt_opencl_copy_host_to_device(const int devid, void *host, const int width, const int height,
                                     const int bpp);
 
@@ -320,6 +371,21 @@ void *dt_opencl_alloc_device_buffer_with_flags(const int devid, const size_t siz
 
 void dt_opencl_release_mem_object(cl_mem mem);
 
+/** an image like dt_opencl_alloc_device() from the pool of the device, or a new one. the pool lives while
+  * the device is locked, the caller holds the lock and flushes the pool when done with its tiles, as
+  * dt_opencl_image_fits_device() doesn't know about it. give it back with dt_opencl_pool_put(). */
+void *dt_opencl_pool_alloc_device(const int devid, const int width, const int height, const int bpp);
+
+/** a buffer of at least size bytes in pinned host memory from the pool of the device, or a new one, mapped
+  * to *host for reading and writing. NULL if the pool is full. give it back with dt_opencl_pool_put(). */
+void *dt_opencl_pool_alloc_pinned(const int devid, const size_t size, void **host);
+
+/** give an image or pinned buffer back to the pool. ones which didn't come from there are released. */
+void dt_opencl_pool_put(const int devid, cl_mem mem);
+
+/** release everything in the pool of the device which isn't taken */
+void dt_opencl_pool_flush(const int devid);
+
 void *dt_opencl_map_buffer(const int devid, cl_mem buffer, const int blocking, const int flags, size_t offset,
                            size_t size);
 
@@ -395,6 +461,14 @@ static inline int dt_opencl_lock_device(const int dev)
 {
   return -1;
 }
+static inline int dt_opencl_lock_device_for_image(const int pipetype, const int width, const int height)
+{
+  return -1;
+}
+static inline void dt_opencl_cpu_pipe_done(const int pipetype, const int width, const int height,
+                                           const double seconds)
+{
+}
 static inline void dt_opencl_unlock_device(const int dev)
 {
 }
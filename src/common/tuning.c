@@ -0,0 +1,165 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/tuning.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *_codepath_names[] = { "default", "sse2", "plain" };
+
+static dt_tuning_codepath_t _codepath_from_name(const char *name)
+{
+  for(int k = 0; k < (int)G_N_ELEMENTS(_codepath_names); k++)
+    if(name && !strcmp(name, _codepath_names[k])) return (dt_tuning_codepath_t)k;
+  return DT_TUNING_CODEPATH_DEFAULT;
+}
+
+void dt_tuning_init(dt_tuning_t *t)
+{
+  char configdir[PATH_MAX] = { 0 };
+  dt_loc_get_user_config_dir(configdir, sizeof(configdir));
+  snprintf(t->filename, sizeof(t->filename), "%s/tuning.rc", configdir);
+
+  t->modules = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  t->timings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  t->override = FALSE;
+  t->measure = FALSE;
+  memset(&t->forced, 0, sizeof(t->forced));
+  dt_pthread_mutex_init(&t->lock, NULL);
+
+  GKeyFile *kf = g_key_file_new();
+  if(!g_key_file_load_from_file(kf, t->filename, G_KEY_FILE_NONE, NULL))
+  {
+    g_key_file_free(kf);
+    return;
+  }
+
+  gsize num_groups = 0;
+  gchar **groups = g_key_file_get_groups(kf, &num_groups);
+  for(gsize k = 0; k < num_groups; k++)
+  {
+    dt_tuning_module_t *m = (dt_tuning_module_t *)g_malloc0(sizeof(dt_tuning_module_t));
+    m->threads = MAX(g_key_file_get_integer(kf, groups[k], "threads", NULL), 0);
+    m->tile_size = MAX(g_key_file_get_integer(kf, groups[k], "tile_size", NULL), 0);
+    gchar *codepath = g_key_file_get_string(kf, groups[k], "codepath", NULL);
+    m->codepath = _codepath_from_name(codepath);
+    g_free(codepath);
+    g_hash_table_insert(t->modules, g_strdup(groups[k]), m);
+  }
+  g_strfreev(groups);
+  g_key_file_free(kf);
+
+  dt_print(DT_DEBUG_PERF, "[tuning] loaded settings for %u modules from `%s'\n",
+           g_hash_table_size(t->modules), t->filename);
+}
+
+void dt_tuning_cleanup(dt_tuning_t *t)
+{
+  g_hash_table_destroy(t->modules);
+  g_hash_table_destroy(t->timings);
+  dt_pthread_mutex_destroy(&t->lock);
+}
+
+int dt_tuning_save(dt_tuning_t *t)
+{
+  GKeyFile *kf = g_key_file_new();
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, t->modules);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const dt_tuning_module_t *m = (const dt_tuning_module_t *)value;
+    g_key_file_set_integer(kf, (const char *)key, "threads", m->threads);
+    g_key_file_set_string(kf, (const char *)key, "codepath", _codepath_names[m->codepath]);
+    g_key_file_set_integer(kf, (const char *)key, "tile_size", m->tile_size);
+  }
+
+  GError *error = NULL;
+  const gboolean ok = g_key_file_save_to_file(kf, t->filename, &error);
+  if(!ok)
+  {
+    fprintf(stderr, "[tuning] can't write `%s': %s\n", t->filename, error->message);
+    g_error_free(error);
+  }
+  g_key_file_free(kf);
+  return ok ? 0 : 1;
+}
+
+const dt_tuning_module_t *dt_tuning_get(const dt_tuning_t *t, const char *op)
+{
+  if(!t) return NULL;
+  if(t->override) return &t->forced;
+  return (const dt_tuning_module_t *)g_hash_table_lookup(t->modules, op);
+}
+
+void dt_tuning_set(dt_tuning_t *t, const char *op, const dt_tuning_module_t *m)
+{
+  dt_tuning_module_t *copy = (dt_tuning_module_t *)g_malloc(sizeof(dt_tuning_module_t));
+  *copy = *m;
+  g_hash_table_replace(t->modules, g_strdup(op), copy);
+}
+
+size_t dt_tuning_tile_size(const dt_tuning_t *t, const char *op)
+{
+  const dt_tuning_module_t *m = dt_tuning_get(t, op);
+  return m ? (size_t)m->tile_size * 1024 * 1024 : 0;
+}
+
+gboolean dt_tuning_prefers_tiling(const dt_tuning_t *t, const char *op, const size_t size)
+{
+  const size_t tile_size = dt_tuning_tile_size(t, op);
+  return tile_size > 0 && size > tile_size;
+}
+
+void dt_tuning_record(dt_tuning_t *t, const char *op, const double seconds)
+{
+  if(!t || !t->measure) return;
+  dt_pthread_mutex_lock(&t->lock);
+  double *sum = (double *)g_hash_table_lookup(t->timings, op);
+  if(!sum)
+  {
+    sum = (double *)g_malloc0(sizeof(double));
+    g_hash_table_insert(t->timings, g_strdup(op), sum);
+  }
+  *sum += seconds;
+  dt_pthread_mutex_unlock(&t->lock);
+}
+
+void dt_tuning_reset_timings(dt_tuning_t *t)
+{
+  dt_pthread_mutex_lock(&t->lock);
+  g_hash_table_remove_all(t->timings);
+  dt_pthread_mutex_unlock(&t->lock);
+}
+
+double dt_tuning_get_timing(dt_tuning_t *t, const char *op)
+{
+  dt_pthread_mutex_lock(&t->lock);
+  const double *sum = (const double *)g_hash_table_lookup(t->timings, op);
+  const double res = sum ? *sum : -1.0;
+  dt_pthread_mutex_unlock(&t->lock);
+  return res;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,87 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+#include <glib.h>
+#include <limits.h>
+#include <stddef.h>
+
+/**
+ * per-machine tuning profile, written by darktable-bench.
+ *
+ * for every module that was benchmarked it records the number of OpenMP threads,
+ * the CPU codepath and the tile size that gave the best throughput on this
+ * machine. the pixelpipe consults it when processing on the CPU. modules not in
+ * the profile (or all of them, if there is no profile) keep the usual defaults.
+ */
+
+typedef enum dt_tuning_codepath_t
+{
+  DT_TUNING_CODEPATH_DEFAULT = 0, // whatever darktable.codepath says
+  DT_TUNING_CODEPATH_SSE2 = 1,
+  DT_TUNING_CODEPATH_PLAIN = 2
+} dt_tuning_codepath_t;
+
+typedef struct dt_tuning_module_t
+{
+  int threads;                   // OpenMP threads to use, 0 for all of them
+  dt_tuning_codepath_t codepath;
+  int tile_size;                 // process in tiles of at most this many MB, 0 to only tile when out of memory
+} dt_tuning_module_t;
+
+typedef struct dt_tuning_t
+{
+  char filename[PATH_MAX];
+  GHashTable *modules; // op name -> dt_tuning_module_t
+
+  // benchmark support: apply the same settings to all modules and sum up per module timings.
+  gboolean override;
+  dt_tuning_module_t forced;
+  gboolean measure;
+  GHashTable *timings; // op name -> double seconds
+  dt_pthread_mutex_t lock;
+} dt_tuning_t;
+
+void dt_tuning_init(dt_tuning_t *t);
+void dt_tuning_cleanup(dt_tuning_t *t);
+
+/** write the profile back to disk. returns 0 on success. */
+int dt_tuning_save(dt_tuning_t *t);
+
+/** settings for the module with the given op name, NULL if there are none. */
+const dt_tuning_module_t *dt_tuning_get(const dt_tuning_t *t, const char *op);
+void dt_tuning_set(dt_tuning_t *t, const char *op, const dt_tuning_module_t *m);
+
+/** maximum size in bytes of a single tile for op, 0 if there is no preference. */
+size_t dt_tuning_tile_size(const dt_tuning_t *t, const char *op);
+
+/** TRUE if op was found to be faster when processing buffers of the given size in tiles. */
+gboolean dt_tuning_prefers_tiling(const dt_tuning_t *t, const char *op, const size_t size);
+
+/** account for seconds spent processing op, in case we are measuring. */
+void dt_tuning_record(dt_tuning_t *t, const char *op, const double seconds);
+/** forget all timings collected so far. */
+void dt_tuning_reset_timings(dt_tuning_t *t);
+/** seconds spent in op since the last reset, a negative value if it didn't run. */
+double dt_tuning_get_timing(dt_tuning_t *t, const char *op);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
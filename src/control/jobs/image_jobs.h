@@ -24,6 +24,9 @@
 #include <inttypes.h>
 
 dt_job_t *dt_image_load_job_create(int32_t imgid, dt_mipmap_size_t mip);
+/** like dt_image_load_job_create(), but the job turns into a no-op once *serial differs from the value it had
+ * when the job was created. that allows to cheaply drop speculative loads which are no longer wanted. */
+dt_job_t *dt_image_prefetch_job_create(int32_t imgid, dt_mipmap_size_t mip, uint32_t *serial);
 
 dt_job_t *dt_image_import_job_create(uint32_t filmid, const char *filename);
 
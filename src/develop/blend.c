@@ -23,6 +23,10 @@
 #include "develop/masks.h"
 #include "develop/tiling.h"
 
+#if defined(__SSE__)
+#include <emmintrin.h>
+#endif
+
 #define CLAMP_RANGE(x, y, z) (CLAMP(x, y, z))
 
 typedef struct _blend_buffer_desc_t
@@ -36,6 +40,14 @@ typedef struct _blend_buffer_desc_t
 typedef void(_blend_row_func)(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
                               int flag);
 
+/* how dt_develop_blend_process() gets a row of the mask right before blending it */
+typedef enum _blend_row_mask_t
+{
+  DT_BLEND_ROW_MASK_DONE,     // the mask is complete already
+  DT_BLEND_ROW_MASK_OPACITY,  // the global opacity
+  DT_BLEND_ROW_MASK_BLENDIF   // the drawn mask combined with the parametric one
+} _blend_row_mask_t;
+
 static inline void _RGB_2_HSL(const float *RGB, float *HSL)
 {
   float H, S, L;
@@ -243,94 +255,60 @@ static inline void _PX_COPY(const float *src, float *dst)
   dst[2] = src[2];
 }
 
-static inline float _blendif_factor(dt_iop_colorspace_type_t cst, const float *input, const float *output,
-                                    const unsigned int blendif, const float *parameters,
-                                    const unsigned int mask_mode, const unsigned int mask_combine)
+/* what the conditional mask of a module needs of its parameters, prepared once per image */
+typedef struct _blendif_setup_t
 {
-  float result = 1.0f;
-  float scaled[DEVELOP_BLENDIF_SIZE] = { 0.5f };
+  int uniform;         // same conditional factor for every pixel, that is value
+  float value;
+  unsigned int active; // channels with a restricted range, the only ones to look at per pixel
+  int zero;            // a channel spanning the whole range excludes everything after the active ones
+  int polar;           // whether one of them is LCh resp. HSL
+} _blendif_setup_t;
+
+static void _blendif_setup(_blendif_setup_t *s, dt_iop_colorspace_type_t cst, const unsigned int blendif,
+                           const unsigned int mask_mode, const unsigned int mask_combine)
+{
+  const int incl = mask_combine & DEVELOP_COMBINE_INCL;
   unsigned int channel_mask = 0;
+  if(cst == iop_cs_Lab)
+    channel_mask = DEVELOP_BLENDIF_Lab_MASK;
+  else if(cst == iop_cs_rgb)
+    channel_mask = DEVELOP_BLENDIF_RGB_MASK;
+
+  s->uniform = 1;
+  s->value = incl ? 0.0f : 1.0f;
+  s->active = 0;
+  s->zero = 0;
+  s->polar = 0;
+  // not implemented for other color spaces
+  if(!(mask_mode & DEVELOP_MASK_CONDITIONAL) || !channel_mask) return;
+
+  // channels where the sliders span the whole range give a factor of 1 or 0 everywhere. after the first 0
+  // the result stays 0, active channels up to there can only end the product early
+  for(int ch = 0; ch <= DEVELOP_BLENDIF_MAX && !s->zero; ch++)
+  {
+    if((channel_mask & (1 << ch)) == 0) continue;
+    if(blendif & (1 << ch))
+      s->active |= 1 << ch;
+    else if(!(blendif & (1 << (ch + 16))) != !incl)
+      s->zero = 1;
+  }
+
+  const float constant = s->zero ? 0.0f : 1.0f;
+  s->uniform = !s->active;
+  s->value = incl ? 1.0f - constant : constant;
+  s->polar = (s->active & 0x7f00) != 0;
+}
 
-  if(!(mask_mode & DEVELOP_MASK_CONDITIONAL)) return (mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
-
-  switch(cst)
-  {
-    case iop_cs_Lab:
-      scaled[DEVELOP_BLENDIF_L_in] = CLAMP_RANGE(input[0] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
-      scaled[DEVELOP_BLENDIF_A_in]
-          = CLAMP_RANGE((input[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
-      scaled[DEVELOP_BLENDIF_B_in]
-          = CLAMP_RANGE((input[2] + 128.0f) / 256.0f, 0.0f, 1.0f);                 // b scaled to 0..1
-      scaled[DEVELOP_BLENDIF_L_out] = CLAMP_RANGE(output[0] / 100.0f, 0.0f, 1.0f); // L scaled to 0..1
-      scaled[DEVELOP_BLENDIF_A_out]
-          = CLAMP_RANGE((output[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
-      scaled[DEVELOP_BLENDIF_B_out]
-          = CLAMP_RANGE((output[2] + 128.0f) / 256.0f, 0.0f, 1.0f); // b scaled to 0..1
-
-      if(blendif & 0x7f00) // do we need to consider LCh ?
-      {
-        float LCH_input[3];
-        float LCH_output[3];
-        _Lab_2_LCH(input, LCH_input);
-        _Lab_2_LCH(output, LCH_output);
-
-        scaled[DEVELOP_BLENDIF_C_in] = CLAMP_RANGE(LCH_input[1] / (128.0f * sqrtf(2.0f)), 0.0f,
-                                                   1.0f);                     // C scaled to 0..1
-        scaled[DEVELOP_BLENDIF_h_in] = CLAMP_RANGE(LCH_input[2], 0.0f, 1.0f); // h scaled to 0..1
-
-        scaled[DEVELOP_BLENDIF_C_out] = CLAMP_RANGE(LCH_output[1] / (128.0f * sqrtf(2.0f)), 0.0f,
-                                                    1.0f);                      // C scaled to 0..1
-        scaled[DEVELOP_BLENDIF_h_out] = CLAMP_RANGE(LCH_output[2], 0.0f, 1.0f); // h scaled to 0..1
-      }
-
-      channel_mask = DEVELOP_BLENDIF_Lab_MASK;
-
-      break;
-    case iop_cs_rgb:
-      scaled[DEVELOP_BLENDIF_GRAY_in]
-          = CLAMP_RANGE(0.3f * input[0] + 0.59f * input[1] + 0.11f * input[2], 0.0f,
-                        1.0f);                                              // Gray scaled to 0..1
-      scaled[DEVELOP_BLENDIF_RED_in] = CLAMP_RANGE(input[0], 0.0f, 1.0f);   // Red
-      scaled[DEVELOP_BLENDIF_GREEN_in] = CLAMP_RANGE(input[1], 0.0f, 1.0f); // Green
-      scaled[DEVELOP_BLENDIF_BLUE_in] = CLAMP_RANGE(input[2], 0.0f, 1.0f);  // Blue
-      scaled[DEVELOP_BLENDIF_GRAY_out] = CLAMP_RANGE(0.3f * output[0] + 0.59f * output[1] + 0.11f * output[2],
-                                                     0.0f, 1.0f);             // Gray scaled to 0..1
-      scaled[DEVELOP_BLENDIF_RED_out] = CLAMP_RANGE(output[0], 0.0f, 1.0f);   // Red
-      scaled[DEVELOP_BLENDIF_GREEN_out] = CLAMP_RANGE(output[1], 0.0f, 1.0f); // Green
-      scaled[DEVELOP_BLENDIF_BLUE_out] = CLAMP_RANGE(output[2], 0.0f, 1.0f);  // Blue
-
-      if(blendif & 0x7f00) // do we need to consider HSL ?
-      {
-        float HSL_input[3];
-        float HSL_output[3];
-        _RGB_2_HSL(input, HSL_input);
-        _RGB_2_HSL(output, HSL_output);
-
-        scaled[DEVELOP_BLENDIF_H_in] = CLAMP_RANGE(HSL_input[0], 0.0f, 1.0f); // H scaled to 0..1
-        scaled[DEVELOP_BLENDIF_S_in] = CLAMP_RANGE(HSL_input[1], 0.0f, 1.0f); // S scaled to 0..1
-        scaled[DEVELOP_BLENDIF_l_in] = CLAMP_RANGE(HSL_input[2], 0.0f, 1.0f); // L scaled to 0..1
-
-        scaled[DEVELOP_BLENDIF_H_out] = CLAMP_RANGE(HSL_output[0], 0.0f, 1.0f); // H scaled to 0..1
-        scaled[DEVELOP_BLENDIF_S_out] = CLAMP_RANGE(HSL_output[1], 0.0f, 1.0f); // S scaled to 0..1
-        scaled[DEVELOP_BLENDIF_l_out] = CLAMP_RANGE(HSL_output[2], 0.0f, 1.0f); // L scaled to 0..1
-      }
-
-      channel_mask = DEVELOP_BLENDIF_RGB_MASK;
-
-      break;
-    default:
-      return (mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f; // not implemented for other color spaces
-  }
+static inline float _blendif_combine(const _blendif_setup_t *s, const float *scaled, const unsigned int blendif,
+                                     const float *parameters, const unsigned int mask_combine)
+{
+  float result = 1.0f;
 
-  for(int ch = 0; ch <= DEVELOP_BLENDIF_MAX; ch++)
+  int ch;
+  for(ch = 0; ch <= DEVELOP_BLENDIF_MAX; ch++)
   {
-    if((channel_mask & (1 << ch)) == 0) continue; // skip blendif channels not used in this color space
-
-    if((blendif & (1 << ch)) == 0) // deal with channels where sliders span the whole range
-    {
-      result *= !(blendif & (1 << (ch + 16))) == !(mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f : 0.0f;
-      continue;
-    }
+    if((s->active & (1 << ch)) == 0) continue;
 
     if(result <= 0.000001f) break; // no need to continue if we are already at or close to zero
 
@@ -357,10 +335,67 @@ static inline float _blendif_factor(dt_iop_colorspace_type_t cst, const float *i
 
     result *= ((mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - factor : factor);
   }
+  if(s->zero && ch > DEVELOP_BLENDIF_MAX) result = 0.0f;
 
   return (mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - result : result;
 }
 
+static inline void _blendif_scale_Lab(const float *input, const float *output, float *scaled, const int polar)
+{
+  scaled[DEVELOP_BLENDIF_L_in] = CLAMP_RANGE(input[0] / 100.0f, 0.0f, 1.0f);             // L scaled to 0..1
+  scaled[DEVELOP_BLENDIF_A_in] = CLAMP_RANGE((input[1] + 128.0f) / 256.0f, 0.0f, 1.0f);  // a scaled to 0..1
+  scaled[DEVELOP_BLENDIF_B_in] = CLAMP_RANGE((input[2] + 128.0f) / 256.0f, 0.0f, 1.0f);  // b scaled to 0..1
+  scaled[DEVELOP_BLENDIF_L_out] = CLAMP_RANGE(output[0] / 100.0f, 0.0f, 1.0f);            // L scaled to 0..1
+  scaled[DEVELOP_BLENDIF_A_out] = CLAMP_RANGE((output[1] + 128.0f) / 256.0f, 0.0f, 1.0f); // a scaled to 0..1
+  scaled[DEVELOP_BLENDIF_B_out] = CLAMP_RANGE((output[2] + 128.0f) / 256.0f, 0.0f, 1.0f); // b scaled to 0..1
+
+  if(polar) // do we need to consider LCh ?
+  {
+    float LCH_input[3];
+    float LCH_output[3];
+    _Lab_2_LCH(input, LCH_input);
+    _Lab_2_LCH(output, LCH_output);
+
+    scaled[DEVELOP_BLENDIF_C_in] = CLAMP_RANGE(LCH_input[1] / (128.0f * sqrtf(2.0f)), 0.0f,
+                                               1.0f);                     // C scaled to 0..1
+    scaled[DEVELOP_BLENDIF_h_in] = CLAMP_RANGE(LCH_input[2], 0.0f, 1.0f); // h scaled to 0..1
+
+    scaled[DEVELOP_BLENDIF_C_out] = CLAMP_RANGE(LCH_output[1] / (128.0f * sqrtf(2.0f)), 0.0f,
+                                                1.0f);                      // C scaled to 0..1
+    scaled[DEVELOP_BLENDIF_h_out] = CLAMP_RANGE(LCH_output[2], 0.0f, 1.0f); // h scaled to 0..1
+  }
+}
+
+static inline void _blendif_scale_rgb(const float *input, const float *output, float *scaled, const int polar)
+{
+  scaled[DEVELOP_BLENDIF_GRAY_in] = CLAMP_RANGE(0.3f * input[0] + 0.59f * input[1] + 0.11f * input[2], 0.0f,
+                                                1.0f);                  // Gray scaled to 0..1
+  scaled[DEVELOP_BLENDIF_RED_in] = CLAMP_RANGE(input[0], 0.0f, 1.0f);   // Red
+  scaled[DEVELOP_BLENDIF_GREEN_in] = CLAMP_RANGE(input[1], 0.0f, 1.0f); // Green
+  scaled[DEVELOP_BLENDIF_BLUE_in] = CLAMP_RANGE(input[2], 0.0f, 1.0f);  // Blue
+  scaled[DEVELOP_BLENDIF_GRAY_out] = CLAMP_RANGE(0.3f * output[0] + 0.59f * output[1] + 0.11f * output[2],
+                                                 0.0f, 1.0f);             // Gray scaled to 0..1
+  scaled[DEVELOP_BLENDIF_RED_out] = CLAMP_RANGE(output[0], 0.0f, 1.0f);   // Red
+  scaled[DEVELOP_BLENDIF_GREEN_out] = CLAMP_RANGE(output[1], 0.0f, 1.0f); // Green
+  scaled[DEVELOP_BLENDIF_BLUE_out] = CLAMP_RANGE(output[2], 0.0f, 1.0f);  // Blue
+
+  if(polar) // do we need to consider HSL ?
+  {
+    float HSL_input[3];
+    float HSL_output[3];
+    _RGB_2_HSL(input, HSL_input);
+    _RGB_2_HSL(output, HSL_output);
+
+    scaled[DEVELOP_BLENDIF_H_in] = CLAMP_RANGE(HSL_input[0], 0.0f, 1.0f); // H scaled to 0..1
+    scaled[DEVELOP_BLENDIF_S_in] = CLAMP_RANGE(HSL_input[1], 0.0f, 1.0f); // S scaled to 0..1
+    scaled[DEVELOP_BLENDIF_l_in] = CLAMP_RANGE(HSL_input[2], 0.0f, 1.0f); // L scaled to 0..1
+
+    scaled[DEVELOP_BLENDIF_H_out] = CLAMP_RANGE(HSL_output[0], 0.0f, 1.0f); // H scaled to 0..1
+    scaled[DEVELOP_BLENDIF_S_out] = CLAMP_RANGE(HSL_output[1], 0.0f, 1.0f); // S scaled to 0..1
+    scaled[DEVELOP_BLENDIF_l_out] = CLAMP_RANGE(HSL_output[2], 0.0f, 1.0f); // L scaled to 0..1
+  }
+}
+
 static inline void _blend_colorspace_channel_range(dt_iop_colorspace_type_t cst, float *min, float *max)
 {
   switch(cst)
@@ -414,21 +449,45 @@ static inline void _blend_noop(const _blend_buffer_desc_t *bd, const float *a, f
 }
 
 
-/* generate blend mask */
-static void _blend_make_mask(const _blend_buffer_desc_t *bd, const unsigned int blendif,
-                             const float *blendif_parameters, const unsigned int mask_mode,
+static inline float _blend_mask_opacity(const float form, const float conditional,
+                                        const unsigned int mask_combine, const float gopacity)
+{
+  float opacity = (mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - (1.0f - form) * (1.0f - conditional)
+                                                        : form * conditional;
+  opacity = (mask_combine & DEVELOP_COMBINE_INV) ? 1.0f - opacity : opacity;
+  return opacity * gopacity;
+}
+
+/* generate blend mask, with one loop per color space to keep the switch out of the pixels */
+static void _blend_make_mask(const _blend_buffer_desc_t *bd, const _blendif_setup_t *setup,
+                             const unsigned int blendif, const float *blendif_parameters,
                              const unsigned int mask_combine, const float gopacity, const float *a,
                              const float *b, float *mask)
 {
-  for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
+  float scaled[DEVELOP_BLENDIF_SIZE] = { 0.5f };
+
+  if(setup->uniform)
   {
-    float form = mask[i];
-    float conditional
-        = _blendif_factor(bd->cst, &a[j], &b[j], blendif, blendif_parameters, mask_mode, mask_combine);
-    float opacity = (mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - (1.0f - form) * (1.0f - conditional)
-                                                          : form * conditional;
-    opacity = (mask_combine & DEVELOP_COMBINE_INV) ? 1.0f - opacity : opacity;
-    mask[i] = opacity * gopacity;
+    for(size_t i = 0; i < bd->stride / bd->ch; i++)
+      mask[i] = _blend_mask_opacity(mask[i], setup->value, mask_combine, gopacity);
+  }
+  else if(bd->cst == iop_cs_Lab)
+  {
+    for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
+    {
+      _blendif_scale_Lab(&a[j], &b[j], scaled, setup->polar);
+      const float conditional = _blendif_combine(setup, scaled, blendif, blendif_parameters, mask_combine);
+      mask[i] = _blend_mask_opacity(mask[i], conditional, mask_combine, gopacity);
+    }
+  }
+  else /* if(bd->cst == iop_cs_rgb) */
+  {
+    for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
+    {
+      _blendif_scale_rgb(&a[j], &b[j], scaled, setup->polar);
+      const float conditional = _blendif_combine(setup, scaled, blendif, blendif_parameters, mask_combine);
+      mask[i] = _blend_mask_opacity(mask[i], conditional, mask_combine, gopacity);
+    }
   }
 }
 
@@ -542,6 +601,56 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
   }
 }
 
+#if defined(__SSE__)
+/* normal blend of four channel pixels, the same arithmetic as the plain versions for all channels at once */
+static inline void _blend_normal_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                      const float *mask, const int flag, const int bounded)
+{
+  const int Lab = bd->cst == iop_cs_Lab;
+  float max[4] = { 0 }, min[4] = { 0 };
+  _blend_colorspace_channel_range(bd->cst, min, max);
+
+  const __m128 vmin = _mm_loadu_ps(min);
+  const __m128 vmax = _mm_loadu_ps(max);
+  const __m128 one = _mm_set1_ps(1.0f);
+  // Lab is blended scaled to about 0..1, the division is exact for rgb
+  const __m128 scale = Lab ? _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f) : one;
+  // a and b of the input when blending only the lightness
+  const __m128 keep = (Lab && flag) ? _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, 0)) : _mm_setzero_ps();
+
+  for(size_t i = 0, j = 0; j < bd->stride; i++, j += 4)
+  {
+    const __m128 opacity = _mm_set1_ps(mask[i]);
+    const __m128 ta = _mm_div_ps(_mm_loadu_ps(a + j), scale);
+    const __m128 tb = _mm_div_ps(_mm_loadu_ps(b + j), scale);
+    __m128 tr = _mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(one, opacity)), _mm_mul_ps(tb, opacity));
+    // min/max in this order keep NaNs as CLAMP() does
+    if(bounded) tr = _mm_min_ps(vmax, _mm_max_ps(vmin, tr));
+    tr = _mm_or_ps(_mm_and_ps(keep, ta), _mm_andnot_ps(keep, tr));
+    _mm_storeu_ps(b + j, _mm_mul_ps(tr, scale));
+    b[j + 3] = mask[i];
+  }
+}
+
+static void _blend_normal_bounded_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                       const float *mask, int flag)
+{
+  if(bd->cst == iop_cs_RAW || bd->ch != 4)
+    _blend_normal_bounded(bd, a, b, mask, flag);
+  else
+    _blend_normal_sse2(bd, a, b, mask, flag, 1);
+}
+
+static void _blend_normal_unbounded_sse2(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                         const float *mask, int flag)
+{
+  if(bd->cst == iop_cs_RAW || bd->ch != 4)
+    _blend_normal_unbounded(bd, a, b, mask, flag);
+  else
+    _blend_normal_sse2(bd, a, b, mask, flag, 0);
+}
+#endif
+
 /* lighten */
 static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
                            int flag)
@@ -2746,6 +2855,13 @@ _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
       break;
     case DEVELOP_BLEND_NORMAL:
     case DEVELOP_BLEND_BOUNDED:
+#if defined(__SSE__)
+      if(darktable.codepath.SSE2 && !darktable.codepath.OPENMP_SIMD)
+      {
+        blend = _blend_normal_bounded_sse2;
+        break;
+      }
+#endif
       blend = _blend_normal_bounded;
       break;
     case DEVELOP_BLEND_COLORADJUST:
@@ -2784,6 +2900,13 @@ _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
     case DEVELOP_BLEND_NORMAL2:
     case DEVELOP_BLEND_UNBOUNDED:
     default:
+#if defined(__SSE__)
+      if(darktable.codepath.SSE2 && !darktable.codepath.OPENMP_SIMD)
+      {
+        blend = _blend_normal_unbounded_sse2;
+        break;
+      }
+#endif
       blend = _blend_normal_unbounded;
       break;
   }
@@ -2862,15 +2985,22 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
 
   float *const mask = _mask;
 
-  if(mask_mode == DEVELOP_MASK_ENABLED)
+  const int maskblur = fabs(d->radius) <= 0.1f ? 0 : 1;
+
+  /* check if mask should be suppressed temporarily (i.e. just set to global opacity value) */
+  const int suppress = self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module)
+                       && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH);
+
+  /* the rows of the mask which only depend on the same row of the images are made right before blending
+   * that row, in the same pass and while the row is still in the cache. a blurred mask needs all of it. */
+  _blend_row_mask_t row_mask = DT_BLEND_ROW_MASK_DONE;
+  _blendif_setup_t setup;
+  _blendif_setup(&setup, cst, d->blendif, d->mask_mode, d->mask_combine);
+
+  if(mask_mode == DEVELOP_MASK_ENABLED || suppress)
   {
     /* blend uniformly (no drawn or parametric mask) */
-
-    const size_t buffsize = (size_t)roi_out->width * roi_out->height;
-#ifdef _OPENMP
-#pragma omp parallel for default(none)
-#endif
-    for(size_t i = 0; i < buffsize; i++) mask[i] = opacity;
+    row_mask = DT_BLEND_ROW_MASK_OPACITY;
   }
   else
   {
@@ -2915,28 +3045,28 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       for(size_t i = 0; i < buffsize; i++) mask[i] = fill;
     }
 
+    if(!maskblur)
+      row_mask = DT_BLEND_ROW_MASK_BLENDIF;
+    else
+    {
 #ifdef _OPENMP
-#pragma omp parallel for default(none)
+#pragma omp parallel for default(none) shared(setup)
 #endif
-    for(size_t y = 0; y < roi_out->height; y++)
-    {
+      for(size_t y = 0; y < roi_out->height; y++)
+      {
 
-      size_t iindex = ((size_t)(y + yoffs) * iwidth + xoffs) * ch;
-      size_t oindex = (size_t)y * roi_out->width * ch;
-      _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)roi_out->width * ch, .ch = ch, .bch = bch };
-      float *in = (float *)ivoid + iindex;
-      float *out = (float *)ovoid + oindex;
-      float *m = (float *)mask + y * roi_out->width;
-      _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in,
-                       out, m);
-    }
+        size_t iindex = ((size_t)(y + yoffs) * iwidth + xoffs) * ch;
+        size_t oindex = (size_t)y * roi_out->width * ch;
+        _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)roi_out->width * ch, .ch = ch, .bch = bch };
+        float *in = (float *)ivoid + iindex;
+        float *out = (float *)ovoid + oindex;
+        float *m = (float *)mask + y * roi_out->width;
+        _blend_make_mask(&bd, &setup, d->blendif, d->blendif_parameters, d->mask_combine, opacity, in, out, m);
+      }
 
-    const int maskblur = fabs(d->radius) <= 0.1f ? 0 : 1;
-    const int gaussian = d->radius > 0.0f ? 1 : 0;
-    const float radius = fabs(d->radius);
+      const int gaussian = d->radius > 0.0f ? 1 : 0;
+      const float radius = fabs(d->radius);
 
-    if(maskblur)
-    {
       if(gaussian)
       {
         const float sigma = radius * roi_out->scale / piece->iscale;
@@ -2956,25 +3086,11 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
         // potential further blend algorithm (bilateral grid?)
       }
     }
-
-    /* check if mask should be suppressed temporarily (i.e. just set to global
-     * opacity value) */
-    if(self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module)
-       && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH))
-    {
-#ifdef _OPENMP
-#pragma omp parallel for default(none)
-#endif
-      for(size_t k = 0; k < (size_t)roi_out->height * roi_out->width; k++)
-      {
-        mask[k] = opacity;
-      }
-    }
   }
 
 /* now apply blending with per-pixel opacity value as defined in mask */
 #ifdef _OPENMP
-#pragma omp parallel for default(none)
+#pragma omp parallel for default(none) shared(setup, row_mask)
 #endif
   for(size_t y = 0; y < roi_out->height; y++)
   {
@@ -2985,6 +3101,11 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
     float *out = (float *)ovoid + oindex;
     float *m = (float *)mask + y * roi_out->width;
 
+    if(row_mask == DT_BLEND_ROW_MASK_OPACITY)
+      for(size_t x = 0; x < roi_out->width; x++) m[x] = opacity;
+    else if(row_mask == DT_BLEND_ROW_MASK_BLENDIF)
+      _blend_make_mask(&bd, &setup, d->blendif, d->blendif_parameters, d->mask_combine, opacity, in, out, m);
+
     if(request_mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY)
       display_channel(&bd, in, out, m, request_mask_display);
     else
@@ -40,6 +40,7 @@
 #include "develop/imageop.h"
 #include "develop/lightroom.h"
 #include "develop/masks.h"
+#include "develop/pyramid.h"
 #include "gui/gtk.h"
 #include "gui/presets.h"
 
@@ -102,6 +103,13 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
     dt_dev_pixelpipe_init(dev->pipe);
     dt_dev_pixelpipe_init_preview(dev->preview_pipe);
 
+    const int pyramid_size = dt_conf_get_int("cache_raw_pyramid");
+    if(pyramid_size > 0)
+    {
+      dev->pyramid = (dt_dev_pyramid_t *)malloc(sizeof(dt_dev_pyramid_t));
+      dt_dev_pyramid_init(dev->pyramid, (size_t)pyramid_size * 1024 * 1024);
+    }
+
     dev->histogram = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
     dev->histogram_pre_tonecurve = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
     dev->histogram_pre_levels = (uint32_t *)calloc(4 * 256, sizeof(uint32_t));
@@ -144,6 +152,11 @@ void dt_dev_cleanup(dt_develop_t *dev)
     dt_dev_pixelpipe_cleanup(dev->preview_pipe);
     free(dev->preview_pipe);
   }
+  if(dev->pyramid)
+  {
+    dt_dev_pyramid_cleanup(dev->pyramid);
+    free(dev->pyramid);
+  }
   while(dev->history)
   {
     dt_dev_free_history_item(((dt_dev_history_item_t *)dev->history->data));
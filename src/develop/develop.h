@@ -111,6 +111,7 @@ typedef struct dt_dev_proxy_exposure_t
 } dt_dev_proxy_exposure_t;
 
 struct dt_dev_pixelpipe_t;
+struct dt_dev_pyramid_t;
 typedef struct dt_develop_t
 {
   int32_t gui_attached; // != 0 if the gui should be notified of changes in hist stack and modules should be
@@ -133,6 +134,8 @@ typedef struct dt_develop_t
   // image processing pipeline with caching
   struct dt_dev_pixelpipe_t *pipe, *preview_pipe;
   dt_pthread_mutex_t pipe_mutex, preview_pipe_mutex; // these are locked while the pipes are still in use
+  // demosaiced images of the full pipe at lower resolutions, NULL if disabled
+  struct dt_dev_pyramid_t *pyramid;
 
   // image under consideration, which
   // is copied each time an image is changed. this means we have some information
@@ -26,6 +26,7 @@
 #include "common/interpolation.h"
 #include "common/module.h"
 #include "common/opencl.h"
+#include "common/tuning.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/develop.h"
@@ -176,7 +177,15 @@ static void default_process(struct dt_iop_module_t *self, struct dt_dev_pixelpip
                             const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                             const struct dt_iop_roi_t *const roi_out)
 {
-  if(darktable.codepath.OPENMP_SIMD && self->process_plain)
+  // the tuning profile might know better than the defaults for this machine
+  const dt_tuning_module_t *tuning = dt_tuning_get(darktable.tuning, self->op);
+  const dt_tuning_codepath_t codepath = tuning ? tuning->codepath : DT_TUNING_CODEPATH_DEFAULT;
+#ifdef _OPENMP
+  const int threads = omp_get_max_threads();
+  if(tuning && tuning->threads > 0) omp_set_num_threads(MIN(tuning->threads, dt_get_num_threads()));
+#endif
+
+  if((darktable.codepath.OPENMP_SIMD || codepath == DT_TUNING_CODEPATH_PLAIN) && self->process_plain)
     self->process_plain(self, piece, i, o, roi_in, roi_out);
 #if defined(__SSE__)
   else if(darktable.codepath.SSE2 && self->process_sse2)
@@ -186,6 +195,24 @@ static void default_process(struct dt_iop_module_t *self, struct dt_dev_pixelpip
     self->process_plain(self, piece, i, o, roi_in, roi_out);
   else
     dt_unreachable_codepath_with_desc(self->op);
+
+#ifdef _OPENMP
+  if(tuning && tuning->threads > 0) omp_set_num_threads(threads);
+#endif
+}
+
+dt_iop_process_pixels_t dt_iop_get_process_pixels(const dt_iop_module_t *module)
+{
+  // the same choice as in default_process(), so that fused and single runs give the same pixels
+  const dt_tuning_module_t *tuning = dt_tuning_get(darktable.tuning, module->op);
+  const dt_tuning_codepath_t codepath = tuning ? tuning->codepath : DT_TUNING_CODEPATH_DEFAULT;
+
+  if(darktable.codepath.OPENMP_SIMD || codepath == DT_TUNING_CODEPATH_PLAIN) return module->process_pixels;
+#if defined(__SSE__)
+  if(darktable.codepath.SSE2 && module->process_sse2)
+    return module->process_pixels_sse2; // no plain fallback, process() wouldn't take it either
+#endif
+  return module->process_pixels;
 }
 
 static dt_introspection_field_t *default_get_introspection_linear()
@@ -299,6 +326,13 @@ int dt_iop_load_module_so(void *m, const char *libname, const char *op)
 
   if(!g_module_symbol(module->module, "process", (gpointer) & (module->process_plain))) goto error;
 
+  if(!g_module_symbol(module->module, "process_pixels", (gpointer) & (module->process_pixels)))
+    module->process_pixels = NULL;
+  if(!g_module_symbol(module->module, "process_pixels_sse2", (gpointer) & (module->process_pixels_sse2)))
+    module->process_pixels_sse2 = NULL;
+  if(!g_module_symbol(module->module, "process_pixels_setup", (gpointer) & (module->process_pixels_setup)))
+    module->process_pixels_setup = NULL;
+
   if(!darktable.opencl->inited
      || !g_module_symbol(module->module, "process_cl", (gpointer) & (module->process_cl)))
     module->process_cl = NULL;
@@ -417,6 +451,9 @@ static int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t
   module->process_sse2 = so->process_sse2;
   module->process_cl = so->process_cl;
   module->process_tiling_cl = so->process_tiling_cl;
+  module->process_pixels = so->process_pixels;
+  module->process_pixels_sse2 = so->process_pixels_sse2;
+  module->process_pixels_setup = so->process_pixels_setup;
   module->distort_transform = so->distort_transform;
   module->distort_backtransform = so->distort_backtransform;
   module->modify_roi_in = so->modify_roi_in;
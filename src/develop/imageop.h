@@ -91,7 +91,9 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_PREVIEW_NON_OPENCL
   = 1 << 8, // Preview pixelpipe of this module must not run on GPU but always on CPU
   IOP_FLAGS_NO_HISTORY_STACK = 1 << 9, // This iop will never show up in the history stack
-  IOP_FLAGS_NO_MASKS = 1 << 10         // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_NO_MASKS = 1 << 10,        // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_ALLOW_BANDS
+  = 1 << 11 // process() gives the same rows on a band of the image (plus tiling overlap) as on all of it
 } dt_iop_flags_t;
 
 /** status of a module*/
@@ -225,6 +227,11 @@ typedef struct dt_iop_module_so_t
   int (*process_tiling_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                            const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                            const struct dt_iop_roi_t *const roi_out, const int bpp);
+  void (*process_pixels)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const float *const in, float *const out, const size_t npixels);
+  void (*process_pixels_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                              const float *const in, float *const out, const size_t npixels);
+  void (*process_pixels_setup)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece);
 
   int (*distort_transform)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *points,
                            size_t points_count);
@@ -428,6 +435,14 @@ typedef struct dt_iop_module_t
   int (*process_tiling_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                            const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                            const struct dt_iop_roi_t *const roi_out, const int bpp);
+  /** the per pixel core of process() for pointwise modules, lets the pipe fuse runs of them. */
+  void (*process_pixels)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const float *const in, float *const out, const size_t npixels);
+  /** a variant of process_pixels(), that can contain SSE2 intrinsics. */
+  void (*process_pixels_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                              const float *const in, float *const out, const size_t npixels);
+  /** what process() does once per buffer before process_pixels() runs on it. */
+  void (*process_pixels_setup)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece);
 
   /** this functions are used for distort iop
    * points is an array of float {x1,y1,x2,y2,...}
@@ -528,6 +543,13 @@ typedef enum dt_iop_colorspace_type_t
 /** find which colorspace the module works within */
 dt_iop_colorspace_type_t dt_iop_module_colorspace(const dt_iop_module_t *module);
 
+typedef void (*dt_iop_process_pixels_t)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                        const float *const in, float *const out, const size_t npixels);
+
+/** the process_pixels() variant matching the code path process() takes for this module, NULL if there is
+ * none. */
+dt_iop_process_pixels_t dt_iop_get_process_pixels(const dt_iop_module_t *module);
+
 dt_iop_module_t *get_colorout_module();
 
 /** returns the localized plugin name for a given op name. must not be freed. */
@@ -40,7 +40,8 @@ typedef enum dt_dev_request_flags_t
 {
   DT_REQUEST_NONE = 0,
   DT_REQUEST_ON = 1 << 0,
-  DT_REQUEST_ONLY_IN_GUI = 1 << 1
+  DT_REQUEST_ONLY_IN_GUI = 1 << 1,
+  DT_REQUEST_ONLY_DISPLAYED = 1 << 2 // histogram is only drawn, it may be collected on a subsampled grid
 } dt_dev_request_flags_t;
 
 // params to be used to collect histogram
@@ -52,6 +53,8 @@ typedef struct dt_dev_histogram_collection_params_t
   uint32_t bins_count;
   /** in most cases, bins_count-1. */
   float mul;
+  /** only every step-th pixel of every step-th row is collected. 0 or 1 for all of them. */
+  uint32_t step;
 } dt_dev_histogram_collection_params_t;
 
 // params used to collect histogram during last histogram capture
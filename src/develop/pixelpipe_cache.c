@@ -17,6 +17,7 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/half.h"
 #include "develop/format.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
@@ -32,9 +33,19 @@
 //   ping, pong, and priority buffer (focused plugin)
 // - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
 
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, int half_entries)
 {
   cache->entries = entries;
+  cache->length = (size_t *)calloc(entries, sizeof(size_t));
+  cache->half_ok = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->half_entries = half_entries;
+  cache->half_data = (uint16_t **)calloc(half_entries, sizeof(uint16_t *));
+  cache->half_size = (size_t *)calloc(half_entries, sizeof(size_t));
+  cache->half_length = (size_t *)calloc(half_entries, sizeof(size_t));
+  cache->half_dsc = (dt_iop_buffer_dsc_t *)calloc(half_entries, sizeof(dt_iop_buffer_dsc_t));
+  cache->half_hash = (uint64_t *)calloc(half_entries, sizeof(uint64_t));
+  cache->half_used = (int32_t *)calloc(half_entries, sizeof(int32_t));
+  for(int k = 0; k < half_entries; k++) cache->half_hash[k] = -1;
   cache->data = (void **)calloc(entries, sizeof(void *));
   cache->size = (size_t *)calloc(entries, sizeof(size_t));
   cache->dsc = (dt_iop_buffer_dsc_t *)calloc(entries, sizeof(dt_iop_buffer_dsc_t));
@@ -75,6 +86,15 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
   free(cache->hash);
   free(cache->used);
   free(cache->size);
+  free(cache->length);
+  free(cache->half_ok);
+  for(int k = 0; k < cache->half_entries; k++) dt_free_align(cache->half_data[k]);
+  free(cache->half_data);
+  free(cache->half_size);
+  free(cache->half_length);
+  free(cache->half_dsc);
+  free(cache->half_hash);
+  free(cache->half_used);
 }
 
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
@@ -117,9 +137,51 @@ int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint
   // search for hash in cache
   for(int32_t k = 0; k < cache->entries; k++)
     if(cache->hash[k] == hash) return 1;
+  for(int32_t k = 0; k < cache->half_entries; k++)
+    if(cache->half_hash[k] == hash) return 1;
   return 0;
 }
 
+// keep the content of line k in the second tier, before it is given away
+static void _cache_demote(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  if(!cache->half_ok[k] || cache->hash[k] == (uint64_t)-1 || cache->dsc[k].datatype != TYPE_FLOAT) return;
+
+  // an empty line, the one with the same hash or the least recently used one
+  int h = -1, max_used = -1;
+  for(int i = 0; i < cache->half_entries && h < 0; i++)
+    if(cache->half_hash[i] == (uint64_t)-1 || cache->half_hash[i] == cache->hash[k]) h = i;
+  for(int i = 0; i < cache->half_entries; i++)
+  {
+    if(h < 0 && cache->half_used[i] > max_used)
+    {
+      max_used = cache->half_used[i];
+      h = i;
+    }
+    cache->half_used[i]++;
+  }
+  if(h < 0) return;
+
+  const size_t count = cache->length[k] / sizeof(float);
+  if(cache->half_size[h] < count * sizeof(uint16_t))
+  {
+    dt_free_align(cache->half_data[h]);
+    cache->half_data[h] = (uint16_t *)dt_alloc_align(16, count * sizeof(uint16_t));
+    cache->half_size[h] = cache->half_data[h] ? count * sizeof(uint16_t) : 0;
+  }
+  if(!cache->half_data[h])
+  {
+    cache->half_hash[h] = -1;
+    return;
+  }
+
+  dt_float_to_half(cache->half_data[h], (const float *)cache->data[k], count);
+  cache->half_dsc[h] = cache->dsc[k];
+  cache->half_hash[h] = cache->hash[k];
+  cache->half_length[h] = cache->length[k];
+  cache->half_used[h] = 0;
+}
+
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
                                          void **data, dt_iop_buffer_dsc_t **dsc)
 {
@@ -164,9 +226,10 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
 
   if(!*data || sz < size)
   {
-    // kill LRU entry
+    // kill LRU entry, its data might live on in the second tier
     // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
     // weight);
+    if(cache->hash[max] != hash) _cache_demote(cache, max);
     if(cache->size[max] < size)
     {
       dt_free_align(cache->data[max]);
@@ -185,6 +248,21 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
 
     cache->hash[max] = hash;
     cache->used[max] = weight;
+    cache->length[max] = size;
+    cache->half_ok[max] = 0;
+
+    // the second tier might still have it
+    for(int h = 0; h < cache->half_entries; h++)
+    {
+      if(cache->half_hash[h] != hash || cache->half_length[h] < size) continue;
+      dt_half_to_float((float *)*data, cache->half_data[h], size / sizeof(float));
+      cache->dsc[max] = cache->half_dsc[h];
+      cache->half_hash[h] = -1;
+      // it can go back there
+      cache->half_ok[max] = 1;
+      return 0;
+    }
+
     cache->misses++;
     return 1;
   }
@@ -200,6 +278,17 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
     cache->used[k] = 0;
     ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
   }
+  for(int k = 0; k < cache->half_entries; k++)
+  {
+    cache->half_hash[k] = -1;
+    cache->half_used[k] = 0;
+  }
+}
+
+void dt_dev_pixelpipe_cache_allow_half(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data) cache->half_ok[k] = 1;
 }
 
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
@@ -233,6 +322,8 @@ void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
     printf("used %d by %" PRIu64 "", cache->used[k], cache->hash[k]);
     printf("\n");
   }
+  for(int k = 0; k < cache->half_entries; k++)
+    printf("pixelpipe half cacheline %d used %d by %" PRIu64 "\n", k, cache->half_used[k], cache->half_hash[k]);
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
 }
 
@@ -41,15 +41,27 @@ typedef struct dt_dev_pixelpipe_cache_t
 #ifdef HAVE_OPENCL
   void **gpu_mem;
 #endif
+  size_t *length; // bytes asked for when the line was filled
+  int32_t *half_ok;
+  // second tier: lines pushed out of the ones above are kept here as half floats, if they were allowed to.
+  // it holds as many lines again in half the memory, buffers are allocated when they are first needed.
+  int32_t half_entries;
+  uint16_t **half_data;
+  size_t *half_size;
+  size_t *half_length;
+  struct dt_iop_buffer_dsc_t *half_dsc;
+  uint64_t *half_hash;
+  int32_t *half_used;
   // profiling:
   uint64_t queries;
   uint64_t misses;
 } dt_dev_pixelpipe_cache_t;
 
-/** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
+/** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes,
+  and half_entries lines of half floats behind them.
   \param[out] returns 0 if fail to allocate mem cache.
 */
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, int half_entries);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
 
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
@@ -58,7 +70,7 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const struct dt_iop_roi_t *roi,
 
 /** returns the float data buffer for the given hash from the cache. if the hash does not match any
   * cache line, the least recently used cache line will be cleared and an empty buffer is returned
-  * together with a non-zero return value. */
+  * together with a non-zero return value. a line found in the second tier is converted back to floats. */
 int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
                                void **data, struct dt_iop_buffer_dsc_t **dsc);
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
@@ -66,6 +78,10 @@ int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const
 int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
                                         void **data, struct dt_iop_buffer_dsc_t **dsc, int weight);
 
+/** the line of this buffer may go to the second tier when it is pushed out. only for float data that
+  * doesn't need full precision any more, until the line is handed out for another hash. */
+void dt_dev_pixelpipe_cache_allow_half(dt_dev_pixelpipe_cache_t *cache, void *data);
+
 /** test availability of a cache line without destroying another, if it is not found. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
 
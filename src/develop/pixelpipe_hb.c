@@ -22,12 +22,14 @@
 #include "common/histogram.h"
 #include "common/imageio.h"
 #include "common/opencl.h"
+#include "common/tuning.h"
 #include "control/control.h"
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/format.h"
 #include "develop/imageop_math.h"
 #include "develop/pixelpipe.h"
+#include "develop/pyramid.h"
 #include "develop/tiling.h"
 #include "gui/gtk.h"
 #include "libs/colorpicker.h"
@@ -137,13 +139,19 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
-  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size,
+                                  dt_conf_get_bool("pixelpipe_cache_half") ? entries : 0))
+    return 0;
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
   pipe->processing = 0;
   pipe->shutdown = 0;
   pipe->opencl_error = 0;
   pipe->tiling = 0;
+  pipe->fuse_pointwise = dt_conf_get_bool("pixelpipe_fuse_pointwise");
+  pipe->wavefront_band = dt_conf_get_int("pixelpipe_wavefront_band_size");
+  pipe->colorout_priority = -1;
+  memset(&pipe->pool_stats, 0, sizeof(pipe->pool_stats));
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   pipe->input_timestamp = 0;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
@@ -187,6 +195,7 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
+  dt_bufferpool_scope_forget(darktable.bufferpool, &pipe->pool_stats);
   pipe->icc_type = DT_COLORSPACE_NONE;
   g_free(pipe->icc_filename);
   pipe->icc_filename = NULL;
@@ -278,10 +287,12 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   // call reset_params on all pieces first.
+  pipe->colorout_priority = -1;
   GList *nodes = pipe->nodes;
   while(nodes)
   {
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!strcmp(piece->module->op, "colorout")) pipe->colorout_priority = piece->module->priority;
     piece->hash = 0;
     piece->enabled = piece->module->default_enabled;
     dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params,
@@ -358,9 +369,54 @@ static void get_output_format(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe,
 }
 
 
+// the output of modules after colorout, and anything of the preview pipe, doesn't need full float precision
+// to be reused. the darkroom pipes may keep it as half floats once it is pushed out of their cache.
+static void _cache_allow_half(dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module, void *data)
+{
+  if(pipe->type != DT_DEV_PIXELPIPE_PREVIEW && pipe->type != DT_DEV_PIXELPIPE_FULL) return;
+  // not floats at all
+  if(!strcmp(module->op, "gamma")) return;
+
+  if(pipe->type == DT_DEV_PIXELPIPE_FULL
+     && (pipe->colorout_priority < 0 || module->priority <= pipe->colorout_priority))
+    return;
+
+  dt_dev_pixelpipe_cache_allow_half(&(pipe->cache), data);
+}
+
+// tile if we have to, or if this machine's tuning profile says the module runs faster from smaller tiles
+static inline gboolean _piece_wants_tiling(const dt_iop_module_t *module, const dt_iop_roi_t *roi_in,
+                                           const dt_iop_roi_t *roi_out, const unsigned bpp,
+                                           const dt_develop_tiling_t *tiling)
+{
+  const size_t width = MAX(roi_in->width, roi_out->width);
+  const size_t height = MAX(roi_in->height, roi_out->height);
+  return !dt_tiling_piece_fits_host_memory(width, height, bpp, tiling->factor, tiling->overhead)
+         || dt_tuning_prefers_tiling(darktable.tuning, module->op, width * height * bpp);
+}
+
 // helper to get per module histogram
-static void histogram_collect(dt_dev_pixelpipe_iop_t *piece, const void *pixel, const dt_iop_roi_t *roi,
-                              uint32_t **histogram, uint32_t *histogram_max)
+//
+// histograms which are only drawn are collected from about this many pixels of larger buffers. the step is
+// rounded, so buffers of less than 2.25 times that (147k pixels) are taken whole, and the largest preview of
+// 720x450 (324k pixels) is collected from every second pixel of every second row.
+#define DT_HISTOGRAM_DISPLAY_PIXELS (1 << 16)
+
+static uint32_t histogram_step(const dt_dev_pixelpipe_iop_t *piece, const dt_histogram_roi_t *roi)
+{
+  if(!(piece->request_histogram & DT_REQUEST_ONLY_DISPLAYED)) return 1;
+  const float pixels
+      = (float)(roi->width - roi->crop_width - roi->crop_x) * (roi->height - roi->crop_height - roi->crop_y);
+  return MAX(1, (int)roundf(sqrtf(pixels / DT_HISTOGRAM_DISPLAY_PIXELS)));
+}
+
+static int pixelpipe_picker_helper(dt_iop_module_t *module, const dt_iop_roi_t *roi, float *picked_color,
+                                   float *picked_color_min, float *picked_color_max,
+                                   dt_pixelpipe_picker_source_t picker_source, int *box);
+
+// also does the input colour picker of the module if it picks from the same buffer, and returns whether it did
+static int histogram_collect(dt_dev_pixelpipe_iop_t *piece, const void *pixel, const dt_iop_roi_t *roi,
+                             uint32_t **histogram, uint32_t *histogram_max)
 {
   dt_dev_histogram_collection_params_t histogram_params = piece->histogram_params;
 
@@ -375,11 +431,43 @@ static void histogram_collect(dt_dev_pixelpipe_iop_t *piece, const void *pixel,
 
     histogram_params.roi = &histogram_roi;
   }
+  histogram_params.step = histogram_step(piece, histogram_params.roi);
 
   const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(piece->module);
 
-  dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, pixel, histogram);
+  // the picker needs the whole buffer and 4 channels, see pixelpipe_picker()
+  dt_iop_module_t *module = piece->module;
+  const dt_develop_t *dev = module->dev;
+  dt_histogram_picker_t picker, *pick = NULL;
+  int picked = 0;
+  if(piece->histogram_params.roi == NULL && piece->dsc_in.channels == 4 && cst != iop_cs_RAW
+     && dev->gui_attached && piece->pipe == dev->preview_pipe && module == dev->gui_module
+     && module->request_color_pick != DT_REQUEST_COLORPICK_OFF)
+  {
+    picked = 1;
+    if(!pixelpipe_picker_helper(module, roi, module->picked_color, module->picked_color_min,
+                                module->picked_color_max, PIXELPIPE_PICKER_INPUT, picker.box))
+    {
+      memcpy(picker.mean, module->picked_color, sizeof(picker.mean));
+      memcpy(picker.min, module->picked_color_min, sizeof(picker.min));
+      memcpy(picker.max, module->picked_color_max, sizeof(picker.max));
+      pick = &picker;
+    }
+  }
+
+  const int filled = dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, pixel, histogram, pick);
   dt_histogram_max_helper(&piece->histogram_stats, cst, histogram, histogram_max);
+
+  // without memory for the picker the caller has to run it on its own
+  if(pick && !filled) picked = 0;
+
+  if(pick && filled)
+  {
+    memcpy(module->picked_color, picker.mean, sizeof(picker.mean));
+    memcpy(module->picked_color_min, picker.min, sizeof(picker.min));
+    memcpy(module->picked_color_max, picker.max, sizeof(picker.max));
+  }
+  return picked;
 }
 
 #ifdef HAVE_OPENCL
@@ -422,10 +510,11 @@ static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_me
 
     histogram_params.roi = &histogram_roi;
   }
+  histogram_params.step = histogram_step(piece, histogram_params.roi);
 
   const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(piece->module);
 
-  dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, pixel, histogram);
+  dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, pixel, histogram, NULL);
   dt_histogram_max_helper(&piece->histogram_stats, cst, histogram, histogram_max);
 
   if(tmpbuf) dt_free_align(tmpbuf);
@@ -576,6 +665,701 @@ error:
 #endif
 
 
+// the darkroom keeps the demosaiced image of the full pipe in a pyramid, see develop/pyramid.h
+static inline gboolean _pyramid_applies(const dt_dev_pixelpipe_t *pipe, const dt_develop_t *dev,
+                                        const dt_iop_module_t *module, const dt_iop_roi_t *roi_out)
+{
+  return dev->pyramid && pipe == dev->pipe && roi_out->scale <= DT_DEV_PYRAMID_MAX_SCALE
+         && !strcmp(module->op, "demosaic");
+}
+
+// history up to and including the module at pos, without the roi
+static inline uint64_t _pyramid_hash(dt_dev_pixelpipe_t *pipe, const int pos)
+{
+  const dt_iop_roi_t roi = { 0 };
+  return dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, pos);
+}
+
+// the whole output of the piece at the scale of roi
+static inline void _pyramid_full_roi(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi,
+                                     dt_iop_roi_t *full)
+{
+  *full = (dt_iop_roi_t){ 0, 0, piece->buf_out.width * roi->scale, piece->buf_out.height * roi->scale,
+                          roi->scale };
+}
+
+static inline gboolean _pyramid_covers_image(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi)
+{
+  dt_iop_roi_t full;
+  _pyramid_full_roi(piece, roi, &full);
+  return roi->x == 0 && roi->y == 0 && abs(roi->width - full.width) <= 1 && abs(roi->height - full.height) <= 1;
+}
+
+
+// longest run of pointwise modules processed in one pass, and pixels per work item of that pass. a work item
+// stays in the cpu cache while all modules of the run go over it.
+#define DT_DEV_PIXELPIPE_FUSED_MAX 16
+#define DT_DEV_PIXELPIPE_FUSED_CHUNK 2048
+
+typedef struct dt_dev_pixelpipe_fused_t
+{
+  int count;
+  dt_iop_module_t *module[DT_DEV_PIXELPIPE_FUSED_MAX];
+  dt_dev_pixelpipe_iop_t *piece[DT_DEV_PIXELPIPE_FUSED_MAX];
+  dt_iop_process_pixels_t process[DT_DEV_PIXELPIPE_FUSED_MAX];
+  int overlap[DT_DEV_PIXELPIPE_FUSED_MAX]; // rows needed around a band, for wavefront runs
+} dt_dev_pixelpipe_fused_t;
+
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+// does something need the input or output of this piece on its own: blending, histogram or color picker (of
+// the focused module)?
+static gboolean _piece_needs_own_buffers(dt_develop_t *dev, dt_iop_module_t *module,
+                                         dt_dev_pixelpipe_iop_t *piece)
+{
+  if(module == dev->gui_module) return TRUE;
+
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  if(bp && (bp->mask_mode & DEVELOP_MASK_ENABLED)) return TRUE;
+
+  return (dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
+         && (piece->request_histogram & DT_REQUEST_ON);
+}
+
+// a piece can be part of a fused run if it has a per pixel core for the code path process() would take, and
+// if nothing needs its own input or output.
+static gboolean _piece_is_pointwise(dt_develop_t *dev, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                                    const dt_iop_roi_t *roi_out)
+{
+  if(!module->process_pixels || piece->colors != 4 || _piece_needs_own_buffers(dev, module, piece))
+    return FALSE;
+
+  if(!dt_iop_get_process_pixels(module)) return FALSE;
+
+  dt_iop_roi_t roi_in;
+  module->modify_roi_in(module, piece, roi_out, &roi_in);
+  return !memcmp(&roi_in, roi_out, sizeof(dt_iop_roi_t));
+}
+
+// runs are collected from the back
+static void _fused_run_reverse(dt_dev_pixelpipe_fused_t *run)
+{
+  for(int k = 0; k < run->count / 2; k++)
+  {
+    const int l = run->count - 1 - k;
+    dt_iop_module_t *module = run->module[k];
+    dt_dev_pixelpipe_iop_t *piece = run->piece[k];
+    dt_iop_process_pixels_t process = run->process[k];
+    const int overlap = run->overlap[k];
+    run->module[k] = run->module[l];
+    run->piece[k] = run->piece[l];
+    run->process[k] = run->process[l];
+    run->overlap[k] = run->overlap[l];
+    run->module[l] = module;
+    run->piece[l] = piece;
+    run->process[l] = process;
+    run->overlap[l] = overlap;
+  }
+}
+
+// collect the run of pointwise modules that ends with the one at pos. skipped modules don't break it, a
+// cached output does, as that's where the run can take its input from. modules, pieces and pos are moved
+// to what the run takes its input from.
+static void _fused_run_collect(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi_out,
+                               dt_dev_pixelpipe_fused_t *run, GList **modules, GList **pieces, int *pos)
+{
+  GList *m = *modules;
+  GList *p = *pieces;
+  int mpos = *pos;
+
+  run->count = 0;
+  for(; m && run->count < DT_DEV_PIXELPIPE_FUSED_MAX; m = g_list_previous(m), p = g_list_previous(p), mpos--)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+
+    if(!piece->enabled
+       || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+      continue;
+
+    if(!_piece_is_pointwise(dev, module, piece, roi_out)) break;
+
+    // the caller has just looked for the output of the last module
+    if(run->count
+       && dt_dev_pixelpipe_cache_available(&(pipe->cache),
+                                           dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, mpos)))
+      break;
+
+    run->module[run->count] = module;
+    run->piece[run->count] = piece;
+    run->process[run->count] = dt_iop_get_process_pixels(module);
+    run->overlap[run->count] = 0;
+    run->count++;
+
+    *modules = g_list_previous(m);
+    *pieces = g_list_previous(p);
+    *pos = mpos - 1;
+  }
+
+  _fused_run_reverse(run);
+}
+
+// the formats of the k-th piece of the run, as if it ran on its own
+static void _fused_piece_format(dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_fused_t *run, const int k,
+                                const dt_iop_buffer_dsc_t *input_format)
+{
+  dt_dev_pixelpipe_iop_t *piece = run->piece[k];
+  piece->dsc_out = piece->dsc_in = k ? run->piece[k - 1]->dsc_out : *input_format;
+  run->module[k]->output_format(run->module[k], pipe, piece, &piece->dsc_out);
+  pipe->dsc = piece->dsc_out;
+}
+
+static void _fused_run_process(dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_fused_t *run,
+                               const dt_iop_buffer_dsc_t *input_format, const float *const input,
+                               float *const output, const size_t npixels)
+{
+  for(int k = 0; k < run->count; k++)
+  {
+    _fused_piece_format(pipe, run, k, input_format);
+    dt_iop_module_t *module = run->module[k];
+    if(module->process_pixels_setup) module->process_pixels_setup(module, run->piece[k]);
+    run->piece[k]->dsc_out = pipe->dsc;
+  }
+
+  const size_t chunks = (npixels + DT_DEV_PIXELPIPE_FUSED_CHUNK - 1) / DT_DEV_PIXELPIPE_FUSED_CHUNK;
+
+#ifdef _OPENMP
+  // as many threads as the module of the run which wants the most in the tuning profile, see default_process()
+  int threads = 0;
+  for(int k = 0; k < run->count; k++)
+  {
+    const dt_tuning_module_t *tuning = dt_tuning_get(darktable.tuning, run->module[k]->op);
+    if(!tuning || tuning->threads <= 0)
+    {
+      threads = 0;
+      break;
+    }
+    threads = MAX(threads, tuning->threads);
+  }
+  threads = threads > 0 ? MIN(threads, dt_get_num_threads()) : omp_get_max_threads();
+#pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+  for(size_t c = 0; c < chunks; c++)
+  {
+    const size_t offs = c * DT_DEV_PIXELPIPE_FUSED_CHUNK;
+    const size_t n = MIN(DT_DEV_PIXELPIPE_FUSED_CHUNK, npixels - offs);
+    const float *const in = input + 4 * offs;
+    float *const out = output + 4 * offs;
+
+    // the first module reads the input, the others work on the output in place
+    for(int k = 0; k < run->count; k++)
+      run->process[k](run->module[k], run->piece[k], k ? out : in, out, n);
+  }
+}
+
+#ifdef HAVE_OPENCL
+// the run on the gpu: the process_cl() of its modules one after the other, on two device buffers in turn,
+// without going back to the host or into the cache in between. returns FALSE if the cpu has to do it.
+static int _fused_run_process_cl(dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_fused_t *run,
+                                 const dt_iop_buffer_dsc_t *input_format, const void *const input,
+                                 void **cl_mem_input, void **cl_mem_output, const dt_iop_roi_t *roi,
+                                 const size_t bpp)
+{
+  const int devid = pipe->devid;
+
+  // two buffers more than the input, plus what the module needing the most wants on top of its in and out
+  float factor = 3.0f;
+  unsigned overhead = 0;
+  for(int k = 0; k < run->count; k++)
+  {
+    dt_iop_module_t *module = run->module[k];
+    dt_dev_pixelpipe_iop_t *piece = run->piece[k];
+    if(!module->process_cl || !piece->process_cl_ready
+       || ((pipe->type == DT_DEV_PIXELPIPE_PREVIEW) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL)))
+      return FALSE;
+
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, piece, roi, roi, &tiling);
+    factor = fmax(factor, tiling.factor + 1.0f);
+    overhead = MAX(overhead, tiling.overhead);
+  }
+
+  if(!dt_opencl_image_fits_device(devid, roi->width, roi->height, bpp, factor, overhead)) return FALSE;
+
+  void *cl_mem_tmp = NULL;
+  int success = TRUE;
+  const int own_input = (*cl_mem_input == NULL);
+
+  if(own_input)
+  {
+    *cl_mem_input = dt_opencl_alloc_device(devid, roi->width, roi->height, bpp);
+    if(*cl_mem_input == NULL
+       || dt_opencl_write_host_to_device(devid, (void *)input, *cl_mem_input, roi->width, roi->height, bpp)
+              != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] couldn't copy image to opencl device for fused run\n");
+      success = FALSE;
+    }
+  }
+
+  if(success)
+  {
+    *cl_mem_output = dt_opencl_alloc_device(devid, roi->width, roi->height, bpp);
+    cl_mem_tmp = dt_opencl_alloc_device(devid, roi->width, roi->height, bpp);
+    if(*cl_mem_output == NULL || cl_mem_tmp == NULL)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] couldn't allocate output buffers for fused run\n");
+      success = FALSE;
+    }
+  }
+
+  // indirectly give gpu some air to breathe (and to do display related stuff)
+  if(success) dt_iop_nap(darktable.opencl->micro_nap);
+
+  // the buffers take turns so that the last module writes to the output
+  void *src = *cl_mem_input;
+  for(int k = 0; success && k < run->count; k++)
+  {
+    void *dst = ((run->count - 1 - k) & 1) ? cl_mem_tmp : *cl_mem_output;
+    _fused_piece_format(pipe, run, k, input_format);
+    success = run->module[k]->process_cl(run->module[k], run->piece[k], src, dst, roi, roi);
+    run->piece[k]->dsc_out = pipe->dsc;
+    if(!success)
+      dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] could not run module '%s' of fused run on gpu\n",
+               run->module[k]->op);
+    src = dst;
+  }
+
+  /* synchronization point for opencl pipe */
+  if(success && (!darktable.opencl->async_pixelpipe || pipe->type == DT_DEV_PIXELPIPE_EXPORT))
+    success = dt_opencl_finish(devid);
+
+  dt_opencl_release_mem_object(cl_mem_tmp);
+  if(!success)
+  {
+    dt_opencl_release_mem_object(*cl_mem_output);
+    *cl_mem_output = NULL;
+    // the host still has the input if we brought it here
+    if(own_input)
+    {
+      dt_opencl_release_mem_object(*cl_mem_input);
+      *cl_mem_input = NULL;
+    }
+  }
+  return success;
+}
+#endif
+
+// process the run of pointwise modules that ends at pos in one pass, see process_pixels() in iop_api.h.
+// returns -1 if there is no such run, otherwise what dt_dev_pixelpipe_process_rec() returns.
+static int _pixelpipe_process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                    void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                    const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos,
+                                    const uint64_t hash, const size_t bufsize)
+{
+  dt_dev_pixelpipe_fused_t run;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  _fused_run_collect(pipe, dev, roi_out, &run, &modules, &pieces, &pos);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  if(run.count < 2) return -1;
+
+  dt_dev_pixelpipe_iop_t *piece = run.piece[run.count - 1];
+
+  // recurse to get the input of the whole run, it has the roi of its output
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_out, modules, pieces,
+                                  pos))
+    return 1;
+
+  assert(input_format->datatype == TYPE_FLOAT && input_format->channels == 4);
+  const size_t bpp = dt_iop_buffer_dsc_to_bpp(input_format);
+
+  for(int k = 0; k < run.count; k++) _fused_piece_format(pipe, &run, k, input_format);
+  **out_format = pipe->dsc = piece->dsc_out;
+
+  // reserve new cache line: output. the ones of the other modules of the run are left alone.
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+  _cache_allow_half(pipe, run.module[run.count - 1], *output);
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  // user requests to see channel data in the parametric mask of an earlier module: pass through, like
+  // process_rec() does for single modules.
+  if(pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY)
+  {
+#ifdef HAVE_OPENCL
+    if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0 && (cl_mem_input != NULL))
+      *cl_mem_output = cl_mem_input;
+    else
+#endif
+      memcpy(*output, input, bufsize);
+
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 0;
+  }
+
+  const char *device = "CPU";
+  int done = FALSE;
+
+#ifdef HAVE_OPENCL
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0)
+  {
+    /* if input is on gpu memory only, remember this fact to later take appropriate action */
+    int valid_input_on_gpu_only = (cl_mem_input != NULL);
+
+    done = _fused_run_process_cl(pipe, &run, input_format, input, &cl_mem_input, cl_mem_output, roi_out, bpp);
+
+    if(pipe->shutdown)
+    {
+      dt_opencl_release_mem_object(cl_mem_input);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+
+    if(done)
+    {
+      device = "GPU";
+
+      /* write back input into cache for faster re-usal (not for export or thumbnails) */
+      if(darktable.opencl->synch_cache && valid_input_on_gpu_only && pipe->type != DT_DEV_PIXELPIPE_EXPORT
+         && pipe->type != DT_DEV_PIXELPIPE_THUMBNAIL
+         && dt_opencl_copy_device_to_host(pipe->devid, input, cl_mem_input, roi_out->width, roi_out->height,
+                                          bpp) == CL_SUCCESS)
+        valid_input_on_gpu_only = FALSE;
+
+      dt_opencl_release_mem_object(cl_mem_input);
+    }
+    else if(cl_mem_input != NULL)
+    {
+      /* copy back to host memory for the cpu, opencl modules must not spoil their input buffer */
+      const cl_int err = dt_opencl_copy_device_to_host(pipe->devid, input, cl_mem_input, roi_out->width,
+                                                       roi_out->height, bpp);
+      if(err != CL_SUCCESS)
+      {
+        /* late opencl error */
+        dt_print(DT_DEBUG_OPENCL,
+                 "[opencl_pixelpipe (f)] late opencl error detected while copying back to cpu buffer: %d\n",
+                 err);
+        dt_opencl_release_mem_object(cl_mem_input);
+        pipe->opencl_error = 1;
+        dt_pthread_mutex_unlock(&pipe->busy_mutex);
+        return 1;
+      }
+
+      (void)dt_opencl_finish(pipe->devid);
+      dt_opencl_release_mem_object(cl_mem_input);
+      valid_input_on_gpu_only = FALSE;
+    }
+
+    /* input is still only on GPU? Let's invalidate CPU input buffer then */
+    if(valid_input_on_gpu_only) dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
+  }
+#endif
+
+  if(!done)
+  {
+    _fused_run_process(pipe, &run, input_format, (const float *)input, (float *)*output,
+                       (size_t)roi_out->width * roi_out->height);
+
+    // the modules leave the alpha channel alone when showing a mask
+    if(pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
+      dt_iop_alpha_copy(input, *output, roi_out->width, roi_out->height);
+  }
+
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    GString *labels = g_string_new(NULL);
+    for(int k = 0; k < run.count; k++)
+    {
+      gchar *module_label = dt_history_item_get_name(run.module[k]);
+      g_string_append_printf(labels, "%s`%s'", k ? ", " : "", module_label);
+      g_free(module_label);
+    }
+    dt_show_times(&start, "[dev_pixelpipe]", "processed %s in one pass on %s [%s]", labels->str, device,
+                  _pipe_type_to_str(pipe->type));
+    g_string_free(labels, TRUE);
+  }
+
+  // in case we get this buffer from the cache in the future, cache some stuff:
+  **out_format = piece->dsc_out = pipe->dsc;
+
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+// export and thumbnail pipes push bands of the image through runs of modules that can be tiled, instead
+// of going over the whole image once per module. a band is sized to stay in the cpu caches, each module
+// processes it together with the rows it needs around it, and only the output of the whole run gets a
+// buffer of the full image and a cache line.
+#define DT_DEV_PIXELPIPE_WAVEFRONT_MIN_ROWS 16
+
+static inline gboolean _wavefront_applies(const dt_dev_pixelpipe_t *pipe)
+{
+  if(pipe->wavefront_band <= 0 || pipe->mask_display) return FALSE;
+  if(pipe->type != DT_DEV_PIXELPIPE_EXPORT && pipe->type != DT_DEV_PIXELPIPE_THUMBNAIL) return FALSE;
+#ifdef HAVE_OPENCL
+  // the gpu wants whole buffers
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0) return FALSE;
+#endif
+  return TRUE;
+}
+
+// output rows of a band of roi
+static inline int _wavefront_band_rows(const dt_dev_pixelpipe_t *pipe, const dt_iop_roi_t *roi)
+{
+  const size_t rows = (size_t)pipe->wavefront_band * 1024 * 1024 / ((size_t)roi->width * 4 * sizeof(float));
+  return MAX(DT_DEV_PIXELPIPE_WAVEFRONT_MIN_ROWS, (int)MIN(rows, INT_MAX));
+}
+
+// a piece can be part of a wavefront run if its module says a band comes out as from the whole image (per
+// pixel cores do anyway), keeps the roi, and nothing needs its own input or output. modules which gather
+// statistics of the whole image (hazeremoval, drago in globaltonemap, ...) must not say so, tiling is only
+// good enough for them when memory is short. *overlap is what it needs around a band, as for tiling.
+static gboolean _piece_is_tileable(dt_develop_t *dev, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                                   const dt_iop_roi_t *roi_out, int *overlap)
+{
+  const int flags = module->flags();
+  if(!(flags & IOP_FLAGS_ALLOW_TILING) || (flags & IOP_FLAGS_TILING_FULL_ROI) || piece->colors != 4
+     || _piece_needs_own_buffers(dev, module, piece))
+    return FALSE;
+
+  // bands call process(), a module with its own tiling wants to see the whole image
+  if(module->process_tiling != default_process_tiling) return FALSE;
+  if(!(flags & IOP_FLAGS_ALLOW_BANDS) && !dt_iop_get_process_pixels(module)) return FALSE;
+
+  dt_iop_roi_t roi_in;
+  module->modify_roi_in(module, piece, roi_out, &roi_in);
+  if(memcmp(&roi_in, roi_out, sizeof(dt_iop_roi_t))) return FALSE;
+
+  // bands span the whole width, so only the vertical alignment matters
+  dt_develop_tiling_t tiling = { 0 };
+  module->tiling_callback(module, piece, roi_out, roi_out, &tiling);
+  if(tiling.yalign > 1) return FALSE;
+
+  *overlap = tiling.overlap;
+  return TRUE;
+}
+
+// collect the run of tileable modules that ends with the one at pos, like _fused_run_collect(). modules are
+// left out once the rows around a band get more than a quarter of the band.
+static void _wavefront_run_collect(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi_out,
+                                   dt_dev_pixelpipe_fused_t *run, GList **modules, GList **pieces, int *pos)
+{
+  GList *m = *modules;
+  GList *p = *pieces;
+  int mpos = *pos;
+  const int max_halo = _wavefront_band_rows(pipe, roi_out) / 4;
+  int halo = 0;
+
+  run->count = 0;
+  for(; m && run->count < DT_DEV_PIXELPIPE_FUSED_MAX; m = g_list_previous(m), p = g_list_previous(p), mpos--)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+
+    if(!piece->enabled
+       || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+      continue;
+
+    int overlap = 0;
+    if(!_piece_is_tileable(dev, module, piece, roi_out, &overlap) || halo + overlap > max_halo) break;
+
+    if(run->count
+       && dt_dev_pixelpipe_cache_available(&(pipe->cache),
+                                           dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, mpos)))
+      break;
+
+    run->module[run->count] = module;
+    run->piece[run->count] = piece;
+    run->process[run->count] = NULL;
+    run->overlap[run->count] = overlap;
+    run->count++;
+    halo += overlap;
+
+    *modules = g_list_previous(m);
+    *pieces = g_list_previous(p);
+    *pos = mpos - 1;
+  }
+
+  _fused_run_reverse(run);
+}
+
+// the run on the bands of roi, from input to output which both cover all of roi. band holds two buffers of
+// the size of the largest band a module processes.
+static void _wavefront_run_process(dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_fused_t *run,
+                                   const dt_iop_buffer_dsc_t *input_format, const float *const input,
+                                   float *const output, const dt_iop_roi_t *roi, float *band[2])
+{
+  const int rows = _wavefront_band_rows(pipe, roi);
+  const size_t stride = (size_t)roi->width * 4;
+  const int last = run->count - 1;
+  dt_iop_buffer_dsc_t format[DT_DEV_PIXELPIPE_FUSED_MAX];
+  int top[DT_DEV_PIXELPIPE_FUSED_MAX], bottom[DT_DEV_PIXELPIPE_FUSED_MAX];
+
+  pipe->tiling = 1;
+
+  for(int y = 0; y < roi->height; y += rows)
+  {
+    // rows processed by each module, from the back: what the next one processes, plus its own overlap. only
+    // the rows away from the overlap come out right, and those are all the next module looks at.
+    int t = y, b = MIN(y + rows, roi->height);
+    for(int k = last; k >= 0; k--)
+    {
+      top[k] = t = MAX(t - run->overlap[k], 0);
+      bottom[k] = b = MIN(b + run->overlap[k], roi->height);
+    }
+
+    const float *in = input + top[0] * stride;
+    for(int k = 0; k <= last; k++)
+    {
+      dt_iop_module_t *module = run->module[k];
+      dt_dev_pixelpipe_iop_t *piece = run->piece[k];
+      float *const out = band[k & 1];
+      const dt_iop_roi_t roi_band = { roi->x, roi->y + top[k], roi->width, bottom[k] - top[k], roi->scale };
+
+      // every band starts from the same dsc, like tiles do, see _default_process_tiling_ptp()
+      if(y == 0)
+      {
+        _fused_piece_format(pipe, run, k, input_format);
+        format[k] = pipe->dsc;
+      }
+      else
+        pipe->dsc = format[k];
+
+      const double start = dt_get_wtime();
+      module->process(module, piece, in, out, &roi_band, &roi_band);
+      dt_tuning_record(darktable.tuning, module->op, dt_get_wtime() - start);
+      piece->dsc_out = pipe->dsc;
+
+      if(k < last) in = out + (top[k + 1] - top[k]) * stride;
+    }
+
+    memcpy(output + y * stride, band[last & 1] + (y - top[last]) * stride,
+           sizeof(float) * (MIN(y + rows, roi->height) - y) * stride);
+  }
+
+  pipe->tiling = 0;
+}
+
+// process the run of tileable modules that ends at pos band by band. returns -1 if it isn't worth it,
+// otherwise what dt_dev_pixelpipe_process_rec() returns.
+static int _pixelpipe_process_wavefront(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                                        GList *modules, GList *pieces, int pos, const uint64_t hash,
+                                        const size_t bufsize)
+{
+  if(!_wavefront_applies(pipe)) return -1;
+
+  // one band is the whole image
+  const int rows = _wavefront_band_rows(pipe, roi_out);
+  if(roi_out->height <= rows) return -1;
+
+  dt_dev_pixelpipe_fused_t run;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  _wavefront_run_collect(pipe, dev, roi_out, &run, &modules, &pieces, &pos);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  if(run.count < 2) return -1;
+
+  dt_dev_pixelpipe_iop_t *piece = run.piece[run.count - 1];
+
+  int halo = 0;
+  for(int k = 0; k < run.count; k++) halo += run.overlap[k];
+  const size_t band_size = sizeof(float) * 4 * roi_out->width * MIN(rows + 2 * halo, roi_out->height);
+  float *band[2] = { dt_alloc_align(64, band_size), dt_alloc_align(64, band_size) };
+  if(band[0] == NULL || band[1] == NULL)
+  {
+    dt_free_align(band[0]);
+    dt_free_align(band[1]);
+    return -1;
+  }
+
+  // recurse to get the input of the whole run, it has the roi of its output
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_out, modules, pieces,
+                                  pos))
+  {
+    dt_free_align(band[0]);
+    dt_free_align(band[1]);
+    return 1;
+  }
+
+  assert(input_format->datatype == TYPE_FLOAT && input_format->channels == 4);
+
+  for(int k = 0; k < run.count; k++) _fused_piece_format(pipe, &run, k, input_format);
+  **out_format = pipe->dsc = piece->dsc_out;
+
+  // reserve new cache line: output. the ones of the other modules of the run are left alone.
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    dt_free_align(band[0]);
+    dt_free_align(band[1]);
+    return 1;
+  }
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+  _cache_allow_half(pipe, run.module[run.count - 1], *output);
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  _wavefront_run_process(pipe, &run, input_format, (const float *)input, (float *)*output, roi_out, band);
+
+  dt_free_align(band[0]);
+  dt_free_align(band[1]);
+
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    GString *labels = g_string_new(NULL);
+    for(int k = 0; k < run.count; k++)
+    {
+      gchar *module_label = dt_history_item_get_name(run.module[k]);
+      g_string_append_printf(labels, "%s`%s'", k ? ", " : "", module_label);
+      g_free(module_label);
+    }
+    dt_show_times(&start, "[dev_pixelpipe]", "processed %s in bands of %d rows on CPU [%s]", labels->str,
+                  rows, _pipe_type_to_str(pipe->type));
+    g_string_free(labels, TRUE);
+  }
+
+  // in case we get this buffer from the cache in the future, cache some stuff:
+  **out_format = piece->dsc_out = pipe->dsc;
+
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
 // recursive helper for process:
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
@@ -698,6 +1482,64 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   {
     // 3b) recurse and obtain output array in &input
 
+    // export and thumbnail pipes go over runs of tileable modules band by band
+    const int banded = _pixelpipe_process_wavefront(pipe, dev, output, out_format, roi_out, modules, pieces,
+                                                    pos, hash, bufsize);
+    if(banded >= 0) return banded;
+
+    // runs of pointwise modules go over the image once, see process_pixels() in iop_api.h
+    if(pipe->fuse_pointwise)
+    {
+      const int fused = _pixelpipe_process_fused(pipe, dev, output, cl_mem_output, out_format, roi_out, modules,
+                                                 pieces, pos, hash, bufsize);
+      if(fused >= 0) return fused;
+    }
+
+    if(_pyramid_applies(pipe, dev, module, roi_out))
+    {
+      const uint64_t pyramid_hash = _pyramid_hash(pipe, pos);
+      dt_iop_roi_t roi_full;
+      _pyramid_full_roi(piece, roi_out, &roi_full);
+
+      // only a part of the image at a scale we don't have yet: process all of it once (if that's not way
+      // more work), so that panning around and coming back to this image later is served from the pyramid.
+      if(!_pyramid_covers_image(piece, roi_out)
+         && !dt_dev_pyramid_available(dev->pyramid, pipe->image.id, pyramid_hash, roi_out->scale)
+         && (size_t)roi_full.width * roi_full.height <= (size_t)4 * roi_out->width * roi_out->height)
+      {
+        void *full_output = NULL;
+        void *cl_mem_full_output = NULL;
+        dt_iop_buffer_dsc_t _full_format = **out_format;
+        dt_iop_buffer_dsc_t *full_format = &_full_format;
+        if(dt_dev_pixelpipe_process_rec(pipe, dev, &full_output, &cl_mem_full_output, &full_format, &roi_full,
+                                        modules, pieces, pos))
+          return 1;
+#ifdef HAVE_OPENCL
+        if(cl_mem_full_output) dt_opencl_release_mem_object(cl_mem_full_output);
+#endif
+      }
+
+      if(dt_dev_pyramid_available(dev->pyramid, pipe->image.id, pyramid_hash, roi_out->scale))
+      {
+        dt_pthread_mutex_lock(&pipe->busy_mutex);
+        if(pipe->shutdown)
+        {
+          dt_pthread_mutex_unlock(&pipe->busy_mutex);
+          return 1;
+        }
+        (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+        dt_iop_buffer_dsc_t dsc;
+        const int err
+            = dt_dev_pyramid_get(dev->pyramid, pipe->image.id, pyramid_hash, roi_out, (float *)*output, &dsc);
+        if(err)
+          dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+        else
+          **out_format = piece->dsc_out = pipe->dsc = dsc;
+        dt_pthread_mutex_unlock(&pipe->busy_mutex);
+        if(!err) goto post_process_collect_info;
+      }
+    }
+
     // get region of interest which is needed in input
     dt_pthread_mutex_lock(&pipe->busy_mutex);
     if(pipe->shutdown)
@@ -741,6 +1583,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       (void)dt_dev_pixelpipe_cache_get_important(&(pipe->cache), hash, bufsize, output, out_format);
     else
       (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+    _cache_allow_half(pipe, module, *output);
 
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
@@ -758,6 +1601,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     dt_get_times(&start);
 
     dt_pixelpipe_flow_t pixelpipe_flow = (PIXELPIPE_FLOW_NONE | PIXELPIPE_FLOW_HISTOGRAM_NONE);
+    int picked_input = 0; // the input colour picker was done along with the histogram
 
     // special case: user requests to see channel data in the parametric mask of a module. In that case
     // we skip all modules manipulating pixel content and only process image distorting modules. Finally
@@ -1064,7 +1908,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           if(success_opencl && (dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
              && (piece->request_histogram & DT_REQUEST_ON))
           {
-            histogram_collect(piece, input, &roi_in, &(piece->histogram), piece->histogram_max);
+            picked_input = histogram_collect(piece, input, &roi_in, &(piece->histogram), piece->histogram_max);
             pixelpipe_flow |= (PIXELPIPE_FLOW_HISTOGRAM_ON_CPU);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_HISTOGRAM_NONE | PIXELPIPE_FLOW_HISTOGRAM_ON_GPU);
 
@@ -1112,8 +1956,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
              module == dev->gui_module && // only modules with focus can pick
              module->request_color_pick != DT_REQUEST_COLORPICK_OFF) // and they want to pick ;)
           {
-            pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
-                             module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
+            if(!picked_input)
+              pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
+                               module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
             pixelpipe_picker(module, &pipe->dsc, (float *)(*output), roi_out, module->picked_output_color,
                              module->picked_output_color_min, module->picked_output_color_max,
                              PIXELPIPE_PICKER_OUTPUT);
@@ -1270,7 +2115,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           if((dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
              && (piece->request_histogram & DT_REQUEST_ON))
           {
-            histogram_collect(piece, input, &roi_in, &(piece->histogram), piece->histogram_max);
+            picked_input = histogram_collect(piece, input, &roi_in, &(piece->histogram), piece->histogram_max);
             pixelpipe_flow |= (PIXELPIPE_FLOW_HISTOGRAM_ON_CPU);
             pixelpipe_flow &= ~(PIXELPIPE_FLOW_HISTOGRAM_NONE | PIXELPIPE_FLOW_HISTOGRAM_ON_GPU);
 
@@ -1299,9 +2144,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
           /* process module on cpu. use tiling if needed and possible. */
           if(piece->process_tiling_ready
-             && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
-                                                  MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
-                                                  tiling.factor, tiling.overhead))
+             && _piece_wants_tiling(module, &roi_in, roi_out, MAX(in_bpp, bpp), &tiling))
           {
             module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
             pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
@@ -1326,8 +2169,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
              module == dev->gui_module && // only modules with focus can pick
              module->request_color_pick != DT_REQUEST_COLORPICK_OFF) // and they want to pick ;)
           {
-            pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
-                             module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
+            if(!picked_input)
+              pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
+                               module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
             pixelpipe_picker(module, &pipe->dsc, (float *)(*output), roi_out, module->picked_output_color,
                              module->picked_output_color_min, module->picked_output_color_max,
                              PIXELPIPE_PICKER_OUTPUT);
@@ -1403,7 +2247,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         if((dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
            && (piece->request_histogram & DT_REQUEST_ON))
         {
-          histogram_collect(piece, input, &roi_in, &(piece->histogram), piece->histogram_max);
+          picked_input = histogram_collect(piece, input, &roi_in, &(piece->histogram), piece->histogram_max);
           pixelpipe_flow |= (PIXELPIPE_FLOW_HISTOGRAM_ON_CPU);
           pixelpipe_flow &= ~(PIXELPIPE_FLOW_HISTOGRAM_NONE | PIXELPIPE_FLOW_HISTOGRAM_ON_GPU);
 
@@ -1432,9 +2276,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
         /* process module on cpu. use tiling if needed and possible. */
         if(piece->process_tiling_ready
-           && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
-                                                MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
-                                                tiling.factor, tiling.overhead))
+           && _piece_wants_tiling(module, &roi_in, roi_out, MAX(in_bpp, bpp), &tiling))
         {
           module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
           pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
@@ -1459,8 +2301,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
            module == dev->gui_module && // only modules with focus can pick
            module->request_color_pick != DT_REQUEST_COLORPICK_OFF) // and they want to pick ;)
         {
-          pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
-                           module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
+          if(!picked_input)
+            pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
+                             module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
           pixelpipe_picker(module, &pipe->dsc, (float *)(*output), roi_out, module->picked_output_color,
                            module->picked_output_color_min, module->picked_output_color_max,
                            PIXELPIPE_PICKER_OUTPUT);
@@ -1501,7 +2344,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       if((dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
          && (piece->request_histogram & DT_REQUEST_ON))
       {
-        histogram_collect(piece, input, &roi_in, &(piece->histogram), piece->histogram_max);
+        picked_input = histogram_collect(piece, input, &roi_in, &(piece->histogram), piece->histogram_max);
         pixelpipe_flow |= (PIXELPIPE_FLOW_HISTOGRAM_ON_CPU);
         pixelpipe_flow &= ~(PIXELPIPE_FLOW_HISTOGRAM_NONE | PIXELPIPE_FLOW_HISTOGRAM_ON_GPU);
 
@@ -1530,9 +2373,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
       /* process module on cpu. use tiling if needed and possible. */
       if(piece->process_tiling_ready
-         && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
-                                              MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
-                                              tiling.factor, tiling.overhead))
+         && _piece_wants_tiling(module, &roi_in, roi_out, MAX(in_bpp, bpp), &tiling))
       {
         module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
         pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
@@ -1557,8 +2398,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
          module == dev->gui_module && // only modules with focus can pick
          module->request_color_pick != DT_REQUEST_COLORPICK_OFF) // and they want to pick ;)
       {
-        pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
-                         module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
+        if(!picked_input)
+          pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
+                           module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
         pixelpipe_picker(module, &pipe->dsc, (float *)(*output), roi_out, module->picked_output_color,
                          module->picked_output_color_min, module->picked_output_color_max,
                          PIXELPIPE_PICKER_OUTPUT);
@@ -1586,7 +2428,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     if((dev->gui_attached || !(piece->request_histogram & DT_REQUEST_ONLY_IN_GUI))
        && (piece->request_histogram & DT_REQUEST_ON))
     {
-      histogram_collect(piece, (float *)input, &roi_in, &(piece->histogram), piece->histogram_max);
+      picked_input
+          = histogram_collect(piece, (float *)input, &roi_in, &(piece->histogram), piece->histogram_max);
       pixelpipe_flow |= (PIXELPIPE_FLOW_HISTOGRAM_ON_CPU);
       pixelpipe_flow &= ~(PIXELPIPE_FLOW_HISTOGRAM_NONE | PIXELPIPE_FLOW_HISTOGRAM_ON_GPU);
 
@@ -1615,9 +2458,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     /* process module on cpu. use tiling if needed and possible. */
     if(piece->process_tiling_ready
-       && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
-                                            MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
-                                            tiling.factor, tiling.overhead))
+       && _piece_wants_tiling(module, &roi_in, roi_out, MAX(in_bpp, bpp), &tiling))
     {
       module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
       pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
@@ -1642,8 +2483,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
        module == dev->gui_module && // only modules with focus can pick
        module->request_color_pick != DT_REQUEST_COLORPICK_OFF) // and they want to pick ;)
     {
-      pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
-                       module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
+      if(!picked_input)
+        pixelpipe_picker(module, &piece->dsc_in, (float *)input, &roi_in, module->picked_color,
+                         module->picked_color_min, module->picked_color_max, PIXELPIPE_PICKER_INPUT);
       pixelpipe_picker(module, &pipe->dsc, (float *)(*output), roi_out, module->picked_output_color,
                        module->picked_output_color_min, module->picked_output_color_max, PIXELPIPE_PICKER_OUTPUT);
 
@@ -1675,6 +2517,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                     : pixelpipe_flow & PIXELPIPE_FLOW_HISTOGRAM_ON_CPU ? "CPU" : ""));
     }
 
+    dt_tuning_record(darktable.tuning, module->op, dt_get_wtime() - start.clock);
+
     gchar *module_label = dt_history_item_get_name(module);
     dt_show_times(
         &start, "[dev_pixelpipe]", "processed `%s' on %s%s%s, blended on %s [%s]", module_label,
@@ -1695,6 +2539,18 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     // in case we get this buffer from the cache in the future, cache some stuff:
     **out_format = piece->dsc_out = pipe->dsc;
 
+    if(_pyramid_applies(pipe, dev, module, roi_out) && _pyramid_covers_image(piece, roi_out)
+       && (*out_format)->datatype == TYPE_FLOAT && (*out_format)->channels == 4)
+    {
+#ifdef HAVE_OPENCL
+      if(*cl_mem_output != NULL)
+        dt_opencl_copy_device_to_host(pipe->devid, *output, *cl_mem_output, roi_out->width, roi_out->height,
+                                      bpp);
+#endif
+      dt_dev_pyramid_put(dev->pyramid, pipe->image.id, _pyramid_hash(pipe, pos), roi_out, (float *)*output,
+                         *out_format);
+    }
+
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(module == darktable.develop->gui_module)
     {
@@ -2246,9 +3102,15 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
                              float scale)
 {
   pipe->processing = 1;
+  // pooled buffers taken by this thread count to the pipe, the peak to this run of it
+  pipe->pool_stats.peak = pipe->pool_stats.used;
+  dt_bufferpool_stats_t *const pool_scope = dt_bufferpool_scope_enter(&pipe->pool_stats);
   pipe->opencl_enabled = dt_opencl_update_settings(); // update enabled flag and profile from preferences
-  pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
+  pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device_for_image(pipe->type, width, height)
                                        : -1; // try to get/lock opencl resource
+  // runs the opencl scheduler sent to the cpu tell it when they are done and how fast it was
+  const int cpu_run = pipe->opencl_enabled && pipe->devid < 0;
+  const double start = dt_get_wtime();
 
   dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] using device %d\n", _pipe_type_to_str(pipe->type),
            pipe->devid);
@@ -2334,6 +3196,10 @@ restart:
     dt_opencl_unlock_device(pipe->devid);
     pipe->devid = -1;
   }
+  dt_bufferpool_scope_leave(pool_scope);
+  dt_print(DT_DEBUG_MEMORY, "[pixelpipe_process] [%s] peak of pooled buffers %zu MB\n",
+           _pipe_type_to_str(pipe->type), pipe->pool_stats.peak >> 20);
+  if(cpu_run) dt_opencl_cpu_pipe_done(pipe->type, width, height, err ? -1.0 : dt_get_wtime() - start);
   // ... and in case of other errors ...
   if(err)
   {
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "common/bufferpool.h"
 #include "common/image.h"
 #include "common/imageio.h"
 #include "control/conf.h"
@@ -115,6 +116,14 @@ typedef struct dt_dev_pixelpipe_t
   int opencl_error;
   // running in a tiling context?
   int tiling;
+  // process runs of pointwise modules in one pass?
+  int fuse_pointwise;
+  // size in MB of the bands pushed through runs of tileable modules in export pipes, 0 to not do that
+  int wavefront_band;
+  // priority of colorout in this pipe, -1 if it has none. set by dt_dev_pixelpipe_synch_all()
+  int colorout_priority;
+  // pooled buffers taken by modules while this pipe processes, see common/bufferpool.h
+  dt_bufferpool_stats_t pool_stats;
   // should this pixelpipe display a mask in the end?
   int mask_display;
   // input data based on this timestamp:
@@ -0,0 +1,200 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pyramid.h"
+#include "common/darktable.h"
+#include "develop/imageop.h"
+#include "develop/imageop_math.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t _level_size(const dt_dev_pyramid_level_t *l)
+{
+  return sizeof(float) * 4 * l->width * l->height;
+}
+
+static void _level_free(dt_dev_pyramid_level_t *l)
+{
+  dt_free_align(l->buf);
+  free(l);
+}
+
+/** smallest level of the image that still has at least the requested resolution. lock must be held. */
+static GList *_find(dt_dev_pyramid_t *p, const int32_t imgid, const uint64_t hash, const float scale)
+{
+  GList *best = NULL;
+  for(GList *iter = p->levels; iter; iter = g_list_next(iter))
+  {
+    const dt_dev_pyramid_level_t *l = (dt_dev_pyramid_level_t *)iter->data;
+    if(l->imgid != imgid || l->hash != hash || l->scale < scale * 0.999f) continue;
+    if(!best || l->scale < ((dt_dev_pyramid_level_t *)best->data)->scale) best = iter;
+  }
+  return best;
+}
+
+static void _remove_link(dt_dev_pyramid_t *p, GList *link)
+{
+  dt_dev_pyramid_level_t *l = (dt_dev_pyramid_level_t *)link->data;
+  p->size -= _level_size(l);
+  _level_free(l);
+  p->levels = g_list_delete_link(p->levels, link);
+}
+
+void dt_dev_pyramid_init(dt_dev_pyramid_t *p, size_t max_size)
+{
+  p->levels = NULL;
+  p->size = 0;
+  p->max_size = max_size;
+  dt_pthread_mutex_init(&p->lock, NULL);
+}
+
+void dt_dev_pyramid_cleanup(dt_dev_pyramid_t *p)
+{
+  g_list_free_full(p->levels, (GDestroyNotify)_level_free);
+  p->levels = NULL;
+  p->size = 0;
+  dt_pthread_mutex_destroy(&p->lock);
+}
+
+gboolean dt_dev_pyramid_available(dt_dev_pyramid_t *p, const int32_t imgid, const uint64_t hash,
+                                  const float scale)
+{
+  dt_pthread_mutex_lock(&p->lock);
+  const gboolean res = _find(p, imgid, hash, scale) != NULL;
+  dt_pthread_mutex_unlock(&p->lock);
+  return res;
+}
+
+int dt_dev_pyramid_get(dt_dev_pyramid_t *p, const int32_t imgid, const uint64_t hash,
+                       const dt_iop_roi_t *roi_out, float *out, dt_iop_buffer_dsc_t *dsc)
+{
+  dt_pthread_mutex_lock(&p->lock);
+  GList *link = _find(p, imgid, hash, roi_out->scale);
+  if(!link)
+  {
+    dt_pthread_mutex_unlock(&p->lock);
+    return 1;
+  }
+
+  // move to the front, it's the most recently used now
+  p->levels = g_list_remove_link(p->levels, link);
+  p->levels = g_list_concat(link, p->levels);
+
+  const dt_dev_pyramid_level_t *l = (dt_dev_pyramid_level_t *)link->data;
+  const float level_scale = l->scale;
+  *dsc = l->dsc;
+
+  // the resampling code takes the scale relative to the input buffer
+  const dt_iop_roi_t roi_in = { 0, 0, l->width, l->height, 1.0f };
+  dt_iop_roi_t roi = *roi_out;
+  roi.scale = roi_out->scale / l->scale;
+  if(fabsf(roi.scale - 1.0f) < 1e-4f) roi.scale = 1.0f;
+
+  if(roi.scale == 1.0f)
+  {
+    // plain copy, clamped to the level in case of rounding differences in the roi
+    memset(out, 0, sizeof(float) * 4 * roi_out->width * roi_out->height);
+    const int x = MAX(roi.x, 0), y = MAX(roi.y, 0);
+    const int w = MIN(roi_out->width, l->width - x), h = MIN(roi_out->height, l->height - y);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int j = 0; j < h; j++)
+      memcpy(out + (size_t)4 * j * roi_out->width, l->buf + (size_t)4 * ((y + j) * l->width + x),
+             sizeof(float) * 4 * MAX(w, 0));
+  }
+  else
+    dt_iop_clip_and_zoom(out, l->buf, &roi, &roi_in, roi_out->width, l->width);
+
+  dt_pthread_mutex_unlock(&p->lock);
+
+  dt_print(DT_DEBUG_DEV, "[pyramid] image %d at scale %f served from level %f\n", imgid, roi_out->scale,
+           level_scale);
+  return 0;
+}
+
+void dt_dev_pyramid_put(dt_dev_pyramid_t *p, const int32_t imgid, const uint64_t hash, const dt_iop_roi_t *roi,
+                        const float *buf, const dt_iop_buffer_dsc_t *dsc)
+{
+  if(roi->scale > DT_DEV_PYRAMID_MAX_SCALE * 1.001f) return;
+  const size_t size = sizeof(float) * 4 * roi->width * roi->height;
+  if(size > p->max_size) return;
+
+  dt_pthread_mutex_lock(&p->lock);
+  for(GList *iter = p->levels; iter;)
+  {
+    GList *next = g_list_next(iter);
+    const dt_dev_pyramid_level_t *l = (dt_dev_pyramid_level_t *)iter->data;
+    // the history changed, the old levels are of no use anymore
+    if(l->imgid == imgid && l->hash != hash) _remove_link(p, iter);
+    // already there
+    else if(l->imgid == imgid && fabsf(l->scale - roi->scale) < 1e-4f)
+    {
+      dt_pthread_mutex_unlock(&p->lock);
+      return;
+    }
+    iter = next;
+  }
+
+  // make room, least recently used last
+  while(p->levels && p->size + size > p->max_size) _remove_link(p, g_list_last(p->levels));
+
+  dt_dev_pyramid_level_t *l = (dt_dev_pyramid_level_t *)malloc(sizeof(dt_dev_pyramid_level_t));
+  float *copy = (float *)dt_alloc_align(64, size);
+  if(!l || !copy)
+  {
+    free(l);
+    dt_free_align(copy);
+    dt_pthread_mutex_unlock(&p->lock);
+    return;
+  }
+  l->buf = copy;
+  l->imgid = imgid;
+  l->hash = hash;
+  l->scale = roi->scale;
+  l->width = roi->width;
+  l->height = roi->height;
+  l->dsc = *dsc;
+  memcpy(l->buf, buf, size);
+
+  p->levels = g_list_prepend(p->levels, l);
+  p->size += size;
+  const size_t in_use = p->size;
+  dt_pthread_mutex_unlock(&p->lock);
+
+  dt_print(DT_DEBUG_DEV, "[pyramid] stored image %d at scale %f (%dx%d), %zu MB in use\n", imgid, roi->scale,
+           roi->width, roi->height, in_use / (1024 * 1024));
+}
+
+void dt_dev_pyramid_remove(dt_dev_pyramid_t *p, const int32_t imgid)
+{
+  dt_pthread_mutex_lock(&p->lock);
+  for(GList *iter = p->levels; iter;)
+  {
+    GList *next = g_list_next(iter);
+    if(((dt_dev_pyramid_level_t *)iter->data)->imgid == imgid) _remove_link(p, iter);
+    iter = next;
+  }
+  dt_pthread_mutex_unlock(&p->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
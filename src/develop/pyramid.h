@@ -0,0 +1,84 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+#include "develop/format.h"
+
+#include <glib.h>
+#include <inttypes.h>
+
+struct dt_iop_roi_t;
+
+/**
+ * multi-resolution cache of the demosaiced, scene-referred image of the darkroom.
+ *
+ * whenever the full pipe computes the output of demosaic for the whole image at
+ * some scale, a copy is kept here as one level of that image's pyramid, keyed by
+ * the hash of the history up to and including demosaic. later requests at that
+ * scale or below (fit to screen, 50%) are served from the nearest level above,
+ * skipping raw prepare, demosaic and everything in between. unlike the pixelpipe
+ * cache this survives switching images, so going back and forth through a shoot
+ * only pays for the modules after demosaic.
+ *
+ * levels are only stored for scales up to DT_DEV_PYRAMID_MAX_SCALE, 100% and
+ * export always process the raw.
+ */
+
+#define DT_DEV_PYRAMID_MAX_SCALE 0.5f
+
+typedef struct dt_dev_pyramid_level_t
+{
+  int32_t imgid;
+  uint64_t hash;          // history up to and including demosaic, independent of the roi
+  float scale;            // with respect to the full image
+  int32_t width, height;  // the whole image at that scale
+  dt_iop_buffer_dsc_t dsc;
+  float *buf;             // 4 floats per pixel
+} dt_dev_pyramid_level_t;
+
+typedef struct dt_dev_pyramid_t
+{
+  GList *levels; // most recently used first
+  size_t size, max_size;
+  dt_pthread_mutex_t lock;
+} dt_dev_pyramid_t;
+
+/** max_size in bytes, 0 keeps it empty. */
+void dt_dev_pyramid_init(dt_dev_pyramid_t *p, size_t max_size);
+void dt_dev_pyramid_cleanup(dt_dev_pyramid_t *p);
+
+/** TRUE if there is a level of this image that can serve the given scale. */
+gboolean dt_dev_pyramid_available(dt_dev_pyramid_t *p, const int32_t imgid, const uint64_t hash,
+                                  const float scale);
+
+/** fill out (roi_out->width x roi_out->height, 4 floats) from the best level. returns 0 on success. */
+int dt_dev_pyramid_get(dt_dev_pyramid_t *p, const int32_t imgid, const uint64_t hash,
+                       const struct dt_iop_roi_t *roi_out, float *out, dt_iop_buffer_dsc_t *dsc);
+
+/** store a copy of buf, which has to cover the whole image at roi->scale. */
+void dt_dev_pyramid_put(dt_dev_pyramid_t *p, const int32_t imgid, const uint64_t hash,
+                        const struct dt_iop_roi_t *roi, const float *buf, const dt_iop_buffer_dsc_t *dsc);
+
+/** drop all levels of an image. */
+void dt_dev_pyramid_remove(dt_dev_pyramid_t *p, const int32_t imgid);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -18,7 +18,9 @@
 
 
 #include "develop/tiling.h"
+#include "common/bufferpool.h"
 #include "common/opencl.h"
+#include "common/tuning.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/pixelpipe.h"
@@ -626,6 +628,10 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
   singlebuffer = fmax(available / factor, singlebuffer);
 
+  /* this machine's tuning profile might ask for smaller, cache friendly tiles */
+  const size_t tuned_tile_size = dt_tuning_tile_size(darktable.tuning, self->op);
+  if(tuned_tile_size > 0) singlebuffer = fmin(singlebuffer, (float)tuned_tile_size);
+
   int width = roi_in->width;
   int height = roi_in->height;
 
@@ -701,14 +707,14 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
            tiles_x, tiles_y, width, height, overlap);
 
   /* reserve input and output buffers for tiles */
-  input = dt_alloc_align(64, (size_t)width * height * in_bpp);
+  input = dt_bufferpool_alloc(darktable.bufferpool, (size_t)width * height * in_bpp);
   if(input == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n",
              self->op);
     goto error;
   }
-  output = dt_alloc_align(64, (size_t)width * height * out_bpp);
+  output = dt_bufferpool_alloc(darktable.bufferpool, (size_t)width * height * out_bpp);
   if(output == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n",
@@ -803,8 +809,8 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  if(input != NULL) dt_bufferpool_free(darktable.bufferpool, input);
+  if(output != NULL) dt_bufferpool_free(darktable.bufferpool, output);
   piece->pipe->tiling = 0;
   return;
 
@@ -813,8 +819,8 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  if(input != NULL) dt_bufferpool_free(darktable.bufferpool, input);
+  if(output != NULL) dt_bufferpool_free(darktable.bufferpool, output);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n",
            self->op);
@@ -885,6 +891,10 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
   singlebuffer = fmax(available / factor, singlebuffer);
 
+  /* this machine's tuning profile might ask for smaller, cache friendly tiles */
+  const size_t tuned_tile_size = dt_tuning_tile_size(darktable.tuning, self->op);
+  if(tuned_tile_size > 0) singlebuffer = fmin(singlebuffer, (float)tuned_tile_size);
+
   int width = _max(roi_in->width, roi_out->width);
   int height = _max(roi_in->height, roi_out->height);
 
@@ -1078,14 +1088,14 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
 
 
       /* prepare input tile buffer */
-      input = dt_alloc_align(64, (size_t)iroi_full.width * iroi_full.height * in_bpp);
+      input = dt_bufferpool_alloc(darktable.bufferpool, (size_t)iroi_full.width * iroi_full.height * in_bpp);
       if(input == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc input buffer for module '%s'\n",
                  self->op);
         goto error;
       }
-      output = dt_alloc_align(64, (size_t)oroi_full.width * oroi_full.height * out_bpp);
+      output = dt_bufferpool_alloc(darktable.bufferpool, (size_t)oroi_full.width * oroi_full.height * out_bpp);
       if(output == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc output buffer for module '%s'\n",
@@ -1130,16 +1140,16 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
                (char *)output + ((j + origin_y) * oroi_full.width + origin_x) * out_bpp,
                (size_t)oroi_good.width * out_bpp);
 
-      dt_free_align(input);
-      dt_free_align(output);
+      dt_bufferpool_free(darktable.bufferpool, input);
+      dt_bufferpool_free(darktable.bufferpool, output);
       input = output = NULL;
     }
 
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  if(input != NULL) dt_bufferpool_free(darktable.bufferpool, input);
+  if(output != NULL) dt_bufferpool_free(darktable.bufferpool, output);
   piece->pipe->tiling = 0;
   return;
 
@@ -1148,8 +1158,8 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  if(input != NULL) dt_bufferpool_free(darktable.bufferpool, input);
+  if(output != NULL) dt_bufferpool_free(darktable.bufferpool, output);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] fall back to standard processing for module '%s'\n",
            self->op);
@@ -1178,6 +1188,157 @@ void default_process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpip
 
 
 #ifdef HAVE_OPENCL
+/* host <-> device transfers of the opencl tiling. with pinned memory there are two input and two output
+   buffers taking turns: while the device works on a tile the host copies the next one into the other input
+   buffer and the good part of the previous one out of the other output buffer. nothing blocks, the host
+   only waits for the last transfer of the buffer it is about to touch. without pinned memory the tiles go
+   straight between the images and the device, and the host waits for all of them at the end. */
+typedef struct _cl_transfer_t
+{
+  int devid;
+  int pinned;
+  cl_mem pinned_input[2];
+  cl_mem pinned_output[2];
+  void *input_buffer[2];
+  void *output_buffer[2];
+  cl_event input_event[2];  // last write from the input buffer
+  cl_event output_event[2]; // last read into the output buffer
+  int current;              // buffers of the tile on its way
+
+  /* where the good part of the tile in an output buffer goes in the output image */
+  int pending[2];
+  char *dest[2];
+  size_t offset[2], rows[2], rowsize[2], pitch[2], dest_pitch[2];
+} _cl_transfer_t;
+
+static void _cl_transfer_init(_cl_transfer_t *t, const int devid, const int use_pinned_memory,
+                              const size_t input_size, const size_t output_size, const char *op)
+{
+  memset(t, 0, sizeof(_cl_transfer_t));
+  t->devid = devid;
+  if(!use_pinned_memory) return;
+
+  t->pinned = 1;
+  for(int k = 0; k < 2 && t->pinned; k++)
+  {
+    t->pinned_input[k] = dt_opencl_pool_alloc_pinned(devid, input_size, &t->input_buffer[k]);
+    t->pinned_output[k] = dt_opencl_pool_alloc_pinned(devid, output_size, &t->output_buffer[k]);
+    t->pinned = t->pinned_input[k] && t->pinned_output[k];
+  }
+  if(t->pinned) return;
+
+  dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl] could not get pinned buffers for module '%s'\n", op);
+  for(int k = 0; k < 2; k++)
+  {
+    dt_opencl_pool_put(devid, t->pinned_input[k]);
+    dt_opencl_pool_put(devid, t->pinned_output[k]);
+    t->pinned_input[k] = t->pinned_output[k] = NULL;
+  }
+  t->pinned = 0;
+}
+
+/* a tile of the input image, wd x ht at src, onto the device */
+static cl_int _cl_transfer_upload(_cl_transfer_t *t, const char *src, const size_t pitch, cl_mem input,
+                                  const size_t wd, const size_t ht, const int bpp)
+{
+  const size_t origin[] = { 0, 0, 0 };
+  const size_t region[] = { wd, ht, 1 };
+
+  if(!t->pinned)
+    return dt_opencl_write_host_to_device_raw(t->devid, (void *)src, input, origin, region, pitch, CL_FALSE);
+
+  const int c = t->current;
+  cl_int err = dt_opencl_wait_for_event(&t->input_event[c]);
+  if(err != CL_SUCCESS) return err;
+
+  char *const buffer = t->input_buffer[c];
+  const size_t rowsize = wd * bpp;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(src) schedule(static)
+#endif
+  for(size_t j = 0; j < ht; j++) memcpy(buffer + j * rowsize, src + j * pitch, rowsize);
+
+  return dt_opencl_write_host_to_device_raw_event(t->devid, buffer, input, origin, region, rowsize,
+                                                  &t->input_event[c]);
+}
+
+/* the good part of an output buffer into the output image, once it has arrived */
+static cl_int _cl_transfer_complete(_cl_transfer_t *t, const int c)
+{
+  if(!t->pending[c]) return CL_SUCCESS;
+  t->pending[c] = 0;
+
+  const cl_int err = dt_opencl_wait_for_event(&t->output_event[c]);
+  if(err != CL_SUCCESS) return err;
+
+  char *const dest = t->dest[c];
+  const char *const buffer = (char *)t->output_buffer[c] + t->offset[c];
+  const size_t rows = t->rows[c], rowsize = t->rowsize[c], pitch = t->pitch[c], dest_pitch = t->dest_pitch[c];
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t j = 0; j < rows; j++) memcpy(dest + j * dest_pitch, buffer + j * pitch, rowsize);
+
+  return CL_SUCCESS;
+}
+
+/* a tile of wd x ht back from the device. the good part of it at origin with region goes to dest, the
+   previous tile gets copied out meanwhile */
+static cl_int _cl_transfer_download(_cl_transfer_t *t, cl_mem output, const size_t wd, const size_t ht,
+                                    const int bpp, const size_t *origin, const size_t *region, char *dest,
+                                    const size_t dest_pitch)
+{
+  if(!t->pinned)
+    return dt_opencl_read_host_from_device_raw(t->devid, dest, output, origin, region, dest_pitch, CL_FALSE);
+
+  const int c = t->current;
+  const size_t forigin[] = { 0, 0, 0 };
+  const size_t fregion[] = { wd, ht, 1 };
+  cl_int err = dt_opencl_read_host_from_device_raw_event(t->devid, t->output_buffer[c], output, forigin,
+                                                         fregion, wd * bpp, &t->output_event[c]);
+  if(err != CL_SUCCESS) return err;
+
+  t->pending[c] = 1;
+  t->dest[c] = dest;
+  t->offset[c] = (origin[1] * wd + origin[0]) * bpp;
+  t->rows[c] = region[1];
+  t->rowsize[c] = region[0] * bpp;
+  t->pitch[c] = wd * bpp;
+  t->dest_pitch[c] = dest_pitch;
+
+  // the next tile takes the other buffers, which hold the previous one
+  t->current = !c;
+  return _cl_transfer_complete(t, t->current);
+}
+
+/* all tiles in the output image. on errors it just waits for the transfers still running */
+static cl_int _cl_transfer_finish(_cl_transfer_t *t)
+{
+  if(!t->pinned) return dt_opencl_finish(t->devid) ? CL_SUCCESS : -1;
+
+  cl_int err = CL_SUCCESS;
+  for(int c = 0; c < 2; c++)
+  {
+    if(err == CL_SUCCESS) err = _cl_transfer_complete(t, c);
+    t->pending[c] = 0;
+    const cl_int out_err = dt_opencl_wait_for_event(&t->output_event[c]);
+    const cl_int in_err = dt_opencl_wait_for_event(&t->input_event[c]);
+    if(err == CL_SUCCESS) err = out_err != CL_SUCCESS ? out_err : in_err;
+  }
+  return err;
+}
+
+static void _cl_transfer_cleanup(_cl_transfer_t *t)
+{
+  (void)_cl_transfer_finish(t);
+  for(int k = 0; k < 2; k++)
+  {
+    dt_opencl_pool_put(t->devid, t->pinned_input[k]);
+    dt_opencl_pool_put(t->devid, t->pinned_output[k]);
+  }
+  memset(t, 0, sizeof(_cl_transfer_t));
+}
+
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
 static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                           const void *const ivoid, void *const ovoid,
@@ -1187,10 +1348,7 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
   cl_int err = -999;
   cl_mem input = NULL;
   cl_mem output = NULL;
-  cl_mem pinned_input = NULL;
-  cl_mem pinned_output = NULL;
-  void *input_buffer = NULL;
-  void *output_buffer = NULL;
+  _cl_transfer_t transfer = { 0 };
 
   dt_iop_buffer_dsc_t dsc;
   self->output_format(self, piece->pipe, piece, &dsc);
@@ -1207,7 +1365,7 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
 
   /* shall we use pinned memory transfers? */
   int use_pinned_memory = dt_conf_get_bool("opencl_use_pinned_memory");
-  const int pinned_buffer_overhead = use_pinned_memory ? 2 : 0; // add two additional pinned memory buffers
+  const int pinned_buffer_overhead = use_pinned_memory ? 4 : 0; // add four additional pinned memory buffers
                                                                 // which seemingly get allocated not only on
                                                                 // host but also on device (why???)
   const float pinned_buffer_slack
@@ -1311,60 +1469,8 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
   for(int k = 0; k < 4; k++) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
 
   /* reserve pinned input and output memory for host<->device data transfer */
-  if(use_pinned_memory)
-  {
-    pinned_input = dt_opencl_alloc_device_buffer_with_flags(devid, (size_t)width * height * in_bpp,
-                                                            CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
-    if(pinned_input == NULL)
-    {
-      dt_print(DT_DEBUG_OPENCL,
-               "[default_process_tiling_cl_ptp] could not alloc pinned input buffer for module '%s'\n",
-               self->op);
-      use_pinned_memory = 0;
-    }
-  }
-
-  if(use_pinned_memory)
-  {
-
-    input_buffer = dt_opencl_map_buffer(devid, pinned_input, CL_TRUE, CL_MAP_WRITE, 0,
-                                        (size_t)width * height * in_bpp);
-    if(input_buffer == NULL)
-    {
-      dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] could not map pinned input buffer to host "
-                                "memory for module '%s'\n",
-               self->op);
-      use_pinned_memory = 0;
-    }
-  }
-
-  if(use_pinned_memory)
-  {
-
-    pinned_output = dt_opencl_alloc_device_buffer_with_flags(devid, (size_t)width * height * out_bpp,
-                                                             CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
-    if(pinned_output == NULL)
-    {
-      dt_print(DT_DEBUG_OPENCL,
-               "[default_process_tiling_cl_ptp] could not alloc pinned output buffer for module '%s'\n",
-               self->op);
-      use_pinned_memory = 0;
-    }
-  }
-
-  if(use_pinned_memory)
-  {
-
-    output_buffer = dt_opencl_map_buffer(devid, pinned_output, CL_TRUE, CL_MAP_READ, 0,
-                                         (size_t)width * height * out_bpp);
-    if(output_buffer == NULL)
-    {
-      dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] could not map pinned output buffer to host "
-                                "memory for module '%s'\n",
-               self->op);
-      use_pinned_memory = 0;
-    }
-  }
+  _cl_transfer_init(&transfer, devid, use_pinned_memory, (size_t)width * height * in_bpp,
+                    (size_t)width * height * out_bpp, self->op);
 
   /* iterate over tiles */
   for(size_t tx = 0; tx < tiles_x; tx++)
@@ -1397,33 +1503,14 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
                ht, tx * tile_wd, ty * tile_ht);
 
       /* get input and output buffers */
-      input = dt_opencl_alloc_device(devid, wd, ht, in_bpp);
+      input = dt_opencl_pool_alloc_device(devid, wd, ht, in_bpp);
       if(input == NULL) goto error;
-      output = dt_opencl_alloc_device(devid, wd, ht, out_bpp);
+      output = dt_opencl_pool_alloc_device(devid, wd, ht, out_bpp);
       if(output == NULL) goto error;
 
-      if(use_pinned_memory)
-      {
-/* prepare pinned input tile buffer: copy part of input image */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(input_buffer, width, ioffs, wd, ht) schedule(static)
-#endif
-        for(size_t j = 0; j < ht; j++)
-          memcpy((char *)input_buffer + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch,
-                 (size_t)wd * in_bpp);
-
-        /* blocking memory transfer: pinned host input buffer -> opencl/device tile */
-        err = dt_opencl_write_host_to_device_raw(devid, (char *)input_buffer, input, origin, region,
-                                                 wd * in_bpp, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
-      else
-      {
-        /* blocking direct memory transfer: host input image -> opencl/device tile */
-        err = dt_opencl_write_host_to_device_raw(devid, (char *)ivoid + ioffs, input, origin, region, ipitch,
-                                                 CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
+      /* non-blocking memory transfer: host input image -> opencl/device tile */
+      err = _cl_transfer_upload(&transfer, (char *)ivoid + ioffs, ipitch, input, wd, ht, in_bpp);
+      if(err != CL_SUCCESS) goto error;
 
       /* take original processed_maximum as starting point */
       for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
@@ -1444,14 +1531,6 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
         processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
       }
 
-      if(use_pinned_memory)
-      {
-        /* blocking memory transfer: complete opencl/device tile -> pinned host output buffer */
-        err = dt_opencl_read_host_from_device_raw(devid, (char *)output_buffer, output, origin, region,
-                                                  wd * out_bpp, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
-
       /* correct origin and region of tile for overlap.
          makes sure that we only copy back the "good" part. */
       if(tx > 0)
@@ -1467,58 +1546,40 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
         ooffs += overlap * opitch;
       }
 
-      if(use_pinned_memory)
-      {
-/* copy "good" part of tile from pinned output buffer to output image */
-#if 0 // def _OPENMP
-#pragma omp parallel for default(none) shared(ovoid, ooffs, output_buffer, width, origin, region,            \
-                                              wd) schedule(static)
-#endif
-        for(size_t j = 0; j < region[1]; j++)
-          memcpy((char *)ovoid + ooffs + j * opitch,
-                 (char *)output_buffer + ((j + origin[1]) * wd + origin[0]) * out_bpp,
-                 (size_t)region[0] * out_bpp);
-      }
-      else
-      {
-        /* blocking direct memory transfer: good part of opencl/device tile -> host output image */
-        err = dt_opencl_read_host_from_device_raw(devid, (char *)ovoid + ooffs, output, origin, region,
-                                                  opitch, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
+      /* non-blocking memory transfer: good part of opencl/device tile -> host output image. with pinned
+         memory the previous tile arrives meanwhile */
+      err = _cl_transfer_download(&transfer, output, wd, ht, out_bpp, origin, region, (char *)ovoid + ooffs,
+                                  opitch);
+      if(err != CL_SUCCESS) goto error;
 
-      /* release input and output buffers */
-      dt_opencl_release_mem_object(input);
+      /* give input and output buffers back, the next tile of the same size takes them again */
+      dt_opencl_pool_put(devid, input);
       input = NULL;
-      dt_opencl_release_mem_object(output);
+      dt_opencl_pool_put(devid, output);
       output = NULL;
-
-      /* block until opencl queue has finished to free all used event handlers */
-      if(!darktable.opencl->async_pixelpipe || piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT)
-        dt_opencl_finish(devid);
     }
 
+  /* wait for the last tiles */
+  err = _cl_transfer_finish(&transfer);
+  if(err != CL_SUCCESS) goto error;
+
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
 
-  if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
-  dt_opencl_release_mem_object(pinned_input);
-  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
-  dt_opencl_release_mem_object(pinned_output);
-  dt_opencl_release_mem_object(input);
-  dt_opencl_release_mem_object(output);
+  _cl_transfer_cleanup(&transfer);
+  /* idle images and pinned buffers are only of use to the tiles of this module. out of the pool they count
+     against the memory dt_opencl_image_fits_device() thinks the next module has */
+  dt_opencl_pool_flush(devid);
   piece->pipe->tiling = 0;
   return TRUE;
 
 error:
   /* copy back stored processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
-  if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
-  dt_opencl_release_mem_object(pinned_input);
-  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
-  dt_opencl_release_mem_object(pinned_output);
-  dt_opencl_release_mem_object(input);
-  dt_opencl_release_mem_object(output);
+  _cl_transfer_cleanup(&transfer);
+  dt_opencl_pool_put(devid, input);
+  dt_opencl_pool_put(devid, output);
+  dt_opencl_pool_flush(devid);
   piece->pipe->tiling = 0;
   dt_print(
       DT_DEBUG_OPENCL,
@@ -1538,10 +1599,7 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
   cl_int err = -999;
   cl_mem input = NULL;
   cl_mem output = NULL;
-  cl_mem pinned_input = NULL;
-  cl_mem pinned_output = NULL;
-  void *input_buffer = NULL;
-  void *output_buffer = NULL;
+  _cl_transfer_t transfer = { 0 };
 
 
   //_print_roi(roi_in, "module roi_in");
@@ -1571,7 +1629,7 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
 
   /* shall we use pinned memory transfers? */
   int use_pinned_memory = dt_conf_get_bool("opencl_use_pinned_memory");
-  const int pinned_buffer_overhead = use_pinned_memory ? 2 : 0; // add two additional pinned memory buffers
+  const int pinned_buffer_overhead = use_pinned_memory ? 4 : 0; // add four additional pinned memory buffers
                                                                 // which seemingly get allocated not only on
                                                                 // host but also on device (why???)
   const float pinned_buffer_slack
@@ -1687,60 +1745,8 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
   for(int k = 0; k < 4; k++) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
 
   /* reserve pinned input and output memory for host<->device data transfer */
-  if(use_pinned_memory)
-  {
-    pinned_input = dt_opencl_alloc_device_buffer_with_flags(devid, (size_t)width * height * in_bpp,
-                                                            CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
-    if(pinned_input == NULL)
-    {
-      dt_print(DT_DEBUG_OPENCL,
-               "[default_process_tiling_cl_roi] could not alloc pinned input buffer for module '%s'\n",
-               self->op);
-      use_pinned_memory = 0;
-    }
-  }
-
-  if(use_pinned_memory)
-  {
-
-    input_buffer = dt_opencl_map_buffer(devid, pinned_input, CL_TRUE, CL_MAP_WRITE, 0,
-                                        (size_t)width * height * in_bpp);
-    if(input_buffer == NULL)
-    {
-      dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_roi] could not map pinned input buffer to host "
-                                "memory for module '%s'\n",
-               self->op);
-      use_pinned_memory = 0;
-    }
-  }
-
-  if(use_pinned_memory)
-  {
-
-    pinned_output = dt_opencl_alloc_device_buffer_with_flags(devid, (size_t)width * height * out_bpp,
-                                                             CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
-    if(pinned_output == NULL)
-    {
-      dt_print(DT_DEBUG_OPENCL,
-               "[default_process_tiling_cl_roi] could not alloc pinned output buffer for module '%s'\n",
-               self->op);
-      use_pinned_memory = 0;
-    }
-  }
-
-  if(use_pinned_memory)
-  {
-
-    output_buffer = dt_opencl_map_buffer(devid, pinned_output, CL_TRUE, CL_MAP_READ, 0,
-                                         (size_t)width * height * out_bpp);
-    if(output_buffer == NULL)
-    {
-      dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_roi] could not map pinned output buffer to host "
-                                "memory for module '%s'\n",
-               self->op);
-      use_pinned_memory = 0;
-    }
-  }
+  _cl_transfer_init(&transfer, devid, use_pinned_memory, (size_t)width * height * in_bpp,
+                    (size_t)width * height * out_bpp, self->op);
 
 
   /* iterate over tiles */
@@ -1838,47 +1844,21 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
                "[default_process_tiling_cl_roi] tile (%zu, %zu) with %d x %d at origin [%d, %d]\n", tx, ty,
                iroi_full.width, iroi_full.height, iroi_full.x, iroi_full.y);
 
-      /* origin and region of full input tile */
-      size_t iorigin[] = { 0, 0, 0 };
-      size_t iregion[] = { iroi_full.width, iroi_full.height, 1 };
-
-      /* origin and region of full output tile */
-      size_t oforigin[] = { 0, 0, 0 };
-      size_t ofregion[] = { oroi_full.width, oroi_full.height, 1 };
-
       /* origin and region of good part of output tile */
       size_t oorigin[] = { oroi_good.x - oroi_full.x, oroi_good.y - oroi_full.y, 0 };
       size_t oregion[] = { oroi_good.width, oroi_good.height, 1 };
 
       /* get opencl input and output buffers */
-      input = dt_opencl_alloc_device(devid, iroi_full.width, iroi_full.height, in_bpp);
+      input = dt_opencl_pool_alloc_device(devid, iroi_full.width, iroi_full.height, in_bpp);
       if(input == NULL) goto error;
 
-      output = dt_opencl_alloc_device(devid, oroi_full.width, oroi_full.height, out_bpp);
+      output = dt_opencl_pool_alloc_device(devid, oroi_full.width, oroi_full.height, out_bpp);
       if(output == NULL) goto error;
 
-      if(use_pinned_memory)
-      {
-/* prepare pinned input tile buffer: copy part of input image */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(input_buffer, width, ioffs, iroi_full) schedule(static)
-#endif
-        for(size_t j = 0; j < iroi_full.height; j++)
-          memcpy((char *)input_buffer + j * iroi_full.width * in_bpp, (char *)ivoid + ioffs + j * ipitch,
-                 (size_t)iroi_full.width * in_bpp);
-
-        /* blocking memory transfer: pinned host input buffer -> opencl/device tile */
-        err = dt_opencl_write_host_to_device_raw(devid, (char *)input_buffer, input, iorigin, iregion,
-                                                 (size_t)iroi_full.width * in_bpp, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
-      else
-      {
-        /* blocking direct memory transfer: host input image -> opencl/device tile */
-        err = dt_opencl_write_host_to_device_raw(devid, (char *)ivoid + ioffs, input, iorigin, iregion,
-                                                 ipitch, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
+      /* non-blocking memory transfer: host input image -> opencl/device tile */
+      err = _cl_transfer_upload(&transfer, (char *)ivoid + ioffs, ipitch, input, iroi_full.width,
+                                iroi_full.height, in_bpp);
+      if(err != CL_SUCCESS) goto error;
 
       /* take original processed_maximum as starting point */
       for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
@@ -1899,62 +1879,37 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
         processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
       }
 
-      if(use_pinned_memory)
-      {
-        /* blocking memory transfer: complete opencl/device tile -> pinned host output buffer */
-        err = dt_opencl_read_host_from_device_raw(devid, (char *)output_buffer, output, oforigin, ofregion,
-                                                  (size_t)oroi_full.width * out_bpp, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-
-/* copy "good" part of tile from pinned output buffer to output image */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(ooffs, output_buffer, oroi_full, oorigin,                      \
-                                              oregion) schedule(static)
-#endif
-        for(size_t j = 0; j < oregion[1]; j++)
-          memcpy((char *)ovoid + ooffs + j * opitch,
-                 (char *)output_buffer + ((j + oorigin[1]) * oroi_full.width + oorigin[0]) * out_bpp,
-                 (size_t)oregion[0] * out_bpp);
-      }
-      else
-      {
-        /* blocking direct memory transfer: good part of opencl/device tile -> host output image */
-        err = dt_opencl_read_host_from_device_raw(devid, (char *)ovoid + ooffs, output, oorigin, oregion,
-                                                  opitch, CL_TRUE);
-        if(err != CL_SUCCESS) goto error;
-      }
+      /* non-blocking memory transfer: good part of opencl/device tile -> host output image. with pinned
+         memory the previous tile arrives meanwhile */
+      err = _cl_transfer_download(&transfer, output, oroi_full.width, oroi_full.height, out_bpp, oorigin,
+                                  oregion, (char *)ovoid + ooffs, opitch);
+      if(err != CL_SUCCESS) goto error;
 
-      /* release input and output buffers */
-      dt_opencl_release_mem_object(input);
+      /* give input and output buffers back, the next tile of the same size takes them again */
+      dt_opencl_pool_put(devid, input);
       input = NULL;
-      dt_opencl_release_mem_object(output);
+      dt_opencl_pool_put(devid, output);
       output = NULL;
-
-      /* block until opencl queue has finished to free all used event handlers */
-      if(!darktable.opencl->async_pixelpipe || piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT)
-        dt_opencl_finish(devid);
     }
 
+  /* wait for the last tiles */
+  err = _cl_transfer_finish(&transfer);
+  if(err != CL_SUCCESS) goto error;
+
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
-  if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
-  dt_opencl_release_mem_object(pinned_input);
-  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
-  dt_opencl_release_mem_object(pinned_output);
-  dt_opencl_release_mem_object(input);
-  dt_opencl_release_mem_object(output);
+  _cl_transfer_cleanup(&transfer);
+  dt_opencl_pool_flush(devid);
   piece->pipe->tiling = 0;
   return TRUE;
 
 error:
   /* copy back stored processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
-  if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
-  dt_opencl_release_mem_object(pinned_input);
-  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
-  dt_opencl_release_mem_object(pinned_output);
-  dt_opencl_release_mem_object(input);
-  dt_opencl_release_mem_object(output);
+  _cl_transfer_cleanup(&transfer);
+  dt_opencl_pool_put(devid, input);
+  dt_opencl_pool_put(devid, output);
+  dt_opencl_pool_flush(devid);
   piece->pipe->tiling = 0;
   dt_print(
       DT_DEBUG_OPENCL,
@@ -19,6 +19,7 @@
 #define __STDC_FORMAT_MACROS
 
 extern "C" {
+#include "common/tuning.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 
@@ -236,6 +237,24 @@ static INLINE vfloat vdup(vfloat a)
   // returns { a[0],a[0],a[1],a[1] }
   return _mm_unpacklo_ps(a, a);
 }
+static INLINE vfloat vclampnan01(vfloat x)
+{
+  // same as clampnan(x, 0, 1) on each element: infinities go to 0 or 1, nan to 0.5, everything else passes
+  const vmask infmask = (vmask)_mm_cmpeq_ps(vabsf(x), F2V(INFINITY));
+  const vmask nanmask = (vmask)_mm_cmpunord_ps(x, x);
+  x = vself(infmask, vself(vmaskf_gt(x, ZEROV), F2V(1.f), ZEROV), x);
+  return vself(nanmask, F2V(0.5f), x);
+}
+static INLINE void STRGB4(float *out, vfloat r, vfloat g, vfloat b)
+{
+  // stores 4 consecutive pixels as { r, g, b, 0 }
+  const vfloat rglo = _mm_unpacklo_ps(r, g), rghi = _mm_unpackhi_ps(r, g);
+  const vfloat b0lo = _mm_unpacklo_ps(b, ZEROV), b0hi = _mm_unpackhi_ps(b, ZEROV);
+  _mm_storeu_ps(out, _mm_movelh_ps(rglo, b0lo));
+  _mm_storeu_ps(out + 4, _mm_movehl_ps(b0lo, rglo));
+  _mm_storeu_ps(out + 8, _mm_movelh_ps(rghi, b0hi));
+  _mm_storeu_ps(out + 12, _mm_movehl_ps(b0hi, rghi));
+}
 
 #endif // __SSE2__
 
@@ -399,6 +418,16 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
     float v;
   } s_hv;
 
+#ifdef __SSE2__
+  // the plain codepath keeps the scalar green population and the channel by channel output. the vectorized
+  // versions have to give the same pixels, the pixelpipe test runs both.
+  const dt_tuning_module_t *tuning = dt_tuning_get(darktable.tuning, self->op);
+  const bool vectorize = darktable.codepath.SSE2 && !darktable.codepath.OPENMP_SIMD
+                         && !(tuning && tuning->codepath == DT_TUNING_CODEPATH_PLAIN);
+#else
+  const bool vectorize = false;
+#endif
+
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
@@ -1391,7 +1420,43 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 
         // populate G at R/B sites
         for(int rr = 8; rr < rr1 - 8; rr++)
-          for(int indx = rr * ts + 8 + (FC(rr, 2, filters) & 1); indx < rr * ts + cc1 - 8; indx += 2)
+        {
+          int indx = rr * ts + 8 + (FC(rr, 2, filters) & 1);
+#ifdef __SSE2__
+          // four R/B sites at once. hvwt of the row above is final already, so this only runs along the row.
+          const vfloat zd25v = F2V(0.25f);
+          if(vectorize)
+          {
+            for(; indx < rr * ts + cc1 - 14; indx += 8)
+            {
+              const vfloat hvwtv = LVFU(hvwt[indx >> 1]);
+              const vfloat hvwtaltv = zd25v * (LVFU(hvwt[(indx - m1) >> 1]) + LVFU(hvwt[(indx + p1) >> 1])
+                                               + LVFU(hvwt[(indx - p1) >> 1]) + LVFU(hvwt[(indx + m1) >> 1]));
+              const vfloat hvwtnewv
+                  = vself(vmaskf_lt(vabsf(zd5v - hvwtv), vabsf(zd5v - hvwtaltv)), hvwtaltv, hvwtv);
+              STVFU(hvwt[indx >> 1], hvwtnewv);
+
+              const vfloat Dgrbv = vintpf(hvwtnewv, LC2VFU(vcd[indx]), LC2VFU(hcd[indx]));
+              STVFU(Dgrb[0][indx >> 1], Dgrbv);
+
+              const vfloat rgbgreenv = LC2VFU(cfa[indx]) + Dgrbv;
+              STC2VFU(rgbgreen[indx], rgbgreenv);
+
+              vint nyv = _mm_cvtsi32_si128(*(int *)&nyquist2[indx >> 1]);
+              nyv = _mm_unpacklo_epi16(_mm_unpacklo_epi8(nyv, _mm_setzero_si128()), _mm_setzero_si128());
+              const vmask nymask = vnotm(_mm_cmpeq_epi32(nyv, _mm_setzero_si128()));
+              const vfloat hv = vself(
+                  nymask, SQRV(rgbgreenv - zd5v * (LC2VFU(rgbgreen[indx - 1]) + LC2VFU(rgbgreen[indx + 1]))),
+                  ZEROV);
+              const vfloat vv = vself(
+                  nymask, SQRV(rgbgreenv - zd5v * (LC2VFU(rgbgreen[indx - v1]) + LC2VFU(rgbgreen[indx + v1]))),
+                  ZEROV);
+              STVFU(Dgrb2[indx >> 1].h, _mm_unpacklo_ps(hv, vv));
+              STVFU(Dgrb2[(indx >> 1) + 2].h, _mm_unpackhi_ps(hv, vv));
+            }
+          }
+#endif
+          for(; indx < rr * ts + cc1 - 8; indx += 2)
           {
 
             // first ask if one gets more directional discrimination from nearby B/R sites
@@ -1415,6 +1480,7 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                                      ? SQR(rgbgreen[indx] - xdiv2f(rgbgreen[indx - v1] + rgbgreen[indx + v1]))
                                      : 0.f;
           }
+        }
 
 
         // end of standard interpolation
@@ -2105,14 +2171,24 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                                     * tempv;
               vfloat redv2 = greenv - vdup(LVFU(Dgrb[0][indx >> 1]));
               vfloat bluev2 = greenv - vdup(LVFU(Dgrb[1][indx >> 1]));
-              __attribute__((aligned(16))) float _r[4];
-              __attribute__((aligned(16))) float _b[4];
-              STVF(*_r, vself(selmask, redv1, redv2));
-              STVF(*_b, vself(selmask, bluev1, bluev2));
-              for(int c = 0; c < 4; c++)
+              if(vectorize)
               {
-                out[(row * roi_out->width + col + c) * 4] = clampnan(_r[c], 0.0, 1.0);
-                out[(row * roi_out->width + col + c) * 4 + 2] = clampnan(_b[c], 0.0, 1.0);
+                // write whole pixels, green included, instead of scattering single channels
+                STRGB4(&out[(row * roi_out->width + col) * 4], vclampnan01(vself(selmask, redv1, redv2)),
+                       vclampnan01(greenv), vclampnan01(vself(selmask, bluev1, bluev2)));
+              }
+              else
+              {
+                // green is copied back below
+                __attribute__((aligned(16))) float _r[4];
+                __attribute__((aligned(16))) float _b[4];
+                STVF(*_r, vself(selmask, redv1, redv2));
+                STVF(*_b, vself(selmask, bluev1, bluev2));
+                for(int c = 0; c < 4; c++)
+                {
+                  out[(row * roi_out->width + col + c) * 4] = clampnan(_r[c], 0.0, 1.0);
+                  out[(row * roi_out->width + col + c) * 4 + 2] = clampnan(_b[c], 0.0, 1.0);
+                }
               }
             }
           }
@@ -2141,6 +2217,7 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                                       + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1])
                                          * temp,
                                0.0, 1.0);
+                out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0, 1.0);
               }
 
               indx++;
@@ -2151,6 +2228,7 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                     = clampnan(rgbgreen[indx] - Dgrb[0][indx >> 1], 0.0, 1.0);
                 out[(row * roi_out->width + col) * 4 + 2]
                     = clampnan(rgbgreen[indx] - Dgrb[1][indx >> 1], 0.0, 1.0);
+                out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0, 1.0);
               }
             }
 
@@ -2176,6 +2254,7 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                                       + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1])
                                          * temp,
                                0.0, 1.0);
+                out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0, 1.0);
               }
             }
           }
@@ -2189,6 +2268,7 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                     = clampnan(rgbgreen[indx] - Dgrb[0][indx >> 1], 0.0, 1.0);
                 out[(row * roi_out->width + col) * 4 + 2]
                     = clampnan(rgbgreen[indx] - Dgrb[1][indx >> 1], 0.0, 1.0);
+                out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0, 1.0);
               }
 
               indx++;
@@ -2213,6 +2293,7 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                                       + (hvwt[(indx + v1) >> 1]) * Dgrb[1][(indx + v1) >> 1])
                                          * temp,
                                0.0, 1.0);
+                out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0, 1.0);
               }
             }
 
@@ -2224,6 +2305,7 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                     = clampnan(rgbgreen[indx] - Dgrb[0][indx >> 1], 0.0, 1.0);
                 out[(row * roi_out->width + col) * 4 + 2]
                     = clampnan(rgbgreen[indx] - Dgrb[1][indx >> 1], 0.0, 1.0);
+                out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0, 1.0);
               }
             }
           }
@@ -2346,29 +2428,19 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 #endif
         }
 
-        // copy smoothed results back to image matrix
-        for(int rr = 16; rr < rr1 - 16; rr++)
+        // copy smoothed results back to image matrix. the vectorized output above has written green already.
+        if(!vectorize)
         {
-          int row = rr + top;
-          int cc = 16;
-          // TODO (darktable): we have the pixel colors interleaved so writing them in blocks using SSE2 is
-          // not possible. or is it?
-          // #ifdef __SSE2__
-          //
-          //           for(; cc < cc1 - 19; cc += 4)
-          //           {
-          //             STVFU(out[(row * roi_out->width + (cc + left))  * 4 + 1], LVF(rgbgreen[rr * ts +
-          //             cc]));
-          //           }
-          //
-          // #endif
-
-          for(; cc < cc1 - 16; cc++)
+          for(int rr = 16; rr < rr1 - 16; rr++)
           {
-            int col = cc + left;
-            int indx = rr * ts + cc;
-            if(col < roi_out->width && row < roi_out->height)
-              out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0f, 1.0f);
+            int row = rr + top;
+            for(int cc = 16; cc < cc1 - 16; cc++)
+            {
+              int col = cc + left;
+              int indx = rr * ts + cc;
+              if(col < roi_out->width && row < roi_out->height)
+                out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0f, 1.0f);
+            }
           }
         }
 
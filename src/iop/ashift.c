@@ -67,6 +67,9 @@
 #define LSD_DENSITY_TH 0.7                  // LSD: minimal density of region points in rectangle
 #define LSD_N_BINS 1024                     // LSD: number of bins in pseudo-ordering of gradient modulus
 #define LSD_GAMMA 0.45                      // gamma correction to apply on raw images prior to line detection
+#define LSD_MAX_SIZE 1500                   // LSD: larger images are downscaled, lines are refined coarse to fine
+#define LSD_MAX_LEVELS 4                    // LSD: maximum number of downscaling steps
+#define LSD_REFINE_RADIUS 2                 // LSD: search range (in pixels) across a line when refining it
 #define RANSAC_RUNS 400                     // how many interations to run in ransac
 #define RANSAC_EPSILON 2                    // starting value for ransac epsilon (in -log10 units)
 #define RANSAC_EPSILON_STEP 1               // step size of epsilon optimization (log10 units)
@@ -403,6 +406,9 @@ typedef struct dt_iop_ashift_gui_data_t
   uint64_t lines_hash;
   uint64_t grid_hash;
   uint64_t buf_hash;
+  dt_iop_ashift_line_t *detected_lines; // result of the last line detection, before outlier removal
+  int detected_count;
+  uint64_t detected_hash;
   dt_iop_ashift_fitaxis_t lastfit;
   float lastx;
   float lasty;
@@ -1258,55 +1264,245 @@ static void gamma_correct(const float *in, float *out, const int width, const in
   }
 }
 
-// do actual line_detection based on LSD algorithm and return results according
-// to this module's conventions
-static int line_detect(float *in, const int width, const int height, const int x_off, const int y_off,
-                       const float scale, dt_iop_ashift_line_t **alines, int *lcount, int *vcount, int *hcount,
-                       float *vweight, float *hweight, dt_iop_ashift_enhance_t enhance, const int is_raw)
+// downscale a RGBA buffer by two for the next level of the line detection pyramid. pixel (i, j) covers
+// pixels (2i, 2j) to (2i + 1, 2j + 1) of the finer level, its center is at (2i + 0.5, 2j + 0.5) there.
+// a last odd row or column is dropped.
+static float *pyramid_down(const float *in, const int width, const int height, const int owidth,
+                           const int oheight)
+{
+  float *out = malloc((size_t)owidth * oheight * 4 * sizeof(float));
+  if(out == NULL) return NULL;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int j = 0; j < oheight; j++)
+  {
+    const float *inp = in + (size_t)4 * 2 * j * width;
+    float *outp = out + (size_t)4 * j * owidth;
+    for(int i = 0; i < owidth; i++, inp += 8, outp += 4)
+    {
+      for(int c = 0; c < 4; c++)
+        outp[c] = 0.25f * (inp[c] + inp[4 + c] + inp[4 * width + c] + inp[4 * width + 4 + c]);
+    }
+  }
+
+  return out;
+}
+
+// bilinear lookup in a greyscale buffer, coordinates have their origin in the center of the first pixel
+// like the lines returned by LSD
+static inline double grey_sample(const double *grey, const int width, const int height, double x, double y)
+{
+  x = CLAMP(x, 0.0, width - 1.0);
+  y = CLAMP(y, 0.0, height - 1.0);
+  const int i = MIN((int)x, width - 2);
+  const int j = MIN((int)y, height - 2);
+  const double fx = x - i, fy = y - j;
+  const double *p = grey + (size_t)j * width + i;
+  return (1.0 - fy) * ((1.0 - fx) * p[0] + fx * p[1]) + fy * ((1.0 - fx) * p[width] + fx * p[width + 1]);
+}
+
+// refine a line found on a coarser pyramid level on this one: look for the maximum gradient across the
+// line near a number of points along it and fit a new line through these maxima. the end points are
+// projected onto the new line. lines which can't be refined are kept as they are.
+static void line_refine(const double *grey, const int width, const int height, double *line)
+{
+  const double x1 = line[0], y1 = line[1], x2 = line[2], y2 = line[3];
+  const double length = sqrt(SQR(x2 - x1) + SQR(y2 - y1));
+  if(length < 2.0 * MIN_LINE_LENGTH || width < 2 || height < 2) return;
+
+  const double dx = (x2 - x1) / length, dy = (y2 - y1) / length;
+  const double nx = -dy, ny = dx;
+  const int r = LSD_REFINE_RADIUS;
+  const int samples = MIN((int)length, 256);
+
+  double sw = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, syy = 0.0, sxy = 0.0;
+  int found = 0;
+
+  for(int k = 0; k < samples; k++)
+  {
+    const double t = (k + 0.5) / samples;
+    const double px = x1 + t * (x2 - x1), py = y1 + t * (y2 - y1);
+
+    // grey values and gradients across the line
+    double v[2 * LSD_REFINE_RADIUS + 3];
+    double grad[2 * LSD_REFINE_RADIUS + 1];
+    for(int s = -r - 1; s <= r + 1; s++)
+      v[s + r + 1] = grey_sample(grey, width, height, px + s * nx, py + s * ny);
+    int best = 0;
+    for(int s = -r; s <= r; s++)
+    {
+      grad[s + r] = fabs(v[s + r + 2] - v[s + r]);
+      if(grad[s + r] > grad[best]) best = s + r;
+    }
+
+    // the edge has to be inside the search range
+    if(best == 0 || best == 2 * r || grad[best] <= 0.0) continue;
+
+    const double a = grad[best - 1], b = grad[best], c = grad[best + 1];
+    const double denom = a - 2.0 * b + c;
+    const double offset = best - r + (denom < 0.0 ? 0.5 * (a - c) / denom : 0.0);
+    const double qx = px + offset * nx, qy = py + offset * ny;
+
+    sw += b;
+    sx += b * qx;
+    sy += b * qy;
+    sxx += b * qx * qx;
+    syy += b * qy * qy;
+    sxy += b * qx * qy;
+    found++;
+  }
+
+  // not enough support for a new line
+  if(2 * found < samples || found < 4) return;
+
+  // weighted total least squares fit
+  const double cx = sx / sw, cy = sy / sw;
+  const double cxx = sxx / sw - cx * cx, cyy = syy / sw - cy * cy, cxy = sxy / sw - cx * cy;
+  const double theta = 0.5 * atan2(2.0 * cxy, cxx - cyy);
+  double ex = cos(theta), ey = sin(theta);
+  if(ex * dx + ey * dy < 0.0)
+  {
+    ex = -ex;
+    ey = -ey;
+  }
+
+  const double t1 = (x1 - cx) * ex + (y1 - cy) * ey;
+  const double t2 = (x2 - cx) * ex + (y2 - cy) * ey;
+  line[0] = cx + t1 * ex;
+  line[1] = cy + t1 * ey;
+  line[2] = cx + t2 * ex;
+  line[3] = cy + t2 * ey;
+}
+
+// run LSD on the coarsest level of a pyramid of in and refine the lines it finds on all finer levels.
+// without a pyramid this is plain LSD on the whole buffer. the results are in coordinates of in,
+// in the format of LineSegmentDetection().
+static double *pyramid_line_detect(float *in, const int width, const int height, int *lines_count,
+                                   dt_iop_ashift_enhance_t enhance)
 {
+  float *level_in[LSD_MAX_LEVELS + 1] = { NULL };
+  double *level_grey[LSD_MAX_LEVELS + 1] = { NULL };
+  int level_width[LSD_MAX_LEVELS + 1], level_height[LSD_MAX_LEVELS + 1];
   double *greyscale = NULL;
   double *lsd_lines = NULL;
-  dt_iop_ashift_line_t *ashift_lines = NULL;
 
-  int vertical_count = 0;
-  int horizontal_count = 0;
-  float vertical_weight = 0.0f;
-  float horizontal_weight = 0.0f;
+  // downscale until the buffer fits the size we want to run LSD on
+  int levels = 0;
+  level_in[0] = in;
+  level_width[0] = width;
+  level_height[0] = height;
+  while(levels < LSD_MAX_LEVELS && MAX(level_width[levels], level_height[levels]) > LSD_MAX_SIZE
+        && MIN(level_width[levels], level_height[levels]) >= 32)
+  {
+    const int w = level_width[levels] / 2, h = level_height[levels] / 2;
+    level_in[levels + 1] = pyramid_down(level_in[levels], level_width[levels], level_height[levels], w, h);
+    if(level_in[levels + 1] == NULL) goto error;
+    level_width[levels + 1] = w;
+    level_height[levels + 1] = h;
+    levels++;
+  }
 
-  // apply gamma correction if image is raw
-  if(is_raw)
+  // greyscale versions of the finer levels, without any enhancement, for the refinement
+  for(int l = 0; l < levels; l++)
   {
-    gamma_correct(in, in, width, height);
+    level_grey[l] = malloc((size_t)level_width[l] * level_height[l] * sizeof(double));
+    if(level_grey[l] == NULL) goto error;
+    rgb2grey256(level_in[l], level_grey[l], level_width[l], level_height[l]);
   }
 
+  const int cwidth = level_width[levels], cheight = level_height[levels];
+  float *coarse = level_in[levels];
+
   // if requested perform an additional detail enhancement step
   if(enhance & ASHIFT_ENHANCE_DETAIL)
   {
-    (void)detail_enhance(in, in, width, height);
+    (void)detail_enhance(coarse, coarse, cwidth, cheight);
   }
 
   // allocate intermediate buffers
-  greyscale = malloc((size_t)width * height * sizeof(double));
+  greyscale = malloc((size_t)cwidth * cheight * sizeof(double));
   if(greyscale == NULL) goto error;
 
   // convert to greyscale image
-  rgb2grey256(in, greyscale, width, height);
+  rgb2grey256(coarse, greyscale, cwidth, cheight);
 
   // if requested perform an additional edge enhancement step
   if(enhance & ASHIFT_ENHANCE_EDGES)
   {
-    (void)edge_enhance(greyscale, greyscale, width, height);
+    (void)edge_enhance(greyscale, greyscale, cwidth, cheight);
   }
 
   // call the line segment detector LSD;
   // LSD stores the number of found lines in lines_count.
   // it returns structural details as vector 'double lines[7 * lines_count]'
-  int lines_count;
-  lsd_lines = LineSegmentDetection(&lines_count, greyscale, width, height,
+  lsd_lines = LineSegmentDetection(lines_count, greyscale, cwidth, cheight,
                                    LSD_SCALE, LSD_SIGMA_SCALE, LSD_QUANT,
                                    LSD_ANG_TH, LSD_LOG_EPS, LSD_DENSITY_TH,
                                    LSD_N_BINS, NULL, NULL, NULL);
 
+  // coarse to fine: scale the lines to the next level and refine them there
+  for(int l = levels - 1; l >= 0; l--)
+  {
+    const int n = *lines_count;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for(int k = 0; k < n; k++)
+    {
+      double *line = lsd_lines + (size_t)k * 7;
+      for(int c = 0; c < 4; c++) line[c] = 2.0 * line[c] + 0.5;
+      line[4] *= 2.0;
+      line_refine(level_grey[l], level_width[l], level_height[l], line);
+    }
+  }
+
+  for(int l = 0; l <= levels; l++)
+  {
+    if(l > 0) free(level_in[l]);
+    free(level_grey[l]);
+  }
+  free(greyscale);
+  return lsd_lines;
+
+error:
+  for(int l = 0; l <= levels + 1 && l <= LSD_MAX_LEVELS; l++)
+  {
+    if(l > 0) free(level_in[l]);
+    free(level_grey[l]);
+  }
+  free(greyscale);
+  free(lsd_lines);
+  *lines_count = 0;
+  return NULL;
+}
+
+// do actual line_detection based on LSD algorithm and return results according
+// to this module's conventions
+static int line_detect(float *in, const int width, const int height, const int x_off, const int y_off,
+                       const float scale, dt_iop_ashift_line_t **alines, int *lcount, int *vcount, int *hcount,
+                       float *vweight, float *hweight, dt_iop_ashift_enhance_t enhance, const int is_raw)
+{
+  double *lsd_lines = NULL;
+  dt_iop_ashift_line_t *ashift_lines = NULL;
+
+  int vertical_count = 0;
+  int horizontal_count = 0;
+  float vertical_weight = 0.0f;
+  float horizontal_weight = 0.0f;
+
+  // apply gamma correction if image is raw
+  if(is_raw)
+  {
+    gamma_correct(in, in, width, height);
+  }
+
+  // detect lines, on a downscaled copy for large images
+  int lines_count;
+  lsd_lines = pyramid_line_detect(in, width, height, &lines_count, enhance);
+  if(lsd_lines == NULL) goto error;
+
   // we count the lines that we really want to use
   int lct = 0;
 
@@ -1424,15 +1620,30 @@ static int line_detect(float *in, const int width, const int height, const int x
 
   // free intermediate buffers
   free(lsd_lines);
-  free(greyscale);
   return lct > 0 ? TRUE : FALSE;
 
 error:
   free(lsd_lines);
-  free(greyscale);
   return FALSE;
 }
 
+// hash of everything line detection depends on: image, input buffer and enhancement
+static uint64_t get_structure_hash(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhance)
+{
+  dt_iop_ashift_gui_data_t *g = (dt_iop_ashift_gui_data_t *)module->gui_data;
+
+  const int32_t imgid = module->dev->image_storage.id;
+  const int values[] = { imgid, enhance, g->buf_width, g->buf_height, g->buf_x_off, g->buf_y_off };
+
+  uint64_t hash = g->buf_hash;
+  const char *str = (const char *)values;
+  for(size_t i = 0; i < sizeof(values); i++) hash = ((hash << 5) + hash) ^ str[i];
+  str = (const char *)&g->buf_scale;
+  for(size_t i = 0; i < sizeof(g->buf_scale); i++) hash = ((hash << 5) + hash) ^ str[i];
+
+  return hash;
+}
+
 // get image from buffer, analyze for structure and save results
 static int get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhance)
 {
@@ -1444,6 +1655,8 @@ static int get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhanc
   int x_off = 0;
   int y_off = 0;
   float scale = 0.0f;
+  uint64_t hash = 0;
+  int cached = FALSE;
 
   dt_pthread_mutex_lock(&g->lock);
   // read buffer data if they are available
@@ -1454,15 +1667,22 @@ static int get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhanc
     x_off = g->buf_x_off;
     y_off = g->buf_y_off;
     scale = g->buf_scale;
+    hash = get_structure_hash(module, enhance);
+
+    // lines of the same image, buffer and enhancement don't need to be detected again
+    cached = g->detected_lines != NULL && g->detected_hash == hash;
 
     // create a temporary buffer to hold image data
-    buffer = malloc((size_t)width * height * 4 * sizeof(float));
-    if(buffer != NULL)
-      memcpy(buffer, g->buf, (size_t)width * height * 4 * sizeof(float));
+    if(!cached)
+    {
+      buffer = malloc((size_t)width * height * 4 * sizeof(float));
+      if(buffer != NULL)
+        memcpy(buffer, g->buf, (size_t)width * height * 4 * sizeof(float));
+    }
   }
   dt_pthread_mutex_unlock(&g->lock);
 
-  if(buffer == NULL) goto error;
+  if(buffer == NULL && !cached) goto error;
 
   // get rid of old structural data
   g->lines_count = 0;
@@ -1473,16 +1693,51 @@ static int get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhanc
 
   dt_iop_ashift_line_t *lines;
   int lines_count;
-  int vertical_count;
-  int horizontal_count;
-  float vertical_weight;
-  float horizontal_weight;
+  int vertical_count = 0;
+  int horizontal_count = 0;
+  float vertical_weight = 0.0f;
+  float horizontal_weight = 0.0f;
 
-  // get new structural data
-  if(!line_detect(buffer, width, height, x_off, y_off, scale, &lines, &lines_count,
-                  &vertical_count, &horizontal_count, &vertical_weight, &horizontal_weight,
-                  enhance, dt_image_is_raw(&module->dev->image_storage)))
-    goto error;
+  if(cached)
+  {
+    // take a copy of the detected lines, outlier removal changes their type
+    lines_count = g->detected_count;
+    lines = (dt_iop_ashift_line_t *)malloc((size_t)lines_count * sizeof(dt_iop_ashift_line_t));
+    if(lines == NULL) goto error;
+    memcpy(lines, g->detected_lines, (size_t)lines_count * sizeof(dt_iop_ashift_line_t));
+
+    for(int n = 0; n < lines_count; n++)
+    {
+      if(lines[n].type == ASHIFT_LINE_VERTICAL_SELECTED)
+      {
+        vertical_count++;
+        vertical_weight += lines[n].weight;
+      }
+      else if(lines[n].type == ASHIFT_LINE_HORIZONTAL_SELECTED)
+      {
+        horizontal_count++;
+        horizontal_weight += lines[n].weight;
+      }
+    }
+  }
+  else
+  {
+    // get new structural data
+    if(!line_detect(buffer, width, height, x_off, y_off, scale, &lines, &lines_count,
+                    &vertical_count, &horizontal_count, &vertical_weight, &horizontal_weight,
+                    enhance, dt_image_is_raw(&module->dev->image_storage)))
+      goto error;
+
+    // and keep it for the next time
+    free(g->detected_lines);
+    g->detected_lines = (dt_iop_ashift_line_t *)malloc((size_t)lines_count * sizeof(dt_iop_ashift_line_t));
+    if(g->detected_lines != NULL)
+    {
+      memcpy(g->detected_lines, lines, (size_t)lines_count * sizeof(dt_iop_ashift_line_t));
+      g->detected_count = lines_count;
+      g->detected_hash = hash;
+    }
+  }
 
   // save new structural data
   g->lines_in_width = width;
@@ -4342,6 +4597,9 @@ void gui_init(struct dt_iop_module_t *self)
   dt_pthread_mutex_unlock(&g->lock);
 
   g->fitting = 0;
+  g->detected_lines = NULL;
+  g->detected_count = 0;
+  g->detected_hash = 0;
   g->lines = NULL;
   g->lines_count = 0;
   g->vertical_count = 0;
@@ -4576,6 +4834,7 @@ void gui_cleanup(struct dt_iop_module_t *self)
   dt_iop_ashift_gui_data_t *g = (dt_iop_ashift_gui_data_t *)self->gui_data;
   dt_pthread_mutex_destroy(&g->lock);
   free(g->lines);
+  free(g->detected_lines);
   free(g->buf);
   free(g->points);
   free(g->points_idx);
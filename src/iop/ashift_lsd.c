@@ -25,6 +25,10 @@
  *      catch (unlikely) division by zero near line 2035
  *      rename rad1 and rad2 to radius1 and radius2 in reduce_region_radius()
  *        to avoid naming conflict in windows build
+ *      fill the table of inverse values in advance, which makes nfa() thread safe
+ *      parallelize gaussian_sampler() and the gradient computation of ll_angle()
+ *      LineSegmentDetection() grows all regions first and validates them afterwards
+ *        in parallel, the results are the same as those of the sequential code
  *
  */
 
@@ -690,13 +694,22 @@ static image_double gaussian_sampler( image_double in, double scale,
   prec = 3.0;
   h = (unsigned int) ceil( sigma * sqrt( 2.0 * prec * log(10.0) ) );
   n = 1+2*h; /* kernel size */
-  kernel = new_ntuple_list(n);
 
   /* auxiliary double image size variables */
   double_x_size = (int) (2 * in->xsize);
   double_y_size = (int) (2 * in->ysize);
 
+  /* each thread needs its own kernel, it is computed for every column and row */
+#ifdef _OPENMP
+#pragma omp parallel private(kernel, x, y, i, j, xc, yc, xx, yy, sum)
+#endif
+  {
+  kernel = new_ntuple_list(n);
+
   /* First subsampling: x axis */
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
   for(x=0;x<aux->xsize;x++)
     {
       /*
@@ -731,6 +744,9 @@ static image_double gaussian_sampler( image_double in, double scale,
     }
 
   /* Second subsampling: y axis */
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
   for(y=0;y<out->ysize;y++)
     {
       /*
@@ -764,8 +780,10 @@ static image_double gaussian_sampler( image_double in, double scale,
         }
     }
 
-  /* free memory */
   free_ntuple_list(kernel);
+  }
+
+  /* free memory */
   free_image_double(aux);
 
   return out;
@@ -845,6 +863,10 @@ static image_double ll_angle( image_double in, double threshold,
   for(y=0;y<n;y++) g->data[p*y+p-1]   = NOTDEF;
 
   /* compute gradient on the remaining pixels */
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) private(y, adr, com1, com2, gx, gy, norm, norm2) \
+    reduction(max : max_grad)
+#endif
   for(x=0;x<p-1;x++)
     for(y=0;y<n-1;y++)
       {
@@ -1081,6 +1103,8 @@ __attribute__((constructor)) static void invConstructor()
 {
   if(inv) return;
   inv = malloc(sizeof(double) * TABSIZE);
+  inv[0] = 0.0;
+  for(int i = 1; i < TABSIZE; i++) inv[i] = 1.0 / (double)i;
 }
 
 __attribute__((destructor)) static void invDestructor()
@@ -1185,13 +1209,11 @@ static double nfa(int n, int k, double p, double logNT)
            term_i / term_i-1 = (n-i+1)/i * p/(1-p)
          and
            term_i = term_i-1 * (n-i+1)/i * p/(1-p).
-         1/i is stored in a table as they are computed,
+         1/i is stored in a table computed in advance,
          because divisions are expensive.
          p/(1-p) is computed only once and stored in 'p_term'.
        */
-      bin_term = (double) (n-i+1) * ( i<TABSIZE ?
-                   ( inv[i]!=0.0 ? inv[i] : ( inv[i] = 1.0 / (double) i ) ) :
-                   1.0 / (double) i );
+      bin_term = (double) (n-i+1) * ( i<TABSIZE ? inv[i] : 1.0 / (double) i );
 
       mult_term = bin_term * p_term;
       term *= mult_term;
@@ -2087,6 +2109,17 @@ static int refine( struct point * reg, int * reg_size, image_double modgrad,
 /*----------------------------------------------------------------------------*/
 /** LSD full interface.
  */
+/*----------------------------------------------------------------------------*/
+/** A region that passed 'refine', waiting for its NFA value.
+ */
+struct candidate
+{
+  struct rect rec;    /* rectangle approximation of the region */
+  double log_nfa;
+  struct point * reg; /* the region points, only if a region image is requested */
+  int reg_size;
+};
+
 static
 double * LineSegmentDetection( int * n_out,
                                double * img, int X, int Y,
@@ -2107,8 +2140,10 @@ double * LineSegmentDetection( int * n_out,
   struct point * reg;
   int reg_size,min_reg_size,i;
   unsigned int xsize,ysize;
-  double rho,reg_angle,prec,p,log_nfa,logNT;
+  double rho,reg_angle,prec,p,logNT;
   int ls_count = 0;                   /* line segments are numbered 1,2,3,... */
+  struct candidate * cand = NULL;     /* regions which passed 'refine' */
+  int cand_count = 0, cand_size = 0;
 
 
   /* check parameters */
@@ -2200,9 +2235,45 @@ double * LineSegmentDetection( int * n_out,
         if( !refine( reg, &reg_size, modgrad, reg_angle,
                      prec, p, &rec, used, angles, density_th ) ) continue;
 
-        /* compute NFA value */
-        log_nfa = rect_improve(&rec,angles,logNT,log_eps);
-        if( log_nfa <= log_eps ) continue;
+        /* the NFA only depends on 'angles', it is computed for all
+           candidates at once below */
+        if( cand_count == cand_size )
+          {
+            cand_size = cand_size ? 2 * cand_size : 256;
+            cand = (struct candidate *) realloc( (void *) cand,
+                                  (size_t) cand_size * sizeof(struct candidate) );
+            if( cand == NULL ) error("not enough memory!");
+          }
+        rect_copy(&rec,&cand[cand_count].rec);
+        cand[cand_count].reg = NULL;
+        cand[cand_count].reg_size = reg_size;
+        if( region != NULL )
+          {
+            cand[cand_count].reg = (struct point *)
+                                   malloc( (size_t) reg_size * sizeof(struct point) );
+            if( cand[cand_count].reg == NULL ) error("not enough memory!");
+            for(i=0; i<reg_size; i++) cand[cand_count].reg[i] = reg[i];
+          }
+        cand_count++;
+      }
+
+  /* compute NFA values */
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for(int c=0; c<cand_count; c++)
+    cand[c].log_nfa = rect_improve(&cand[c].rec,angles,logNT,log_eps);
+
+  /* keep the meaningful ones, in the order they were found */
+  for(int c=0; c<cand_count; c++)
+      {
+        const double log_nfa = cand[c].log_nfa;
+        rec = cand[c].rec;
+        if( log_nfa <= log_eps )
+          {
+            free( (void *) cand[c].reg );
+            continue;
+          }
 
         /* A New Line Segment was found! */
         ++ls_count;  /* increase line segment counter */
@@ -2229,8 +2300,9 @@ double * LineSegmentDetection( int * n_out,
 
         /* add region number to 'region' image if needed */
         if( region != NULL )
-          for(i=0; i<reg_size; i++)
-            region->data[ reg[i].x + reg[i].y * region->xsize ] = ls_count;
+          for(i=0; i<cand[c].reg_size; i++)
+            region->data[ cand[c].reg[i].x + cand[c].reg[i].y * region->xsize ] = ls_count;
+        free( (void *) cand[c].reg );
       }
 
 
@@ -2243,6 +2315,7 @@ double * LineSegmentDetection( int * n_out,
   free_image_char(used);
   free( (void *) reg );
   free( (void *) mem_p );
+  free( (void *) cand );
 
   /* return the result */
   if( reg_img != NULL && reg_x != NULL && reg_y != NULL )
@@ -19,8 +19,10 @@
 #include "config.h"
 #endif
 #include "common/darktable.h"
+#include "common/opencl.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
+#include "develop/tiling.h"
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
 
@@ -42,12 +44,28 @@ typedef struct dt_iop_cacorrect_gui_data_t
 {
 } dt_iop_cacorrect_gui_data_t;
 
+// the correction is constant on blocks of CA_BLOCK x CA_BLOCK pixels, given by
+// a polynomial fit over the block positions of the whole image
+#define CA_TS 128
+#define CA_BLOCK (CA_TS - 16)
+
+typedef struct dt_iop_cacorrect_fit_t
+{
+  int valid;   // 0: still to be estimated, 1: fitparams hold a fit, -1: nothing to correct
+  int polyord; // order of the 2d polynomial
+  int x, y;    // origin of the image the fit was estimated on, block (1, 1) starts there
+  double fitparams[2][2][16];
+} dt_iop_cacorrect_fit_t;
+
 typedef struct dt_iop_cacorrect_data_t
 {
+  dt_iop_cacorrect_fit_t fit; // valid only while process_tiling() runs the tiles
 } dt_iop_cacorrect_data_t;
 
 typedef struct dt_iop_cacorrect_global_data_t
 {
+  int kernel_cacorrect_green;
+  int kernel_cacorrect_apply;
 } dt_iop_cacorrect_global_data_t;
 
 // this returns a translatable name
@@ -64,7 +82,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_ALLOW_TILING;
 }
 
 /** modify regions of interest (optional, per pixel ops don't need this) */
@@ -300,20 +318,60 @@ static inline void pixSort(float *a, float *b)
   }
 }
 
+// CA shifts of red and blue, vertical and horizontal, of the given block
+static void CA_block_shifts(const dt_iop_cacorrect_fit_t *const fit, const int vblock, const int hblock,
+                            float lblockshifts[2][2])
+{
+  const int polyord = fit->polyord;
+  lblockshifts[0][0] = lblockshifts[0][1] = 0;
+  lblockshifts[1][0] = lblockshifts[1][1] = 0;
+  double powVblock = 1.0;
+  for(int i = 0; i < polyord; i++)
+  {
+    double powHblock = powVblock;
+    for(int j = 0; j < polyord; j++)
+    {
+      lblockshifts[0][0] += powHblock * fit->fitparams[0][0][polyord * i + j];
+      lblockshifts[0][1] += powHblock * fit->fitparams[0][1][polyord * i + j];
+      lblockshifts[1][0] += powHblock * fit->fitparams[1][0][polyord * i + j];
+      lblockshifts[1][1] += powHblock * fit->fitparams[1][1][polyord * i + j];
+      powHblock *= hblock;
+    }
+    powVblock *= vblock;
+  }
+  const float bslim = 3.99; // max allowed CA shift
+  lblockshifts[0][0] = LIM(lblockshifts[0][0], -bslim, bslim);
+  lblockshifts[0][1] = LIM(lblockshifts[0][1], -bslim, bslim);
+  lblockshifts[1][0] = LIM(lblockshifts[1][0], -bslim, bslim);
+  lblockshifts[1][1] = LIM(lblockshifts[1][1], -bslim, bslim);
+}
+
+// with fit->valid == 0 the CA shifts are estimated on in2 and stored in fit, the image is then corrected with
+// them. otherwise the given fit is used, in2 being a part of the image it was estimated on (aligned to
+// CA_BLOCK). out == NULL only estimates.
 // void RawImageSource::CA_correct_RT(const double cared, const double cablue, const double caautostrength)
 static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in2,
-                       float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+                       float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                       dt_iop_cacorrect_fit_t *const fit)
 {
   const int width = roi_in->width;
   const int height = roi_in->height;
   const uint32_t filters = piece->pipe->dsc.filters;
-  memcpy(out, in2, width * height * sizeof(float));
-  const float *const in = out;
+  if(out) memcpy(out, in2, sizeof(float) * width * height);
+  const float *const in = in2;
   const double cared = 0, cablue = 0;
   const double caautostrength = 4;
 
+  const gboolean estimate = fit->valid == 0;
+  if(estimate)
+  {
+    fit->valid = -1;
+    fit->x = roi_in->x;
+    fit->y = roi_in->y;
+  }
+
   // multithreaded and partly vectorized by Ingo Weyrich
-  const int ts = 128;
+  const int ts = CA_TS;
   const int tsh = ts / 2;
   // shifts to location of vertical and diagonal neighbors
   const int v1 = ts, v2 = 2 * ts, v3 = 3 * ts,
@@ -339,16 +397,21 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   // local variables
   //   const int width = W, height = H;
   // temporary array to store simple interpolation of G
-  float *Gtmp = (float(*))calloc((height) * (width), sizeof *Gtmp);
+  // (only needed for the correction)
+  float *Gtmp = out ? (float(*))calloc((size_t)height * width, sizeof *Gtmp) : NULL;
 
   // temporary array to avoid race conflicts, only every second pixel needs to be saved here
-  float *RawDataTmp = (float *)malloc(height * width * sizeof(float) / 2 + 4);
+  float *RawDataTmp = out ? (float *)malloc((size_t)height * width * sizeof(float) / 2 + 4) : NULL;
 
   float blockave[2][2] = { { 0, 0 }, { 0, 0 } }, blocksqave[2][2] = { { 0, 0 }, { 0, 0 } },
         blockdenom[2][2] = { { 0, 0 }, { 0, 0 } }, blockvar[2][2];
 
   // Because we can't break parallel processing, we need a switch do handle the errors
-  gboolean processpasstwo = TRUE;
+  gboolean processpasstwo = estimate || fit->valid > 0;
+
+  // blocks of this image relative to the one the fit is for
+  const int voffs = (roi_in->y - fit->y) / CA_BLOCK;
+  const int hoffs = (roi_in->x - fit->x) / CA_BLOCK;
 
   const int border = 8;
   const int border2 = 16;
@@ -364,7 +427,7 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   float *blockwt = (float *)buffer1;
   float(*blockshifts)[2][2] = (float(*)[2][2])(buffer1 + (vblsz * hblsz * sizeof(float)));
 
-  double fitparams[2][2][16];
+  double(*fitparams)[2][16] = fit->fitparams;
 
   // order of 2d polynomial fit (polyord), and numpar=polyord^2
   int polyord = 4, numpar = 16;
@@ -606,7 +669,7 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                              / (wtu + wtd + wtl + wtr);
             }
 
-            if(row > -1 && row < height)
+            if(Gtmp && row > -1 && row < height)
             {
               for(int col = MAX(left + 3, 0), indx = rr * ts + 3 - (left < 0 ? (left + 3) : 0);
                   col < MIN(cc1 + left - 3, width); col++, indx++)
@@ -615,6 +678,9 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
               }
             }
           }
+
+          // with a given fit only the interpolated G is needed
+          if(!estimate) continue;
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 #ifdef __SSE2__
           vfloat zd25v = F2V(0.25f);
@@ -888,6 +954,7 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 #ifdef _OPENMP
 #pragma omp single
 #endif
+      if(estimate)
       {
         for(int dir = 0; dir < 2; dir++)
           for(int c = 0; c < 2; c++)
@@ -1068,13 +1135,15 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
         }
 
         // fitparams[polyord*i+j] gives the coefficients of (vblock^i hblock^j) in a polynomial fit for i,j<=4
+        fit->polyord = polyord;
+        fit->valid = processpasstwo ? 1 : -1;
       }
       // end of initialization for CA correction pass
       // only executed if cared and cablue are zero
     }
 
     // Main algorithm: Tile loop
-    if(processpasstwo)
+    if(processpasstwo && out)
     {
 #ifdef _OPENMP
 #pragma omp for schedule(dynamic) collapse(2) nowait
@@ -1085,8 +1154,8 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
         {
           memset(buffer, 0, buffersize);
           float lblockshifts[2][2];
-          const int vblock = ((top + border) / (ts - border2)) + 1;
-          const int hblock = ((left + border) / (ts - border2)) + 1;
+          const int vblock = ((top + border) / (ts - border2)) + 1 + voffs;
+          const int hblock = ((left + border) / (ts - border2)) + 1 + hoffs;
           const int bottom = MIN(top + ts, height + border);
           const int right = MIN(left + ts, width + border);
           const int rr1 = bottom - top;
@@ -1258,28 +1327,7 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
           else
           {
             // CA auto correction; use CA diagnostic pass to set shift parameters
-            lblockshifts[0][0] = lblockshifts[0][1] = 0;
-            lblockshifts[1][0] = lblockshifts[1][1] = 0;
-            double powVblock = 1.0;
-            for(int i = 0; i < polyord; i++)
-            {
-              double powHblock = powVblock;
-              for(int j = 0; j < polyord; j++)
-              {
-                // printf("i= %d j= %d polycoeff= %f \n",i,j,fitparams[0][0][polyord*i+j]);
-                lblockshifts[0][0] += powHblock * fitparams[0][0][polyord * i + j];
-                lblockshifts[0][1] += powHblock * fitparams[0][1][polyord * i + j];
-                lblockshifts[1][0] += powHblock * fitparams[1][0][polyord * i + j];
-                lblockshifts[1][1] += powHblock * fitparams[1][1][polyord * i + j];
-                powHblock *= hblock;
-              }
-              powVblock *= vblock;
-            }
-            const float bslim = 3.99; // max allowed CA shift
-            lblockshifts[0][0] = LIM(lblockshifts[0][0], -bslim, bslim);
-            lblockshifts[0][1] = LIM(lblockshifts[0][1], -bslim, bslim);
-            lblockshifts[1][0] = LIM(lblockshifts[1][0], -bslim, bslim);
-            lblockshifts[1][1] = LIM(lblockshifts[1][1], -bslim, bslim);
+            CA_block_shifts(fit, vblock, hblock, lblockshifts);
           } // end of setting CA shift parameters
 
 
@@ -1478,11 +1526,176 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
  *==================================================================================*/
 
 
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  // input and output, interpolated G and the half sized temporary image on the cpu. the gpu needs
+  // input, output and G.
+  tiling->factor = piece->pipe->devid >= 0 ? 3.0f : 3.5f;
+  tiling->maxbuf = 1.0f;
+  // the per thread tile buffers of the cpu code
+  tiling->overhead
+      = piece->pipe->devid >= 0 ? 0 : (size_t)dt_get_num_threads() * sizeof(float) * 6 * CA_TS * CA_TS;
+  // G interpolation and the CA shift reach less than 16 pixels. tiles have to start on the grid of the
+  // blocks, which keeps the cfa pattern as well.
+  tiling->overlap = 16;
+  tiling->xalign = CA_BLOCK;
+  tiling->yalign = CA_BLOCK;
+}
+
 /** process, all real work is done here. */
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  CA_correct(self, piece, (float *)i, (float *)o, roi_in, roi_out);
+  dt_iop_cacorrect_data_t *d = (dt_iop_cacorrect_data_t *)piece->data;
+  // estimated on this image unless process_tiling() has done so on the whole one
+  dt_iop_cacorrect_fit_t fit = d->fit;
+  CA_correct(self, piece, (float *)i, (float *)o, roi_in, roi_out, &fit);
+}
+
+// the CA shifts are a fit over the whole image, the tiles would each find their own
+void process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                    void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                    const int bpp)
+{
+  dt_iop_cacorrect_data_t *d = (dt_iop_cacorrect_data_t *)piece->data;
+  d->fit.valid = 0;
+  CA_correct(self, piece, (float *)ivoid, NULL, roi_in, roi_out, &d->fit);
+  default_process_tiling(self, piece, ivoid, ovoid, roi_in, roi_out, bpp);
+  d->fit.valid = 0;
+}
+
+#ifdef HAVE_OPENCL
+int process_tiling_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                      void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                      const int bpp)
+{
+  dt_iop_cacorrect_data_t *d = (dt_iop_cacorrect_data_t *)piece->data;
+  d->fit.valid = 0;
+  CA_correct(self, piece, (float *)ivoid, NULL, roi_in, roi_out, &d->fit);
+  const int success = default_process_tiling_cl(self, piece, ivoid, ovoid, roi_in, roi_out, bpp);
+  d->fit.valid = 0;
+  return success;
+}
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_cacorrect_data_t *d = (dt_iop_cacorrect_data_t *)piece->data;
+  dt_iop_cacorrect_global_data_t *gd = (dt_iop_cacorrect_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_green = NULL, dev_shifts = NULL;
+  float *in = NULL, *shifts = NULL;
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const uint32_t filters = piece->pipe->dsc.filters;
+
+  dt_iop_cacorrect_fit_t fit = d->fit;
+  if(!fit.valid)
+  {
+    // the CA shifts are estimated on the cpu, only the correction runs here
+    in = dt_alloc_align(64, sizeof(float) * width * height);
+    if(in == NULL) goto error;
+    err = dt_opencl_copy_device_to_host(devid, in, dev_in, width, height, sizeof(float));
+    if(err != CL_SUCCESS) goto error;
+    CA_correct(self, piece, in, NULL, roi_in, roi_out, &fit);
+    dt_free_align(in);
+    in = NULL;
+  }
+
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+  if(fit.valid < 0)
+  {
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  // red and blue shifts of every block, vertical and horizontal
+  const int bwidth = (width + CA_BLOCK - 1) / CA_BLOCK;
+  const int bheight = (height + CA_BLOCK - 1) / CA_BLOCK;
+  const int voffs = (roi_in->y - fit.y) / CA_BLOCK;
+  const int hoffs = (roi_in->x - fit.x) / CA_BLOCK;
+  shifts = malloc(sizeof(float) * 4 * bwidth * bheight);
+  if(shifts == NULL) goto error;
+  for(int j = 0; j < bheight; j++)
+    for(int i = 0; i < bwidth; i++)
+    {
+      float lblockshifts[2][2];
+      CA_block_shifts(&fit, j + 1 + voffs, i + 1 + hoffs, lblockshifts);
+      float *const s = shifts + 4 * ((size_t)j * bwidth + i);
+      s[0] = lblockshifts[0][0];
+      s[1] = lblockshifts[0][1];
+      s[2] = lblockshifts[1][0];
+      s[3] = lblockshifts[1][1];
+    }
+
+  dev_shifts = dt_opencl_copy_host_to_device(devid, shifts, bwidth, bheight, 4 * sizeof(float));
+  dev_green = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(dev_shifts == NULL || dev_green == NULL)
+  {
+    err = -999;
+    goto error;
+  }
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  const int blocksize = CA_BLOCK;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 1, sizeof(cl_mem), (void *)&dev_green);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_green, 4, sizeof(uint32_t), (void *)&filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_cacorrect_green, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 1, sizeof(cl_mem), (void *)&dev_green);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 2, sizeof(cl_mem), (void *)&dev_shifts);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 3, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 4, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 5, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 6, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_cacorrect_apply, 7, sizeof(int), (void *)&blocksize);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_cacorrect_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_green);
+  dt_opencl_release_mem_object(dev_shifts);
+  free(shifts);
+  return TRUE;
+
+error:
+  dt_free_align(in);
+  free(shifts);
+  dt_opencl_release_mem_object(dev_green);
+  dt_opencl_release_mem_object(dev_shifts);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_cacorrect] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 23; // cacorrect.cl, from programs.conf
+  dt_iop_cacorrect_global_data_t *gd
+      = (dt_iop_cacorrect_global_data_t *)malloc(sizeof(dt_iop_cacorrect_global_data_t));
+  module->data = gd;
+  gd->kernel_cacorrect_green = dt_opencl_create_kernel(program, "cacorrect_green");
+  gd->kernel_cacorrect_apply = dt_opencl_create_kernel(program, "cacorrect_apply");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_cacorrect_global_data_t *gd = (dt_iop_cacorrect_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_cacorrect_green);
+  dt_opencl_free_kernel(gd->kernel_cacorrect_apply);
+  free(module->data);
+  module->data = NULL;
 }
 
 void reload_defaults(dt_iop_module_t *module)
@@ -1508,8 +1721,6 @@ end:
 /** init, cleanup, commit to pipeline */
 void init(dt_iop_module_t *module)
 {
-  // we don't need global data:
-  module->data = NULL; // malloc(sizeof(dt_iop_cacorrect_global_data_t));
   module->params = calloc(1, sizeof(dt_iop_cacorrect_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_cacorrect_params_t));
   // our module is disabled by default
@@ -1526,8 +1737,6 @@ void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
   module->params = NULL;
-  free(module->data); // just to be sure
-  module->data = NULL;
 }
 
 /** commit is the synch point between core and gui, so it copies params to pipe data. */
@@ -1535,7 +1744,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev
                    dt_dev_pixelpipe_iop_t *piece)
 {
   // dt_iop_cacorrect_params_t *p = (dt_iop_cacorrect_params_t *)params;
-  // dt_iop_cacorrect_data_t *d = (dt_iop_cacorrect_data_t *)piece->data;
+  dt_iop_cacorrect_data_t *d = (dt_iop_cacorrect_data_t *)piece->data;
+  d->fit.valid = 0;
   if(!(pipe->image.flags & DT_IMAGE_RAW)) piece->enabled = 0;
 }
 
@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/bufferpool.h"
 #include "common/colorspaces.h"
 #include "common/darktable.h"
 #include "control/control.h"
@@ -81,7 +82,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const int ch = piece->colors;
 
   // PASS1: Get a luminance map of image...
-  float *luminance = (float *)malloc(((size_t)roi_out->width * roi_out->height) * sizeof(float));
+  float *luminance
+      = dt_bufferpool_alloc(darktable.bufferpool, (size_t)roi_out->width * roi_out->height * sizeof(float));
 // double lsmax=0.0,lsmin=1.0;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) schedule(static) shared(luminance)
@@ -109,7 +111,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float slope = data->slope;
 
   const size_t destbuf_size = roi_out->width;
-  float *const dest_buf = malloc(destbuf_size * sizeof(float) * dt_get_num_threads());
+  float *const dest_buf
+      = dt_bufferpool_alloc(darktable.bufferpool, destbuf_size * sizeof(float) * dt_get_num_threads());
 
 // CLAHE
 #ifdef _OPENMP
@@ -228,10 +231,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     }
   }
 
-  free(dest_buf);
+  dt_bufferpool_free(darktable.bufferpool, dest_buf);
 
   // Cleanup
-  free(luminance);
+  dt_bufferpool_free(darktable.bufferpool, luminance);
 
 #undef BINS
 }
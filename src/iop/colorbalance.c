@@ -102,11 +102,10 @@ int groups()
 }
 
 // see http://www.brucelindbloom.com/Eqn_RGB_XYZ_Matrix.html for the transformation matrices
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
 {
   dt_iop_colorbalance_data_t *d = (dt_iop_colorbalance_data_t *)piece->data;
-  const int ch = piece->colors;
 
   // these are RGB values!
   const float lift[3] = { 2.0 - (d->lift[CHANNEL_RED] * d->lift[CHANNEL_FACTOR]),
@@ -122,51 +121,59 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
                           d->gain[CHANNEL_GREEN] * d->gain[CHANNEL_FACTOR],
                           d->gain[CHANNEL_BLUE] * d->gain[CHANNEL_FACTOR] };
 
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
-#endif
-  for(int j = 0; j < roi_out->height; j++)
+  for(size_t k = 0; k < npixels; k++)
   {
-    float *in = ((float *)ivoid) + (size_t)ch * roi_in->width * j;
-    float *out = ((float *)ovoid) + (size_t)ch * roi_out->width * j;
-    for(int i = 0; i < roi_out->width; i++)
+    const float *const inp = in + 4 * k;
+    float *const outp = out + 4 * k;
+
+    // transform the pixel to sRGB:
+    // Lab -> XYZ
+    float XYZ[3];
+    dt_Lab_to_XYZ(inp, XYZ);
+    // XYZ -> sRGB
+    float rgb[3] = { 0, 0, 0 };
+    dt_XYZ_to_sRGB(XYZ, rgb);
+
+    // do the calculation in RGB space
+    for(int c = 0; c < 3; c++)
     {
-      // transform the pixel to sRGB:
-      // Lab -> XYZ
-      float XYZ[3];
-      dt_Lab_to_XYZ(in, XYZ);
-      // XYZ -> sRGB
-      float rgb[3] = { 0, 0, 0 };
-      dt_XYZ_to_sRGB(XYZ, rgb);
-
-      // do the calculation in RGB space
-      for(int c = 0; c < 3; c++)
-      {
-        float tmp = (((rgb[c] - 1.0f) * lift[c]) + 1.0f) * gain[c];
-        if(tmp < 0.0f) tmp = 0.0f;
-        rgb[c] = powf(tmp, gamma_inv[c]);
-      }
+      float tmp = (((rgb[c] - 1.0f) * lift[c]) + 1.0f) * gain[c];
+      if(tmp < 0.0f) tmp = 0.0f;
+      rgb[c] = powf(tmp, gamma_inv[c]);
+    }
 
-      // transform the result back to Lab
-      // sRGB -> XYZ
-      dt_sRGB_to_XYZ(rgb, XYZ);
+    // transform the result back to Lab
+    // sRGB -> XYZ
+    dt_sRGB_to_XYZ(rgb, XYZ);
 
-      // XYZ -> Lab
-      dt_XYZ_to_Lab(XYZ, out);
-      out[3] = in[3];
+    // XYZ -> Lab
+    const float alpha = inp[3];
+    dt_XYZ_to_Lab(XYZ, outp);
+    outp[3] = alpha;
+  }
+}
 
-      in += ch;
-      out += ch;
-    }
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const float *in = ((float *)ivoid) + (size_t)ch * roi_in->width * j;
+    float *out = ((float *)ovoid) + (size_t)ch * roi_out->width * j;
+    process_pixels(self, piece, in, out, roi_out->width);
   }
 }
 
 #if defined(__SSE__)
-void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                         float *const out, const size_t npixels)
 {
   dt_iop_colorbalance_data_t *d = (dt_iop_colorbalance_data_t *)piece->data;
-  const int ch = piece->colors;
 
   // these are RGB values!
   const __m128 lift = _mm_setr_ps(2.0 - (d->lift[CHANNEL_RED] * d->lift[CHANNEL_FACTOR]),
@@ -186,35 +193,43 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
                                   d->gain[CHANNEL_BLUE] * d->gain[CHANNEL_FACTOR],
                                   0.0f);
 
+  for(size_t k = 0; k < npixels; k++)
+  {
+    // transform the pixel to sRGB:
+    // Lab -> XYZ
+    __m128 Lab = _mm_load_ps(in + 4 * k);
+    __m128 XYZ = dt_Lab_to_XYZ_sse2(Lab);
+    // XYZ -> sRGB
+    __m128 rgb = dt_XYZ_to_sRGB_sse2(XYZ);
+
+    // do the calculation in RGB space
+    __m128 one = _mm_set1_ps(1.0);
+    __m128 tmp = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(rgb, one), lift),one), gain);
+    tmp = _mm_max_ps(tmp, _mm_setzero_ps());
+    rgb = _mm_pow_ps(tmp, gamma_inv);
+
+    // transform the result back to Lab
+    // sRGB -> XYZ
+    XYZ = dt_sRGB_to_XYZ_sse2(rgb);
+    // XYZ -> Lab
+    __m128 outv = dt_XYZ_to_Lab_sse2(XYZ);
+    _mm_store_ps(out + 4 * k, outv);
+  }
+}
+
+void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
   for(int j = 0; j < roi_out->height; j++)
   {
-    float *in = ((float *)ivoid) + (size_t)ch * roi_in->width * j;
+    const float *in = ((float *)ivoid) + (size_t)ch * roi_in->width * j;
     float *out = ((float *)ovoid) + (size_t)ch * roi_out->width * j;
-    for(int i = 0; i < roi_out->width; i++, in += ch, out += ch)
-    {
-      // transform the pixel to sRGB:
-      // Lab -> XYZ
-      __m128 Lab = _mm_load_ps(in);
-      __m128 XYZ = dt_Lab_to_XYZ_sse2(Lab);
-      // XYZ -> sRGB
-      __m128 rgb = dt_XYZ_to_sRGB_sse2(XYZ);
-
-      // do the calculation in RGB space
-      __m128 one = _mm_set1_ps(1.0);
-      __m128 tmp = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(rgb, one), lift),one), gain);
-      tmp = _mm_max_ps(tmp, _mm_setzero_ps());
-      rgb = _mm_pow_ps(tmp, gamma_inv);
-
-      // transform the result back to Lab
-      // sRGB -> XYZ
-      XYZ = dt_sRGB_to_XYZ_sse2(rgb);
-      // XYZ -> Lab
-      __m128 outv = dt_XYZ_to_Lab_sse2(XYZ);
-      _mm_store_ps(out, outv);
-    }
+    process_pixels_sse2(self, piece, in, out, roi_out->width);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
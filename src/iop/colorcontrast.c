@@ -136,46 +136,82 @@ void connect_key_accels(dt_iop_module_t *self)
 
 #endif
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
 {
-  // this is called for preview and full pipe separately, each with its own pixelpipe piece.
-  assert(dt_iop_module_colorspace(self) == iop_cs_Lab);
-
   // get our data struct:
   const dt_iop_colorcontrast_params_t *const d = (dt_iop_colorcontrast_params_t *)piece->data;
 
-  // how many colors in our buffer?
-  const int ch = piece->colors;
-
-  const float *const in = (const float *const)ivoid;
-  float *const out = (float *const)ovoid;
-
   if(d->unbound)
   {
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) schedule(static)
-#endif
-    for(size_t k = 0; k < (size_t)ch * roi_out->width * roi_out->height; k += ch)
+    for(size_t k = 0; k < (size_t)4 * npixels; k += 4)
     {
+      out[k + 0] = in[k + 0];
       out[k + 1] = (in[k + 1] * d->a_steepness) + d->a_offset;
       out[k + 2] = (in[k + 2] * d->b_steepness) + d->b_offset;
+      out[k + 3] = in[k + 3];
     }
   }
   else
   {
-#ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) schedule(static)
-#endif
-    for(size_t k = 0; k < (size_t)ch * roi_out->width * roi_out->height; k += ch)
+    for(size_t k = 0; k < (size_t)4 * npixels; k += 4)
     {
+      out[k + 0] = in[k + 0];
       out[k + 1] = CLAMP((in[k + 1] * d->a_steepness) + d->a_offset, -128.0f, 128.0f);
       out[k + 2] = CLAMP((in[k + 2] * d->b_steepness) + d->b_offset, -128.0f, 128.0f);
+      out[k + 3] = in[k + 3];
     }
   }
 }
 
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  // this is called for preview and full pipe separately, each with its own pixelpipe piece.
+  assert(dt_iop_module_colorspace(self) == iop_cs_Lab);
+
+  // how many colors in our buffer?
+  const int ch = piece->colors;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const float *in = ((float *)ivoid) + (size_t)ch * roi_in->width * j;
+    float *out = ((float *)ovoid) + (size_t)ch * roi_out->width * j;
+    process_pixels(self, piece, in, out, roi_out->width);
+  }
+}
+
 #if defined(__SSE__)
+// streaming stores for whole buffers, but not when a fused run keeps working on out
+static inline void process_pixels_sse2_common(const dt_iop_colorcontrast_params_t *const d,
+                                              const float *in, float *out, const size_t npixels,
+                                              const int stream)
+{
+  const __m128 scale = _mm_set_ps(1.0f, d->b_steepness, d->a_steepness, 1.0f);
+  const __m128 offset = _mm_set_ps(0.0f, d->b_offset, d->a_offset, 0.0f);
+  const __m128 min = _mm_set_ps(-INFINITY, -128.0f, -128.0f, -INFINITY);
+  const __m128 max = _mm_set_ps(INFINITY, 128.0f, 128.0f, INFINITY);
+
+  for(size_t i = 0; i < npixels; i++, in += 4, out += 4)
+  {
+    __m128 v = _mm_add_ps(offset, _mm_mul_ps(scale, _mm_load_ps(in)));
+    if(!d->unbound) v = _mm_min_ps(max, _mm_max_ps(min, v));
+    if(stream)
+      _mm_stream_ps(out, v);
+    else
+      _mm_store_ps(out, v);
+  }
+}
+
+void process_pixels_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                         float *const out, const size_t npixels)
+{
+  process_pixels_sse2_common((dt_iop_colorcontrast_params_t *)piece->data, in, out, npixels, 0);
+}
+
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -183,47 +219,20 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
   assert(dt_iop_module_colorspace(self) == iop_cs_Lab);
 
   // get our data struct:
-  dt_iop_colorcontrast_params_t *d = (dt_iop_colorcontrast_params_t *)piece->data;
+  const dt_iop_colorcontrast_params_t *const d = (dt_iop_colorcontrast_params_t *)piece->data;
 
   // how many colors in our buffer?
   const int ch = piece->colors;
 
-  const int unbound = d->unbound;
-
 // iterate over all output pixels (same coordinates as input)
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(d)
+#pragma omp parallel for schedule(static)
 #endif
   for(int j = 0; j < roi_out->height; j++)
   {
-
-    float *in = ((float *)ivoid) + (size_t)ch * roi_in->width * j;
+    const float *in = ((float *)ivoid) + (size_t)ch * roi_in->width * j;
     float *out = ((float *)ovoid) + (size_t)ch * roi_out->width * j;
-
-    const __m128 scale = _mm_set_ps(1.0f, d->b_steepness, d->a_steepness, 1.0f);
-    const __m128 offset = _mm_set_ps(0.0f, d->b_offset, d->a_offset, 0.0f);
-    const __m128 min = _mm_set_ps(-INFINITY, -128.0f, -128.0f, -INFINITY);
-    const __m128 max = _mm_set_ps(INFINITY, 128.0f, 128.0f, INFINITY);
-
-    if(unbound)
-    {
-      for(int i = 0; i < roi_out->width; i++)
-      {
-        _mm_stream_ps(out, _mm_add_ps(offset, _mm_mul_ps(scale, _mm_load_ps(in))));
-        in += ch;
-        out += ch;
-      }
-    }
-    else
-    {
-      for(int i = 0; i < roi_out->width; i++)
-      {
-        _mm_stream_ps(
-            out, _mm_min_ps(max, _mm_max_ps(min, _mm_add_ps(offset, _mm_mul_ps(scale, _mm_load_ps(in))))));
-        in += ch;
-        out += ch;
-      }
-    }
+    process_pixels_sse2_common(d, in, out, roi_out->width, 1);
   }
   _mm_sfence();
 }
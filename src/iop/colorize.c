@@ -125,12 +125,10 @@ void connect_key_accels(dt_iop_module_t *self)
   dt_accel_connect_slider_iop(self, "source mix", GTK_WIDGET(g->scale2));
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
 {
-  float *in, *out;
   dt_iop_colorize_data_t *d = (dt_iop_colorize_data_t *)piece->data;
-  const int ch = piece->colors;
 
   const float L = d->L;
   const float a = d->a;
@@ -138,24 +136,27 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float mix = d->mix;
   const float Lmlmix = L - (mix * 100.0f) / 2.0f;
 
+  for(size_t l = 0; l < (size_t)4 * npixels; l += 4)
+  {
+    out[l + 0] = Lmlmix + in[l + 0] * mix;
+    out[l + 1] = a;
+    out[l + 2] = b;
+    out[l + 3] = in[l + 3];
+  }
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+
 #ifdef _OPENMP
-#pragma omp parallel for default(none) private(in, out) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
   for(int k = 0; k < roi_out->height; k++)
   {
-
-    int stride = ch * roi_out->width;
-
-    in = (float *)ivoid + (size_t)k * stride;
-    out = (float *)ovoid + (size_t)k * stride;
-
-    for(int l = 0; l < stride; l += ch)
-    {
-      out[l + 0] = Lmlmix + in[l + 0] * mix;
-      out[l + 1] = a;
-      out[l + 2] = b;
-      out[l + 3] = in[l + 3];
-    }
+    const size_t stride = (size_t)ch * roi_out->width;
+    process_pixels(self, piece, (const float *)ivoid + k * stride, (float *)ovoid + k * stride, roi_out->width);
   }
 }
 
@@ -24,6 +24,8 @@
 #include <string.h>
 
 #include "bauhaus/bauhaus.h"
+#include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -32,6 +34,9 @@
 #include "iop/iop_api.h"
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define GRAIN_LIGHTNESS_STRENGTH_SCALE 0.15
 // (m_pi/2)/4 = half hue colorspan
@@ -47,6 +52,8 @@
 #define GRAIN_LUT_DELTA_MIN 0.0001
 #define GRAIN_LUT_PAPER_GAMMA 1.0
 
+#define GRAIN_TEXTURE_SIZE 256
+
 #define CLIP(x) ((x < 0) ? 0.0 : (x > 1.0) ? 1.0 : x)
 DT_MODULE_INTROSPECTION(2, dt_iop_grain_params_t)
 
@@ -81,8 +88,15 @@ typedef struct dt_iop_grain_data_t
   float strength;
   float midtones_bias;
   float grain_lut[GRAIN_LUT_SIZE * GRAIN_LUT_SIZE];
+  float *texture;                   // tileable noise for the preview pipe
+  double texture_dx, texture_zoom;  // what it was computed for
 } dt_iop_grain_data_t;
 
+typedef struct dt_iop_grain_global_data_t
+{
+  int kernel_grain;
+} dt_iop_grain_global_data_t;
+
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params,
                   const int new_version)
@@ -143,30 +157,50 @@ static void _simplex_noise_init()
 {
   for(int i = 0; i < 512; i++) perm[i] = permutation[i & 255];
 }
-static double dot(int g[], double x, double y, double z)
-{
-  return g[0] * x + g[1] * y + g[2] * z;
+#define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
+
+/*
+ * the noise coordinates get large (millions for coarse grain far from the image origin), more than float can
+ * resolve. so the lattice point of the simplex cell is found once in double, and the noise is evaluated in
+ * float on the small offsets from it. the lattice point only enters through the permutation lookups, the
+ * result is the same as the double precision noise up to float rounding.
+ */
+static inline void _simplex_origin(const double xin, const double yin, const double zin, int origin[3],
+                                   float local[3])
+{
+  const double s = (xin + yin + zin) * (1.0 / 3.0);
+  origin[0] = FASTFLOOR(xin + s);
+  origin[1] = FASTFLOOR(yin + s);
+  origin[2] = FASTFLOOR(zin + s);
+  const double t = (origin[0] + origin[1] + origin[2]) * (1.0 / 6.0);
+  local[0] = xin - (origin[0] - t);
+  local[1] = yin - (origin[1] - t);
+  local[2] = zin - (origin[2] - t);
 }
 
-#define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
+static inline float _simplex_corner(const int g, const float x, const float y, const float z)
+{
+  float t = 0.6f - x * x - y * y - z * z;
+  if(t < 0.0f) return 0.0f;
+  t *= t;
+  return t * t * (grad3[g][0] * x + grad3[g][1] * y + grad3[g][2] * z);
+}
 
-static double _simplex_noise(double xin, double yin, double zin)
-{
-  double n0, n1, n2, n3; // Noise contributions from the four corners
-                         // Skew the input space to determine which simplex cell we're in
-  double F3 = 1.0 / 3.0;
-  double s = (xin + yin + zin) * F3; // Very nice and simple skew factor for 3D
-  int i = FASTFLOOR(xin + s);
-  int j = FASTFLOOR(yin + s);
-  int k = FASTFLOOR(zin + s);
-  double G3 = 1.0 / 6.0; // Very nice and simple unskew factor, too
-  double t = (i + j + k) * G3;
-  double X0 = i - t; // Unskew the cell origin back to (x,y,z) space
-  double Y0 = j - t;
-  double Z0 = k - t;
-  double x0 = xin - X0; // The x,y,z distances from the cell origin
-  double y0 = yin - Y0;
-  double z0 = zin - Z0;
+/* 3d simplex noise at origin + (xin, yin, zin), see _simplex_origin(). */
+static float _simplex_noise(const float xin, const float yin, const float zin, const int origin[3])
+{
+  // Skew the input space to determine which simplex cell we're in
+  const float F3 = 1.0f / 3.0f;
+  const float s = (xin + yin + zin) * F3; // Very nice and simple skew factor for 3D
+  const int i = FASTFLOOR(xin + s);
+  const int j = FASTFLOOR(yin + s);
+  const int k = FASTFLOOR(zin + s);
+  const float G3 = 1.0f / 6.0f; // Very nice and simple unskew factor, too
+  const float t = (i + j + k) * G3;
+  // The x,y,z distances from the cell origin
+  const float x0 = xin - (i - t);
+  const float y0 = yin - (j - t);
+  const float z0 = zin - (k - t);
   // For the 3D case, the simplex shape is a slightly irregular tetrahedron.
   // Determine which simplex we are in.
   int i1, j1, k1; // Offsets for second corner of simplex in (i,j,k) coords
@@ -175,121 +209,152 @@ static double _simplex_noise(double xin, double yin, double zin)
   {
     if(y0 >= z0)
     {
-      i1 = 1; // X Y Z order
-      j1 = 0;
-      k1 = 0;
-      i2 = 1;
-      j2 = 1;
-      k2 = 0;
+      i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0; // X Y Z order
     }
     else if(x0 >= z0)
     {
-      i1 = 1; // X Z Y order
-      j1 = 0;
-      k1 = 0;
-      i2 = 1;
-      j2 = 0;
-      k2 = 1;
+      i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1; // X Z Y order
     }
     else
     {
-      i1 = 0; // Z X Y order
-      j1 = 0;
-      k1 = 1;
-      i2 = 1;
-      j2 = 0;
-      k2 = 1;
+      i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1; // Z X Y order
     }
   }
   else // x0<y0
   {
     if(y0 < z0)
     {
-      i1 = 0; // Z Y X order
-      j1 = 0;
-      k1 = 1;
-      i2 = 0;
-      j2 = 1;
-      k2 = 1;
+      i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1; // Z Y X order
     }
     else if(x0 < z0)
     {
-      i1 = 0; // Y Z X order
-      j1 = 1;
-      k1 = 0;
-      i2 = 0;
-      j2 = 1;
-      k2 = 1;
+      i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1; // Y Z X order
     }
     else
     {
-      i1 = 0; // Y X Z order
-      j1 = 1;
-      k1 = 0;
-      i2 = 1;
-      j2 = 1;
-      k2 = 0;
+      i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0; // Y X Z order
     }
   }
   //  A step of (1,0,0) in (i,j,k) means a step of (1-c,-c,-c) in (x,y,z),
   //  a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z), and
   //  a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in (x,y,z), where
   //  c = 1/6.
-  double x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
-  double y1 = y0 - j1 + G3;
-  double z1 = z0 - k1 + G3;
-  double x2 = x0 - i2 + 2.0 * G3; // Offsets for third corner in (x,y,z) coords
-  double y2 = y0 - j2 + 2.0 * G3;
-  double z2 = z0 - k2 + 2.0 * G3;
-  double x3 = x0 - 1.0 + 3.0 * G3; // Offsets for last corner in (x,y,z) coords
-  double y3 = y0 - 1.0 + 3.0 * G3;
-  double z3 = z0 - 1.0 + 3.0 * G3;
+  const float x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
+  const float y1 = y0 - j1 + G3;
+  const float z1 = z0 - k1 + G3;
+  const float x2 = x0 - i2 + 2.0f * G3; // Offsets for third corner in (x,y,z) coords
+  const float y2 = y0 - j2 + 2.0f * G3;
+  const float z2 = z0 - k2 + 2.0f * G3;
+  const float x3 = x0 - 1.0f + 3.0f * G3; // Offsets for last corner in (x,y,z) coords
+  const float y3 = y0 - 1.0f + 3.0f * G3;
+  const float z3 = z0 - 1.0f + 3.0f * G3;
   // Work out the hashed gradient indices of the four simplex corners
-  int ii = i & 255;
-  int jj = j & 255;
-  int kk = k & 255;
-  int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
-  int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
-  int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
-  int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
-  // Calculate the contribution from the four corners
-  double t0 = 0.6 - x0 * x0 - y0 * y0 - z0 * z0;
-  if(t0 < 0)
-    n0 = 0.0;
-  else
-  {
-    t0 *= t0;
-    n0 = t0 * t0 * dot(grad3[gi0], x0, y0, z0);
-  }
-  double t1 = 0.6 - x1 * x1 - y1 * y1 - z1 * z1;
-  if(t1 < 0)
-    n1 = 0.0;
-  else
-  {
-    t1 *= t1;
-    n1 = t1 * t1 * dot(grad3[gi1], x1, y1, z1);
-  }
-  double t2 = 0.6 - x2 * x2 - y2 * y2 - z2 * z2;
-  if(t2 < 0)
-    n2 = 0.0;
-  else
-  {
-    t2 *= t2;
-    n2 = t2 * t2 * dot(grad3[gi2], x2, y2, z2);
-  }
-  double t3 = 0.6 - x3 * x3 - y3 * y3 - z3 * z3;
-  if(t3 < 0)
-    n3 = 0.0;
-  else
-  {
-    t3 *= t3;
-    n3 = t3 * t3 * dot(grad3[gi3], x3, y3, z3);
-  }
+  const int ii = (origin[0] + i) & 255;
+  const int jj = (origin[1] + j) & 255;
+  const int kk = (origin[2] + k) & 255;
+  const int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
+  const int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
+  const int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
+  const int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
   // Add contributions from each corner to get the final noise value.
   // The result is scaled to stay just inside [-1,1]
-  return 32.0 * (n0 + n1 + n2 + n3);
+  return 32.0f * (_simplex_corner(gi0, x0, y0, z0) + _simplex_corner(gi1, x1, y1, z1)
+                  + _simplex_corner(gi2, x2, y2, z2) + _simplex_corner(gi3, x3, y3, z3));
 }
 
+#if defined(__SSE2__)
+/* FASTFLOOR() for four floats, including its off-by-one at negative integers. */
+static inline __m128i _mm_fastfloor_ps(const __m128 x)
+{
+  return _mm_add_epi32(_mm_cvttps_epi32(x), _mm_castps_si128(_mm_cmple_ps(x, _mm_setzero_ps())));
+}
+
+static inline __m128 _simplex_corner_sse(const __m128 x, const __m128 y, const __m128 z, const float *gx,
+                                         const float *gy, const float *gz)
+{
+  __m128 t = _mm_sub_ps(_mm_set1_ps(0.6f),
+                        _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+  t = _mm_max_ps(t, _mm_setzero_ps());
+  t = _mm_mul_ps(t, t);
+  t = _mm_mul_ps(t, t);
+  const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(gx), x), _mm_mul_ps(_mm_load_ps(gy), y)),
+                              _mm_mul_ps(_mm_load_ps(gz), z));
+  return _mm_mul_ps(t, d);
+}
+
+/* _simplex_noise() at four points sharing one lattice origin. only the permutation lookups are scalar. */
+static inline __m128 _simplex_noise_sse(const __m128 xin, const __m128 yin, const __m128 zin, const int origin[3])
+{
+  const __m128 G3 = _mm_set1_ps(1.0f / 6.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+  const __m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(xin, yin), zin), _mm_set1_ps(1.0f / 3.0f));
+  const __m128i i = _mm_fastfloor_ps(_mm_add_ps(xin, s));
+  const __m128i j = _mm_fastfloor_ps(_mm_add_ps(yin, s));
+  const __m128i k = _mm_fastfloor_ps(_mm_add_ps(zin, s));
+  const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_add_epi32(i, j), k)), G3);
+  const __m128 x0 = _mm_sub_ps(xin, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+  const __m128 y0 = _mm_sub_ps(yin, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+  const __m128 z0 = _mm_sub_ps(zin, _mm_sub_ps(_mm_cvtepi32_ps(k), t));
+
+  // the simplex ranking of the scalar version, branch free
+  const __m128 xy = _mm_cmpge_ps(x0, y0), xz = _mm_cmpge_ps(x0, z0), yz = _mm_cmpge_ps(y0, z0);
+  const __m128 i1 = _mm_and_ps(xy, xz);
+  const __m128 k1 = _mm_or_ps(_mm_andnot_ps(xz, xy), _mm_andnot_ps(_mm_or_ps(xy, yz), all));
+  const __m128 j1 = _mm_andnot_ps(_mm_or_ps(i1, k1), all);
+  const __m128 i2 = _mm_or_ps(xy, xz);
+  const __m128 j2 = _mm_or_ps(_mm_andnot_ps(xy, all), yz);
+  const __m128 k2 = _mm_or_ps(_mm_andnot_ps(yz, xy), _mm_andnot_ps(_mm_or_ps(xy, xz), all));
+
+  const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(i1, one)), G3);
+  const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(j1, one)), G3);
+  const __m128 z1 = _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(k1, one)), G3);
+  const __m128 G3_2 = _mm_set1_ps(2.0f / 6.0f);
+  const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(i2, one)), G3_2);
+  const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(j2, one)), G3_2);
+  const __m128 z2 = _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(k2, one)), G3_2);
+  const __m128 G3_3 = _mm_set1_ps(-1.0f + 3.0f / 6.0f);
+  const __m128 x3 = _mm_add_ps(x0, G3_3);
+  const __m128 y3 = _mm_add_ps(y0, G3_3);
+  const __m128 z3 = _mm_add_ps(z0, G3_3);
+
+  int ia[4] __attribute__((aligned(16))), ja[4] __attribute__((aligned(16))), ka[4] __attribute__((aligned(16)));
+  _mm_store_si128((__m128i *)ia, i);
+  _mm_store_si128((__m128i *)ja, j);
+  _mm_store_si128((__m128i *)ka, k);
+  const int mi1 = _mm_movemask_ps(i1), mj1 = _mm_movemask_ps(j1), mk1 = _mm_movemask_ps(k1);
+  const int mi2 = _mm_movemask_ps(i2), mj2 = _mm_movemask_ps(j2), mk2 = _mm_movemask_ps(k2);
+
+  // gradients of the four corners, one lane per point
+  float gx[4][4] __attribute__((aligned(16))), gy[4][4] __attribute__((aligned(16))),
+      gz[4][4] __attribute__((aligned(16)));
+  for(int l = 0; l < 4; l++)
+  {
+    const int ii = (origin[0] + ia[l]) & 255;
+    const int jj = (origin[1] + ja[l]) & 255;
+    const int kk = (origin[2] + ka[l]) & 255;
+    const int oi1 = (mi1 >> l) & 1, oj1 = (mj1 >> l) & 1, ok1 = (mk1 >> l) & 1;
+    const int oi2 = (mi2 >> l) & 1, oj2 = (mj2 >> l) & 1, ok2 = (mk2 >> l) & 1;
+    const int gi[4] = { perm[ii + perm[jj + perm[kk]]] % 12,
+                        perm[ii + oi1 + perm[jj + oj1 + perm[kk + ok1]]] % 12,
+                        perm[ii + oi2 + perm[jj + oj2 + perm[kk + ok2]]] % 12,
+                        perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12 };
+    for(int c = 0; c < 4; c++)
+    {
+      gx[c][l] = grad3[gi[c]][0];
+      gy[c][l] = grad3[gi[c]][1];
+      gz[c][l] = grad3[gi[c]][2];
+    }
+  }
+
+  const __m128 n = _mm_add_ps(_mm_add_ps(_simplex_corner_sse(x0, y0, z0, gx[0], gy[0], gz[0]),
+                                         _simplex_corner_sse(x1, y1, z1, gx[1], gy[1], gz[1])),
+                              _mm_add_ps(_simplex_corner_sse(x2, y2, z2, gx[2], gy[2], gz[2]),
+                                         _simplex_corner_sse(x3, y3, z3, gx[3], gy[3], gz[3])));
+  return _mm_mul_ps(_mm_set1_ps(32.0f), n);
+}
+#endif
 
 
 #define PRIME_LEVELS 4
@@ -348,20 +413,43 @@ static double _perlin_2d_noise(double x,double y,uint32_t octaves,double persist
   return total;
 }*/
 
-static double _simplex_2d_noise(double x, double y, uint32_t octaves, double persistance, double z)
-{
-  double total = 0;
+// parametrization of octaves to match power spectrum of real grain scans
+#define GRAIN_OCTAVES 3
+static const double _octave_freq[GRAIN_OCTAVES] = { 0.4910, 0.9441, 1.7280 };
+static const float _octave_amp[GRAIN_OCTAVES] = { 0.2340, 0.7850, 1.2150 };
 
-  // parametrization of octaves to match power spectrum of real grain scans
-  static double f[] = {0.4910, 0.9441, 1.7280};
-  static double a[] = {0.2340, 0.7850, 1.2150};
+static float _simplex_2d_noise(const double x, const double y, const double z)
+{
+  float total = 0.0f;
+  for(int o = 0; o < GRAIN_OCTAVES; o++)
+  {
+    int origin[3];
+    float local[3];
+    _simplex_origin(x * _octave_freq[o] / z, y * _octave_freq[o] / z, o, origin, local);
+    total += _simplex_noise(local[0], local[1], local[2], origin) * _octave_amp[o];
+  }
+  return total;
+}
 
-  for(uint32_t o = 0; o < octaves; o++)
+#if defined(__SSE2__)
+/* _simplex_2d_noise() at (x, y), (x + dx, y), (x + 2 dx, y) and (x + 3 dx, y). */
+static inline __m128 _simplex_2d_noise_sse(const double x, const double y, const double dx, const double z)
+{
+  __m128 total = _mm_setzero_ps();
+  for(int o = 0; o < GRAIN_OCTAVES; o++)
   {
-    total += (_simplex_noise(x * f[o] / z, y * f[o] / z, o) * a[o]);
+    const double f = _octave_freq[o] / z;
+    int origin[3];
+    float local[3];
+    _simplex_origin(x * f, y * f, o, origin, local);
+    const __m128 xin = _mm_add_ps(_mm_set1_ps(local[0]),
+                                  _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(dx * f)));
+    const __m128 n = _simplex_noise_sse(xin, _mm_set1_ps(local[1]), _mm_set1_ps(local[2]), origin);
+    total = _mm_add_ps(total, _mm_mul_ps(n, _mm_set1_ps(_octave_amp[o])));
   }
   return total;
 }
+#endif
 
 static float paper_resp(float exposure, float mb, float gp)
 {
@@ -457,8 +545,104 @@ static unsigned int _hash_string(char *s)
   return h;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+// rank-1 lattice used to downsample the noise when zoomed out
+#define GRAIN_LATTICE_FIB1 34
+#define GRAIN_LATTICE_FIB2 21
+
+static void _lattice_offsets(const double filtermul, float *dx, float *dy)
+{
+  const float fib1 = GRAIN_LATTICE_FIB1, fib2 = GRAIN_LATTICE_FIB2;
+  for(int l = 0; l < GRAIN_LATTICE_FIB2; l++)
+  {
+    float px = l / fib2, py = l * (fib1 / fib2);
+    py -= (int)py;
+    dx[l] = px * filtermul;
+    dy[l] = py * filtermul;
+  }
+}
+
+/* noise of width pixels along a row, starting at (x, y) in normalized coordinates, dx apart. */
+static void _noise_row(float *const noise, const int width, const double x, const double y, const double dx,
+                       const double zoom, const int filter, const float *ldx, const float *ldy)
+{
+  for(int i = 0; i < width; i++)
+  {
+    const double px = x + i * dx;
+    if(filter)
+    {
+      float n = 0.0f;
+      for(int l = 0; l < GRAIN_LATTICE_FIB2; l++) n += _simplex_2d_noise(px + ldx[l], y + ldy[l], zoom);
+      noise[i] = n * (1.0f / GRAIN_LATTICE_FIB2);
+    }
+    else
+      noise[i] = _simplex_2d_noise(px, y, zoom);
+  }
+}
+
+#if defined(__SSE2__)
+static void _noise_row_sse(float *const noise, const int width, const double x, const double y,
+                           const double dx, const double zoom, const int filter, const float *ldx,
+                           const float *ldy)
+{
+  int i = 0;
+  for(; i + 4 <= width; i += 4)
+  {
+    const double px = x + i * dx;
+    __m128 n;
+    if(filter)
+    {
+      n = _mm_setzero_ps();
+      for(int l = 0; l < GRAIN_LATTICE_FIB2; l++)
+        n = _mm_add_ps(n, _simplex_2d_noise_sse(px + ldx[l], y + ldy[l], dx, zoom));
+      n = _mm_mul_ps(n, _mm_set1_ps(1.0f / GRAIN_LATTICE_FIB2));
+    }
+    else
+      n = _simplex_2d_noise_sse(px, y, dx, zoom);
+    _mm_storeu_ps(noise + i, n);
+  }
+  _noise_row(noise + i, width - i, x + i * dx, y, dx, zoom, filter, ldx, ldy);
+}
+#endif
+
+/*
+ * the preview pipe gets its grain from a tileable texture computed once per coarseness and preview scale,
+ * so that edits of other modules don't pay for the noise again. the tiles are made seamless by blending the
+ * noise of the four periodic images with bilinear weights, normalized to keep the variance.
+ */
+static void _update_texture(dt_iop_grain_data_t *data, const double dx, const double zoom, const int filter,
+                            const float *ldx, const float *ldy)
+{
+  if(data->texture && data->texture_dx == dx && data->texture_zoom == zoom) return;
+  if(!data->texture)
+    data->texture = dt_alloc_align(64, sizeof(float) * GRAIN_TEXTURE_SIZE * GRAIN_TEXTURE_SIZE);
+  if(!data->texture) return;
+  data->texture_dx = dx;
+  data->texture_zoom = zoom;
+
+  const int size = GRAIN_TEXTURE_SIZE;
+  float *const texture = data->texture;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int j = 0; j < size; j++)
+  {
+    float n[4][GRAIN_TEXTURE_SIZE];
+    for(int k = 0; k < 4; k++)
+      _noise_row(n[k], size, -(k & 1) * size * dx, (j - (k >> 1) * size) * dx, dx, zoom, filter, ldx, ldy);
+    const float v = (float)j / size;
+    for(int i = 0; i < size; i++)
+    {
+      const float u = (float)i / size;
+      const float w[4] = { (1.0f - u) * (1.0f - v), u * (1.0f - v), (1.0f - u) * v, u * v };
+      const float sum = w[0] * n[0][i] + w[1] * n[1][i] + w[2] * n[2][i] + w[3] * n[3][i];
+      texture[(size_t)j * size + i] = sum / sqrtf(w[0] * w[0] + w[1] * w[1] + w[2] * w[2] + w[3] * w[3]);
+    }
+  }
+}
+
+static void _process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                     void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                     const int sse)
 {
   dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
 
@@ -466,8 +650,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   const int ch = piece->colors;
   // Apply grain to image
-  const double strength = (data->strength / 100.0);
-  const double octaves = 3;
+  const float strength = (data->strength / 100.0);
   // double zoom=1.0+(8*(data->scale/100.0));
   const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
   const double zoom = (1.0 + 8 * data->scale / 100) / 800.0;
@@ -475,43 +658,54 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   // filter width depends on world space (i.e. reverse wd norm and roi->scale, as well as buffer input to
   // pixelpipe iscale)
   const double filtermul = piece->iscale / (roi_out->scale * wd);
+  float ldx[GRAIN_LATTICE_FIB2], ldy[GRAIN_LATTICE_FIB2];
+  _lattice_offsets(filtermul, ldx, ldy);
+  // x, y: worldspace in full image pixel coords, normalized to shorter side of image, so with pixel aspect = 1.
+  const double dx = 1.0 / (roi_out->scale * wd);
+
+  const float *texture = NULL;
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW
+     && dt_conf_get_bool("plugins/darkroom/grain/preview_texture"))
+  {
+    _update_texture(data, dx, zoom, filter, ldx, ldy);
+    texture = data->texture;
+  }
+
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(data, hash)
+#pragma omp parallel for schedule(static)
 #endif
   for(int j = 0; j < roi_out->height; j++)
   {
-    float *in = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
+    const float *in = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
     float *out = ((float *)ovoid) + (size_t)roi_out->width * j * ch;
-    for(int i = 0; i < roi_out->width; i++)
+    float *noise = dt_alloc_align(64, sizeof(float) * roi_out->width);
+    if(!noise)
+    {
+      memcpy(out, in, sizeof(float) * ch * roi_out->width);
+      continue;
+    }
+
+    if(texture)
     {
-      // calculate x, y in a resolution independent way:
-      // wx,wy: worldspace in full image pixel coords:
-      double wx = (roi_out->x + i) / roi_out->scale;
-      double wy = (roi_out->y + j) / roi_out->scale;
-      // x, y: normalized to shorter side of image, so with pixel aspect = 1.
-      // printf("scale %f\n", wd);
-      double x = wx / wd;
-      double y = wy / wd;
-      //  double noise=_perlin_2d_noise(x, y, octaves,0.25, zoom)*1.5;
-      double noise = 0.0;
-      if(filter)
-      {
-        // if zoomed out a lot, use rank-1 lattice downsampling
-        const float fib1 = 34.0, fib2 = 21.0;
-        for(int l = 0; l < fib2; l++)
-        {
-          float px = l / fib2, py = l * (fib1 / fib2);
-          py -= (int)py;
-          float dx = px * filtermul, dy = py * filtermul;
-          noise += (1.0 / fib2) * _simplex_2d_noise(x + dx + hash, y + dy, octaves, 1.0, zoom);
-        }
-      }
+      const int size = GRAIN_TEXTURE_SIZE;
+      const float *row = texture + (size_t)size * (((roi_out->y + j) % size + size) % size);
+      for(int i = 0; i < roi_out->width; i++) noise[i] = row[((roi_out->x + i) % size + size) % size];
+    }
+    else
+    {
+      const double x = roi_out->x * dx + hash;
+      const double y = (roi_out->y + j) * dx;
+#if defined(__SSE2__)
+      if(sse)
+        _noise_row_sse(noise, roi_out->width, x, y, dx, zoom, filter, ldx, ldy);
       else
-      {
-        noise = _simplex_2d_noise(x + hash, y, octaves, 1.0, zoom);
-      }
+#endif
+        _noise_row(noise, roi_out->width, x, y, dx, zoom, filter, ldx, ldy);
+    }
 
-      out[0] = in[0] + dt_lut_lookup_2d_1c(data->grain_lut, (noise * strength) * GRAIN_LIGHTNESS_STRENGTH_SCALE, in[0] / 100.0f);
+    for(int i = 0; i < roi_out->width; i++)
+    {
+      out[0] = in[0] + dt_lut_lookup_2d_1c(data->grain_lut, (noise[i] * strength) * GRAIN_LIGHTNESS_STRENGTH_SCALE, in[0] / 100.0f);
       out[1] = in[1];
       out[2] = in[2];
       out[3] = in[3];
@@ -519,9 +713,120 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       out += ch;
       in += ch;
     }
+    dt_free_align(noise);
   }
 }
 
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  _process(self, piece, ivoid, ovoid, roi_in, roi_out, 0);
+}
+
+#if defined(__SSE2__)
+void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  _process(self, piece, ivoid, ovoid, roi_in, roi_out, 1);
+}
+#endif
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_perm = NULL, dev_origin = NULL, dev_coords = NULL, dev_lattice = NULL, dev_lut = NULL;
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)fmax(roi_out->width * 0.3, 1.0);
+  const float strength = (data->strength / 100.0) * GRAIN_LIGHTNESS_STRENGTH_SCALE;
+  const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
+  const double zoom = (1.0 + 8 * data->scale / 100) / 800.0;
+  const int filter = fabsf(roi_out->scale - 1.0f) > 0.01;
+  const double filtermul = piece->iscale / (roi_out->scale * wd);
+  const double dx = 1.0 / (roi_out->scale * wd);
+
+  // the kernel works on offsets from the simplex lattice point of the top left pixel, per octave, so that
+  // float is precise enough for it too. see _simplex_origin().
+  int origin[4 * GRAIN_OCTAVES] = { 0 };
+  float coords[8 * GRAIN_OCTAVES] = { 0 }; // offset x, y, z, step per pixel, frequency, amplitude
+  for(int o = 0; o < GRAIN_OCTAVES; o++)
+  {
+    const double f = _octave_freq[o] / zoom;
+    _simplex_origin((roi_out->x * dx + hash) * f, roi_out->y * dx * f, o, origin + 4 * o, coords + 8 * o);
+    coords[8 * o + 3] = dx * f;
+    coords[8 * o + 4] = f;
+    coords[8 * o + 5] = _octave_amp[o];
+  }
+  float lattice[2 * GRAIN_LATTICE_FIB2];
+  _lattice_offsets(filtermul, lattice, lattice + GRAIN_LATTICE_FIB2);
+
+  dev_perm = dt_opencl_copy_host_to_device_constant(devid, sizeof(perm), perm);
+  if(dev_perm == NULL) goto error;
+  dev_origin = dt_opencl_copy_host_to_device_constant(devid, sizeof(origin), origin);
+  if(dev_origin == NULL) goto error;
+  dev_coords = dt_opencl_copy_host_to_device_constant(devid, sizeof(coords), coords);
+  if(dev_coords == NULL) goto error;
+  dev_lattice = dt_opencl_copy_host_to_device_constant(devid, sizeof(lattice), lattice);
+  if(dev_lattice == NULL) goto error;
+  dev_lut = dt_opencl_copy_host_to_device(devid, data->grain_lut, GRAIN_LUT_SIZE, GRAIN_LUT_SIZE, sizeof(float));
+  if(dev_lut == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 4, sizeof(cl_mem), (void *)&dev_perm);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 5, sizeof(cl_mem), (void *)&dev_origin);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 6, sizeof(cl_mem), (void *)&dev_coords);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 7, sizeof(cl_mem), (void *)&dev_lattice);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 8, sizeof(cl_mem), (void *)&dev_lut);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 9, sizeof(int), (void *)&filter);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 10, sizeof(float), (void *)&strength);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_grain, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_lut);
+  dt_opencl_release_mem_object(dev_lattice);
+  dt_opencl_release_mem_object(dev_coords);
+  dt_opencl_release_mem_object(dev_origin);
+  dt_opencl_release_mem_object(dev_perm);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_lut);
+  dt_opencl_release_mem_object(dev_lattice);
+  dt_opencl_release_mem_object(dev_coords);
+  dt_opencl_release_mem_object(dev_origin);
+  dt_opencl_release_mem_object(dev_perm);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_grain] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 20; // grain.cl, from programs.conf
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)malloc(sizeof(dt_iop_grain_global_data_t));
+  module->data = gd;
+  gd->kernel_grain = dt_opencl_create_kernel(program, "grain");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_grain);
+  free(module->data);
+  module->data = NULL;
+}
+
 static void scale_callback(GtkWidget *slider, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
@@ -571,6 +876,8 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_grain_data_t *d = (dt_iop_grain_data_t *)piece->data;
+  dt_free_align(d->texture);
   free(piece->data);
   piece->data = NULL;
 }
@@ -36,9 +36,13 @@
 #endif
 
 #include "bauhaus/bauhaus.h"
+#include "common/box_filters.h"
 #include "common/darktable.h"
+#include "common/guided_filter.h"
+#include "common/opencl.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
+#include "develop/tiling.h"
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
 
@@ -48,6 +52,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+// window size (positive integer) for determing the dark channel and the transition map
+#define HAZE_W1 6
+// window size (positive integer) for the guided filter
+#define HAZE_W2 9
+// regularization parameter for guided filter
+#define HAZE_EPS 0.025f
+
 //----------------------------------------------------------------------
 // implement the module api
 //----------------------------------------------------------------------
@@ -62,9 +73,15 @@ typedef struct dt_iop_hazeremoval_params_t
   float distance;
 } dt_iop_hazeremoval_params_t;
 
-// types  dt_iop_hazeremoval_params_t and dt_iop_hazeremoval_data_t are
-// equal, thus no commit_params function needs to be implemented
-typedef dt_iop_hazeremoval_params_t dt_iop_hazeremoval_data_t;
+typedef struct dt_iop_hazeremoval_data_t
+{
+  float strength;
+  float distance;
+  // diffusive ambient light and maximal depth of the whole image, set
+  // while it is processed in tiles and NAN otherwise
+  rgb_pixel A0;
+  float distance_max;
+} dt_iop_hazeremoval_data_t;
 
 typedef struct dt_iop_hazeremoval_gui_data_t
 {
@@ -78,6 +95,8 @@ typedef struct dt_iop_hazeremoval_gui_data_t
 
 typedef struct dt_iop_hazeremoval_global_data_t
 {
+  int kernel_hazeremoval_transition_map;
+  int kernel_hazeremoval_dehaze;
 } dt_iop_hazeremoval_global_data_t;
 
 const char *name()
@@ -87,7 +106,7 @@ const char *name()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
 }
 
 int groups()
@@ -95,9 +114,23 @@ int groups()
   return IOP_GROUP_CORRECT;
 }
 
+void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
+                   dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_hazeremoval_params_t *p = (dt_iop_hazeremoval_params_t *)p1;
+  dt_iop_hazeremoval_data_t *d = (dt_iop_hazeremoval_data_t *)piece->data;
+  d->strength = p->strength;
+  d->distance = p->distance;
+}
+
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   piece->data = calloc(1, sizeof(dt_iop_hazeremoval_data_t));
+  dt_iop_hazeremoval_data_t *d = (dt_iop_hazeremoval_data_t *)piece->data;
+  d->A0[0] = NAN;
+  d->A0[1] = NAN;
+  d->A0[2] = NAN;
+  d->distance_max = NAN;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
@@ -109,11 +142,21 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
 
 void init_global(dt_iop_module_so_t *self)
 {
-  self->data = NULL;
+  const int program = 22; // hazeremoval.cl, from programs.conf
+  dt_iop_hazeremoval_global_data_t *gd
+      = (dt_iop_hazeremoval_global_data_t *)malloc(sizeof(dt_iop_hazeremoval_global_data_t));
+  self->data = gd;
+  gd->kernel_hazeremoval_transition_map = dt_opencl_create_kernel(program, "hazeremoval_transition_map");
+  gd->kernel_hazeremoval_dehaze = dt_opencl_create_kernel(program, "hazeremoval_dehaze");
 }
 
 void cleanup_global(dt_iop_module_so_t *self)
 {
+  dt_iop_hazeremoval_global_data_t *gd = (dt_iop_hazeremoval_global_data_t *)self->data;
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_transition_map);
+  dt_opencl_free_kernel(gd->kernel_hazeremoval_dehaze);
+  free(self->data);
+  self->data = NULL;
 }
 
 void init(dt_iop_module_t *self)
@@ -205,11 +248,6 @@ void gui_cleanup(dt_iop_module_t *self)
 // module local functions and structures required by process function
 //----------------------------------------------------------------------
 
-typedef struct tile
-{
-  int left, right, lower, upper;
-} tile;
-
 typedef struct rgb_image
 {
   float *data;
@@ -247,18 +285,6 @@ static inline void copy_gray_image(gray_image img1, gray_image img2)
   memcpy(img2.data, img1.data, sizeof(float) * img1.width * img1.height);
 }
 
-// minimum of two integers
-static inline int min_i(int a, int b)
-{
-  return a < b ? a : b;
-}
-
-// maximum of two integers
-static inline int max_i(int a, int b)
-{
-  return a > b ? a : b;
-}
-
 // swap two floats
 static inline void swap_f(float a, float b)
 {
@@ -283,205 +309,9 @@ static inline void swap_pointer_f(float *a, float *b)
   b = t;
 }
 
-// calculate the one-dimensional moving average over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_mean_1d(int N, const float *x, float *y, size_t stride_y, int w)
-{
-  float m = 0, n_box = 0;
-  for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++)
-  {
-    m += x[i];
-    n_box++;
-  }
-  for(int i = 0; i < N; i++)
-  {
-    y[i * stride_y] = m / n_box;
-    if(i - w >= 0)
-    {
-      m -= x[i - w];
-      n_box--;
-    }
-    if(i + w + 1 < N)
-    {
-      m += x[i + w + 1];
-      n_box++;
-    }
-  }
-}
-
-// calculate the two-dimensional moving average over a box of size (2*w+1) x (2*w+1)
-// does the calculation in-place if input and ouput images are identical
-// this function is always called from a OpenMP thread, thus no parallelization
-static void box_mean(gray_image img1, gray_image img2, int w)
-{
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
-    img2_bak = new_gray_image(max_i(img2.width, img2.height), 1);
-    for(int i1 = 0; i1 < img2.height; i1++)
-    {
-      memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-      box_mean_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-    }
-  }
-  else
-  {
-    for(int i1 = 0; i1 < img1.height; i1++)
-      box_mean_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
-    img2_bak = new_gray_image(1, img2.height);
-  }
-  for(int i0 = 0; i0 < img1.width; i0++)
-  {
-    for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-    box_mean_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
-  }
-  free_gray_image(&img2_bak);
-}
-
-// calculate the one-dimensional moving maximum over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_max_1d(int N, const float *x, float *y, size_t stride_y, int w)
-{
-  float m = -(INFINITY);
-  for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++) m = fmaxf(x[i], m);
-  for(int i = 0; i < N; i++)
-  {
-    y[i * stride_y] = m;
-    if(i - w >= 0 && x[i - w] == m)
-    {
-      m = -(INFINITY);
-      for(int j = max_i(i - w + 1, 0), j_end = min_i(i + w + 2, N); j < j_end; j++) m = fmaxf(x[j], m);
-    }
-    if(i + w + 1 < N) m = fmaxf(x[i + w + 1], m);
-  }
-}
-
-// calculate the two-dimensional moving maximum over a box of size (2*w+1) x (2*w+1)
-// does the calculation in-place if input and ouput images are identical
-static void box_max(const gray_image img1, const gray_image img2, const int w)
-{
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-    {
-      img2_bak = new_gray_image(img2.width, 1);
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img2.height; i1++)
-      {
-        memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-        box_max_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-      }
-      free_gray_image(&img2_bak);
-    }
-  }
-  else
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-    {
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img1.height; i1++)
-        box_max_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
-    }
-  }
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-  {
-    img2_bak = new_gray_image(1, img2.height);
-#ifdef _OPENMP
-#pragma omp for
-#endif
-    for(int i0 = 0; i0 < img1.width; i0++)
-    {
-      for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-      box_max_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
-    }
-    free_gray_image(&img2_bak);
-  }
-}
-
-// calculate the one-dimensional moving minimum over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_min_1d(int N, const float *x, float *y, size_t stride_y, int w)
-{
-  float m = INFINITY;
-  for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++) m = fminf(x[i], m);
-  for(int i = 0; i < N; i++)
-  {
-    y[i * stride_y] = m;
-    if(i - w >= 0 && x[i - w] == m)
-    {
-      m = INFINITY;
-      for(int j = max_i(i - w + 1, 0), j_end = min_i(i + w + 2, N); j < j_end; j++) m = fminf(x[j], m);
-    }
-    if(i + w + 1 < N) m = fminf(x[i + w + 1], m);
-  }
-}
-
-// calculate the two-dimensional moving minimum over a box of size (2*w+1) x (2*w+1)
-// does the calculation in-place if input and ouput images are identical
-static void box_min(const gray_image img1, const gray_image img2, const int w)
-{
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-    {
-      img2_bak = new_gray_image(img2.width, 1);
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img2.height; i1++)
-      {
-        memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-        box_min_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-      }
-      free_gray_image(&img2_bak);
-    }
-  }
-  else
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-    {
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img1.height; i1++)
-        box_min_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
-    }
-  }
-#ifdef _OPENMP
-#pragma omp parallel default(none) private(img2_bak)
-#endif
-  {
-    img2_bak = new_gray_image(1, img2.height);
-#ifdef _OPENMP
-#pragma omp for schedule(static)
-#endif
-    for(int i0 = 0; i0 < img1.width; i0++)
-    {
-      for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-      box_min_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
-    }
-    free_gray_image(&img2_bak);
-  }
-}
-
-// calculate the dark channel (minimal color component over a box of size (2*w+1) x (2*w+1) )
-static void dark_channel(const const_rgb_image img1, const gray_image img2, const int w)
+// calculate the dark channel (minimal color component over a box of size (2*w+1) x (2*w+1) ), returns non-zero
+// if there was no memory for the box filter
+static int dark_channel(const const_rgb_image img1, const gray_image img2, const int w)
 {
   const size_t size = (size_t)img1.height * img1.width;
 #ifdef _OPENMP
@@ -495,11 +325,11 @@ static void dark_channel(const const_rgb_image img1, const gray_image img2, cons
     m = fminf(pixel[2], m);
     img2.data[i] = m;
   }
-  box_min(img2, img2, w);
+  return dt_box_min(img2.data, img2.width, img2.height, w, NULL);
 }
 
-// calculate the transition map
-static void transition_map(const const_rgb_image img1, const gray_image img2, const int w, const float *const A0,
+// calculate the transition map, returns non-zero if there was no memory for the box filter
+static int transition_map(const const_rgb_image img1, const gray_image img2, const int w, const float *const A0,
                            const float strength)
 {
   const size_t size = (size_t)img1.height * img1.width;
@@ -514,172 +344,10 @@ static void transition_map(const const_rgb_image img1, const gray_image img2, co
     m = fminf(pixel[2] / A0[2], m);
     img2.data[i] = 1.f - m * strength;
   }
-  box_max(img2, img2, w);
+  return dt_box_max(img2.data, img2.width, img2.height, w, NULL);
 }
 
-// apply guided filter to single-component image img using the 3-components
-// image imgg as a guide
-static void guided_filter_tiling(const_rgb_image imgg, gray_image img, gray_image img_out, tile target, int w,
-                                 float eps)
-{
-  const tile source = { max_i(target.left - 2 * w, 0), min_i(target.right + 2 * w, imgg.width),
-                        max_i(target.lower - 2 * w, 0), min_i(target.upper + 2 * w, imgg.height) };
-  const int width = source.right - source.left;
-  const int height = source.upper - source.lower;
-  const size_t size = (size_t)width * height;
-  gray_image imgg_mean_r = new_gray_image(width, height);
-  gray_image imgg_mean_g = new_gray_image(width, height);
-  gray_image imgg_mean_b = new_gray_image(width, height);
-  gray_image img_mean = new_gray_image(width, height);
-  for(int j_imgg = source.lower; j_imgg < source.upper; j_imgg++)
-  {
-    size_t k = (size_t)(j_imgg - source.lower) * width;
-    size_t l = source.left + (size_t)j_imgg * imgg.width;
-    for(int i_imgg = source.left; i_imgg < source.right; i_imgg++, k++, l++)
-    {
-      const float *pixel = imgg.data + l * imgg.stride;
-      imgg_mean_r.data[k] = pixel[0];
-      imgg_mean_g.data[k] = pixel[1];
-      imgg_mean_b.data[k] = pixel[2];
-      img_mean.data[k] = img.data[l];
-    }
-  }
-  box_mean(imgg_mean_r, imgg_mean_r, w);
-  box_mean(imgg_mean_g, imgg_mean_g, w);
-  box_mean(imgg_mean_b, imgg_mean_b, w);
-  box_mean(img_mean, img_mean, w);
-  gray_image cov_imgg_img_r = new_gray_image(width, height);
-  gray_image cov_imgg_img_g = new_gray_image(width, height);
-  gray_image cov_imgg_img_b = new_gray_image(width, height);
-  gray_image var_imgg_rr, var_imgg_rg, var_imgg_rb, var_imgg_gg, var_imgg_gb, var_imgg_bb;
-  var_imgg_rr = new_gray_image(width, height);
-  var_imgg_gg = new_gray_image(width, height);
-  var_imgg_bb = new_gray_image(width, height);
-  var_imgg_rg = new_gray_image(width, height);
-  var_imgg_rb = new_gray_image(width, height);
-  var_imgg_gb = new_gray_image(width, height);
-  for(int j_imgg = source.lower; j_imgg < source.upper; j_imgg++)
-  {
-    size_t k = (size_t)(j_imgg - source.lower) * width;
-    size_t l = source.left + (size_t)j_imgg * imgg.width;
-    for(int i_imgg = source.left; i_imgg < source.right; i_imgg++, k++, l++)
-    {
-      const float *pixel = imgg.data + l * imgg.stride;
-      cov_imgg_img_r.data[k] = pixel[0] * img.data[l];
-      cov_imgg_img_g.data[k] = pixel[1] * img.data[l];
-      cov_imgg_img_b.data[k] = pixel[2] * img.data[l];
-      var_imgg_rr.data[k] = pixel[0] * pixel[0];
-      var_imgg_rg.data[k] = pixel[0] * pixel[1];
-      var_imgg_rb.data[k] = pixel[0] * pixel[2];
-      var_imgg_gg.data[k] = pixel[1] * pixel[1];
-      var_imgg_gb.data[k] = pixel[1] * pixel[2];
-      var_imgg_bb.data[k] = pixel[2] * pixel[2];
-    }
-  }
-  box_mean(cov_imgg_img_r, cov_imgg_img_r, w);
-  box_mean(cov_imgg_img_g, cov_imgg_img_g, w);
-  box_mean(cov_imgg_img_b, cov_imgg_img_b, w);
-  box_mean(var_imgg_rr, var_imgg_rr, w);
-  box_mean(var_imgg_rg, var_imgg_rg, w);
-  box_mean(var_imgg_rb, var_imgg_rb, w);
-  box_mean(var_imgg_gg, var_imgg_gg, w);
-  box_mean(var_imgg_gb, var_imgg_gb, w);
-  box_mean(var_imgg_bb, var_imgg_bb, w);
-  for(size_t i = 0; i < size; i++)
-  {
-    cov_imgg_img_r.data[i] -= imgg_mean_r.data[i] * img_mean.data[i];
-    cov_imgg_img_g.data[i] -= imgg_mean_g.data[i] * img_mean.data[i];
-    cov_imgg_img_b.data[i] -= imgg_mean_b.data[i] * img_mean.data[i];
-    var_imgg_rr.data[i] -= imgg_mean_r.data[i] * imgg_mean_r.data[i] - eps;
-    var_imgg_rg.data[i] -= imgg_mean_r.data[i] * imgg_mean_g.data[i];
-    var_imgg_rb.data[i] -= imgg_mean_r.data[i] * imgg_mean_b.data[i];
-    var_imgg_gg.data[i] -= imgg_mean_g.data[i] * imgg_mean_g.data[i] - eps;
-    var_imgg_gb.data[i] -= imgg_mean_g.data[i] * imgg_mean_b.data[i];
-    var_imgg_bb.data[i] -= imgg_mean_b.data[i] * imgg_mean_b.data[i] - eps;
-  }
-  gray_image a_r = new_gray_image(width, height);
-  gray_image a_g = new_gray_image(width, height);
-  gray_image a_b = new_gray_image(width, height);
-  gray_image b = img_mean;
-  for(int i1 = 0; i1 < height; i1++)
-  {
-    size_t i = (size_t)i1 * width;
-    for(int i0 = 0; i0 < width; i0++)
-    {
-      // solve linear system of equations of size 3x3 via Cramer's rule
-      float Sigma[3][3]; // symmetric coefficient matrix
-      Sigma[0][0] = var_imgg_rr.data[i];
-      Sigma[0][1] = var_imgg_rg.data[i];
-      Sigma[0][2] = var_imgg_rb.data[i];
-      Sigma[1][1] = var_imgg_gg.data[i];
-      Sigma[1][2] = var_imgg_gb.data[i];
-      Sigma[2][2] = var_imgg_bb.data[i];
-      rgb_pixel cov_imgg_img;
-      cov_imgg_img[0] = cov_imgg_img_r.data[i];
-      cov_imgg_img[1] = cov_imgg_img_g.data[i];
-      cov_imgg_img[2] = cov_imgg_img_b.data[i];
-      float det0 = Sigma[0][0] * (Sigma[1][1] * Sigma[2][2] - Sigma[1][2] * Sigma[1][2])
-                   - Sigma[0][1] * (Sigma[0][1] * Sigma[2][2] - Sigma[0][2] * Sigma[1][2])
-                   + Sigma[0][2] * (Sigma[0][1] * Sigma[1][2] - Sigma[0][2] * Sigma[1][1]);
-      if(fabsf(det0) > 4.f * FLT_EPSILON)
-      {
-        float det1 = cov_imgg_img[0] * (Sigma[1][1] * Sigma[2][2] - Sigma[1][2] * Sigma[1][2])
-                     - Sigma[0][1] * (cov_imgg_img[1] * Sigma[2][2] - cov_imgg_img[2] * Sigma[1][2])
-                     + Sigma[0][2] * (cov_imgg_img[1] * Sigma[1][2] - cov_imgg_img[2] * Sigma[1][1]);
-        float det2 = Sigma[0][0] * (cov_imgg_img[1] * Sigma[2][2] - cov_imgg_img[2] * Sigma[1][2])
-                     - cov_imgg_img[0] * (Sigma[0][1] * Sigma[2][2] - Sigma[0][2] * Sigma[1][2])
-                     + Sigma[0][2] * (Sigma[0][1] * cov_imgg_img[2] - Sigma[0][2] * cov_imgg_img[1]);
-        float det3 = Sigma[0][0] * (Sigma[1][1] * cov_imgg_img[2] - Sigma[1][2] * cov_imgg_img[1])
-                     - Sigma[0][1] * (Sigma[0][1] * cov_imgg_img[2] - Sigma[0][2] * cov_imgg_img[1])
-                     + cov_imgg_img[0] * (Sigma[0][1] * Sigma[1][2] - Sigma[0][2] * Sigma[1][1]);
-        a_r.data[i] = det1 / det0;
-        a_g.data[i] = det2 / det0;
-        a_b.data[i] = det3 / det0;
-      }
-      else
-      {
-        // linear system is singular
-        a_r.data[i] = 0;
-        a_g.data[i] = 0;
-        a_b.data[i] = 0;
-      }
-      b.data[i] -= a_r.data[i] * imgg_mean_r.data[i];
-      b.data[i] -= a_g.data[i] * imgg_mean_g.data[i];
-      b.data[i] -= a_b.data[i] * imgg_mean_b.data[i];
-      ++i;
-    }
-  }
-  box_mean(a_r, a_r, w);
-  box_mean(a_g, a_g, w);
-  box_mean(a_b, a_b, w);
-  box_mean(b, b, w);
-  for(int j_imgg = source.lower; j_imgg < source.upper; j_imgg++)
-  {
-    size_t k = (size_t)(j_imgg - source.lower) * width;
-    size_t l = source.left + (size_t)j_imgg * imgg.width;
-    for(int i_imgg = source.left; i_imgg < source.right; i_imgg++, k++, l++)
-    {
-      const float *pixel = imgg.data + l * imgg.stride;
-      img_out.data[l] = a_r.data[k] * pixel[0] + a_g.data[k] * pixel[1] + a_b.data[k] * pixel[2] + b.data[k];
-    }
-  }
-  free_gray_image(&a_r);
-  free_gray_image(&a_g);
-  free_gray_image(&a_b);
-  free_gray_image(&var_imgg_rr);
-  free_gray_image(&var_imgg_rg);
-  free_gray_image(&var_imgg_rb);
-  free_gray_image(&var_imgg_gg);
-  free_gray_image(&var_imgg_gb);
-  free_gray_image(&var_imgg_bb);
-  free_gray_image(&cov_imgg_img_r);
-  free_gray_image(&cov_imgg_img_g);
-  free_gray_image(&cov_imgg_img_b);
-  free_gray_image(&img_mean);
-  free_gray_image(&imgg_mean_r);
-  free_gray_image(&imgg_mean_g);
-  free_gray_image(&imgg_mean_b);
-}
+
 
 // partition the array [first, last) using the pivot value val, i.e.,
 // reorder the elements in the range [first, last) in such a way that
@@ -744,7 +412,8 @@ static float ambient_light(const const_rgb_image img, int w1, rgb_pixel *pA0)
   const size_t size = (size_t)width * height;
   // calculate dark channel, which is an estimate for local amount of haze
   gray_image dark_ch = new_gray_image(width, height);
-  dark_channel(img, dark_ch, w1);
+  // without the box filter the minimum of every pixel on its own is still an estimate
+  if(dark_channel(img, dark_ch, w1)) fprintf(stderr, "[hazeremoval] dark channel without box filter\n");
   // determine the brightest pixels among the most hazy pixels
   gray_image bright_hazy = new_gray_image(width, height);
   copy_gray_image(dark_ch, bright_hazy);
@@ -803,40 +472,16 @@ static float ambient_light(const const_rgb_image img, int w1, rgb_pixel *pA0)
   return crit_haze_level > 0 ? -1.125f * logf(crit_haze_level) : logf(FLT_MAX) / 2; // return the maximal depth
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+// hazeremoval module needs the color and the haziness (which yields
+// distance_max) of the most hazy region of the image.  In pixelpipe
+// FULL we can not reliably get this value as the pixelpipe might
+// only see part of the image (region of interest).  Therefore, we
+// try to get A0 and distance_max from the PREVIEW pixelpipe which
+// luckily stores it for us.  Returns NAN if they are not available.
+static float fetch_ambient_light(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, rgb_pixel *pA0)
 {
   dt_iop_hazeremoval_gui_data_t *g = (dt_iop_hazeremoval_gui_data_t *)self->gui_data;
-  dt_iop_hazeremoval_params_t *d = (dt_iop_hazeremoval_params_t *)piece->data;
-
-  const int ch = piece->colors;
-  const int width = roi_in->width;
-  const int height = roi_in->height;
-  const size_t size = (size_t)width * height;
-  const int w1 = 6; // window size (positive integer) for determing the dark channel and the transition map
-  const int w2 = 9; // window size (positive integer) for the guided filter
-
-  // module parameters
-  const float strength = d->strength; // strength of haze removal
-  const float distance = d->distance; // maximal distance from camera to remove haze
-  const float eps = 0.025f;           // regularization parameter for guided filter
-
-  const const_rgb_image img_in = (const_rgb_image){ ivoid, width, height, ch };
-  const rgb_image img_out = (rgb_image){ ovoid, width, height, ch };
-
-  // estimate diffusive ambient light and image depth
-  rgb_pixel A0;
-  A0[0] = NAN;
-  A0[1] = NAN;
-  A0[2] = NAN;
   float distance_max = NAN;
-
-  // hazeremoval module needs the color and the haziness (which yields
-  // distance_max) of the most hazy region of the image.  In pixelpipe
-  // FULL we can not reliably get this value as the pixelpipe might
-  // only see part of the image (region of interest).  Therefore, we
-  // try to get A0 and distance_max from the PREVIEW pixelpipe which
-  // luckily stores it for us.
   if(self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
   {
     dt_pthread_mutex_lock(&g->lock);
@@ -851,18 +496,20 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     if(hash != 0 && !dt_dev_sync_pixelpipe_hash(self->dev, piece->pipe, 0, self->priority, &g->lock, &g->hash))
       dt_control_log(_("inconsistent output"));
     dt_pthread_mutex_lock(&g->lock);
-    A0[0] = g->A0[0];
-    A0[1] = g->A0[1];
-    A0[2] = g->A0[2];
+    (*pA0)[0] = g->A0[0];
+    (*pA0)[1] = g->A0[1];
+    (*pA0)[2] = g->A0[2];
     distance_max = g->distance_max;
     dt_pthread_mutex_unlock(&g->lock);
   }
-  // In all other cases we calculate distance_max and A0 here.
-  if(isnan(distance_max))
-  {
-    distance_max = ambient_light(img_in, w1, &A0);
-  }
-  // PREVIEW pixelpipe stores values.
+  return distance_max;
+}
+
+// PREVIEW pixelpipe stores values.
+static void store_ambient_light(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const rgb_pixel A0,
+                                const float distance_max)
+{
+  dt_iop_hazeremoval_gui_data_t *g = (dt_iop_hazeremoval_gui_data_t *)self->gui_data;
   if(self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
   {
     uint64_t hash = dt_dev_hash_plus(self->dev, piece->pipe, 0, self->priority);
@@ -874,36 +521,83 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     g->hash = hash;
     dt_pthread_mutex_unlock(&g->lock);
   }
+}
 
-  // calculate the transition map
-  gray_image trans_map = new_gray_image(width, height);
-  transition_map(img_in, trans_map, w1, A0, strength);
+// estimate diffusive ambient light and image depth, from the PREVIEW
+// pixelpipe if possible and from img_in otherwise
+static float estimate_ambient_light(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                    const const_rgb_image img_in, rgb_pixel *pA0)
+{
+  float distance_max = fetch_ambient_light(self, piece, pA0);
+  // In all other cases we calculate distance_max and A0 here.
+  if(isnan(distance_max)) distance_max = ambient_light(img_in, HAZE_W1, pA0);
+  store_ambient_light(self, piece, *pA0, distance_max);
+  return distance_max;
+}
 
-  // refine the transition map
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  // input and output plus the transition map before and after the guided filter.
+  // on the gpu the guided filter needs another five rgba buffers and box filters
+  // a single channel one.
+  tiling->factor = piece->pipe->devid >= 0 ? 7.75f : 2.5f;
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = dt_guided_filter_memory_use(HAZE_W2);
+  // box max and min of the transition map, then the two box means of the guided filter
+  tiling->overlap = 2 * HAZE_W1 + 2 * HAZE_W2;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_hazeremoval_data_t *d = (dt_iop_hazeremoval_data_t *)piece->data;
+
+  const int ch = piece->colors;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const size_t size = (size_t)width * height;
+
+  // module parameters
+  const float strength = d->strength; // strength of haze removal
+  const float distance = d->distance; // maximal distance from camera to remove haze
+
+  const const_rgb_image img_in = (const_rgb_image){ ivoid, width, height, ch };
+  const rgb_image img_out = (rgb_image){ ovoid, width, height, ch };
+
+  // when processing a tile process_tiling() has estimated both on the whole image already
+  rgb_pixel A0;
+  A0[0] = d->A0[0];
+  A0[1] = d->A0[1];
+  A0[2] = d->A0[2];
+  float distance_max = d->distance_max;
+  if(isnan(distance_max)) distance_max = estimate_ambient_light(self, piece, img_in, &A0);
+
+  // calculate and refine the transition map
+  gray_image trans_map = new_gray_image(width, height);
   gray_image trans_map_filtered = new_gray_image(width, height);
-  box_min(trans_map, trans_map, w1);
-  const int tile_width = 512 - 4 * w2;
-  const gray_image c_trans_map = trans_map;
-  const gray_image c_trans_map_filtered = trans_map_filtered;
-#ifdef _OPENMP
-// use dynamic load ballancing as tiles may have varying size
-#pragma omp parallel for default(none) schedule(dynamic) collapse(2)
-#endif
-  for(int j = 0; j < height; j += tile_width)
+  if(transition_map(img_in, trans_map, HAZE_W1, A0, strength)
+     || dt_box_min(trans_map.data, width, height, HAZE_W1, NULL)
+     || dt_guided_filter(img_in.data, ch, trans_map.data, trans_map_filtered.data, width, height, HAZE_W2,
+                         HAZE_EPS))
   {
-    for(int i = 0; i < width; i += tile_width)
-    {
-      tile target = { i, min_i(i + tile_width, width), j, min_i(j + tile_width, height) };
-      guided_filter_tiling(img_in, c_trans_map, c_trans_map_filtered, target, w2, eps);
-    }
+    fprintf(stderr, "[hazeremoval] out of memory, image passed through\n");
+    memcpy(ovoid, ivoid, sizeof(float) * ch * size);
+    free_gray_image(&trans_map);
+    free_gray_image(&trans_map_filtered);
+    return;
   }
 
   // finally, calculate the haze-free image
   const float t_min
       = fmaxf(expf(-distance * distance_max), 1.f / 1024); // minimum allowed value for transition map
   const float *const c_A0 = A0;
+  const gray_image c_trans_map_filtered = trans_map_filtered;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
   for(size_t i = 0; i < size; i++)
   {
@@ -922,6 +616,125 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+// the ambient light has to be estimated on the whole image, the tiles would
+// each find their own
+void process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                    void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                    const int bpp)
+{
+  dt_iop_hazeremoval_data_t *d = (dt_iop_hazeremoval_data_t *)piece->data;
+  const const_rgb_image img_in = (const_rgb_image){ ivoid, roi_in->width, roi_in->height, piece->colors };
+  d->distance_max = estimate_ambient_light(self, piece, img_in, &d->A0);
+  default_process_tiling(self, piece, ivoid, ovoid, roi_in, roi_out, bpp);
+  d->distance_max = NAN;
+}
+
+#ifdef HAVE_OPENCL
+int process_tiling_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                      void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                      const int bpp)
+{
+  dt_iop_hazeremoval_data_t *d = (dt_iop_hazeremoval_data_t *)piece->data;
+  const const_rgb_image img_in = (const_rgb_image){ ivoid, roi_in->width, roi_in->height, piece->colors };
+  d->distance_max = estimate_ambient_light(self, piece, img_in, &d->A0);
+  const int success = default_process_tiling_cl(self, piece, ivoid, ovoid, roi_in, roi_out, bpp);
+  d->distance_max = NAN;
+  return success;
+}
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_hazeremoval_data_t *d = (dt_iop_hazeremoval_data_t *)piece->data;
+  dt_iop_hazeremoval_global_data_t *gd = (dt_iop_hazeremoval_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_trans_map = NULL, dev_trans_map_filtered = NULL, dev_tmp = NULL;
+  float *in = NULL;
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const float strength = d->strength;
+  const float distance = d->distance;
+
+  rgb_pixel A0;
+  A0[0] = d->A0[0];
+  A0[1] = d->A0[1];
+  A0[2] = d->A0[2];
+  float distance_max = d->distance_max;
+  if(isnan(distance_max)) distance_max = fetch_ambient_light(self, piece, &A0);
+  if(isnan(distance_max))
+  {
+    // the ambient light is estimated on the cpu
+    in = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+    if(in == NULL) goto error;
+    err = dt_opencl_copy_device_to_host(devid, in, dev_in, width, height, 4 * sizeof(float));
+    if(err != CL_SUCCESS) goto error;
+    distance_max = ambient_light((const_rgb_image){ in, width, height, 4 }, HAZE_W1, &A0);
+    dt_free_align(in);
+    in = NULL;
+  }
+  store_ambient_light(self, piece, A0, distance_max);
+
+  dev_trans_map = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  dev_trans_map_filtered = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  dev_tmp = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(dev_trans_map == NULL || dev_trans_map_filtered == NULL || dev_tmp == NULL)
+  {
+    err = -999;
+    goto error;
+  }
+
+  const float A0_cl[4] = { A0[0], A0[1], A0[2], 1.0f };
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  // calculate the transition map
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 1, sizeof(cl_mem), (void *)&dev_trans_map);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 4, 4 * sizeof(float), (void *)A0_cl);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_transition_map, 5, sizeof(float), (void *)&strength);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_hazeremoval_transition_map, sizes);
+  if(err != CL_SUCCESS) goto error;
+  err = dt_box_max_cl(devid, dev_trans_map, dev_tmp, width, height, HAZE_W1);
+  if(err != CL_SUCCESS) goto error;
+
+  // refine the transition map
+  err = dt_box_min_cl(devid, dev_trans_map, dev_tmp, width, height, HAZE_W1);
+  if(err != CL_SUCCESS) goto error;
+  err = dt_guided_filter_cl(devid, dev_in, dev_trans_map, dev_trans_map_filtered, width, height, HAZE_W2,
+                            HAZE_EPS);
+  if(err != CL_SUCCESS) goto error;
+
+  // finally, calculate the haze-free image
+  const float t_min
+      = fmaxf(expf(-distance * distance_max), 1.f / 1024); // minimum allowed value for transition map
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dehaze, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dehaze, 1, sizeof(cl_mem), (void *)&dev_trans_map_filtered);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dehaze, 2, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dehaze, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dehaze, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dehaze, 5, 4 * sizeof(float), (void *)A0_cl);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hazeremoval_dehaze, 6, sizeof(float), (void *)&t_min);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_hazeremoval_dehaze, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_trans_map);
+  dt_opencl_release_mem_object(dev_trans_map_filtered);
+  dt_opencl_release_mem_object(dev_tmp);
+  return TRUE;
+
+error:
+  dt_free_align(in);
+  dt_opencl_release_mem_object(dev_trans_map);
+  dt_opencl_release_mem_object(dev_trans_map_filtered);
+  dt_opencl_release_mem_object(dev_tmp);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_hazeremoval] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
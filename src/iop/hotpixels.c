@@ -24,6 +24,7 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
@@ -34,6 +35,9 @@
 
 #include <gtk/gtk.h>
 #include <stdlib.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 DT_MODULE_INTROSPECTION(1, dt_iop_hotpixels_params_t)
 
@@ -65,6 +69,11 @@ typedef struct dt_iop_hotpixels_data_t
   gboolean markfixed;
 } dt_iop_hotpixels_data_t;
 
+typedef struct dt_iop_hotpixels_global_data_t
+{
+  int kernel_hotpixels;
+} dt_iop_hotpixels_global_data_t;
+
 const char *name()
 {
   return _("hot pixels");
@@ -158,14 +167,113 @@ static int process_bayer(const dt_iop_hotpixels_data_t *data,
   return fixed;
 }
 
-/* X-Trans sensor equivalent of process_bayer(). */
-static int process_xtrans(const dt_iop_hotpixels_data_t *data,
-                          const void *const ivoid, void *const ovoid,
-                          const dt_iop_roi_t *const roi_out, const uint8_t (*const xtrans)[6])
+#if defined(__SSE2__)
+/* SSE2 version of process_bayer(): four sites are tested at once, the few
+ * hot ones are then fixed and marked in the order of the row, just as above. */
+static int process_bayer_sse2(const dt_iop_hotpixels_data_t *data,
+                              const void *const ivoid, void *const ovoid,
+                              const dt_iop_roi_t *const roi_out)
+{
+  const float threshold = data->threshold;
+  const float multiplier = data->multiplier;
+  const gboolean markfixed = data->markfixed;
+  const int min_neighbours = data->permissive ? 3 : 4;
+  const int width = roi_out->width;
+  const int widthx2 = width * 2;
+  int fixed = 0;
+
+  const __m128 threshold4 = _mm_set1_ps(threshold);
+  const __m128 multiplier4 = _mm_set1_ps(multiplier);
+  const __m128 min_neighbours4 = _mm_set1_ps(min_neighbours);
+  const __m128 one = _mm_set1_ps(1.0f);
+
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+ : fixed) schedule(static)
+#endif
+  for(int row = 2; row < roi_out->height - 2; row++)
+  {
+    const float *in = (float *)ivoid + (size_t)width * row + 2;
+    float *out = (float *)ovoid + (size_t)width * row + 2;
+    int col = 2;
+    for(; col + 4 <= width - 2; col += 4, in += 4, out += 4)
+    {
+      const __m128 pixel = _mm_loadu_ps(in);
+      const __m128 mid = _mm_mul_ps(pixel, multiplier4);
+      __m128 count = _mm_setzero_ps();
+      __m128 maxin = _mm_setzero_ps();
+#define TESTONE(OFFSET)                                                                                      \
+  {                                                                                                          \
+    const __m128 other = _mm_loadu_ps(in + (OFFSET));                                                        \
+    const __m128 lower = _mm_cmpgt_ps(mid, other);                                                           \
+    count = _mm_add_ps(count, _mm_and_ps(lower, one));                                                       \
+    maxin = _mm_max_ps(_mm_and_ps(lower, other), maxin);                                                     \
+  }
+      TESTONE(-2);
+      TESTONE(-widthx2);
+      TESTONE(+2);
+      TESTONE(+widthx2);
+#undef TESTONE
+      const int hot
+          = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(pixel, threshold4), _mm_cmpge_ps(count, min_neighbours4)));
+      if(!hot) continue;
+
+      float fix[4];
+      _mm_storeu_ps(fix, maxin);
+      for(int k = 0; k < 4; k++)
+      {
+        if(!(hot & (1 << k))) continue;
+        out[k] = fix[k];
+        fixed++;
+        if(markfixed)
+        {
+          for(int i = -2; i >= -10 && i >= -(col + k); i -= 2) out[k + i] = in[k];
+          for(int i = 2; i <= 10 && i < width - (col + k); i += 2) out[k + i] = in[k];
+        }
+      }
+    }
+    for(; col < width - 2; col++, in++, out++)
+    {
+      float mid = *in * multiplier;
+      if(*in > threshold)
+      {
+        int count = 0;
+        float maxin = 0.0;
+        float other;
+#define TESTONE(OFFSET)                                                                                      \
+  other = in[OFFSET];                                                                                        \
+  if(mid > other)                                                                                            \
+  {                                                                                                          \
+    count++;                                                                                                 \
+    if(other > maxin) maxin = other;                                                                         \
+  }
+        TESTONE(-2);
+        TESTONE(-widthx2);
+        TESTONE(+2);
+        TESTONE(+widthx2);
+#undef TESTONE
+        if(count >= min_neighbours)
+        {
+          *out = maxin;
+          fixed++;
+          if(markfixed)
+          {
+            for(int i = -2; i >= -10 && i >= -col; i -= 2) out[i] = *in;
+            for(int i = 2; i <= 10 && i < width - col; i += 2) out[i] = *in;
+          }
+        }
+      }
+    }
+  }
+
+  return fixed;
+}
+#endif
+
+/* For each cell of the X-Trans sensor array, pre-calculate a list of the
+ * x/y offsets of the four radially nearest pixels of the same color. */
+static void xtrans_offsets(int offsets[6][6][4][2], const dt_iop_roi_t *const roi_out,
+                           const uint8_t (*const xtrans)[6])
 {
-  // for each cell of sensor array, pre-calculate, a list of the x/y
-  // offsets of the four radially nearest pixels of the same color
-  int offsets[6][6][4][2];
   // increasing offsets from pixel to find nearest like-colored pixels
   const int search[20][2] = { { -1, 0 },
                               { 1, 0 },
@@ -203,6 +311,15 @@ static int process_xtrans(const dt_iop_hotpixels_data_t *data,
       }
     }
   }
+}
+
+/* X-Trans sensor equivalent of process_bayer(). */
+static int process_xtrans(const dt_iop_hotpixels_data_t *data,
+                          const void *const ivoid, void *const ovoid,
+                          const dt_iop_roi_t *const roi_out, const uint8_t (*const xtrans)[6])
+{
+  int offsets[6][6][4][2];
+  xtrans_offsets(offsets, roi_out, xtrans);
 
   const float threshold = data->threshold;
   const float multiplier = data->multiplier;
@@ -292,6 +409,126 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+#if defined(__SSE2__)
+void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_hotpixels_gui_data_t *g = (dt_iop_hotpixels_gui_data_t *)self->gui_data;
+  const dt_iop_hotpixels_data_t *data = (dt_iop_hotpixels_data_t *)piece->data;
+
+  memcpy(ovoid, ivoid, (size_t)roi_out->width * roi_out->height * sizeof(float));
+
+  int fixed;
+  if(piece->pipe->dsc.filters == 9u)
+  {
+    fixed = process_xtrans(data, ivoid, ovoid, roi_out, (const uint8_t(*const)[6])piece->pipe->dsc.xtrans);
+  }
+  else
+  {
+    fixed = process_bayer_sse2(data, ivoid, ovoid, roi_out);
+  }
+
+  if(g != NULL && self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
+  {
+    g->pixels_fixed = fixed;
+  }
+}
+#endif
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_hotpixels_gui_data_t *g = (dt_iop_hotpixels_gui_data_t *)self->gui_data;
+  const dt_iop_hotpixels_data_t *data = (dt_iop_hotpixels_data_t *)piece->data;
+  dt_iop_hotpixels_global_data_t *gd = (dt_iop_hotpixels_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_offsets = NULL, dev_xtrans = NULL, dev_fixed = NULL;
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const uint32_t filters = piece->pipe->dsc.filters;
+  const float threshold = data->threshold;
+  const float multiplier = data->multiplier;
+  const int min_neighbours = data->permissive ? 3 : 4;
+  const int markfixed = data->markfixed;
+
+  // the four neighbours of the same colour of every site of the cfa, see hotpixels.cl
+  int offsets[6][6][4][2] = { { { { 0 } } } };
+  if(filters == 9u)
+    xtrans_offsets(offsets, roi_out, (const uint8_t(*const)[6])piece->pipe->dsc.xtrans);
+  else
+  {
+    const int bayer[4][2] = { { -2, 0 }, { 0, -2 }, { 2, 0 }, { 0, 2 } };
+    for(int k = 0; k < 4; k++) memcpy(offsets[0][k], bayer, sizeof(bayer));
+  }
+
+  int fixed = 0;
+  dev_offsets = dt_opencl_copy_host_to_device_constant(devid, sizeof(offsets), offsets);
+  dev_xtrans
+      = dt_opencl_copy_host_to_device_constant(devid, sizeof(piece->pipe->dsc.xtrans), piece->pipe->dsc.xtrans);
+  dev_fixed = dt_opencl_alloc_device_buffer(devid, sizeof(fixed));
+  if(dev_offsets == NULL || dev_xtrans == NULL || dev_fixed == NULL) goto error;
+  err = dt_opencl_write_buffer_to_device(devid, &fixed, dev_fixed, 0, sizeof(fixed), CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 4, sizeof(float), (void *)&threshold);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 5, sizeof(float), (void *)&multiplier);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 6, sizeof(int), (void *)&min_neighbours);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 7, sizeof(int), (void *)&markfixed);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 8, sizeof(cl_mem), (void *)&dev_offsets);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 9, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 10, sizeof(int), (void *)&roi_out->x);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 11, sizeof(int), (void *)&roi_out->y);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 12, sizeof(cl_mem), (void *)&dev_xtrans);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 13, sizeof(cl_mem), (void *)&dev_fixed);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_hotpixels, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  if(g != NULL && self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
+  {
+    err = dt_opencl_read_buffer_from_device(devid, &fixed, dev_fixed, 0, sizeof(fixed), CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+    g->pixels_fixed = fixed;
+  }
+
+  dt_opencl_release_mem_object(dev_fixed);
+  dt_opencl_release_mem_object(dev_xtrans);
+  dt_opencl_release_mem_object(dev_offsets);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_fixed);
+  dt_opencl_release_mem_object(dev_xtrans);
+  dt_opencl_release_mem_object(dev_offsets);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_hotpixels] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 25; // hotpixels.cl, from programs.conf
+  dt_iop_hotpixels_global_data_t *gd
+      = (dt_iop_hotpixels_global_data_t *)malloc(sizeof(dt_iop_hotpixels_global_data_t));
+  module->data = gd;
+  gd->kernel_hotpixels = dt_opencl_create_kernel(program, "hotpixels");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_hotpixels_global_data_t *gd = (dt_iop_hotpixels_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_hotpixels);
+  free(module->data);
+  module->data = NULL;
+}
+
 void reload_defaults(dt_iop_module_t *module)
 {
   const dt_iop_hotpixels_params_t tmp
@@ -313,7 +550,6 @@ end:
 
 void init(dt_iop_module_t *module)
 {
-  module->data = NULL;
   module->params = calloc(1, sizeof(dt_iop_hotpixels_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_hotpixels_params_t));
   module->default_enabled = 0;
@@ -326,8 +562,6 @@ void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
   module->params = NULL;
-  free(module->data);
-  module->data = NULL;
 }
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
@@ -169,6 +169,23 @@ void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
                   const struct dt_iop_roi_t *const roi_out);
 #endif
 
+/** optional, for modules where an output pixel only depends on the input pixel at the same place:
+  * the per pixel core of process(), on npixels pixels of 4 floats. in and out may be the same buffer,
+  * and it will be called from many threads at once. the pipe uses it to run consecutive such modules
+  * in one pass over the image, but only if the module neither blends nor needs histogram or picker. */
+void process_pixels(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels);
+/** optional, what process() does once per buffer before touching the pixels (updating piece->data,
+  * pipe->dsc). called once before the process_pixels() calls on a buffer. */
+void process_pixels_setup(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece);
+
+#if defined(__SSE__)
+/** a variant of process_pixels(), that can contain SSE2 intrinsics. it has to give the same pixels as
+  * process_sse2(), and modules providing process_sse2() need it to take part in fused runs. */
+void process_pixels_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const float *const in, float *const out, const size_t npixels);
+#endif
+
 #ifdef HAVE_OPENCL
 /** the opencl equivalent of process(). */
 int process_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
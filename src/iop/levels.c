@@ -283,58 +283,75 @@ static void commit_params_late(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
   }
 }
 
-void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
-             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels_setup(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece)
 {
-  const int ch = piece->colors;
   const dt_iop_levels_data_t *const d = (dt_iop_levels_data_t *)piece->data;
 
   if(d->mode == LEVELS_MODE_AUTOMATIC)
   {
     commit_params_late(self, piece);
   }
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static)
-#endif
-  for(int k = 0; k < roi_out->height; k++)
+void process_pixels(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  const dt_iop_levels_data_t *const d = (dt_iop_levels_data_t *)piece->data;
+
+  for(size_t j = 0; j < (size_t)4 * npixels; j += 4)
   {
-    float *in = (float *)ivoid + (size_t)k * ch * roi_out->width;
-    float *out = (float *)ovoid + (size_t)k * ch * roi_out->width;
-    for(int j = 0; j < roi_out->width; j++, in += ch, out += ch)
-    {
-      float L_in = in[0] / 100.0f;
+    const float L = in[j + 0];
+    const float L_in = L / 100.0f;
+    float L_out;
 
-      if(L_in <= d->levels[0])
-      {
-        // Anything below the lower threshold just clips to zero
-        out[0] = 0.0f;
-      }
-      else if(L_in >= d->levels[2])
-      {
-        float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
-        out[0] = 100.0f * pow(percentage, d->in_inv_gamma);
-      }
-      else
-      {
-        // Within the expected input range we can use the lookup table
-        float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
-        // out[0] = 100.0 * pow(percentage, d->in_inv_gamma);
-        out[0] = d->lut[CLAMP((int)(percentage * 0x10000ul), 0, 0xffff)];
-      }
+    if(L_in <= d->levels[0])
+    {
+      // Anything below the lower threshold just clips to zero
+      L_out = 0.0f;
+    }
+    else if(L_in >= d->levels[2])
+    {
+      float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
+      L_out = 100.0f * pow(percentage, d->in_inv_gamma);
+    }
+    else
+    {
+      // Within the expected input range we can use the lookup table
+      float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
+      // L_out = 100.0 * pow(percentage, d->in_inv_gamma);
+      L_out = d->lut[CLAMP((int)(percentage * 0x10000ul), 0, 0xffff)];
+    }
 
-      // Preserving contrast
-      if(in[0] > 0.01f)
-      {
-        out[1] = in[1] * out[0] / in[0];
-        out[2] = in[2] * out[0] / in[0];
-      }
-      else
-      {
-        out[1] = in[1] * out[0] / 0.01f;
-        out[2] = in[2] * out[0] / 0.01f;
-      }
+    // Preserving contrast
+    out[j + 0] = L_out;
+    if(L > 0.01f)
+    {
+      out[j + 1] = in[j + 1] * L_out / L;
+      out[j + 2] = in[j + 2] * L_out / L;
+    }
+    else
+    {
+      out[j + 1] = in[j + 1] * L_out / 0.01f;
+      out[j + 2] = in[j + 2] * L_out / 0.01f;
     }
+    out[j + 3] = in[j + 3];
+  }
+}
+
+void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
+             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+
+  process_pixels_setup(self, piece);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int k = 0; k < roi_out->height; k++)
+  {
+    const size_t offs = (size_t)k * ch * roi_out->width;
+    process_pixels(self, piece, (const float *)ivoid + offs, (float *)ovoid + offs, roi_out->width);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
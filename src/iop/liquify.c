@@ -238,6 +238,32 @@ typedef struct {
   int warp_kernel;
 } dt_iop_liquify_global_data_t;
 
+typedef enum {
+  DT_LIQUIFY_MAP_PIPE    = 0, ///< process() and process_cl()
+  DT_LIQUIFY_MAP_DISTORT = 1, ///< distort_transform() and distort_backtransform()
+  DT_LIQUIFY_MAP_SLOTS   = 2
+} dt_liquify_map_slot_t;
+
+typedef struct {
+  float complex *data;
+  int refs;                  ///< the cache and every caller applying it, counted under the lock of the piece
+} dt_liquify_map_t;
+
+typedef struct {
+  cairo_rectangle_int_t extent;
+  dt_liquify_map_t *map;     ///< sum of the stamps of all warps
+  dt_liquify_map_t *imap;    ///< its inverse, built when first asked for
+  dt_liquify_warp_t *warps;  ///< the warps in map
+  int num_warps;
+  int updates;               ///< warps replaced in map since it was built from scratch
+} dt_liquify_map_cache_t;
+
+typedef struct {
+  dt_iop_liquify_params_t params;
+  dt_liquify_map_cache_t maps[DT_LIQUIFY_MAP_SLOTS];
+  dt_pthread_mutex_t lock;   ///< the pipe and the distort callbacks run in different threads
+} dt_iop_liquify_data_t;
+
 typedef struct {
   dt_pthread_mutex_t lock;
   dt_iop_liquify_params_t params;
@@ -930,7 +956,9 @@ static void build_round_stamp (float complex **pstamp,
   Applies a stamp at a specified position.
 
   Applies a stamp at the position specified by @a point and adds the
-  resulting vector field to the global distortion map @a global_map.
+  resulting vector field, times @a weight, to the global distortion
+  map @a global_map.  A weight of -1 applies the stamp, +1 takes it
+  back out again.
 
   The global distortion map is a map of relative pixel displacements
   encompassing all our paths.
@@ -940,7 +968,8 @@ static void add_to_global_distortion_map (float complex *global_map,
                                           const cairo_rectangle_int_t *global_map_extent,
                                           const dt_liquify_warp_t *warp,
                                           const float complex *stamp,
-                                          const cairo_rectangle_int_t *stamp_extent)
+                                          const cairo_rectangle_int_t *stamp_extent,
+                                          const float weight)
 {
   cairo_rectangle_int_t mmext = *stamp_extent;
   mmext.x += (int) round (creal (warp->point));
@@ -964,7 +993,7 @@ static void add_to_global_distortion_map (float complex *global_map,
 
     for (int x = cmmext.x; x < cmmext.x + cmmext.width; x++)
     {
-      destrow[x - global_map_extent->x] -= srcrow[x - mmext.x];
+      destrow[x - global_map_extent->x] += weight * srcrow[x - mmext.x];
     }
   }
 }
@@ -1027,14 +1056,18 @@ static void apply_global_distortion_map (struct dt_iop_module_t *module,
   }
 }
 
-// calculate the map extent.
+// calculate the map extent, of all paths if roi_out is NULL.
 
 static void _get_map_extent (const dt_iop_roi_t *roi_out,
                              GList *interpolated,
                              cairo_rectangle_int_t *map_extent)
 {
-  const cairo_rectangle_int_t roi_out_rect = { roi_out->x, roi_out->y, roi_out->width, roi_out->height };
-  cairo_region_t *roi_out_region = cairo_region_create_rectangle (&roi_out_rect);
+  cairo_region_t *roi_out_region = NULL;
+  if (roi_out)
+  {
+    const cairo_rectangle_int_t roi_out_rect = { roi_out->x, roi_out->y, roi_out->width, roi_out->height };
+    roi_out_region = cairo_region_create_rectangle (&roi_out_rect);
+  }
   cairo_region_t *map_region = cairo_region_create ();
 
   for (GList *i = interpolated; i != NULL; i = i->next)
@@ -1043,7 +1076,8 @@ static void _get_map_extent (const dt_iop_roi_t *roi_out,
     cairo_rectangle_int_t r;
     compute_round_stamp_extent (&r, warp);
     // add extent if not entirely outside the roi
-    if (cairo_region_contains_rectangle (roi_out_region, &r) != CAIRO_REGION_OVERLAP_OUT)
+    if (!roi_out_region
+        || cairo_region_contains_rectangle (roi_out_region, &r) != CAIRO_REGION_OVERLAP_OUT)
     {
       cairo_region_union_rectangle (map_region, &r);
     }
@@ -1052,16 +1086,16 @@ static void _get_map_extent (const dt_iop_roi_t *roi_out,
   // return the paths and the extent of all paths
   cairo_region_get_extents (map_region, map_extent);
   cairo_region_destroy (map_region);
-  cairo_region_destroy (roi_out_region);
+  if (roi_out_region) cairo_region_destroy (roi_out_region);
 }
 
 static float complex *create_global_distortion_map (const cairo_rectangle_int_t *map_extent,
-                                                    GList *interpolated,
-                                                    gboolean inverted)
+                                                    GList *interpolated)
 {
   // allocate distortion map big enough to contain all paths
   const int mapsize = map_extent->width * map_extent->height;
   float complex * map = dt_alloc_align (16, mapsize * sizeof (float complex));
+  if (map == NULL) return NULL;
   memset (map, 0, mapsize * sizeof (float complex));
 
   // build map
@@ -1071,91 +1105,298 @@ static float complex *create_global_distortion_map (const cairo_rectangle_int_t
     float complex *stamp = NULL;
     cairo_rectangle_int_t r;
     build_round_stamp (&stamp, &r, warp);
-    add_to_global_distortion_map (map, map_extent, warp, stamp, &r);
+    add_to_global_distortion_map (map, map_extent, warp, stamp, &r, -1.0f);
     free ((void *) stamp);
   }
 
-  if (inverted)
+  return map;
+}
+
+static float complex *invert_global_distortion_map (const float complex *map,
+                                                    const cairo_rectangle_int_t *map_extent)
+{
+  const int mapsize = map_extent->width * map_extent->height;
+  float complex * const imap = dt_alloc_align (16, mapsize * sizeof (float complex));
+  if (imap == NULL) return NULL;
+  memset (imap, 0, mapsize * sizeof (float complex));
+
+  // copy map into imap (inverted map).
+  // imap [ n + dx(map[n]) , n + dy(map[n]) ] = -map[n]
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule (static) default (shared)
+  #endif
+
+  for (int y = 0; y <  map_extent->height; y++)
   {
-    float complex * const imap = dt_alloc_align (16, mapsize * sizeof (float complex));
-    memset (imap, 0, mapsize * sizeof (float complex));
+    const float complex *row = map + y * map_extent->width;
+    for (int x = 0; x < map_extent->width; x++)
+    {
+      const float complex d = *(row + x);
+      // compute new position (nx,ny) given the displacement d
+      const int nx = x + (int)creal(d);
+      const int ny = y + (int)cimag(d);
+
+      // if the point falls into the extent, set it
+      if (nx>0 && nx<map_extent->width && ny>0 && ny<map_extent->height)
+        imap[nx + ny * map_extent->width] = -d;
+    }
+  }
 
-    // copy map into imap (inverted map).
-    // imap [ n + dx(map[n]) , n + dy(map[n]) ] = -map[n]
+  // now just do a pass to avoid gap with a displacement of zero, note that we do not need high
+  // precision here as the inverted distortion mask is only used to compute a final displacement
+  // of points.
 
-    #ifdef _OPENMP
-    #pragma omp parallel for schedule (static) default (shared)
-    #endif
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule (dynamic) default (shared)
+  #endif
 
-    for (int y = 0; y <  map_extent->height; y++)
+  for (int y = 0; y <  map_extent->height; y++)
+  {
+    float complex *row = imap + y * map_extent->width;
+    float complex last[2] = { 0, 0 };
+    for (int x = 0; x < map_extent->width / 2 + 1; x++)
     {
-      const float complex *row = map + y * map_extent->width;
-      for (int x = 0; x < map_extent->width; x++)
+      float complex *cl = row + x;
+      float complex *cr = row + map_extent->width - x;
+      if (x!=0)
       {
-        const float complex d = *(row + x);
-        // compute new position (nx,ny) given the displacement d
-        const int nx = x + (int)creal(d);
-        const int ny = y + (int)cimag(d);
-
-        // if the point falls into the extent, set it
-        if (nx>0 && nx<map_extent->width && ny>0 && ny<map_extent->height)
-          imap[nx + ny * map_extent->width] = -d;
+        if (*cl == 0) *cl = last[0];
+        if (*cr == 0) *cr = last[1];
       }
+      last[0] = *cl; last[1] = *cr;
     }
+  }
 
-    dt_free_align ((void *) map);
+  return imap;
+}
 
-    // now just do a pass to avoid gap with a displacement of zero, note that we do not need high
-    // precision here as the inverted distortion mask is only used to compute a final displacement
-    // of points.
+/*
+  The distortion map cache.
+
+  Building the map means building a stamp for every interpolated warp,
+  which is slow for long paths.  Yet the map is asked for over and
+  over with the same paths: by process() whenever the pipe runs, and
+  by distort_transform() / distort_backtransform() whenever masks or
+  other modules transform points through us.  So every piece keeps
+  the last map of the pipe and the last map of the distort callbacks,
+  together with the warps that went into them, and any caller may use
+  either of them if the warps match and the map covers the extent it
+  needs.
+
+  The map is a sum of stamps, so if only a few warps changed (the user
+  is dragging one node) the stale stamps are subtracted and the new
+  ones added instead of starting over.  That is only done for the
+  darkroom pipes, and only a few times in a row: the rounding errors
+  of the float sums would otherwise make the map depend on the edit
+  history, and export would not give what the darkroom shows.
+
+  The maps are reference counted, callers hold a reference while they
+  apply one and don't need the lock for that.  A map that is in use is
+  never patched.
+*/
+
+#define DT_LIQUIFY_MAP_MAX_UPDATES 8
+
+static dt_liquify_map_t *_map_new (float complex *data)
+{
+  if (data == NULL) return NULL;
+  dt_liquify_map_t *m = malloc (sizeof (dt_liquify_map_t));
+  if (m == NULL)
+  {
+    dt_free_align ((void *) data);
+    return NULL;
+  }
+  m->data = data;
+  m->refs = 1;
+  return m;
+}
+
+// must be called with d->lock held
+static void _map_unref (dt_liquify_map_t *m)
+{
+  if (m == NULL || --m->refs > 0) return;
+  dt_free_align ((void *) m->data);
+  free (m);
+}
+
+// drop the reference returned by get_global_distortion_map()
+static void _map_release (dt_iop_liquify_data_t *d, dt_liquify_map_t *m)
+{
+  dt_pthread_mutex_lock (&d->lock);
+  _map_unref (m);
+  dt_pthread_mutex_unlock (&d->lock);
+}
+
+static gboolean _warp_equal (const dt_liquify_warp_t *a, const dt_liquify_warp_t *b)
+{
+  return a->point == b->point && a->strength == b->strength && a->radius == b->radius
+    && a->control1 == b->control1 && a->control2 == b->control2
+    && a->type == b->type && a->status == b->status;
+}
+
+static gboolean _extent_contains (const cairo_rectangle_int_t *a, const cairo_rectangle_int_t *b)
+{
+  return b->x >= a->x && b->y >= a->y
+    && b->x + b->width <= a->x + a->width && b->y + b->height <= a->y + a->height;
+}
+
+static void _map_cache_clear (dt_liquify_map_cache_t *c)
+{
+  _map_unref (c->map);
+  _map_unref (c->imap);
+  free (c->warps);
+  memset (c, 0, sizeof (dt_liquify_map_cache_t));
+}
+
+static void _map_cache_add_stamp (dt_liquify_map_cache_t *c, const dt_liquify_warp_t *warp, const float weight)
+{
+  float complex *stamp = NULL;
+  cairo_rectangle_int_t r;
+  build_round_stamp (&stamp, &r, warp);
+  add_to_global_distortion_map (c->map->data, &c->extent, warp, stamp, &r, weight);
+  free ((void *) stamp);
+}
+
+/*
+  Try to bring the cached map up to date with @a warps by replacing
+  the warps that differ.  Edits of a path only change the warps
+  interpolated along that path, which show up as one run between a
+  common head and a common tail of the two lists.
+*/
+
+static gboolean _map_cache_update (dt_liquify_map_cache_t *c, const dt_liquify_warp_t *warps, const int num_warps)
+{
+  // rebuilt from scratch every now and then, and never under the feet of a caller applying it
+  if (c->updates >= DT_LIQUIFY_MAP_MAX_UPDATES || c->map->refs > 1) return FALSE;
 
-    #ifdef _OPENMP
-    #pragma omp parallel for schedule (dynamic) default (shared)
-    #endif
+  int head = 0, tail = 0;
+  while (head < c->num_warps && head < num_warps && _warp_equal (c->warps + head, warps + head))
+    head++;
+  while (tail < c->num_warps - head && tail < num_warps - head
+         && _warp_equal (c->warps + c->num_warps - 1 - tail, warps + num_warps - 1 - tail))
+    tail++;
 
-    for (int y = 0; y <  map_extent->height; y++)
+  const int removed = c->num_warps - head - tail;
+  const int added = num_warps - head - tail;
+
+  // not worth it if most of the map changes
+  if (removed + added > num_warps / 2 + 1) return FALSE;
+
+  dt_liquify_warp_t *copy = malloc (sizeof (dt_liquify_warp_t) * MAX (num_warps, 1));
+  if (copy == NULL) return FALSE;
+
+  for (int k = head; k < head + removed; k++)
+    _map_cache_add_stamp (c, c->warps + k, 1.0f);
+  for (int k = head; k < head + added; k++)
+    _map_cache_add_stamp (c, warps + k, -1.0f);
+
+  memcpy (copy, warps, sizeof (dt_liquify_warp_t) * num_warps);
+  free (c->warps);
+  c->warps = copy;
+  c->num_warps = num_warps;
+  c->updates++;
+  _map_unref (c->imap);
+  c->imap = NULL;
+  return TRUE;
+}
+
+/*
+  Get the (inverted) distortion map of the @a interpolated warps
+  covering at least @a extent, from the cache of @a d if possible.
+  The map is stored in cache slot @a slot, its actual extent is
+  returned in @a map_extent.  Only maps built from scratch are used
+  unless @a patch is set.  Takes d->lock, the map stays valid until
+  it's given back with _map_release().  Returns NULL if there is
+  nothing to distort.
+*/
+
+static dt_liquify_map_t *get_global_distortion_map (dt_iop_liquify_data_t *d,
+                                                    const dt_liquify_map_slot_t slot,
+                                                    GList *interpolated,
+                                                    const cairo_rectangle_int_t *extent,
+                                                    const gboolean inverted,
+                                                    const gboolean patch,
+                                                    cairo_rectangle_int_t *map_extent)
+{
+  if (extent->width <= 0 || extent->height <= 0) return NULL;
+
+  const int num_warps = g_list_length (interpolated);
+  dt_liquify_warp_t *warps = malloc (sizeof (dt_liquify_warp_t) * MAX (num_warps, 1));
+  if (warps == NULL) return NULL;
+  int n = 0;
+  for (GList *i = interpolated; i != NULL; i = i->next)
+    warps[n++] = *((dt_liquify_warp_t *) i->data);
+
+  dt_pthread_mutex_lock (&d->lock);
+
+  // exact match in any slot
+  dt_liquify_map_cache_t *c = NULL;
+  for (int k = 0; k < DT_LIQUIFY_MAP_SLOTS && c == NULL; k++)
+  {
+    dt_liquify_map_cache_t *e = d->maps + k;
+    if (e->map == NULL || e->num_warps != num_warps || !_extent_contains (&e->extent, extent)) continue;
+    if (!patch && e->updates > 0) continue;
+    gboolean equal = TRUE;
+    for (int w = 0; w < num_warps && equal; w++) equal = _warp_equal (e->warps + w, warps + w);
+    if (equal) c = e;
+  }
+
+  if (c == NULL)
+  {
+    c = d->maps + slot;
+    if (!(patch && c->map && _extent_contains (&c->extent, extent) && _map_cache_update (c, warps, num_warps)))
     {
-      float complex *row = imap + y * map_extent->width;
-      float complex last[2] = { 0, 0 };
-      for (int x = 0; x < map_extent->width / 2 + 1; x++)
+      _map_cache_clear (c);
+      c->map = _map_new (create_global_distortion_map (extent, interpolated));
+      if (c->map == NULL)
       {
-        float complex *cl = row + x;
-        float complex *cr = row + map_extent->width - x;
-        if (x!=0)
-        {
-          if (*cl == 0) *cl = last[0];
-          if (*cr == 0) *cr = last[1];
-        }
-        last[0] = *cl; last[1] = *cr;
+        dt_pthread_mutex_unlock (&d->lock);
+        free (warps);
+        return NULL;
       }
+      c->extent = *extent;
+      c->warps = warps;
+      c->num_warps = num_warps;
+      warps = NULL;
     }
+  }
+  free (warps);
 
-    map = imap;
+  *map_extent = c->extent;
+  dt_liquify_map_t *m = c->map;
+  if (inverted)
+  {
+    if (c->imap == NULL) c->imap = _map_new (invert_global_distortion_map (c->map->data, &c->extent));
+    m = c->imap;
   }
+  if (m) m->refs++;
 
-  return map;
+  dt_pthread_mutex_unlock (&d->lock);
+  return m;
 }
 
-static float complex *build_global_distortion_map (struct dt_iop_module_t *module,
-                                                   const dt_dev_pixelpipe_iop_t *piece,
-                                                   const dt_iop_roi_t *roi_in,
-                                                   const dt_iop_roi_t *roi_out,
-                                                   cairo_rectangle_int_t *map_extent)
+// only the darkroom pipes see the edits one by one, and their maps may be patched
+static inline gboolean _pipe_patches_maps (const dt_dev_pixelpipe_t *pipe)
 {
-  // copy params
-  dt_iop_liquify_params_t copy_params;
-  memcpy(&copy_params, (dt_iop_liquify_params_t *)piece->data, sizeof(dt_iop_liquify_params_t));
-
-  distort_paths_raw_to_piece (module, piece->pipe, roi_in->scale, &copy_params);
+  return pipe->type == DT_DEV_PIXELPIPE_FULL || pipe->type == DT_DEV_PIXELPIPE_PREVIEW;
+}
 
-  GList *interpolated = interpolate_paths (&copy_params);
+/*
+  The warps of the paths in the coordinates of the piece at @a scale.
+*/
 
-  _get_map_extent (roi_out, interpolated, map_extent);
+static GList *interpolate_piece_paths (struct dt_iop_module_t *module,
+                                       const dt_dev_pixelpipe_iop_t *piece,
+                                       const float scale)
+{
+  // copy params
+  dt_iop_liquify_params_t copy_params;
+  memcpy(&copy_params, &((dt_iop_liquify_data_t *)piece->data)->params, sizeof(dt_iop_liquify_params_t));
 
-  float complex *map = create_global_distortion_map(map_extent, interpolated, FALSE);
+  distort_paths_raw_to_piece (module, piece->pipe, scale, &copy_params);
 
-  g_list_free_full (interpolated, free);
-  return map;
+  return interpolate_paths (&copy_params);
 }
 
 // 1st pass: how large would the output be, given this input roi?
@@ -1181,12 +1422,6 @@ void modify_roi_in (struct dt_iop_module_t *module,
 
   *roi_in = *roi_out;
 
-  // copy params
-  dt_iop_liquify_params_t copy_params;
-  memcpy(&copy_params, (dt_iop_liquify_params_t*)piece->data, sizeof(dt_iop_liquify_params_t));
-
-  distort_paths_raw_to_piece (module, piece->pipe, roi_in->scale, &copy_params);
-
   cairo_rectangle_int_t pipe_rect = {
     0,
     0,
@@ -1203,7 +1438,7 @@ void modify_roi_in (struct dt_iop_module_t *module,
   cairo_region_t *roi_in_region = cairo_region_create_rectangle (&roi_in_rect);
 
   // get extent of all paths
-  GList *interpolated = interpolate_paths (&copy_params);
+  GList *interpolated = interpolate_piece_paths (module, piece, roi_in->scale);
   cairo_rectangle_int_t extent;
   _get_map_extent (roi_out, interpolated, &extent);
 
@@ -1226,41 +1461,23 @@ void modify_roi_in (struct dt_iop_module_t *module,
 
 static int _distort_xtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *points, size_t points_count, gboolean inverted)
 {
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
   const float scale = piece->iscale;
 
-  // compute the extent of all points (all computations are done in RAW coordinate)
-  float xmin=FLT_MAX, xmax=FLT_MIN, ymin=FLT_MAX, ymax=FLT_MIN;
+  // the map of all paths, all computations are done in RAW coordinate. the
+  // cached map serves any set of points, so it is not cut to their extent.
 
-  for(size_t i = 0; i < points_count * 2; i += 2)
-  {
-    const float x = points[i] * scale;
-    const float y = points[i + 1] * scale;
-    xmin = fmin (xmin, x);
-    xmax = fmax (xmax, x);
-    ymin = fmin (ymin, y);
-    ymax = fmax (ymax, y);
-  }
+  GList *interpolated = interpolate_paths (&d->params);
+  cairo_rectangle_int_t extent;
+  _get_map_extent (NULL, interpolated, &extent);
 
-  cairo_rectangle_int_t extent = { .x = (int)(xmin - .5), .y = (int)(ymin - .5),
-                                   .width = (int)(xmax - xmin + 2.5), .height = (int)(ymax - ymin + 2.5) };
+  dt_liquify_map_t *m = get_global_distortion_map (d, DT_LIQUIFY_MAP_DISTORT, interpolated, &extent, inverted,
+                                                   _pipe_patches_maps (piece->pipe), &extent);
+  g_list_free_full (interpolated, free);
 
-  if (extent.width != 0 && extent.height != 0)
+  if (m)
   {
-    // create the distortion map for this extent
-
-    GList *interpolated = interpolate_paths ((dt_iop_liquify_params_t *)piece->data);
-
-    // we need to adjust the extent to be the union enclosing all the points (currently in extent) and
-    // the warps that are in (possibly partly) in this same region.
-
-    dt_iop_roi_t roi_in = { .x = extent.x, .y = extent.y, .width = extent.width, .height = extent.height };
-    _get_map_extent (&roi_in, interpolated, &extent);
-
-    float complex *map = create_global_distortion_map (&extent, interpolated, inverted);
-    g_list_free_full (interpolated, free);
-
-    if (map == NULL) return 0;
-
+    const float complex *map = m->data;
     const int map_size =  extent.width * extent.height;
     const int x_last = extent.x + extent.width;
     const int y_last = extent.y + extent.height;
@@ -1281,8 +1498,7 @@ static int _distort_xtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
         *py += cimag(dist);
       }
     }
-
-    dt_free_align ((void *) map);
+    _map_release (d, m);
   }
 
   return 1;
@@ -1320,17 +1536,22 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cons
 
   // 2. build the distortion map
 
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  GList *interpolated = interpolate_piece_paths (module, piece, roi_in->scale);
   cairo_rectangle_int_t map_extent;
-  float complex *map = build_global_distortion_map (module, piece, roi_in, roi_out, &map_extent);
-  if (map == NULL)
-    return;
+  _get_map_extent (roi_out, interpolated, &map_extent);
 
-  // 3. apply the map
+  dt_liquify_map_t *map = get_global_distortion_map (d, DT_LIQUIFY_MAP_PIPE, interpolated, &map_extent, FALSE,
+                                                     _pipe_patches_maps (piece->pipe), &map_extent);
+  g_list_free_full (interpolated, free);
 
-  if (map_extent.width != 0 && map_extent.height != 0)
-    apply_global_distortion_map (module, piece, in, out, roi_in, roi_out, map, &map_extent);
+  // 3. apply the map
 
-  dt_free_align ((void *) map);
+  if (map)
+  {
+    apply_global_distortion_map (module, piece, in, out, roi_in, roi_out, map->data, &map_extent);
+    _map_release (d, map);
+  }
 }
 
 #ifdef HAVE_OPENCL
@@ -1490,17 +1711,23 @@ int process_cl (struct dt_iop_module_t *module,
 
   // 2. build the distortion map
 
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  GList *interpolated = interpolate_piece_paths (module, piece, roi_in->scale);
   cairo_rectangle_int_t map_extent;
-  const float complex *map = build_global_distortion_map (module, piece, roi_in, roi_out, &map_extent);
-  if (map == NULL)
-    return TRUE;
+  _get_map_extent (roi_out, interpolated, &map_extent);
 
-  // 3. apply the map
+  dt_liquify_map_t *map = get_global_distortion_map (d, DT_LIQUIFY_MAP_PIPE, interpolated, &map_extent, FALSE,
+                                                     _pipe_patches_maps (piece->pipe), &map_extent);
+  g_list_free_full (interpolated, free);
 
-  if (map_extent.width != 0 && map_extent.height != 0)
-    err = apply_global_distortion_map_cl (module, piece, dev_in, dev_out, roi_in, roi_out, map, &map_extent);
+  // 3. apply the map
 
-  dt_free_align ((void *) map);
+  if (map)
+  {
+    err = apply_global_distortion_map_cl (module, piece, dev_in, dev_out, roi_in, roi_out, map->data,
+                                          &map_extent);
+    _map_release (d, map);
+  }
   if (err != CL_SUCCESS) goto error;
 
   return TRUE;
@@ -1551,24 +1778,32 @@ void cleanup (dt_iop_module_t *module)
 
 void init_pipe (struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc (module->params_size);
+  dt_iop_liquify_data_t *d = calloc (1, sizeof (dt_iop_liquify_data_t));
+  dt_pthread_mutex_init (&d->lock, NULL);
+  piece->data = d;
   module->commit_params (module, module->default_params, pipe, piece);
 }
 
 void cleanup_pipe (struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  for (int k = 0; k < DT_LIQUIFY_MAP_SLOTS; k++)
+    _map_cache_clear (d->maps + k);
+  dt_pthread_mutex_destroy (&d->lock);
   free (piece->data);
   piece->data = NULL;
 }
 
-/* commit is the synch point between core and gui, so it copies params to pipe data. */
+/* commit is the synch point between core and gui, so it copies params to pipe data. the cached maps are
+   keyed by the warps they were built from, so they don't need to be invalidated here. */
 
 void commit_params (struct dt_iop_module_t *module,
                     dt_iop_params_t *params,
                     dt_dev_pixelpipe_t *pipe,
                     dt_dev_pixelpipe_iop_t *piece)
 {
-  memcpy (piece->data, params, module->params_size);
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  memcpy (&d->params, params, module->params_size);
 }
 
 // calculate the dot product of 2 vectors.
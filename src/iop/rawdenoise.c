@@ -22,9 +22,11 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/darktable.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
+#include "develop/tiling.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
@@ -32,6 +34,9 @@
 #include <gtk/gtk.h>
 #include <stdlib.h>
 #include <strings.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 DT_MODULE_INTROSPECTION(1, dt_iop_rawdenoise_params_t)
 
@@ -55,6 +60,12 @@ typedef struct dt_iop_rawdenoise_data_t
 
 typedef struct dt_iop_rawdenoise_global_data_t
 {
+  int kernel_rawdenoise_bayer_split;
+  int kernel_rawdenoise_xtrans_split;
+  int kernel_rawdenoise_hat_v;
+  int kernel_rawdenoise_hat_h;
+  int kernel_rawdenoise_bayer_merge;
+  int kernel_rawdenoise_xtrans_merge;
 } dt_iop_rawdenoise_global_data_t;
 
 const char *name()
@@ -64,7 +75,7 @@ const char *name()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
 }
 
 int groups()
@@ -112,11 +123,136 @@ static void hat_transform(float *temp, const float *const base, int stride, int
 
 #define BIT16 65536.0
 
+// levels of the wavelet decomposition. every one reaches twice as far as the one before,
+// all of them together 1 + 2 + ... + 16 pixels of a plane.
+#define WAVELET_LEVELS 5
+#define WAVELET_REACH ((1 << WAVELET_LEVELS) - 1)
+
+// note that these constants are the same for X-Trans and Bayer, as
+// they are proportional to image detail on each channel, not the
+// sensor pattern
+static const float noise[] = { 0.8002, 0.2735, 0.1202, 0.0585, 0.0291, 0.0152, 0.0080, 0.0044 };
+
+// one level of the decomposition of the plane at fimg + pass1: its hat transform at the
+// scale of the level through fimg + pass2 into fimg + pass3, with the soft thresholded
+// detail added to fimg.
+typedef void (*wavelet_level_t)(float *const fimg, const size_t pass1, const size_t pass2, const size_t pass3,
+                                const int width, const int height, const int lev, const float thold);
+
+static void wavelet_level(float *const fimg, const size_t pass1, const size_t pass2, const size_t pass3,
+                          const int width, const int height, const int lev, const float thold)
+{
+// filter vertically and transpose
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int col = 0; col < width; col++)
+    hat_transform(fimg + pass2 + (size_t)col * height, fimg + pass1 + col, width, height, 1 << lev);
+// filter horizontally and transpose back
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int row = 0; row < height; row++)
+    hat_transform(fimg + pass3 + (size_t)row * width, fimg + pass2 + row, height, width, 1 << lev);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(size_t i = 0; i < (size_t)width * height; i++)
+  {
+    float *fimgp = fimg + i;
+    const float diff = fimgp[pass1] - fimgp[pass3];
+    fimgp[0] += copysignf(fmaxf(fabsf(diff) - thold, 0.0f), diff);
+  }
+}
+
+#if defined(__SSE2__)
+// mirror at the first and last element without repeating them, as hat_transform() does
+static inline int mirror(int i, const int size)
+{
+  if(i < 0) i = -i;
+  if(i >= size) i = 2 * size - 2 - i;
+  return CLAMP(i, 0, size - 1);
+}
+
+// same as wavelet_level(), but the planes are filtered in place along the rows, four
+// pixels at a time, instead of column by column through transposed copies.
+static void wavelet_level_sse2(float *const fimg, const size_t pass1, const size_t pass2, const size_t pass3,
+                               const int width, const int height, const int lev, const float thold)
+{
+  const int sc = 1 << lev;
+  const __m128 quarter = _mm_set1_ps(0.25f);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int row = 0; row < height; row++)
+  {
+    const float *const in = fimg + pass1 + (size_t)row * width;
+    const float *const above = fimg + pass1 + (size_t)mirror(row - sc, height) * width;
+    const float *const below = fimg + pass1 + (size_t)mirror(row + sc, height) * width;
+    float *const out = fimg + pass2 + (size_t)row * width;
+    int col = 0;
+    for(; col + 4 <= width; col += 4)
+    {
+      const __m128 p = _mm_loadu_ps(in + col);
+      const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(p, p), _mm_loadu_ps(above + col)),
+                                    _mm_loadu_ps(below + col));
+      _mm_storeu_ps(out + col, _mm_mul_ps(sum, quarter));
+    }
+    for(; col < width; col++) out[col] = (in[col] * 2 + above[col] + below[col]) * 0.25f;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int row = 0; row < height; row++)
+  {
+    const float *const in = fimg + pass2 + (size_t)row * width;
+    float *const out = fimg + pass3 + (size_t)row * width;
+    int col = 0;
+    for(; col < MIN(sc, width); col++)
+      out[col] = (in[col] * 2 + in[mirror(col - sc, width)] + in[mirror(col + sc, width)]) * 0.25f;
+    for(; col + 4 <= width - sc; col += 4)
+    {
+      const __m128 p = _mm_loadu_ps(in + col);
+      const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(p, p), _mm_loadu_ps(in + col - sc)),
+                                    _mm_loadu_ps(in + col + sc));
+      _mm_storeu_ps(out + col, _mm_mul_ps(sum, quarter));
+    }
+    for(; col < width; col++)
+      out[col] = (in[col] * 2 + in[mirror(col - sc, width)] + in[mirror(col + sc, width)]) * 0.25f;
+  }
+
+  const __m128 thold4 = _mm_set1_ps(thold);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int row = 0; row < height; row++)
+  {
+    float *const fimgp = fimg + (size_t)row * width;
+    int col = 0;
+    for(; col + 4 <= width; col += 4)
+    {
+      const __m128 diff = _mm_sub_ps(_mm_loadu_ps(fimgp + pass1 + col), _mm_loadu_ps(fimgp + pass3 + col));
+      const __m128 shrunk = _mm_max_ps(_mm_sub_ps(_mm_andnot_ps(sign, diff), thold4), _mm_setzero_ps());
+      _mm_storeu_ps(fimgp + col,
+                    _mm_add_ps(_mm_loadu_ps(fimgp + col), _mm_or_ps(shrunk, _mm_and_ps(sign, diff))));
+    }
+    for(; col < width; col++)
+    {
+      const float diff = fimgp[pass1 + col] - fimgp[pass3 + col];
+      fimgp[col] += copysignf(fmaxf(fabsf(diff) - thold, 0.0f), diff);
+    }
+  }
+}
+#endif
+
 static void wavelet_denoise(const float *const in, float *const out, const dt_iop_roi_t *const roi,
-                            float threshold, uint32_t filters)
+                            float threshold, uint32_t filters, wavelet_level_t level)
 {
   int lev;
-  static const float noise[] = { 0.8002, 0.2735, 0.1202, 0.0585, 0.0291, 0.0152, 0.0080, 0.0044 };
 
   const size_t size = (size_t)(roi->width / 2 + 1) * (roi->height / 2 + 1);
 #if 0
@@ -153,41 +289,13 @@ static void wavelet_denoise(const float *const in, float *const out, const dt_io
 
     int lastpass;
 
-    for(lev = 0; lev < 5; lev++)
+    for(lev = 0; lev < WAVELET_LEVELS; lev++)
     {
       const size_t pass1 = size * ((lev & 1) * 2 + 1);
       const size_t pass2 = 2 * size;
       const size_t pass3 = 4 * size - pass1;
 
-// filter horizontally and transpose
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(lev) schedule(static)
-#endif
-      for(int col = 0; col < halfwidth; col++)
-      {
-        hat_transform(fimg + pass2 + (size_t)col * halfheight, fimg + pass1 + col, halfwidth, halfheight,
-                      1 << lev);
-      }
-// filter vertically and transpose back
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(lev) schedule(static)
-#endif
-      for(int row = 0; row < halfheight; row++)
-      {
-        hat_transform(fimg + pass3 + (size_t)row * halfwidth, fimg + pass2 + row, halfheight, halfwidth,
-                      1 << lev);
-      }
-
-      const float thold = threshold * noise[lev];
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(lev)
-#endif
-      for(size_t i = 0; i < (size_t)halfwidth * halfheight; i++)
-      {
-        float *fimgp = fimg + i;
-        const float diff = fimgp[pass1] - fimgp[pass3];
-        fimgp[0] += copysignf(fmaxf(fabsf(diff) - thold, 0.0f), diff);
-      }
+      level(fimg, pass1, pass2, pass3, halfwidth, halfheight, lev, threshold * noise[lev]);
 
       lastpass = pass3;
     }
@@ -249,13 +357,8 @@ static void wavelet_denoise(const float *const in, float *const out, const dt_io
 }
 
 static void wavelet_denoise_xtrans(const float *const in, float *out, const dt_iop_roi_t *const roi,
-                                   float threshold, const uint8_t (*const xtrans)[6])
+                                   float threshold, const uint8_t (*const xtrans)[6], wavelet_level_t level)
 {
-  // note that these constants are the same for X-Trans and Bayer, as
-  // they are proportional to image detail on each channel, not the
-  // sensor pattern
-  static const float noise[] = { 0.8002, 0.2735, 0.1202, 0.0585, 0.0291, 0.0152, 0.0080, 0.0044 };
-
   const int width = roi->width;
   const int height = roi->height;
   const size_t size = (size_t)width * height;
@@ -291,35 +394,13 @@ static void wavelet_denoise_xtrans(const float *const in, float *out, const dt_i
 
     int lastpass;
 
-    for(int lev = 0; lev < 5; lev++)
+    for(int lev = 0; lev < WAVELET_LEVELS; lev++)
     {
       const size_t pass1 = size * ((lev & 1) * 2 + 1);
       const size_t pass2 = 2 * size;
       const size_t pass3 = 4 * size - pass1;
 
-// filter horizontally and transpose
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(lev) schedule(static)
-#endif
-      for(int col = 0; col < width; col++)
-        hat_transform(fimg + pass2 + (size_t)col * height, fimg + pass1 + col, width, height, 1 << lev);
-// filter vertically and transpose back
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(lev) schedule(static)
-#endif
-      for(int row = 0; row < height; row++)
-        hat_transform(fimg + pass3 + (size_t)row * width, fimg + pass2 + row, height, width, 1 << lev);
-
-      const float thold = threshold * noise[lev];
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(lev)
-#endif
-      for(size_t i = 0; i < size; i++)
-      {
-        float *fimgp = fimg + i;
-        const float diff = fimgp[pass1] - fimgp[pass3];
-        fimgp[0] += copysignf(fmaxf(fabsf(diff) - thold, 0.0f), diff);
-      }
+      level(fimg, pass1, pass2, pass3, width, height, lev, threshold * noise[lev]);
 
       lastpass = pass3;
     }
@@ -360,11 +441,193 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     const uint32_t filters = piece->pipe->dsc.filters;
     const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])piece->pipe->dsc.xtrans;
     if (filters != 9u)
-      wavelet_denoise(ivoid, ovoid, roi_in, d->threshold, filters);
+      wavelet_denoise(ivoid, ovoid, roi_in, d->threshold, filters, wavelet_level);
+    else
+      wavelet_denoise_xtrans(ivoid, ovoid, roi_in, d->threshold, xtrans, wavelet_level);
+  }
+}
+
+#if defined(__SSE2__)
+void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_rawdenoise_data_t *d = (dt_iop_rawdenoise_data_t *)piece->data;
+
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  if(!(d->threshold > 0.0f))
+  {
+    memcpy(ovoid, ivoid, (size_t)sizeof(float) * width * height);
+  }
+  else
+  {
+    const uint32_t filters = piece->pipe->dsc.filters;
+    const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])piece->pipe->dsc.xtrans;
+    if(filters != 9u)
+      wavelet_denoise(ivoid, ovoid, roi_in, d->threshold, filters, wavelet_level_sse2);
     else
-      wavelet_denoise_xtrans(ivoid, ovoid, roi_in, d->threshold, xtrans);
+      wavelet_denoise_xtrans(ivoid, ovoid, roi_in, d->threshold, xtrans, wavelet_level_sse2);
   }
 }
+#endif
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_rawdenoise_data_t *d = (dt_iop_rawdenoise_data_t *)piece->data;
+  dt_iop_rawdenoise_global_data_t *gd = (dt_iop_rawdenoise_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_xtrans = NULL;
+  cl_mem dev_plane[3] = { NULL, NULL, NULL };
+  cl_mem dev_acc[2] = { NULL, NULL };
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const uint32_t filters = piece->pipe->dsc.filters;
+
+  if(!(d->threshold > 0.0f))
+  {
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { width, height, 1 };
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  // the bayer sites are denoised as four half sized planes, x-trans colours as three full sized ones
+  const int xtrans = filters == 9u;
+  const int pwidth = xtrans ? width : (width + 1) / 2;
+  const int pheight = xtrans ? height : (height + 1) / 2;
+
+  if(xtrans)
+  {
+    dev_xtrans
+        = dt_opencl_copy_host_to_device_constant(devid, sizeof(piece->pipe->dsc.xtrans), piece->pipe->dsc.xtrans);
+    if(dev_xtrans == NULL) goto error;
+  }
+  for(int k = 0; k < 3; k++)
+    if((dev_plane[k] = dt_opencl_alloc_device(devid, pwidth, pheight, sizeof(float))) == NULL) goto error;
+  for(int k = 0; k < 2; k++)
+    if((dev_acc[k] = dt_opencl_alloc_device(devid, pwidth, pheight, sizeof(float))) == NULL) goto error;
+
+  for(int c = 0; c < (xtrans ? 3 : 4); c++)
+  {
+    // sites of this plane in the bayer pattern, see wavelet_denoise()
+    const int cx = (c & 2) >> 1;
+    const int cy = c & 1;
+    const int cwidth = xtrans ? width : width / 2 + (width & (~(c >> 1)) & 1);
+    const int cheight = xtrans ? height : height / 2 + (height & (~c) & 1);
+    size_t sizes[] = { ROUNDUPWD(cwidth), ROUNDUPHT(cheight), 1 };
+
+    // the input of the next level and the accumulated detail are swapped around with every level
+    int in = 0, acc = 0;
+    const int kernel_split = xtrans ? gd->kernel_rawdenoise_xtrans_split : gd->kernel_rawdenoise_bayer_split;
+    dt_opencl_set_kernel_arg(devid, kernel_split, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, kernel_split, 1, sizeof(cl_mem), (void *)&dev_plane[in]);
+    dt_opencl_set_kernel_arg(devid, kernel_split, 2, sizeof(cl_mem), (void *)&dev_acc[acc]);
+    dt_opencl_set_kernel_arg(devid, kernel_split, 3, sizeof(int), (void *)&cwidth);
+    dt_opencl_set_kernel_arg(devid, kernel_split, 4, sizeof(int), (void *)&cheight);
+    if(xtrans)
+    {
+      dt_opencl_set_kernel_arg(devid, kernel_split, 5, sizeof(int), (void *)&c);
+      dt_opencl_set_kernel_arg(devid, kernel_split, 6, sizeof(int), (void *)&roi_in->x);
+      dt_opencl_set_kernel_arg(devid, kernel_split, 7, sizeof(int), (void *)&roi_in->y);
+      dt_opencl_set_kernel_arg(devid, kernel_split, 8, sizeof(cl_mem), (void *)&dev_xtrans);
+    }
+    else
+    {
+      dt_opencl_set_kernel_arg(devid, kernel_split, 5, sizeof(int), (void *)&cx);
+      dt_opencl_set_kernel_arg(devid, kernel_split, 6, sizeof(int), (void *)&cy);
+    }
+    err = dt_opencl_enqueue_kernel_2d(devid, kernel_split, sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    for(int lev = 0; lev < WAVELET_LEVELS; lev++)
+    {
+      const int out = 2 - in;
+      const int scale = 1 << lev;
+      const float thold = d->threshold * noise[lev];
+
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_v, 0, sizeof(cl_mem), (void *)&dev_plane[in]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_v, 1, sizeof(cl_mem), (void *)&dev_plane[1]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_v, 2, sizeof(int), (void *)&cwidth);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_v, 3, sizeof(int), (void *)&cheight);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_v, 4, sizeof(int), (void *)&scale);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_hat_v, sizes);
+      if(err != CL_SUCCESS) goto error;
+
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 0, sizeof(cl_mem), (void *)&dev_plane[1]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 1, sizeof(cl_mem), (void *)&dev_plane[in]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 2, sizeof(cl_mem), (void *)&dev_acc[acc]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 3, sizeof(cl_mem), (void *)&dev_plane[out]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 4, sizeof(cl_mem), (void *)&dev_acc[1 - acc]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 5, sizeof(int), (void *)&cwidth);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 6, sizeof(int), (void *)&cheight);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 7, sizeof(int), (void *)&scale);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat_h, 8, sizeof(float), (void *)&thold);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_hat_h, sizes);
+      if(err != CL_SUCCESS) goto error;
+
+      in = out;
+      acc = 1 - acc;
+    }
+
+    const int kernel_merge = xtrans ? gd->kernel_rawdenoise_xtrans_merge : gd->kernel_rawdenoise_bayer_merge;
+    dt_opencl_set_kernel_arg(devid, kernel_merge, 0, sizeof(cl_mem), (void *)&dev_acc[acc]);
+    dt_opencl_set_kernel_arg(devid, kernel_merge, 1, sizeof(cl_mem), (void *)&dev_plane[in]);
+    dt_opencl_set_kernel_arg(devid, kernel_merge, 2, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, kernel_merge, 3, sizeof(int), (void *)&cwidth);
+    dt_opencl_set_kernel_arg(devid, kernel_merge, 4, sizeof(int), (void *)&cheight);
+    if(xtrans)
+    {
+      dt_opencl_set_kernel_arg(devid, kernel_merge, 5, sizeof(int), (void *)&c);
+      dt_opencl_set_kernel_arg(devid, kernel_merge, 6, sizeof(int), (void *)&roi_in->x);
+      dt_opencl_set_kernel_arg(devid, kernel_merge, 7, sizeof(int), (void *)&roi_in->y);
+      dt_opencl_set_kernel_arg(devid, kernel_merge, 8, sizeof(cl_mem), (void *)&dev_xtrans);
+    }
+    else
+    {
+      dt_opencl_set_kernel_arg(devid, kernel_merge, 5, sizeof(int), (void *)&cx);
+      dt_opencl_set_kernel_arg(devid, kernel_merge, 6, sizeof(int), (void *)&cy);
+    }
+    err = dt_opencl_enqueue_kernel_2d(devid, kernel_merge, sizes);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  for(int k = 0; k < 3; k++) dt_opencl_release_mem_object(dev_plane[k]);
+  for(int k = 0; k < 2; k++) dt_opencl_release_mem_object(dev_acc[k]);
+  dt_opencl_release_mem_object(dev_xtrans);
+  return TRUE;
+
+error:
+  for(int k = 0; k < 3; k++) dt_opencl_release_mem_object(dev_plane[k]);
+  for(int k = 0; k < 2; k++) dt_opencl_release_mem_object(dev_acc[k]);
+  dt_opencl_release_mem_object(dev_xtrans);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_rawdenoise] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  const int xtrans = piece->pipe->dsc.filters == 9u;
+  // input and output, plus the planes of the decomposition: four on the cpu, five on the gpu.
+  // bayer planes are a quarter of the image.
+  const float plane = xtrans ? 1.0f : 0.25f;
+  tiling->factor = 2.0f + plane * (piece->pipe->devid >= 0 ? 5 : 4);
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = 0;
+  // the wavelet levels reach WAVELET_REACH pixels of a plane. bayer planes are half sized, and
+  // x-trans ones are filled in from one pixel further. tiles start on the cfa pattern.
+  tiling->overlap = xtrans ? WAVELET_REACH + 1 : 2 * WAVELET_REACH + 2;
+  tiling->xalign = xtrans ? 6 : 2;
+  tiling->yalign = xtrans ? 6 : 2;
+}
 
 void reload_defaults(dt_iop_module_t *module)
 {
@@ -386,9 +649,35 @@ end:
   memcpy(module->default_params, &tmp, sizeof(dt_iop_rawdenoise_params_t));
 }
 
-void init(dt_iop_module_t *module)
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 26; // rawdenoise.cl, from programs.conf
+  dt_iop_rawdenoise_global_data_t *gd
+      = (dt_iop_rawdenoise_global_data_t *)malloc(sizeof(dt_iop_rawdenoise_global_data_t));
+  module->data = gd;
+  gd->kernel_rawdenoise_bayer_split = dt_opencl_create_kernel(program, "rawdenoise_bayer_split");
+  gd->kernel_rawdenoise_xtrans_split = dt_opencl_create_kernel(program, "rawdenoise_xtrans_split");
+  gd->kernel_rawdenoise_hat_v = dt_opencl_create_kernel(program, "rawdenoise_hat_v");
+  gd->kernel_rawdenoise_hat_h = dt_opencl_create_kernel(program, "rawdenoise_hat_h");
+  gd->kernel_rawdenoise_bayer_merge = dt_opencl_create_kernel(program, "rawdenoise_bayer_merge");
+  gd->kernel_rawdenoise_xtrans_merge = dt_opencl_create_kernel(program, "rawdenoise_xtrans_merge");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
 {
+  dt_iop_rawdenoise_global_data_t *gd = (dt_iop_rawdenoise_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_bayer_split);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_xtrans_split);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_hat_v);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_hat_h);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_bayer_merge);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_xtrans_merge);
+  free(module->data);
   module->data = NULL;
+}
+
+void init(dt_iop_module_t *module)
+{
   module->params = calloc(1, sizeof(dt_iop_rawdenoise_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_rawdenoise_params_t));
   module->default_enabled = 0;
@@ -403,8 +692,6 @@ void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
   module->params = NULL;
-  free(module->data);
-  module->data = NULL;
 }
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
@@ -154,51 +154,59 @@ void init_presets(dt_iop_module_so_t *self)
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
 }
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const i,
+                    float *const o, const size_t npixels)
+{
+  dt_iop_splittoning_data_t *data = (dt_iop_splittoning_data_t *)piece->data;
+
+  const float compress = (data->compress / 110.0) / 2.0; // Dont allow 100% compression..
+
+  for(size_t j = 0; j < npixels; j++)
+  {
+    const float *in = i + 4 * j;
+    float *out = o + 4 * j;
+
+    double ra, la;
+    float mixrgb[3];
+    float h, s, l;
+    rgb2hsl(in, &h, &s, &l);
+    if(l < data->balance - compress || l > data->balance + compress)
+    {
+      h = l < data->balance ? data->shadow_hue : data->highlight_hue;
+      s = l < data->balance ? data->shadow_saturation : data->highlight_saturation;
+      ra = l < data->balance ? CLIP((fabs(-data->balance + compress + l) * 2.0))
+                             : CLIP((fabs(-data->balance - compress + l) * 2.0));
+      la = (1.0 - ra);
+
+      hsl2rgb(mixrgb, h, s, l);
+
+      out[0] = CLIP(in[0] * la + mixrgb[0] * ra);
+      out[1] = CLIP(in[1] * la + mixrgb[1] * ra);
+      out[2] = CLIP(in[2] * la + mixrgb[2] * ra);
+    }
+    else
+    {
+      out[0] = in[0];
+      out[1] = in[1];
+      out[2] = in[2];
+    }
+
+    out[3] = in[3];
+  }
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_splittoning_data_t *data = (dt_iop_splittoning_data_t *)piece->data;
-  float *in;
-  float *out;
   const int ch = piece->colors;
 
-  const float compress = (data->compress / 110.0) / 2.0; // Dont allow 100% compression..
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(data) private(in, out) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
   for(int k = 0; k < roi_out->height; k++)
   {
-    in = ((float *)ivoid) + (size_t)ch * k * roi_out->width;
-    out = ((float *)ovoid) + (size_t)ch * k * roi_out->width;
-    for(int j = 0; j < roi_out->width; j++, in += ch, out += ch)
-    {
-      double ra, la;
-      float mixrgb[3];
-      float h, s, l;
-      rgb2hsl(in, &h, &s, &l);
-      if(l < data->balance - compress || l > data->balance + compress)
-      {
-        h = l < data->balance ? data->shadow_hue : data->highlight_hue;
-        s = l < data->balance ? data->shadow_saturation : data->highlight_saturation;
-        ra = l < data->balance ? CLIP((fabs(-data->balance + compress + l) * 2.0))
-                               : CLIP((fabs(-data->balance - compress + l) * 2.0));
-        la = (1.0 - ra);
-
-        hsl2rgb(mixrgb, h, s, l);
-
-        out[0] = CLIP(in[0] * la + mixrgb[0] * ra);
-        out[1] = CLIP(in[1] * la + mixrgb[1] * ra);
-        out[2] = CLIP(in[2] * la + mixrgb[2] * ra);
-      }
-      else
-      {
-        out[0] = in[0];
-        out[1] = in[1];
-        out[2] = in[2];
-      }
-
-      out[3] = in[3];
-    }
+    const size_t offs = (size_t)ch * k * roi_out->width;
+    process_pixels(self, piece, (const float *)ivoid + offs, (float *)ovoid + offs, roi_out->width);
   }
 }
 
@@ -18,11 +18,13 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include "common/opencl.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
 #include "develop/masks.h"
+#include "develop/tiling.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
@@ -46,7 +48,48 @@ typedef struct dt_iop_spots_gui_data_t
   GtkWidget *bt_path, *bt_circle, *bt_ellipse;
 } dt_iop_spots_gui_data_t;
 
-typedef struct dt_iop_spots_params_t dt_iop_spots_data_t;
+// number of masks a pipe keeps between runs, and the memory they may take
+#define SPOTS_CACHE_ENTRIES 64
+#define SPOTS_CACHE_BYTES ((size_t)128 << 20)
+
+typedef struct dt_iop_spots_mask_t
+{
+  uint64_t hash;  // of the form, the distortions before us and the pipe dimensions. 0 if the entry is free
+  uint64_t stamp; // run of the pipe that last used the mask
+  float *mask;
+  int width, height, posx, posy;
+} dt_iop_spots_mask_t;
+
+typedef struct dt_iop_spots_data_t
+{
+  int clone_id[64];
+  int clone_algo[64];
+  // masks only change with their form but take long to compute, so they are kept across runs
+  dt_iop_spots_mask_t cache[SPOTS_CACHE_ENTRIES];
+  size_t cache_bytes;
+  uint64_t stamp;
+} dt_iop_spots_data_t;
+
+typedef struct dt_iop_spots_global_data_t
+{
+  int kernel_spots_clone;
+} dt_iop_spots_global_data_t;
+
+// a spot as it is blended into the output: the part of the destination which is in roi_out and has its
+// source in roi_in, with a weight for every pixel of it
+typedef struct dt_iop_spots_spot_t
+{
+  int x, y, width, height; // destination, in the coordinates of roi_out
+  int dx, dy;              // from source to destination
+  size_t weights;          // offset of the weights in the buffer shared by all spots
+  int wave;                // spots of a wave don't overlap, they can be blended at the same time
+  // where the weights come from: a mask with its position (in full size coordinates) and size, or for the
+  // circle clone a smooth filter around the position of the circle
+  const float *mask;
+  float *mask_owned; // if the mask did not go to the cache
+  int mask_x, mask_y, mask_width;
+  int circle_x, circle_y, radius;
+} dt_iop_spots_spot_t;
 
 // this returns a translatable name
 const char *name()
@@ -61,7 +104,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_MASKS;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_NO_MASKS | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
@@ -358,53 +401,139 @@ static int masks_get_delta(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
   return res;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
-             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+static uint64_t _mask_hash(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form)
 {
-  dt_iop_spots_params_t *d = (dt_iop_spots_params_t *)piece->data;
-  dt_develop_blend_params_t *bp = self->blend_params;
+  // the mask is in full size coordinates of our input, so it depends on the distortions before us
+  uint64_t hash = dt_dev_hash_distort_plus(self->dev, piece->pipe, 0, self->priority);
+  hash = ((hash << 5) + hash) ^ piece->pipe->iwidth;
+  hash = ((hash << 5) + hash) ^ piece->pipe->iheight;
+
+  const int length = dt_masks_group_get_hash_buffer_length(form);
+  char *str = malloc(length);
+  dt_masks_group_get_hash_buffer(form, str);
+  for(int i = 0; i < length; i++) hash = ((hash << 5) + hash) ^ str[i];
+  free(str);
+
+  return hash ? hash : 1;
+}
 
-  const int ch = piece->colors;
-  const float *in = (float *)i;
-  float *out = (float *)o;
+// the mask of the form, from the cache of the piece if it is there. masks which can't be cached are
+// returned in *owned and have to be freed by the caller.
+static const float *_get_mask(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
+                              int *width, int *height, int *posx, int *posy, float **owned)
+{
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  const uint64_t hash = _mask_hash(self, piece, form);
+  *owned = NULL;
 
-// we don't modify most of the image:
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(out, in)
-#endif
-  for(int k = 0; k < roi_out->height; k++)
+  for(int k = 0; k < SPOTS_CACHE_ENTRIES; k++)
   {
-    float *outb = out + (size_t)ch * k * roi_out->width;
-    const float *inb = in + (size_t)ch * roi_in->width * (k + roi_out->y - roi_in->y)
-                       + ch * (roi_out->x - roi_in->x);
-    memcpy(outb, inb, sizeof(float) * roi_out->width * ch);
+    dt_iop_spots_mask_t *e = d->cache + k;
+    if(e->hash != hash) continue;
+    e->stamp = d->stamp;
+    *width = e->width, *height = e->height, *posx = e->posx, *posy = e->posy;
+    return e->mask;
   }
 
-  // iterate through all forms
+  float *mask = NULL;
+  if(!dt_masks_get_mask(self, piece, form, &mask, width, height, posx, posy) || !mask)
+  {
+    free(mask);
+    return NULL;
+  }
+
+  // make room, least recently used first. masks of this run are in use by its spots and have to stay.
+  const size_t bytes = sizeof(float) * (*width) * (*height);
+  int slot = -1;
+  while(bytes <= SPOTS_CACHE_BYTES)
+  {
+    int free_slot = -1, lru = -1;
+    for(int k = 0; k < SPOTS_CACHE_ENTRIES; k++)
+    {
+      const dt_iop_spots_mask_t *e = d->cache + k;
+      if(!e->hash)
+        free_slot = k;
+      else if(e->stamp != d->stamp && (lru < 0 || e->stamp < d->cache[lru].stamp))
+        lru = k;
+    }
+    if(free_slot >= 0 && d->cache_bytes + bytes <= SPOTS_CACHE_BYTES)
+    {
+      slot = free_slot;
+      break;
+    }
+    if(lru < 0) break;
+    d->cache_bytes -= sizeof(float) * d->cache[lru].width * d->cache[lru].height;
+    free(d->cache[lru].mask);
+    memset(d->cache + lru, 0, sizeof(dt_iop_spots_mask_t));
+  }
+
+  if(slot < 0)
+  {
+    *owned = mask;
+    return mask;
+  }
+
+  d->cache[slot] = (dt_iop_spots_mask_t){ hash, d->stamp, mask, *width, *height, *posx, *posy };
+  d->cache_bytes += bytes;
+  return mask;
+}
+
+static inline float _circle_filter(const int k, const int rad)
+{
+  if(rad <= 0) return 1.0f;
+  const float kk = 1.0f - fabsf(k / (float)rad);
+  return kk * kk * (3.0f - 2.0f * kk);
+}
+
+// clip the destination [x0, x1[ x [y0, y1[ of a spot to roi_out and its source to roi_in
+static int _clip_spot(dt_iop_spots_spot_t *spot, int x0, int y0, int x1, int y1, const dt_iop_roi_t *roi_in,
+                      const dt_iop_roi_t *roi_out)
+{
+  x0 = MAX(x0, MAX(roi_out->x, roi_in->x + spot->dx));
+  y0 = MAX(y0, MAX(roi_out->y, roi_in->y + spot->dy));
+  x1 = MIN(x1, MIN(roi_out->x + roi_out->width, roi_in->x + roi_in->width + spot->dx));
+  y1 = MIN(y1, MIN(roi_out->y + roi_out->height, roi_in->y + roi_in->height + spot->dy));
+  spot->x = x0 - roi_out->x;
+  spot->y = y0 - roi_out->y;
+  spot->width = x1 - x0;
+  spot->height = y1 - y0;
+  return spot->width > 0 && spot->height > 0;
+}
+
+static void _free_spots(dt_iop_spots_spot_t *spots, const int count)
+{
+  for(int k = 0; k < count; k++) free(spots[k].mask_owned);
+}
+
+// find the spots which touch roi_out, in the order of the forms, and the weights to blend them with.
+// returns the number of spots, or -1 if out of memory.
+static int _get_spots(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in,
+                      const dt_iop_roi_t *roi_out, dt_iop_spots_spot_t *spots, float **weights, int *waves)
+{
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  dt_develop_blend_params_t *bp = self->blend_params;
+  int count = 0;
+  *weights = NULL;
+  *waves = 0;
+  d->stamp++;
+
+  // the forms and the distortions are not thread safe, get everything we need from them first
   dt_masks_form_t *grp = dt_masks_get_from_id(self->dev, bp->mask_id);
-  int pos = 0;
   if(grp && (grp->type & DT_MASKS_GROUP))
   {
     GList *forms = g_list_first(grp->points);
-    while((pos < 64) && forms)
+    for(int pos = 0; pos < 64 && forms; pos++, forms = g_list_next(forms))
     {
       dt_masks_point_group_t *grpt = (dt_masks_point_group_t *)forms->data;
       // we get the spot
       dt_masks_form_t *form = dt_masks_get_from_id(self->dev, grpt->formid);
-      if(!form)
-      {
-        forms = g_list_next(forms);
-        pos++;
-        continue;
-      }
+      if(!form) continue;
 
       // if the form is outside the roi, we just skip it
-      if(!masks_form_is_in_roi(self, piece, form, roi_in, roi_out))
-      {
-        forms = g_list_next(forms);
-        pos++;
-        continue;
-      }
+      if(!masks_form_is_in_roi(self, piece, form, roi_in, roi_out)) continue;
+
+      dt_iop_spots_spot_t *spot = spots + count;
+      memset(spot, 0, sizeof(dt_iop_spots_spot_t));
 
       if(d->clone_algo[pos] == 1 && (form->type & DT_MASKS_CIRCLE))
       {
@@ -414,12 +543,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         masks_point_denormalize(piece, roi_in, circle->center, 1, points);
         masks_point_denormalize(piece, roi_in, form->source, 1, points + 2);
 
-        if(!dt_dev_distort_transform_plus(self->dev, piece->pipe, 0, self->priority, points, 2))
-        {
-          forms = g_list_next(forms);
-          pos++;
-          continue;
-        }
+        if(!dt_dev_distort_transform_plus(self->dev, piece->pipe, 0, self->priority, points, 2)) continue;
 
         // convert from world space:
         float radius10[2] = { circle->radius, circle->radius };
@@ -431,108 +555,298 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         const int posy = points[1] - rad;
         const int posx_source = points[2] - rad;
         const int posy_source = points[3] - rad;
-        const int dx = posx - posx_source;
-        const int dy = posy - posy_source;
-        const int fw = 2 * rad, fh = 2 * rad;
+        spot->dx = posx - posx_source;
+        spot->dy = posy - posy_source;
+        spot->circle_x = posx;
+        spot->circle_y = posy;
+        spot->radius = rad;
 
-        float *filter = malloc((2 * rad + 1) * sizeof(float));
-
-        if(rad > 0)
-        {
-          for(int k = -rad; k <= rad; k++)
-          {
-            const float kk = 1.0f - fabsf(k / (float)rad);
-            filter[rad + k] = kk * kk * (3.0f - 2.0f * kk);
-          }
-        }
-        else
-        {
-          filter[0] = 1.0f;
-        }
-
-        for(int yy = posy; yy < posy + fh; yy++)
-        {
-          // we test if we are inside roi_out
-          if(yy < roi_out->y || yy >= roi_out->y + roi_out->height) continue;
-          // we test if the source point is inside roi_in
-          if(yy - dy < roi_in->y || yy - dy >= roi_in->y + roi_in->height) continue;
-          for(int xx = posx; xx < posx + fw; xx++)
-          {
-            // we test if we are inside roi_out
-            if(xx < roi_out->x || xx >= roi_out->x + roi_out->width) continue;
-            // we test if the source point is inside roi_in
-            if(xx - dx < roi_in->x || xx - dx >= roi_in->x + roi_in->width) continue;
-
-            const float f = filter[xx - posx + 1] * filter[yy - posy + 1];
-            for(int c = 0; c < ch; c++)
-              out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c]
-                  = out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c] * (1.0f - f)
-                    + in[4 * ((size_t)roi_in->width * (yy - posy + posy_source - roi_in->y) + xx - posx
-                              + posx_source - roi_in->x) + c] * f;
-          }
-        }
-
-        free(filter);
+        if(!_clip_spot(spot, posx, posy, posx + 2 * rad, posy + 2 * rad, roi_in, roi_out)) continue;
       }
       else
       {
         // we get the mask
-        float *mask = NULL;
         int posx, posy, width, height;
-        dt_masks_get_mask(self, piece, form, &mask, &width, &height, &posx, &posy);
-        int fts = posy * roi_in->scale, fhs = height * roi_in->scale, fls = posx * roi_in->scale,
-            fws = width * roi_in->scale;
-        int dx = 0, dy = 0;
-
-        // now we search the delta with the source
-        if(!masks_get_delta(self, piece, roi_in, form, &dx, &dy))
+        spot->mask = _get_mask(self, piece, form, &width, &height, &posx, &posy, &spot->mask_owned);
+        if(!spot->mask) continue;
+        const int fts = posy * roi_in->scale, fhs = height * roi_in->scale, fls = posx * roi_in->scale,
+                  fws = width * roi_in->scale;
+        spot->mask_x = fls;
+        spot->mask_y = fts;
+        spot->mask_width = width;
+
+        // now we search the delta with the source, without it there is nothing to clone
+        if(!masks_get_delta(self, piece, roi_in, form, &spot->dx, &spot->dy) || (spot->dx == 0 && spot->dy == 0)
+           || !_clip_spot(spot, fls + 1, fts + 1, fls + fws - 1, fts + fhs - 1, roi_in, roi_out))
         {
-          forms = g_list_next(forms);
-          pos++;
-          free(mask);
-
+          free(spot->mask_owned);
           continue;
         }
+      }
+      count++;
+    }
+  }
 
-        if(dx != 0 || dy != 0)
-        {
-          // now we do the pixel clone
-          for(int yy = fts + 1; yy < fts + fhs - 1; yy++)
-          {
-            // we test if we are inside roi_out
-            if(yy < roi_out->y || yy >= roi_out->y + roi_out->height) continue;
-            // we test if the source point is inside roi_in
-            if(yy - dy < roi_in->y || yy - dy >= roi_in->y + roi_in->height) continue;
-            for(int xx = fls + 1; xx < fls + fws - 1; xx++)
-            {
-              // we test if we are inside roi_out
-              if(xx < roi_out->x || xx >= roi_out->x + roi_out->width) continue;
-              // we test if the source point is inside roi_in
-              if(xx - dx < roi_in->x || xx - dx >= roi_in->x + roi_in->width) continue;
-
-              float f = mask[((int)((yy - fts) / roi_in->scale)) * width
-                             + (int)((xx - fls) / roi_in->scale)]; // we can add the opacity here
-
-              for(int c = 0; c < ch; c++)
-                out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c]
-                    = out[4 * ((size_t)roi_out->width * (yy - roi_out->y) + xx - roi_out->x) + c] * (1.0f - f)
-                      + in[4 * ((size_t)roi_in->width * (yy - dy - roi_in->y) + xx - dx - roi_in->x) + c] * f;
-            }
-          }
-        }
-        free(mask);
+  if(count == 0) return 0;
+
+  // a spot has to wait for the earlier ones it overlaps. everything else only reads the input, so the
+  // spots of a wave can go in any order.
+  size_t size = 0;
+  for(int k = 0; k < count; k++)
+  {
+    dt_iop_spots_spot_t *spot = spots + k;
+    spot->weights = size;
+    size += (size_t)spot->width * spot->height;
+    spot->wave = 0;
+    for(int j = 0; j < k; j++)
+    {
+      const dt_iop_spots_spot_t *other = spots + j;
+      if(other->x < spot->x + spot->width && spot->x < other->x + other->width
+         && other->y < spot->y + spot->height && spot->y < other->y + other->height)
+        spot->wave = MAX(spot->wave, other->wave + 1);
+    }
+    *waves = MAX(*waves, spot->wave + 1);
+  }
+
+  *weights = dt_alloc_align(64, sizeof(float) * size);
+  if(*weights == NULL)
+  {
+    _free_spots(spots, count);
+    return -1;
+  }
+
+  float *const w = *weights;
+  const float scale = roi_in->scale;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for(int k = 0; k < count; k++)
+  {
+    const dt_iop_spots_spot_t *spot = spots + k;
+    for(int j = 0; j < spot->height; j++)
+    {
+      float *const wj = w + spot->weights + (size_t)j * spot->width;
+      const int yy = spot->y + j + roi_out->y;
+      for(int i = 0; i < spot->width; i++)
+      {
+        const int xx = spot->x + i + roi_out->x;
+        if(spot->mask)
+          wj[i] = spot->mask[((int)((yy - spot->mask_y) / scale)) * spot->mask_width
+                             + (int)((xx - spot->mask_x) / scale)]; // we can add the opacity here
+        else
+          wj[i] = _circle_filter(xx - spot->circle_x + 1 - spot->radius, spot->radius)
+                  * _circle_filter(yy - spot->circle_y + 1 - spot->radius, spot->radius);
       }
-      pos++;
-      forms = g_list_next(forms);
     }
   }
+
+  return count;
+}
+
+static inline void _clone_row(const dt_iop_spots_spot_t *const spot, const int j, const float *const in,
+                              float *const out, const float *const weights, const dt_iop_roi_t *const roi_in,
+                              const dt_iop_roi_t *const roi_out, const int ch)
+{
+  const int yy = spot->y + j;
+  const int xx = spot->x;
+  const float *const w = weights + spot->weights + (size_t)j * spot->width;
+  float *const o = out + (size_t)ch * ((size_t)roi_out->width * yy + xx);
+  const float *const i = in + (size_t)ch * ((size_t)roi_in->width * (yy + roi_out->y - spot->dy - roi_in->y)
+                                            + xx + roi_out->x - spot->dx - roi_in->x);
+  for(int k = 0; k < spot->width; k++)
+  {
+    const float f = w[k];
+    for(int c = 0; c < ch; c++) o[ch * k + c] = o[ch * k + c] * (1.0f - f) + i[ch * k + c] * f;
+  }
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
+             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+  const float *in = (float *)i;
+  float *out = (float *)o;
+
+// we don't modify most of the image:
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(out, in)
+#endif
+  for(int k = 0; k < roi_out->height; k++)
+  {
+    float *outb = out + (size_t)ch * k * roi_out->width;
+    const float *inb = in + (size_t)ch * roi_in->width * (k + roi_out->y - roi_in->y)
+                       + ch * (roi_out->x - roi_in->x);
+    memcpy(outb, inb, sizeof(float) * roi_out->width * ch);
+  }
+
+  dt_iop_spots_spot_t spots[64];
+  float *weights = NULL;
+  int waves = 0;
+  const int count = _get_spots(self, piece, roi_in, roi_out, spots, &weights, &waves);
+  if(count < 0)
+  {
+    fprintf(stderr, "[spots] not able to allocate the weights of the spots\n");
+    return;
+  }
+
+  // the rows of all spots of a wave are independent, spread them over the threads
+  for(int wave = 0; wave < waves; wave++)
+  {
+    int index[64], rows[65];
+    int n = 0;
+    rows[0] = 0;
+    for(int k = 0; k < count; k++)
+      if(spots[k].wave == wave)
+      {
+        index[n] = k;
+        rows[n + 1] = rows[n] + spots[k].height;
+        n++;
+      }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+    for(int r = 0; r < rows[n]; r++)
+    {
+      int s = 0;
+      while(rows[s + 1] <= r) s++;
+      _clone_row(spots + index[s], r - rows[s], in, out, weights, roi_in, roi_out, ch);
+    }
+  }
+
+  _free_spots(spots, count);
+  dt_free_align(weights);
+}
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_tmp = NULL;
+  cl_mem dev_weights = NULL;
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  dt_iop_spots_spot_t spots[64];
+  float *weights = NULL;
+  int waves = 0;
+  const int count = _get_spots(self, piece, roi_in, roi_out, spots, &weights, &waves);
+  if(count < 0) goto error;
+
+  // we don't modify most of the image:
+  size_t iorigin[] = { roi_out->x - roi_in->x, roi_out->y - roi_in->y, 0 };
+  size_t oorigin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+  err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, iorigin, oorigin, region);
+  if(err != CL_SUCCESS) goto error;
+
+  if(count > 0)
+  {
+    // the spots blend the output as it is so far, from a copy of it
+    const dt_iop_spots_spot_t *last = spots + count - 1;
+    const size_t size = last->weights + (size_t)last->width * last->height;
+    dev_tmp = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+    dev_weights = dt_opencl_alloc_device_buffer(devid, sizeof(float) * size);
+    if(dev_tmp == NULL || dev_weights == NULL) goto error;
+
+    err = dt_opencl_write_buffer_to_device(devid, weights, dev_weights, 0, sizeof(float) * size, CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+    err = dt_opencl_enqueue_copy_image(devid, dev_out, dev_tmp, oorigin, oorigin, region);
+    if(err != CL_SUCCESS) goto error;
+
+    for(int wave = 0; wave < waves; wave++)
+    {
+      for(int k = 0; k < count; k++)
+      {
+        const dt_iop_spots_spot_t *spot = spots + k;
+        if(spot->wave != wave) continue;
+        const int offset = spot->weights;
+        const int sx = spot->x + roi_out->x - spot->dx - roi_in->x;
+        const int sy = spot->y + roi_out->y - spot->dy - roi_in->y;
+        size_t sizes[] = { ROUNDUPWD(spot->width), ROUNDUPHT(spot->height), 1 };
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 0, sizeof(cl_mem), (void *)&dev_in);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 1, sizeof(cl_mem), (void *)&dev_tmp);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 2, sizeof(cl_mem), (void *)&dev_out);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 3, sizeof(cl_mem), (void *)&dev_weights);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 4, sizeof(int), (void *)&offset);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 5, sizeof(int), (void *)&spot->x);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 6, sizeof(int), (void *)&spot->y);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 7, sizeof(int), (void *)&spot->width);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 8, sizeof(int), (void *)&spot->height);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 9, sizeof(int), (void *)&sx);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_spots_clone, 10, sizeof(int), (void *)&sy);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_spots_clone, sizes);
+        if(err != CL_SUCCESS) goto error;
+      }
+
+      // later waves have to see the spots of this one
+      if(wave == waves - 1) break;
+      for(int k = 0; k < count; k++)
+      {
+        const dt_iop_spots_spot_t *spot = spots + k;
+        if(spot->wave != wave) continue;
+        size_t origin[] = { spot->x, spot->y, 0 };
+        size_t spot_region[] = { spot->width, spot->height, 1 };
+        err = dt_opencl_enqueue_copy_image(devid, dev_out, dev_tmp, origin, origin, spot_region);
+        if(err != CL_SUCCESS) goto error;
+      }
+    }
+  }
+
+  dt_opencl_release_mem_object(dev_weights);
+  dt_opencl_release_mem_object(dev_tmp);
+  if(count > 0) _free_spots(spots, count);
+  dt_free_align(weights);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_weights);
+  dt_opencl_release_mem_object(dev_tmp);
+  if(count > 0) _free_spots(spots, count);
+  dt_free_align(weights);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_spots] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  // input, output and the weights of the spots, about a quarter of an image if they cover all of it. the
+  // gpu needs another copy of the output.
+  tiling->factor = piece->pipe->devid >= 0 ? 3.25f : 2.25f;
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = 0;
+  // modify_roi_in() gives every tile the sources of its spots
+  tiling->overlap = 0;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
 }
 
 /** init, cleanup, commit to pipeline */
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 24; // spots.cl, from programs.conf
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)malloc(sizeof(dt_iop_spots_global_data_t));
+  module->data = gd;
+  gd->kernel_spots_clone = dt_opencl_create_kernel(program, "spots_clone");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_spots_clone);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
-  // we don't need global data:
-  module->data = NULL; // malloc(sizeof(dt_iop_spots_global_data_t));
   module->params = calloc(1, sizeof(dt_iop_spots_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_spots_params_t));
   // our module is disabled by default
@@ -552,8 +866,6 @@ void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
   module->params = NULL;
-  free(module->data); // just to be sure
-  module->data = NULL;
 }
 
 void gui_focus(struct dt_iop_module_t *self, gboolean in)
@@ -584,17 +896,23 @@ void gui_focus(struct dt_iop_module_t *self, gboolean in)
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
-  memcpy(piece->data, params, sizeof(dt_iop_spots_params_t));
+  dt_iop_spots_params_t *p = (dt_iop_spots_params_t *)params;
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  // the cached masks stay, they are found by the hash of their form
+  memcpy(d->clone_id, p->clone_id, sizeof(p->clone_id));
+  memcpy(d->clone_algo, p->clone_algo, sizeof(p->clone_algo));
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_spots_data_t));
+  piece->data = calloc(1, sizeof(dt_iop_spots_data_t));
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  for(int k = 0; k < SPOTS_CACHE_ENTRIES; k++) free(d->cache[k].mask);
   free(piece->data);
   piece->data = NULL;
 }
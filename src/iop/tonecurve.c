@@ -281,10 +281,9 @@ error:
 }
 #endif
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
-             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const i,
+                    float *const o, const size_t npixels)
 {
-  const int ch = piece->colors;
   dt_iop_tonecurve_data_t *d = (dt_iop_tonecurve_data_t *)(piece->data);
 
   const float xm_L = 1.0f / d->unbounded_coeffs_L[0];
@@ -294,86 +293,96 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float xm_bl = 1.0f - 1.0f / d->unbounded_coeffs_ab[9];
   const float low_approximation = d->table[0][(int)(0.01f * 0x10000ul)];
 
-  const int width = roi_out->width;
-  const int height = roi_out->height;
   const int autoscale_ab = d->autoscale_ab;
   const int unbound_ab = d->unbound_ab;
 
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(d) schedule(static)
-#endif
-  for(int k = 0; k < height; k++)
+  for(size_t j = 0; j < npixels; j++)
   {
-    float *in = ((float *)i) + (size_t)k * ch * width;
-    float *out = ((float *)o) + (size_t)k * ch * width;
+    // a copy, out may be the same buffer
+    const float in[4] = { i[4 * j + 0], i[4 * j + 1], i[4 * j + 2], i[4 * j + 3] };
+    float *const out = o + 4 * j;
 
-    for(int j = 0; j < width; j++, in += ch, out += ch)
-    {
-      const float L_in = in[0] / 100.0f;
+    const float L_in = in[0] / 100.0f;
 
-      out[0] = (L_in < xm_L) ? d->table[ch_L][CLAMP((int)(L_in * 0x10000ul), 0, 0xffff)]
-                             : dt_iop_eval_exp(d->unbounded_coeffs_L, L_in);
+    out[0] = (L_in < xm_L) ? d->table[ch_L][CLAMP((int)(L_in * 0x10000ul), 0, 0xffff)]
+                           : dt_iop_eval_exp(d->unbounded_coeffs_L, L_in);
 
-      if(autoscale_ab == s_scale_manual)
-      {
-        const float a_in = (in[1] + 128.0f) / 256.0f;
-        const float b_in = (in[2] + 128.0f) / 256.0f;
+    if(autoscale_ab == s_scale_manual)
+    {
+      const float a_in = (in[1] + 128.0f) / 256.0f;
+      const float b_in = (in[2] + 128.0f) / 256.0f;
 
-        if(unbound_ab == 0)
-        {
-          // old style handling of a/b curves: only lut lookup with clamping
-          out[1] = d->table[ch_a][CLAMP((int)(a_in * 0x10000ul), 0, 0xffff)];
-          out[2] = d->table[ch_b][CLAMP((int)(b_in * 0x10000ul), 0, 0xffff)];
-        }
-        else
-        {
-          // new style handling of a/b curves: lut lookup with two-sided extrapolation;
-          // mind the x-axis reversal for the left-handed side
-          out[1] = (a_in > xm_ar)
-                       ? dt_iop_eval_exp(d->unbounded_coeffs_ab, a_in)
-                       : ((a_in < xm_al) ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 3, 1.0f - a_in)
-                                         : d->table[ch_a][CLAMP((int)(a_in * 0x10000ul), 0, 0xffff)]);
-          out[2] = (b_in > xm_br)
-                       ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 6, b_in)
-                       : ((b_in < xm_bl) ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 9, 1.0f - b_in)
-                                         : d->table[ch_b][CLAMP((int)(b_in * 0x10000ul), 0, 0xffff)]);
-        }
+      if(unbound_ab == 0)
+      {
+        // old style handling of a/b curves: only lut lookup with clamping
+        out[1] = d->table[ch_a][CLAMP((int)(a_in * 0x10000ul), 0, 0xffff)];
+        out[2] = d->table[ch_b][CLAMP((int)(b_in * 0x10000ul), 0, 0xffff)];
       }
-      else if(autoscale_ab == s_scale_automatic)
+      else
       {
-        // in Lab: correct compressed Luminance for saturation:
-        if(L_in > 0.01f)
-        {
-          out[1] = in[1] * out[0] / in[0];
-          out[2] = in[2] * out[0] / in[0];
-        }
-        else
-        {
-          out[1] = in[1] * low_approximation;
-          out[2] = in[2] * low_approximation;
-        }
+        // new style handling of a/b curves: lut lookup with two-sided extrapolation;
+        // mind the x-axis reversal for the left-handed side
+        out[1] = (a_in > xm_ar)
+                     ? dt_iop_eval_exp(d->unbounded_coeffs_ab, a_in)
+                     : ((a_in < xm_al) ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 3, 1.0f - a_in)
+                                       : d->table[ch_a][CLAMP((int)(a_in * 0x10000ul), 0, 0xffff)]);
+        out[2] = (b_in > xm_br)
+                     ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 6, b_in)
+                     : ((b_in < xm_bl) ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 9, 1.0f - b_in)
+                                       : d->table[ch_b][CLAMP((int)(b_in * 0x10000ul), 0, 0xffff)]);
       }
-      else if(autoscale_ab == s_scale_automatic_xyz)
+    }
+    else if(autoscale_ab == s_scale_automatic)
+    {
+      // in Lab: correct compressed Luminance for saturation:
+      if(L_in > 0.01f)
       {
-        float XYZ[3];
-        dt_Lab_to_XYZ(in, XYZ);
-        for(int c=0;c<3;c++)
-          XYZ[c] = (XYZ[c] < xm_L) ? d->table[ch_L][CLAMP((int)(XYZ[c] * 0x10000ul), 0, 0xffff)]
-                                   : dt_iop_eval_exp(d->unbounded_coeffs_L, XYZ[c]);
-        dt_XYZ_to_Lab(XYZ, out);
+        out[1] = in[1] * out[0] / in[0];
+        out[2] = in[2] * out[0] / in[0];
       }
-      else if(autoscale_ab == s_scale_automatic_rgb)
+      else
       {
-        float rgb[3] = {0, 0, 0};
-        dt_Lab_to_prophotorgb(in, rgb);
-        for(int c=0;c<3;c++)
-          rgb[c] = (rgb[c] < xm_L) ? d->table[ch_L][CLAMP((int)(rgb[c] * 0x10000ul), 0, 0xffff)]
-                                   : dt_iop_eval_exp(d->unbounded_coeffs_L, rgb[c]);
-        dt_prophotorgb_to_Lab(rgb, out);
+        out[1] = in[1] * low_approximation;
+        out[2] = in[2] * low_approximation;
       }
-
-      out[3] = in[3];
     }
+    else if(autoscale_ab == s_scale_automatic_xyz)
+    {
+      float XYZ[3];
+      dt_Lab_to_XYZ(in, XYZ);
+      for(int c=0;c<3;c++)
+        XYZ[c] = (XYZ[c] < xm_L) ? d->table[ch_L][CLAMP((int)(XYZ[c] * 0x10000ul), 0, 0xffff)]
+                                 : dt_iop_eval_exp(d->unbounded_coeffs_L, XYZ[c]);
+      dt_XYZ_to_Lab(XYZ, out);
+    }
+    else if(autoscale_ab == s_scale_automatic_rgb)
+    {
+      float rgb[3] = {0, 0, 0};
+      dt_Lab_to_prophotorgb(in, rgb);
+      for(int c=0;c<3;c++)
+        rgb[c] = (rgb[c] < xm_L) ? d->table[ch_L][CLAMP((int)(rgb[c] * 0x10000ul), 0, 0xffff)]
+                                 : dt_iop_eval_exp(d->unbounded_coeffs_L, rgb[c]);
+      dt_prophotorgb_to_Lab(rgb, out);
+    }
+
+    out[3] = in[3];
+  }
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const i, void *const o,
+             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int k = 0; k < height; k++)
+  {
+    const size_t offs = (size_t)k * ch * width;
+    process_pixels(self, piece, (const float *)i + offs, (float *)o + offs, width);
   }
 }
 
@@ -497,6 +506,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     piece->request_histogram |= (DT_REQUEST_ON);
   else
     piece->request_histogram &= ~(DT_REQUEST_ON);
+  piece->request_histogram |= (DT_REQUEST_ONLY_DISPLAYED);
 
   for(int ch = 0; ch < ch_max; ch++)
   {
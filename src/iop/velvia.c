@@ -124,108 +124,140 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
   return 1;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
 {
   const dt_iop_velvia_data_t *const data = (dt_iop_velvia_data_t *)piece->data;
 
-  const int ch = piece->colors;
   const float strength = data->strength / 100.0f;
 
   // Apply velvia saturation
   if(strength <= 0.0)
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-  else
   {
+    if(in != out) memcpy(out, in, sizeof(float) * 4 * npixels);
+    return;
+  }
+
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const float inp[4] = { in[4 * k + 0], in[4 * k + 1], in[4 * k + 2], in[4 * k + 3] };
+    float *const outp = out + 4 * k;
+
+    // calculate vibrance, and apply boost velvia saturation at least saturated pixels
+    float pmax = MAX(inp[0], MAX(inp[1], inp[2])); // max value in RGB set
+    float pmin = MIN(inp[0], MIN(inp[1], inp[2])); // min value in RGB set
+    float plum = (pmax + pmin) / 2.0f;             // pixel luminocity
+    float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
+                                : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
+
+    float pweight
+        = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
+                     / (1.0f + (1.0f - data->bias)),
+                 0.0f, 1.0f);              // The weight of pixel
+    float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
+
+    // Apply velvia saturation values
+    outp[0] = CLAMPS(inp[0] + saturation * (inp[0] - 0.5f * (inp[1] + inp[2])), 0.0f, 1.0f);
+    outp[1] = CLAMPS(inp[1] + saturation * (inp[1] - 0.5f * (inp[2] + inp[0])), 0.0f, 1.0f);
+    outp[2] = CLAMPS(inp[2] + saturation * (inp[2] - 0.5f * (inp[0] + inp[1])), 0.0f, 1.0f);
+    outp[3] = inp[3];
+  }
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const int ch = piece->colors;
+
 #ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
-    for(size_t k = 0; k < (size_t)roi_out->width * roi_out->height; k++)
-    {
-      const float *const in = (const float *const)ivoid + (size_t)ch * k;
-      float *const out = (float *const)ovoid + (size_t)ch * k;
-
-      // calculate vibrance, and apply boost velvia saturation at least saturated pixels
-      float pmax = MAX(in[0], MAX(in[1], in[2])); // max value in RGB set
-      float pmin = MIN(in[0], MIN(in[1], in[2])); // min value in RGB set
-      float plum = (pmax + pmin) / 2.0f;          // pixel luminocity
-      float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
-                                  : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
-
-      float pweight
-          = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
-                       / (1.0f + (1.0f - data->bias)),
-                   0.0f, 1.0f);              // The weight of pixel
-      float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
-
-      // Apply velvia saturation values
-      out[0] = CLAMPS(in[0] + saturation * (in[0] - 0.5f * (in[1] + in[2])), 0.0f, 1.0f);
-      out[1] = CLAMPS(in[1] + saturation * (in[1] - 0.5f * (in[2] + in[0])), 0.0f, 1.0f);
-      out[2] = CLAMPS(in[2] + saturation * (in[2] - 0.5f * (in[0] + in[1])), 0.0f, 1.0f);
-    }
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const size_t offs = (size_t)ch * j * roi_out->width;
+    process_pixels(self, piece, (const float *)ivoid + offs, (float *)ovoid + offs, roi_out->width);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
 #if defined(__SSE__)
-void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+// streaming stores for whole buffers, but not when a fused run keeps working on out
+static inline void process_pixels_sse2_common(const dt_iop_velvia_data_t *const data, const float *const in,
+                                              float *const out, const size_t npixels, const int stream)
 {
-  dt_iop_velvia_data_t *data = (dt_iop_velvia_data_t *)piece->data;
-  float *in = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
   const float strength = data->strength / 100.0f;
 
   // Apply velvia saturation
   if(strength <= 0.0)
-    memcpy(out, in, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-  else
   {
+    if(in != out) memcpy(out, in, sizeof(float) * 4 * npixels);
+    return;
+  }
+
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const float *inp = in + 4 * k;
+    float *outp = out + 4 * k;
+    // calculate vibrance, and apply boost velvia saturation at least saturated pixels
+    float pmax = fmaxf(inp[0], fmaxf(inp[1], inp[2])); // max value in RGB set
+    float pmin = fminf(inp[0], fminf(inp[1], inp[2])); // min value in RGB set
+    float plum = (pmax + pmin) / 2.0f;                 // pixel luminocity
+    float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
+                                : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
+
+    float pweight
+        = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
+                 / (1.0f + (1.0f - data->bias)),
+                 0.0f, 1.0f);              // The weight of pixel
+    float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
+
+    // Apply velvia saturation values
+    const __m128 inp_m = _mm_load_ps(inp);
+    const __m128 boost = _mm_set1_ps(saturation);
+    const __m128 min_m = _mm_set1_ps(0.0f);
+    const __m128 max_m = _mm_set1_ps(1.0f);
+
+    const __m128 inp_shuffled
+        = _mm_mul_ps(_mm_add_ps(_mm_shuffle_ps(inp_m, inp_m, _MM_SHUFFLE(3, 0, 2, 1)),
+                                _mm_shuffle_ps(inp_m, inp_m, _MM_SHUFFLE(3, 1, 0, 2))),
+                     _mm_set1_ps(0.5f));
+
+    const __m128 outp_m = _mm_min_ps(
+        max_m, _mm_max_ps(min_m, _mm_add_ps(inp_m, _mm_mul_ps(boost, _mm_sub_ps(inp_m, inp_shuffled)))));
+    if(stream)
+      _mm_stream_ps(outp, outp_m);
+    else
+      _mm_store_ps(outp, outp_m);
+
+    // equivalent to:
+    /*
+     outp[0]=CLAMPS(inp[0] + saturation*(inp[0]-0.5f*(inp[1]+inp[2])), 0.0f, 1.0f);
+     outp[1]=CLAMPS(inp[1] + saturation*(inp[1]-0.5f*(inp[2]+inp[0])), 0.0f, 1.0f);
+     outp[2]=CLAMPS(inp[2] + saturation*(inp[2]-0.5f*(inp[0]+inp[1])), 0.0f, 1.0f);
+    */
+  }
+}
+
+void process_pixels_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                         float *const out, const size_t npixels)
+{
+  process_pixels_sse2_common((dt_iop_velvia_data_t *)piece->data, in, out, npixels, 0);
+}
+
+void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_velvia_data_t *const data = (dt_iop_velvia_data_t *)piece->data;
+  const int ch = piece->colors;
+
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(in, out, data) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
-    for(size_t k = 0; k < (size_t)roi_out->width * roi_out->height; k++)
-    {
-      float *inp = in + ch * k;
-      float *outp = out + ch * k;
-      // calculate vibrance, and apply boost velvia saturation at least saturated pixels
-      float pmax = fmaxf(inp[0], fmaxf(inp[1], inp[2])); // max value in RGB set
-      float pmin = fminf(inp[0], fminf(inp[1], inp[2])); // min value in RGB set
-      float plum = (pmax + pmin) / 2.0f;                 // pixel luminocity
-      float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
-                                  : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
-
-      float pweight
-          = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
-                   / (1.0f + (1.0f - data->bias)),
-                   0.0f, 1.0f);              // The weight of pixel
-      float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
-
-      // Apply velvia saturation values
-      const __m128 inp_m = _mm_load_ps(inp);
-      const __m128 boost = _mm_set1_ps(saturation);
-      const __m128 min_m = _mm_set1_ps(0.0f);
-      const __m128 max_m = _mm_set1_ps(1.0f);
-
-      const __m128 inp_shuffled
-          = _mm_mul_ps(_mm_add_ps(_mm_shuffle_ps(inp_m, inp_m, _MM_SHUFFLE(3, 0, 2, 1)),
-                                  _mm_shuffle_ps(inp_m, inp_m, _MM_SHUFFLE(3, 1, 0, 2))),
-                       _mm_set1_ps(0.5f));
-
-      _mm_stream_ps(
-          outp, _mm_min_ps(
-                    max_m,
-                    _mm_max_ps(min_m, _mm_add_ps(inp_m, _mm_mul_ps(boost, _mm_sub_ps(inp_m, inp_shuffled))))));
-
-      // equivalent to:
-      /*
-       outp[0]=CLAMPS(inp[0] + saturation*(inp[0]-0.5f*(inp[1]+inp[2])), 0.0f, 1.0f);
-       outp[1]=CLAMPS(inp[1] + saturation*(inp[1]-0.5f*(inp[2]+inp[0])), 0.0f, 1.0f);
-       outp[2]=CLAMPS(inp[2] + saturation*(inp[2]-0.5f*(inp[0]+inp[1])), 0.0f, 1.0f);
-      */
-    }
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const size_t offs = (size_t)ch * j * roi_out->width;
+    process_pixels_sse2_common(data, (const float *)ivoid + offs, (float *)ovoid + offs, roi_out->width, 1);
   }
   _mm_sfence();
 
@@ -88,33 +88,40 @@ void connect_key_accels(dt_iop_module_t *self)
 }
 #endif
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  dt_iop_vibrance_data_t *d = (dt_iop_vibrance_data_t *)piece->data;
+
+  const float amount = (d->amount * 0.01);
+
+  for(size_t l = 0; l < (size_t)4 * npixels; l += 4)
+  {
+    /* saturation weight 0 - 1 */
+    float sw = sqrt((in[l + 1] * in[l + 1]) + (in[l + 2] * in[l + 2])) / 256.0;
+    float ls = 1.0 - ((amount * sw) * .25);
+    float ss = 1.0 + (amount * sw);
+    out[l + 0] = in[l + 0] * ls;
+    out[l + 1] = in[l + 1] * ss;
+    out[l + 2] = in[l + 2] * ss;
+    out[l + 3] = in[l + 3];
+  }
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_vibrance_data_t *d = (dt_iop_vibrance_data_t *)piece->data;
   const float *in = (float *)ivoid;
   float *out = (float *)ovoid;
   const int ch = piece->colors;
 
-  const float amount = (d->amount * 0.01);
-
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(in, out) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
   for(int k = 0; k < roi_out->height; k++)
   {
     size_t offs = (size_t)k * roi_out->width * ch;
-    for(int l = 0; l < (roi_out->width * ch); l += ch)
-    {
-      /* saturation weight 0 - 1 */
-      float sw = sqrt((in[offs + l + 1] * in[offs + l + 1]) + (in[offs + l + 2] * in[offs + l + 2])) / 256.0;
-      float ls = 1.0 - ((amount * sw) * .25);
-      float ss = 1.0 + (amount * sw);
-      out[offs + l + 0] = in[offs + l + 0] * ls;
-      out[offs + l + 1] = in[offs + l + 1] * ss;
-      out[offs + l + 2] = in[offs + l + 2] * ss;
-      out[offs + l + 3] = in[offs + l + 3];
-    }
+    process_pixels(self, piece, in + offs, out + offs, roi_out->width);
   }
 }
 
@@ -26,6 +26,7 @@
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
 #include <assert.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <inttypes.h>
 #include <math.h>
@@ -107,6 +108,41 @@ typedef struct dt_iop_watermark_gui_data_t
   GtkWidget *fontsel;
 } dt_iop_watermark_gui_data_t;
 
+// everything the rendered overlay depends on, apart from the svg document itself
+typedef struct dt_iop_watermark_overlay_key_t
+{
+  float scale, rotate, xoffset, yoffset;
+  int alignment;
+  dt_iop_watermark_base_scale_t sizeto;
+  int iw, ih;                  // piece->buf_in
+  int x, y, width, height;     // roi_in position, roi_out size
+  float roi_scale;
+} dt_iop_watermark_overlay_key_t;
+
+typedef struct dt_iop_watermark_overlay_t
+{
+  gchar *svgdoc; // after variable substitution
+  dt_iop_watermark_overlay_key_t key;
+  guint8 *image; // cairo ARGB32, premultiplied
+  int stride;
+  int refs;
+} dt_iop_watermark_overlay_t;
+
+// keep the last few rendered overlays: batch exports with a fixed watermark render it only once
+#define DT_IOP_WATERMARK_OVERLAYS 4
+
+typedef struct dt_iop_watermark_global_data_t
+{
+  dt_pthread_mutex_t lock;
+  GList *overlays; // most recently used first
+
+  // the last svg file read, to not go to disk for every image
+  gchar *filename;
+  gint64 mtime;
+  goffset size;
+  gchar *contents;
+} dt_iop_watermark_global_data_t;
+
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
                   void *new_params, const int new_version)
 {
@@ -300,11 +336,90 @@ static gchar *_string_substitute(gchar *string, const gchar *search, const gchar
   return result;
 }
 
+static void _overlay_unref(dt_iop_watermark_overlay_t *o)
+{
+  if(--o->refs > 0) return;
+  g_free(o->svgdoc);
+  g_free(o->image);
+  free(o);
+}
+
+static void _overlay_release(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_overlay_t *o)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  _overlay_unref(o);
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+/** returns the overlay for svgdoc and key with a reference held, or NULL. */
+static dt_iop_watermark_overlay_t *_overlay_get(dt_iop_watermark_global_data_t *gd, const gchar *svgdoc,
+                                                const dt_iop_watermark_overlay_key_t *key)
+{
+  dt_iop_watermark_overlay_t *res = NULL;
+  dt_pthread_mutex_lock(&gd->lock);
+  for(GList *iter = gd->overlays; iter; iter = g_list_next(iter))
+  {
+    dt_iop_watermark_overlay_t *o = (dt_iop_watermark_overlay_t *)iter->data;
+    if(!memcmp(&o->key, key, sizeof(*key)) && !strcmp(o->svgdoc, svgdoc))
+    {
+      gd->overlays = g_list_remove_link(gd->overlays, iter);
+      gd->overlays = g_list_concat(iter, gd->overlays);
+      o->refs++;
+      res = o;
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+  return res;
+}
+
+/** adds a new overlay to the cache, the reference of the caller is kept. */
+static void _overlay_insert(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_overlay_t *o)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  o->refs++;
+  gd->overlays = g_list_prepend(gd->overlays, o);
+  while(g_list_length(gd->overlays) > DT_IOP_WATERMARK_OVERLAYS)
+  {
+    GList *last = g_list_last(gd->overlays);
+    _overlay_unref((dt_iop_watermark_overlay_t *)last->data);
+    gd->overlays = g_list_delete_link(gd->overlays, last);
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+/** like g_file_get_contents(), but only goes to disk when the file changed since the last call. */
+static gboolean _watermark_read_file(dt_iop_watermark_global_data_t *gd, const gchar *filename,
+                                     gchar **contents)
+{
+  GStatBuf st;
+  if(g_stat(filename, &st)) return FALSE;
+
+  dt_pthread_mutex_lock(&gd->lock);
+  if(!gd->contents || g_strcmp0(gd->filename, filename) || gd->mtime != (gint64)st.st_mtime
+     || gd->size != (goffset)st.st_size)
+  {
+    gchar *data = NULL;
+    if(!g_file_get_contents(filename, &data, NULL, NULL))
+    {
+      dt_pthread_mutex_unlock(&gd->lock);
+      return FALSE;
+    }
+    g_free(gd->contents);
+    g_free(gd->filename);
+    gd->contents = data;
+    gd->filename = g_strdup(filename);
+    gd->mtime = st.st_mtime;
+    gd->size = st.st_size;
+  }
+  *contents = g_strdup(gd->contents);
+  dt_pthread_mutex_unlock(&gd->lock);
+  return TRUE;
+}
+
 static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data_t *data,
                                     const dt_image_t *image)
 {
-  gsize length;
-
   gchar *svgdoc = NULL;
   gchar configdir[PATH_MAX] = { 0 };
   gchar datadir[PATH_MAX] = { 0 };
@@ -340,7 +455,7 @@ static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data
   time_t t = time(NULL);
   (void)localtime_r(&t, &tt_cur);
 
-  if(g_file_get_contents(filename, &svgdata, &length, NULL))
+  if(_watermark_read_file((dt_iop_watermark_global_data_t *)self->data, filename, &svgdata))
   {
     // File is loaded lets substitute strings if found...
 
@@ -773,25 +888,15 @@ static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data
   return svgdoc;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+/** render the watermark for the given roi into a new cairo ARGB32 buffer, NULL on failure. */
+static guint8 *_watermark_render(const dt_iop_watermark_data_t *data, const gchar *svgdoc,
+                                 const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in,
+                                 const dt_iop_roi_t *const roi_out, int *stride_out)
 {
-  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
-  float *in = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
   double angle = (M_PI / 180) * -data->rotate;
 
-  /* Load svg if not loaded */
-  gchar *svgdoc = _watermark_get_svgdoc(self, data, &piece->pipe->image);
-  if(!svgdoc)
-  {
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-    return;
-  }
-
   /* setup stride for performance */
-  int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, roi_out->width);
+  const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, roi_out->width);
 
   /* create cairo memory surface */
   guint8 *image = (guint8 *)g_malloc0_n(roi_out->height, stride);
@@ -800,9 +905,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
   {
     //   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
+    cairo_surface_destroy(surface);
     g_free(image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-    return;
+    return NULL;
   }
 
   /* create cairo context and setup transformation/scale */
@@ -814,15 +919,16 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   /* create the rsvghandle from parsed svg data */
   GError *error = NULL;
   RsvgHandle *svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
-  g_free(svgdoc);
   if(!svg || error)
   {
-    g_free(image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
     dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-    fprintf(stderr, "[watermark] error processing svg file: %s\n", error->message);
-    g_error_free(error);
-    return;
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+    g_free(image);
+    fprintf(stderr, "[watermark] error processing svg file: %s\n", error ? error->message : "");
+    if(error) g_error_free(error);
+    if(svg) g_object_unref(svg);
+    return NULL;
   }
 
   /* get the dimension of svg */
@@ -962,34 +1068,91 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   /* ensure that all operations on surface finishing up */
   cairo_surface_flush(surface);
 
+  cairo_surface_destroy(surface);
+  g_object_unref(svg);
+
+  *stride_out = stride;
+  return image;
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
+  const float *const in = (const float *)ivoid;
+  float *const out = (float *)ovoid;
+  const int ch = piece->colors;
+
+  /* Load svg if not loaded */
+  gchar *svgdoc = _watermark_get_svgdoc(self, data, &piece->pipe->image);
+  if(!svgdoc)
+  {
+    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+    return;
+  }
+
+  // the substituted document covers file changes and all variables, the rest is the geometry
+  dt_iop_watermark_overlay_key_t key;
+  memset(&key, 0, sizeof(key)); // padding takes part in the comparison
+  key.scale = data->scale;
+  key.rotate = data->rotate;
+  key.xoffset = data->xoffset;
+  key.yoffset = data->yoffset;
+  key.alignment = data->alignment;
+  key.sizeto = data->sizeto;
+  key.iw = piece->buf_in.width;
+  key.ih = piece->buf_in.height;
+  key.x = roi_in->x;
+  key.y = roi_in->y;
+  key.width = roi_out->width;
+  key.height = roi_out->height;
+  key.roi_scale = roi_out->scale;
+
+  dt_iop_watermark_overlay_t *overlay = _overlay_get(gd, svgdoc, &key);
+  if(!overlay)
+  {
+    int stride = 0;
+    guint8 *image = _watermark_render(data, svgdoc, piece, roi_in, roi_out, &stride);
+    if(!image)
+    {
+      g_free(svgdoc);
+      memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+      return;
+    }
+    overlay = (dt_iop_watermark_overlay_t *)calloc(1, sizeof(dt_iop_watermark_overlay_t));
+    overlay->svgdoc = svgdoc;
+    overlay->key = key;
+    overlay->image = image;
+    overlay->stride = stride;
+    overlay->refs = 1;
+    _overlay_insert(gd, overlay);
+  }
+  else
+    g_free(svgdoc);
+
   /* render surface on output */
-  guint8 *sd = image;
-  float opacity = data->opacity / 100.0;
-  /*
-  #ifdef _OPENMP
-    #pragma omp parallel for default(none) shared(in, out,sd,opacity) schedule(static)
-  #endif
-  */
+  const float opacity = data->opacity / 100.0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
   for(int j = 0; j < roi_out->height; j++)
-    for(int i = 0; i < roi_out->width; i++)
+  {
+    const guint8 *sd = overlay->image + (size_t)j * overlay->stride;
+    const float *i = in + (size_t)ch * j * roi_out->width;
+    float *o = out + (size_t)ch * j * roi_out->width;
+    for(int k = 0; k < roi_out->width; k++, sd += 4, i += ch, o += ch)
     {
-      float alpha = (sd[3] / 255.0) * opacity;
+      const float alpha = (sd[3] / 255.0) * opacity;
       /* svg uses a premultiplied alpha, so only use opacity for the blending */
-      out[0] = ((1.0 - alpha) * in[0]) + (opacity * (sd[2] / 255.0));
-      out[1] = ((1.0 - alpha) * in[1]) + (opacity * (sd[1] / 255.0));
-      out[2] = ((1.0 - alpha) * in[2]) + (opacity * (sd[0] / 255.0));
-      out[3] = in[3];
-
-      out += ch;
-      in += ch;
-      sd += 4;
+      o[0] = ((1.0 - alpha) * i[0]) + (opacity * (sd[2] / 255.0));
+      o[1] = ((1.0 - alpha) * i[1]) + (opacity * (sd[1] / 255.0));
+      o[2] = ((1.0 - alpha) * i[2]) + (opacity * (sd[0] / 255.0));
+      o[3] = i[3];
     }
+  }
 
-
-  /* clean up */
-  cairo_surface_destroy(surface);
-  g_object_unref(svg);
-  g_free(image);
+  _overlay_release(gd, overlay);
 }
 
 static void watermark_callback(GtkWidget *tb, gpointer user_data)
@@ -1277,6 +1440,25 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd
+      = (dt_iop_watermark_global_data_t *)calloc(1, sizeof(dt_iop_watermark_global_data_t));
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  module->data = gd;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  g_list_free_full(gd->overlays, (GDestroyNotify)_overlay_unref);
+  g_free(gd->filename);
+  g_free(gd->contents);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(struct dt_iop_module_t *self)
 {
   self->gui_data = calloc(1, sizeof(dt_iop_watermark_gui_data_t));
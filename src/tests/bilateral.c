@@ -0,0 +1,221 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * bilateral grid scaling benchmark.
+ *
+ * splats, blurs and slices a synthetic Lab image with a few grid sizes, from a single thread up to
+ * all of them, and prints the times of every step and the speedup over one thread. the splat cuts the
+ * image into one stripe per thread, a single thread splats straight into the grid. the sliced output
+ * with more threads has to match that serial one, only the order of the sums in the grid may differ.
+ * the sse2 slice has to match the plain one on the same grid. doesn't need a running darktable, the grid
+ * takes its buffers from the system allocator.
+ */
+
+#include "common/bilateral.h"
+#include "common/darktable.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+typedef struct timing_t
+{
+  double splat, blur, slice;
+} timing_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--size <width>x<height>] [--runs <n>] [--codepath sse2|simd]\n", progname);
+}
+
+static float *synthetic_image(const int width, const int height)
+{
+  float *img = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  if(!img) return NULL;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      float *px = img + 4 * ((size_t)j * width + i);
+      // smooth gradients with a few hard edges and some noise, like a photo would have
+      const float edge = ((i / 97 + j / 61) & 1) ? 25.0f : 0.0f;
+      const float noise = (float)(((uint32_t)(i * 1103515245u + j * 12345u) >> 16) & 0xff) / 255.0f - 0.5f;
+      px[0] = CLAMPS(50.0f + 30.0f * sinf(i * 0.01f) * cosf(j * 0.013f) + edge + 4.0f * noise, 0.0f, 100.0f);
+      px[1] = 10.0f * sinf(j * 0.02f);
+      px[2] = -10.0f * cosf(i * 0.02f);
+      px[3] = 1.0f;
+    }
+  return img;
+}
+
+#if defined(__SSE__)
+// slice the same grid with the sse2 and the plain code path, returns the largest difference
+static float compare_slice(const float *const in, float *const plain, float *const sse, const int width,
+                           const int height, const float sigma_s, const float sigma_r)
+{
+  const unsigned int sse2 = darktable.codepath.SSE2, simd = darktable.codepath.OPENMP_SIMD;
+  dt_bilateral_t *b = dt_bilateral_init(width, height, sigma_s, sigma_r);
+  dt_bilateral_splat(b, in);
+  dt_bilateral_blur(b);
+  darktable.codepath.SSE2 = 0;
+  darktable.codepath.OPENMP_SIMD = 1;
+  dt_bilateral_slice(b, in, plain, -1.0f);
+  darktable.codepath.SSE2 = 1;
+  darktable.codepath.OPENMP_SIMD = 0;
+  dt_bilateral_slice(b, in, sse, -1.0f);
+  darktable.codepath.SSE2 = sse2;
+  darktable.codepath.OPENMP_SIMD = simd;
+  dt_bilateral_free(b);
+
+  float diff = 0.0f;
+  for(size_t k = 0; k < (size_t)4 * width * height; k++) diff = fmaxf(diff, fabsf(sse[k] - plain[k]));
+  return diff;
+}
+#endif
+
+static timing_t run(const float *const in, float *const out, const int width, const int height,
+                    const float sigma_s, const float sigma_r, const int runs)
+{
+  timing_t best = { INFINITY, INFINITY, INFINITY };
+  for(int r = 0; r < runs; r++)
+  {
+    dt_bilateral_t *b = dt_bilateral_init(width, height, sigma_s, sigma_r);
+    const double start = dt_get_wtime();
+    dt_bilateral_splat(b, in);
+    const double splat = dt_get_wtime();
+    dt_bilateral_blur(b);
+    const double blur = dt_get_wtime();
+    dt_bilateral_slice(b, in, out, -1.0f);
+    const double slice = dt_get_wtime();
+    dt_bilateral_free(b);
+    best.splat = MIN(best.splat, splat - start);
+    best.blur = MIN(best.blur, blur - splat);
+    best.slice = MIN(best.slice, slice - blur);
+  }
+  return best;
+}
+
+int main(int argc, char *arg[])
+{
+  int width = 4000, height = 3000, runs = 3;
+  darktable.codepath.SSE2 = 1;
+  for(int k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--size") && argc > k + 1)
+    {
+      if(sscanf(arg[++k], "%dx%d", &width, &height) != 2 || width < 1 || height < 1)
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+    }
+    else if(!strcmp(arg[k], "--runs") && argc > k + 1)
+    {
+      runs = atoi(arg[++k]);
+      runs = MAX(runs, 1);
+    }
+    else if(!strcmp(arg[k], "--codepath") && argc > k + 1)
+    {
+      k++;
+      darktable.codepath.SSE2 = !strcmp(arg[k], "sse2");
+      darktable.codepath.OPENMP_SIMD = !strcmp(arg[k], "simd");
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+#if !defined(__SSE__)
+  darktable.codepath.SSE2 = 0;
+  darktable.codepath.OPENMP_SIMD = 1;
+#endif
+
+  float *in = synthetic_image(width, height);
+  float *reference = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  float *out = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  if(!in || !reference || !out)
+  {
+    fprintf(stderr, "can't allocate the %dx%d test image\n", width, height);
+    exit(1);
+  }
+
+  // spatial and range sigma of the grids, from fine (local contrast) to coarse (monochrome, tone mapping)
+  static const float sigmas[][2] = { { 8.0f, 10.0f }, { 32.0f, 20.0f }, { 200.0f, 40.0f } };
+#ifdef _OPENMP
+  const int max_threads = omp_get_max_threads();
+#else
+  const int max_threads = 1;
+#endif
+
+  int failed = 0;
+  printf("bilateral grid on %dx%d, best of %d runs, %s\n", width, height, runs,
+         darktable.codepath.SSE2 ? "sse2" : "plain c");
+  for(int s = 0; s < (int)(sizeof(sigmas) / sizeof(sigmas[0])); s++)
+  {
+    const float sigma_s = sigmas[s][0], sigma_r = sigmas[s][1];
+    dt_bilateral_t *b = dt_bilateral_init(width, height, sigma_s, sigma_r);
+    printf("\ngrid %zux%zux%zu (sigma %g/%g)\n", b->size_x, b->size_y, b->size_z, sigma_s, sigma_r);
+    dt_bilateral_free(b);
+    printf("threads    splat     blur    slice    total  speedup  max diff\n");
+
+    timing_t single = { 0 };
+    for(int threads = 1;; threads = MIN(2 * threads, max_threads))
+    {
+#ifdef _OPENMP
+      omp_set_num_threads(threads);
+#endif
+      const timing_t t = run(in, threads == 1 ? reference : out, width, height, sigma_s, sigma_r, runs);
+      if(threads == 1) single = t;
+
+      float diff = 0.0f;
+      if(threads > 1)
+        for(size_t k = 0; k < (size_t)4 * width * height; k++) diff = fmaxf(diff, fabsf(out[k] - reference[k]));
+      // L is in 0..100, the sums over a grid cell may come in any order
+      const int fail = !(diff < 1e-2f);
+      failed += fail;
+
+      const double total = t.splat + t.blur + t.slice;
+      printf("%7d %6.1fms %6.1fms %6.1fms %6.1fms %7.2fx  %g%s\n", threads, 1e3 * t.splat, 1e3 * t.blur,
+             1e3 * t.slice, 1e3 * total, (single.splat + single.blur + single.slice) / total, diff,
+             fail ? "  [FAIL]" : "");
+      if(threads == max_threads) break;
+    }
+
+#if defined(__SSE__)
+    // only the order of the eight weighted cells differs
+    const float diff = compare_slice(in, reference, out, width, height, sigma_s, sigma_r);
+    const int fail = !(diff < 1e-3f);
+    failed += fail;
+    printf("sse2 slice against plain c: max diff %g%s\n", diff, fail ? "  [FAIL]" : "");
+#endif
+  }
+
+  dt_free_align(in);
+  dt_free_align(reference);
+  dt_free_align(out);
+  return failed ? 1 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,196 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * half float conversion test.
+ *
+ * checks the rounding of dt_float_to_half() on the edges that matter: ties to even, carries into the
+ * exponent, denormals, the overflow threshold and nans. every half float has to survive the way back
+ * and forth. when the cpu has F16C the same is checked for that code path, which also has to agree with
+ * the plain one on random bit patterns. doesn't need a running darktable.
+ */
+
+#include "common/cpuid.h"
+#include "common/darktable.h"
+#include "common/half.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct test_case_t
+{
+  uint32_t f;  // bits of the float
+  uint16_t h;  // expected half float
+  const char *what;
+} test_case_t;
+
+static const test_case_t cases[] = {
+  { 0x00000000, 0x0000, "zero" },
+  { 0x80000000, 0x8000, "negative zero" },
+  { 0x3f800000, 0x3c00, "one" },
+  { 0xbf800000, 0xbc00, "minus one" },
+  { 0x3f801000, 0x3c00, "tie rounds down to even" },
+  { 0x3f803000, 0x3c02, "tie rounds up to even" },
+  { 0x3f801001, 0x3c01, "above the tie rounds up" },
+  { 0x3f800fff, 0x3c00, "below the tie rounds down" },
+  { 0x3fffffff, 0x4000, "mantissa carry into the exponent" },
+  { 0x477fe000, 0x7bff, "65504, the largest half float" },
+  { 0x477fefff, 0x7bff, "just below the overflow threshold" },
+  { 0x477ff000, 0x7c00, "overflow threshold rounds to infinity" },
+  { 0xc77ff000, 0xfc00, "negative overflow threshold" },
+  { 0x47800000, 0x7c00, "65536" },
+  { 0x7f7fffff, 0x7c00, "largest float" },
+  { 0x7f800000, 0x7c00, "infinity" },
+  { 0xff800000, 0xfc00, "minus infinity" },
+  { 0x38800000, 0x0400, "smallest normal" },
+  { 0x387fc000, 0x03ff, "largest denormal" },
+  { 0x387fe000, 0x0400, "tie between largest denormal and smallest normal" },
+  { 0x33800000, 0x0001, "smallest denormal" },
+  { 0xb3800000, 0x8001, "negative smallest denormal" },
+  { 0x33000000, 0x0000, "half the smallest denormal rounds to even zero" },
+  { 0x33000001, 0x0001, "above half the smallest denormal" },
+  { 0x33c00000, 0x0002, "denormal tie rounds up to even" },
+  { 0x34200000, 0x0002, "denormal tie rounds down to even" },
+  { 0x00000001, 0x0000, "float denormal" },
+  { 0x7fc00000, 0x7e00, "quiet nan" },
+  { 0xffc00000, 0xfe00, "negative quiet nan" },
+  { 0x7f800001, 0x7e00, "signalling nan becomes quiet" },
+  { 0x7fa00000, 0x7f00, "nan keeps the top of its payload" },
+};
+
+#define N_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static float from_bits(const uint32_t i)
+{
+  float f;
+  memcpy(&f, &i, sizeof(f));
+  return f;
+}
+
+static int is_nan(const uint16_t h)
+{
+  return (h & 0x7c00) == 0x7c00 && (h & 0x3ff);
+}
+
+static int check(const char *codepath)
+{
+  int failed = 0;
+
+  float in[N_CASES];
+  uint16_t out[N_CASES];
+  for(size_t k = 0; k < N_CASES; k++) in[k] = from_bits(cases[k].f);
+  dt_float_to_half(out, in, N_CASES);
+  for(size_t k = 0; k < N_CASES; k++)
+    if(out[k] != cases[k].h)
+    {
+      fprintf(stderr, "[%s] %s: 0x%08x gives 0x%04x instead of 0x%04x\n", codepath, cases[k].what, cases[k].f,
+              out[k], cases[k].h);
+      failed++;
+    }
+
+  // every half float comes back from float exactly, nans stay nans
+  uint16_t *h = dt_alloc_align(64, sizeof(uint16_t) * 65536);
+  uint16_t *back = dt_alloc_align(64, sizeof(uint16_t) * 65536);
+  float *f = dt_alloc_align(64, sizeof(float) * 65536);
+  for(int k = 0; k < 65536; k++) h[k] = k;
+  dt_half_to_float(f, h, 65536);
+  dt_float_to_half(back, f, 65536);
+  for(int k = 0; k < 65536; k++)
+  {
+    const int ok = is_nan(h[k]) ? is_nan(back[k]) && (back[k] & 0x8000) == (h[k] & 0x8000) : back[k] == h[k];
+    if(!ok)
+    {
+      if(failed < 20) fprintf(stderr, "[%s] 0x%04x comes back as 0x%04x\n", codepath, h[k], back[k]);
+      failed++;
+    }
+  }
+  // the denormals are exact multiples of 2^-24
+  for(int k = 0; k < 0x400; k++)
+    if(f[k] != k / 16777216.0f)
+    {
+      if(failed < 20) fprintf(stderr, "[%s] denormal 0x%04x is %g\n", codepath, k, f[k]);
+      failed++;
+    }
+
+  dt_free_align(h);
+  dt_free_align(back);
+  dt_free_align(f);
+  printf("%s: %s\n", codepath, failed ? "FAILED" : "ok");
+  return failed;
+}
+
+// the F16C path has to give the same bits as the plain one, also off the edges tested above
+static int compare_random(const int n)
+{
+  int failed = 0;
+  float *in = dt_alloc_align(64, sizeof(float) * n);
+  uint16_t *plain = dt_alloc_align(64, sizeof(uint16_t) * n);
+  uint16_t *f16c = dt_alloc_align(64, sizeof(uint16_t) * n);
+  uint32_t seed = 0x2545f491u;
+  for(int k = 0; k < n; k++)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    in[k] = from_bits(seed);
+  }
+  darktable.codepath.F16C = 0;
+  dt_float_to_half(plain, in, n);
+  darktable.codepath.F16C = 1;
+  dt_float_to_half(f16c, in, n);
+  for(int k = 0; k < n; k++)
+  {
+    const int ok = is_nan(plain[k]) ? is_nan(f16c[k]) : plain[k] == f16c[k];
+    if(!ok)
+    {
+      if(failed < 20) fprintf(stderr, "float %g: plain 0x%04x, f16c 0x%04x\n", in[k], plain[k], f16c[k]);
+      failed++;
+    }
+  }
+  dt_free_align(in);
+  dt_free_align(plain);
+  dt_free_align(f16c);
+  printf("f16c against plain c on %d random floats: %s\n", n, failed ? "FAILED" : "ok");
+  return failed;
+}
+
+int main(void)
+{
+  int failed = 0;
+
+  darktable.codepath.SSE2 = 0;
+  darktable.codepath.F16C = 0;
+  failed += check("plain c");
+
+#if defined(__SSE__)
+  if(dt_detect_cpu_features() & CPU_FLAG_F16C)
+  {
+    darktable.codepath.SSE2 = 1;
+    darktable.codepath.F16C = 1;
+    failed += check("f16c");
+    failed += compare_random(1 << 20);
+  }
+  else
+    printf("f16c: not supported by this cpu, skipped\n");
+#endif
+
+  return failed ? 1 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,669 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * pixelpipe regression and performance test.
+ *
+ * generates a small synthetic bayer and x-trans raw (float dng), runs them through
+ * the full export pixelpipe and compares the output against reference images.
+ * the cases are:
+ *  - "default": the pipe as it comes up for a fresh raw
+ *  - one case per module that is off by default, enabled with its default params
+ *  - one case per xmp file found in --xmp-dir, if given
+ * every case runs a second time pushed through in bands of a few rows (see pixelpipe_wavefront_band_size),
+ * which has to give the same output as the first run. cases given to --exact run once more with the modules
+ * they are about on the plain codepath, that has to match bit for bit.
+ * references are only ever written with --update, from a build that is known to be good, and a missing one
+ * fails its case. the ones of the cases in the tree are kept in src/tests/pixelpipe/references.
+ * with --opencl every case runs on the cpu and with opencl instead, where the modules get so little device
+ * memory that all of them which can are tiled, and both have to agree. that needs no references, without an
+ * opencl device it exits with 77 as well. pocl gives one on any machine.
+ * per module timings of every case can be written to a json file with --timings.
+ */
+
+#include "common/darktable.h"
+#include "common/exif.h"
+#include "common/film.h"
+#include "common/history.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/imageio_dng.h"
+#include "common/mipmap_cache.h"
+#include "common/opencl.h"
+#include "common/tuning.h"
+#include "control/conf.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_WIDTH 384
+#define TEST_HEIGHT 256
+// device memory in MB left to the modules with --opencl, less than any of them needs for the whole test image
+#define TEST_OPENCL_MEMORY 4
+
+static const uint8_t test_xtrans[6][6] = { { 1, 1, 0, 1, 1, 2 }, { 1, 1, 2, 1, 1, 0 }, { 2, 0, 1, 0, 2, 1 },
+                                           { 1, 1, 2, 1, 1, 0 }, { 1, 1, 0, 1, 1, 2 }, { 0, 2, 1, 2, 0, 1 } };
+
+typedef struct test_context_t
+{
+  const char *work_dir;
+  const char *reference_dir;
+  const char *xmp_dir;
+  gboolean update;
+  gboolean opencl;         // compare tiled opencl runs against the cpu instead of the references
+  float tolerance_mean, tolerance_max;
+  gchar **skip;
+  gchar **exact; // cases that have to match their reference and the plain codepath bit for bit
+
+  int n_tests, n_failed;
+  GString *timings; // json, NULL if not requested
+} test_context_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s --work-dir <dir> (--references <dir> [--update] | --opencl) "
+                  "[--timings <file.json>] "
+                  "[--xmp-dir <dir>] [--skip <op1,op2,...>] [--tolerance <mean>,<max>] "
+                  "[--exact <case1,case2,...>] [--core <darktable options>]\n",
+          progname);
+}
+
+/** a deterministic test scene: gradient, colour patches, a zone plate and a bit of noise */
+static float scene(const int x, const int y, const int c, uint32_t *seed)
+{
+  const float fx = x / (float)TEST_WIDTH, fy = y / (float)TEST_HEIGHT;
+  float v;
+  if(fy < 0.5f && fx < 0.75f)
+  {
+    static const float patches[6][3] = { { 0.6f, 0.1f, 0.1f }, { 0.1f, 0.6f, 0.1f }, { 0.1f, 0.1f, 0.6f },
+                                         { 0.6f, 0.6f, 0.1f }, { 0.1f, 0.6f, 0.6f }, { 0.5f, 0.5f, 0.5f } };
+    const int p = ((int)(fx * 4.0f) + 4 * (int)(fy * 4.0f)) % 6;
+    v = patches[p][c];
+  }
+  else if(fy >= 0.5f && fx < 0.5f)
+  {
+    const float r2 = (fx - 0.25f) * (fx - 0.25f) + (fy - 0.75f) * (fy - 0.75f);
+    v = 0.5f + 0.4f * sinf(2000.0f * r2);
+  }
+  else
+    v = 0.05f + 0.9f * fx * (c + 1) / 3.0f;
+
+  *seed = *seed * 1664525u + 1013904223u;
+  v += 0.01f * ((*seed >> 8) / (float)(1 << 24) - 0.5f);
+  return CLAMP(v, 0.0f, 1.0f);
+}
+
+static int write_test_raw(const char *filename, const uint32_t filters)
+{
+  float *pixels = (float *)malloc(sizeof(float) * TEST_WIDTH * TEST_HEIGHT);
+  if(!pixels) return 1;
+  uint32_t seed = 42;
+  for(int j = 0; j < TEST_HEIGHT; j++)
+    for(int i = 0; i < TEST_WIDTH; i++)
+    {
+      const int c = filters == 9u ? test_xtrans[j % 6][i % 6]
+                                  : (filters >> ((((j << 1) & 14) + (i & 1)) << 1) & 3);
+      pixels[(size_t)j * TEST_WIDTH + i] = scene(i, j, c == 3 ? 1 : c, &seed);
+    }
+  dt_imageio_write_dng(filename, pixels, TEST_WIDTH, TEST_HEIGHT, NULL, 0, filters, test_xtrans, 1.0f);
+  free(pixels);
+  return 0;
+}
+
+static int write_pfm(const char *filename, const float *rgba, const int width, const int height)
+{
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return 1;
+  fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+  float *row = (float *)malloc(sizeof(float) * 3 * width);
+  // pfm stores the rows bottom to top
+  for(int j = height - 1; j >= 0; j--)
+  {
+    for(int i = 0; i < width; i++)
+      for(int c = 0; c < 3; c++) row[3 * i + c] = rgba[4 * ((size_t)j * width + i) + c];
+    fwrite(row, sizeof(float), 3 * width, f);
+  }
+  free(row);
+  fclose(f);
+  return 0;
+}
+
+static float *read_pfm(const char *filename, int *width, int *height)
+{
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return NULL;
+  char head[3] = { 0 };
+  float scale = 0.0f;
+  float *buf = NULL;
+  if(fscanf(f, "%2s %d %d %f", head, width, height, &scale) != 4 || strcmp(head, "PF") || scale >= 0.0f
+     || *width <= 0 || *height <= 0)
+    goto error;
+  fgetc(f); // the single white space after the header
+  buf = (float *)malloc(sizeof(float) * 4 * *width * *height);
+  for(int j = *height - 1; j >= 0; j--)
+    for(int i = 0; i < *width; i++)
+    {
+      float *px = buf + 4 * ((size_t)j * *width + i);
+      if(fread(px, sizeof(float), 3, f) != 3) goto error;
+      px[3] = 0.0f;
+    }
+  fclose(f);
+  return buf;
+
+error:
+  free(buf);
+  fclose(f);
+  return NULL;
+}
+
+static gboolean in_list(gchar **list, const char *name)
+{
+  for(gchar **s = list; s && *s; s++)
+    if(!strcmp(*s, name)) return TRUE;
+  return FALSE;
+}
+
+/** run the pipe once, returns a copy of its output or NULL */
+static float *run_pipe(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, int *width, int *height, double *total)
+{
+  dt_dev_pixelpipe_get_dimensions(pipe, dev, pipe->iwidth, pipe->iheight, &pipe->processed_width,
+                                  &pipe->processed_height);
+
+  dt_dev_pixelpipe_flush_caches(pipe);
+  const double start = dt_get_wtime();
+  dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, pipe->processed_width, pipe->processed_height, 1.0f);
+  *total = dt_get_wtime() - start;
+
+  if(!pipe->backbuf) return NULL;
+  *width = pipe->backbuf_width;
+  *height = pipe->backbuf_height;
+  const size_t size = sizeof(float) * 4 * *width * *height;
+  float *out = (float *)malloc(size);
+  if(out) memcpy(out, pipe->backbuf, size);
+  return out;
+}
+
+/** compare out to ref, both width x height. what tells which comparison failed. */
+static void compare(test_context_t *ctx, const float *out, const float *ref, const int width, const int height,
+                    const gboolean exact, const char *image, const char *name, const char *what,
+                    const double total)
+{
+  double sum = 0.0;
+  float max = 0.0f;
+  for(size_t k = 0; k < (size_t)4 * width * height; k++)
+  {
+    if((k & 3) == 3) continue;
+    const float d = fabsf(out[k] - ref[k]);
+    // nan never compares, catch it explicitly
+    if(isnan(d))
+      max = INFINITY;
+    else
+      max = fmaxf(max, d);
+    sum += d;
+  }
+  const double mean = sum / (3.0 * width * height);
+  if(exact ? max > 0.0f : mean > ctx->tolerance_mean || max > ctx->tolerance_max)
+  {
+    ctx->n_failed++;
+    printf("  [FAIL] %s/%s%s: mean difference %g, max difference %g\n", image, name, what, mean, max);
+  }
+  else
+    printf("  [OK] %s/%s%s (%.3f s)\n", image, name, what, total);
+}
+
+/** run the pipe once on the cpu and once with opencl and compare both. opencl errors make the pipe fall
+ * back to the cpu, so they fail the case. */
+static void run_opencl_case(test_context_t *ctx, dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const char *image,
+                            const char *name)
+{
+  int width = 0, height = 0, cl_width = 0, cl_height = 0;
+  double total = 0.0;
+  dt_conf_set_bool("opencl", FALSE);
+  float *out = run_pipe(dev, pipe, &width, &height, &total);
+  dt_conf_set_bool("opencl", TRUE);
+  darktable.opencl->error_count = 0;
+  float *cl_out = run_pipe(dev, pipe, &cl_width, &cl_height, &total);
+  const int errors = darktable.opencl->error_count;
+  dt_conf_set_bool("opencl", FALSE);
+
+  ctx->n_tests++;
+  if(!out || !cl_out)
+  {
+    ctx->n_failed++;
+    printf("  [FAIL] %s/%s on opencl: pipe produced no output\n", image, name);
+  }
+  else if(errors)
+  {
+    ctx->n_failed++;
+    printf("  [FAIL] %s/%s on opencl: %d errors, the pipe went on on the cpu\n", image, name, errors);
+  }
+  else if(cl_width != width || cl_height != height)
+  {
+    ctx->n_failed++;
+    printf("  [FAIL] %s/%s on opencl: size %dx%d, expected %dx%d\n", image, name, cl_width, cl_height, width,
+           height);
+  }
+  else
+    compare(ctx, cl_out, out, width, height, FALSE, image, name, " on opencl", total);
+  free(out);
+  free(cl_out);
+}
+
+/** run the pipe again with the modules in ops on the plain codepath, which has to reproduce out bit for bit.
+ * all other modules keep theirs, so only the vectorized code of the modules the case is about is checked. */
+static void run_plain_case(test_context_t *ctx, dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const char *image,
+                           const char *name, GList *ops, const float *out, const int width, const int height)
+{
+  GList *saved = NULL;
+  for(GList *o = ops; o; o = g_list_next(o))
+  {
+    const dt_tuning_module_t *tuning = dt_tuning_get(darktable.tuning, (const char *)o->data);
+    dt_tuning_module_t plain = { 0, DT_TUNING_CODEPATH_DEFAULT, 0 };
+    if(tuning) plain = *tuning;
+    saved = g_list_append(saved, g_memdup(&plain, sizeof(plain)));
+    plain.codepath = DT_TUNING_CODEPATH_PLAIN;
+    dt_tuning_set(darktable.tuning, (const char *)o->data, &plain);
+  }
+
+  int pwidth = 0, pheight = 0;
+  double total = 0.0;
+  float *plain_out = run_pipe(dev, pipe, &pwidth, &pheight, &total);
+
+  GList *s = saved;
+  for(GList *o = ops; o; o = g_list_next(o), s = g_list_next(s))
+    dt_tuning_set(darktable.tuning, (const char *)o->data, (const dt_tuning_module_t *)s->data);
+  g_list_free_full(saved, g_free);
+
+  ctx->n_tests++;
+  if(!plain_out)
+  {
+    ctx->n_failed++;
+    printf("  [FAIL] %s/%s on plain c: pipe produced no output\n", image, name);
+  }
+  else if(pwidth != width || pheight != height)
+  {
+    ctx->n_failed++;
+    printf("  [FAIL] %s/%s on plain c: size %dx%d, expected %dx%d\n", image, name, pwidth, pheight, width,
+           height);
+  }
+  else
+    compare(ctx, out, plain_out, width, height, TRUE, image, name, " on plain c", total);
+  free(plain_out);
+}
+
+/** run the pipe once, compare to / update the reference and record the timings. then run it again in
+ * bands of a few rows (see pixelpipe_wavefront_band_size), which has to give the same output. cases in
+ * --exact are also run with the modules in ops on the plain codepath, see run_plain_case(). */
+static void run_case(test_context_t *ctx, dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const char *image,
+                     const char *name, GList *ops)
+{
+  if(ctx->opencl)
+  {
+    run_opencl_case(ctx, dev, pipe, image, name);
+    return;
+  }
+
+  int width = 0, height = 0;
+  double total = 0.0;
+  dt_tuning_reset_timings(darktable.tuning);
+  darktable.tuning->measure = TRUE;
+  float *out = run_pipe(dev, pipe, &width, &height, &total);
+  darktable.tuning->measure = FALSE;
+
+  ctx->n_tests++;
+  gchar *reference = g_strdup_printf("%s/%s-%s.pfm", ctx->reference_dir, image, name);
+  const gboolean exact = in_list(ctx->exact, name);
+
+  if(!out)
+  {
+    ctx->n_failed++;
+    printf("  [FAIL] %s/%s: pipe produced no output\n", image, name);
+  }
+  else if(ctx->update)
+  {
+    if(write_pfm(reference, out, width, height))
+    {
+      ctx->n_failed++;
+      printf("  [FAIL] %s/%s: can't write `%s'\n", image, name, reference);
+    }
+    else
+      printf("  [UPDATED] %s/%s (%.3f s)\n", image, name, total);
+  }
+  else
+  {
+    int rwidth = 0, rheight = 0;
+    float *ref = read_pfm(reference, &rwidth, &rheight);
+    if(!ref)
+    {
+      ctx->n_failed++;
+      printf("  [FAIL] %s/%s: no reference `%s'\n", image, name, reference);
+    }
+    else if(rwidth != width || rheight != height)
+    {
+      ctx->n_failed++;
+      printf("  [FAIL] %s/%s: size %dx%d, expected %dx%d\n", image, name, width, height, rwidth, rheight);
+    }
+    else
+      compare(ctx, out, ref, width, height, exact, image, name, "", total);
+    free(ref);
+  }
+  g_free(reference);
+
+  if(ctx->timings)
+  {
+    if(ctx->timings->len > 2) g_string_append(ctx->timings, ",\n");
+    g_string_append_printf(ctx->timings, "  { \"image\": \"%s\", \"case\": \"%s\", \"total\": %.6f, \"modules\": {",
+                           image, name, total);
+    gboolean first = TRUE;
+    for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+    {
+      const dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+      const double t = dt_tuning_get_timing(darktable.tuning, piece->module->op);
+      if(!piece->enabled || t < 0.0) continue;
+      g_string_append_printf(ctx->timings, "%s \"%s\": %.6f", first ? "" : ",", piece->module->op, t);
+      first = FALSE;
+    }
+    g_string_append(ctx->timings, " } }");
+  }
+
+  if(out)
+  {
+    // a band of 1 MB is less than the height of the test raws. modules only run in bands if their output
+    // doesn't change, so compare against the run above, whatever the reference says.
+    const int band = pipe->wavefront_band;
+    pipe->wavefront_band = 1;
+    int bwidth = 0, bheight = 0;
+    float *banded = run_pipe(dev, pipe, &bwidth, &bheight, &total);
+    pipe->wavefront_band = band;
+
+    ctx->n_tests++;
+    if(!banded)
+    {
+      ctx->n_failed++;
+      printf("  [FAIL] %s/%s in bands: pipe produced no output\n", image, name);
+    }
+    else if(bwidth != width || bheight != height)
+    {
+      ctx->n_failed++;
+      printf("  [FAIL] %s/%s in bands: size %dx%d, expected %dx%d\n", image, name, bwidth, bheight, width,
+             height);
+    }
+    else
+      compare(ctx, banded, out, width, height, FALSE, image, name, " in bands", total);
+    free(banded);
+  }
+
+  if(out && exact && ops) run_plain_case(ctx, dev, pipe, image, name, ops, out, width, height);
+  free(out);
+}
+
+/** run all cases on one of the test raws. xmp is NULL for the built-in cases. */
+static void run_image(test_context_t *ctx, const int imgid, const char *image, const char *xmp)
+{
+  dt_history_delete_on_image(imgid);
+  if(xmp)
+  {
+    dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+    const int err = dt_exif_xmp_read(img, xmp, 1);
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    if(err)
+    {
+      ctx->n_tests++;
+      ctx->n_failed++;
+      printf("  [FAIL] %s: can't read `%s'\n", image, xmp);
+      return;
+    }
+  }
+
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_dev_load_image(&dev, imgid);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  if(!buf.buf)
+  {
+    ctx->n_tests++;
+    ctx->n_failed++;
+    printf("  [FAIL] %s: can't load the raw\n", image);
+    dt_dev_cleanup(&dev);
+    return;
+  }
+
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_init_export(&pipe, buf.width, buf.height, IMAGEIO_RGB | IMAGEIO_FLOAT);
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+
+  if(xmp)
+  {
+    gchar *name = g_path_get_basename(xmp);
+    char *ext = strrchr(name, '.');
+    if(ext) *ext = '\0';
+    // the case is about the modules in its history
+    GList *ops = NULL;
+    for(GList *history = dev.history; history; history = g_list_next(history))
+    {
+      const dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+      if(!g_list_find_custom(ops, hist->module->op, (GCompareFunc)strcmp))
+        ops = g_list_append(ops, hist->module->op);
+    }
+    run_case(ctx, &dev, &pipe, image, name, ops);
+    g_list_free(ops);
+    g_free(name);
+  }
+  else
+  {
+    run_case(ctx, &dev, &pipe, image, "default", NULL);
+
+    for(GList *modules = dev.iop; modules; modules = g_list_next(modules))
+    {
+      const dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+      if(module->default_enabled || module->hide_enable_button) continue;
+      if(in_list(ctx->skip, module->op)) continue;
+
+      dt_dev_pixelpipe_synch_all(&pipe, &dev);
+      for(GList *nodes = pipe.nodes; nodes; nodes = g_list_next(nodes))
+      {
+        dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+        if(piece->module == module) piece->enabled = 1;
+      }
+      GList *ops = g_list_append(NULL, (gpointer)module->op);
+      run_case(ctx, &dev, &pipe, image, module->op, ops);
+      g_list_free(ops);
+    }
+  }
+
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+}
+
+int main(int argc, char *arg[])
+{
+  test_context_t ctx = { 0 };
+  ctx.tolerance_mean = 1e-4f;
+  ctx.tolerance_max = 2e-2f;
+  gboolean tolerance_set = FALSE;
+  const char *timings_filename = NULL;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--work-dir") && argc > k + 1)
+      ctx.work_dir = arg[++k];
+    else if(!strcmp(arg[k], "--references") && argc > k + 1)
+      ctx.reference_dir = arg[++k];
+    else if(!strcmp(arg[k], "--xmp-dir") && argc > k + 1)
+      ctx.xmp_dir = arg[++k];
+    else if(!strcmp(arg[k], "--timings") && argc > k + 1)
+      timings_filename = arg[++k];
+    else if(!strcmp(arg[k], "--skip") && argc > k + 1)
+      ctx.skip = g_strsplit(arg[++k], ",", -1);
+    else if(!strcmp(arg[k], "--exact") && argc > k + 1)
+      ctx.exact = g_strsplit(arg[++k], ",", -1);
+    else if(!strcmp(arg[k], "--tolerance") && argc > k + 1)
+    {
+      k++;
+      tolerance_set = TRUE;
+      if(sscanf(arg[k], "%f,%f", &ctx.tolerance_mean, &ctx.tolerance_max) != 2)
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+    }
+    else if(!strcmp(arg[k], "--update"))
+      ctx.update = TRUE;
+    else if(!strcmp(arg[k], "--opencl"))
+      ctx.opencl = TRUE;
+    else if(!strcmp(arg[k], "--core"))
+    {
+      // everything from here on should be passed to the core
+      k++;
+      break;
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+
+  if(!ctx.work_dir || !(ctx.reference_dir || ctx.opencl))
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+  // the kernels use native math functions, they don't match the cpu as closely as the cpu matches itself
+  if(ctx.opencl && !tolerance_set)
+  {
+    ctx.tolerance_mean = 1e-3f;
+    ctx.tolerance_max = 5e-2f;
+  }
+
+  int m_argc = 0;
+  char **m_arg = malloc((6 + argc - k + 1) * sizeof(char *));
+  m_arg[m_argc++] = "darktable-test-pixelpipe";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  // references are made on the cpu, opencl results differ slightly
+  if(!ctx.opencl) m_arg[m_argc++] = "--disable-opencl";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui and without data.db:
+  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+  {
+    free(m_arg);
+    exit(1);
+  }
+
+  if(ctx.opencl)
+  {
+    if(!dt_opencl_is_inited())
+    {
+      printf("no opencl device, skipped\n");
+      dt_cleanup();
+      free(m_arg);
+      return 77;
+    }
+#ifdef HAVE_OPENCL
+    // leave the modules so little device memory that they have to tile, the headroom takes the rest
+    cl_ulong memory = darktable.opencl->dev[0].max_global_mem;
+    for(int d = 1; d < darktable.opencl->num_devs; d++)
+      memory = MIN(memory, darktable.opencl->dev[d].max_global_mem);
+    dt_conf_set_int("opencl_memory_headroom", MAX((int)(memory >> 20) - TEST_OPENCL_MEMORY, 0));
+#endif
+    dt_conf_set_bool("opencl", FALSE);
+  }
+
+  g_mkdir_with_parents(ctx.work_dir, 0755);
+  if(ctx.update && ctx.reference_dir) g_mkdir_with_parents(ctx.reference_dir, 0755);
+  if(timings_filename) ctx.timings = g_string_new("[\n");
+
+  static const struct
+  {
+    const char *name;
+    uint32_t filters;
+  } images[] = { { "bayer", 0x94949494u }, { "xtrans", 9u } };
+
+  dt_film_t film;
+  const int filmid = dt_film_new(&film, ctx.work_dir);
+
+  for(int i = 0; i < (int)G_N_ELEMENTS(images); i++)
+  {
+    gchar *filename = g_strdup_printf("%s/%s.dng", ctx.work_dir, images[i].name);
+    const int imgid = write_test_raw(filename, images[i].filters) ? 0 : dt_image_import(filmid, filename, TRUE);
+    printf("running tests on '%s'\n", images[i].name);
+    if(!imgid)
+    {
+      ctx.n_tests++;
+      ctx.n_failed++;
+      printf("  [FAIL] %s: can't create test raw `%s'\n", images[i].name, filename);
+      g_free(filename);
+      continue;
+    }
+    g_free(filename);
+
+    run_image(&ctx, imgid, images[i].name, NULL);
+
+    GDir *dir = ctx.xmp_dir ? g_dir_open(ctx.xmp_dir, 0, NULL) : NULL;
+    if(dir)
+    {
+      const gchar *entry;
+      while((entry = g_dir_read_name(dir)))
+      {
+        if(!g_str_has_suffix(entry, ".xmp")) continue;
+        gchar *xmp = g_build_filename(ctx.xmp_dir, entry, NULL);
+        run_image(&ctx, imgid, images[i].name, xmp);
+        g_free(xmp);
+      }
+      g_dir_close(dir);
+    }
+  }
+
+  if(ctx.timings)
+  {
+    g_string_append(ctx.timings, "\n]\n");
+    if(!g_file_set_contents(timings_filename, ctx.timings->str, ctx.timings->len, NULL))
+      fprintf(stderr, "can't write timings to `%s'\n", timings_filename);
+    g_string_free(ctx.timings, TRUE);
+  }
+
+  printf("%d / %d tests failed\n", ctx.n_failed, ctx.n_tests);
+
+  g_strfreev(ctx.skip);
+  g_strfreev(ctx.exact);
+  dt_cleanup();
+  free(m_arg);
+
+  return ctx.n_failed > 0 ? 1 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
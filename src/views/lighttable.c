@@ -109,6 +109,15 @@ typedef struct dt_library_t
 
   int32_t collection_count;
 
+  // scroll tracking for predictive thumbnail prefetching
+  struct
+  {
+    int32_t offset;  // index of the first visible image at the last expose
+    double time;     // time of the last expose
+    float velocity;  // smoothed scroll speed in rows per second
+    int direction;   // 1 down, -1 up, 0 not scrolled yet
+  } prefetch;
+
   // stuff for the audio player
   GPid audio_player_pid;   // the pid of the child process
   int32_t audio_player_id; // the imgid of the image the audio is played for
@@ -137,6 +146,9 @@ static guint n_targets = G_N_ELEMENTS(target_list);
 
 static void _stop_audio(dt_library_t *lib);
 
+// bumped whenever queued prefetch jobs become useless, see dt_image_prefetch_job_create()
+static uint32_t _prefetch_serial = 0;
+
 const char *name(dt_view_t *self)
 {
   return _("lighttable");
@@ -435,6 +447,10 @@ void init(dt_view_t *self)
   lib->full_res_thumb_id = -1;
   lib->audio_player_id = -1;
   lib->single_img_id = -1;
+  lib->prefetch.offset = 0;
+  lib->prefetch.time = dt_get_wtime();
+  lib->prefetch.velocity = 0.0f;
+  lib->prefetch.direction = 0;
 
   /* setup collection listener and initialize main_query statement */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
@@ -482,6 +498,80 @@ grid_to_index (int row, int col, int stride, int offset)
 }
 #endif
 
+/**
+ * \brief Queue background loads of the thumbnails that are about to be scrolled into view
+ *
+ * Keeps track of the scroll direction and speed between exposes and prefetches up to
+ * plugins/lighttable/prefetch_rows rows ahead, more the faster the user scrolls. Prefetches
+ * still queued for the other direction are cancelled when the user turns around.
+ * Must be called before the visible thumbnails are requested, the job queue being a stack
+ * the on-screen requests then take precedence.
+ *
+ * \param[in] offset The index of the top-left visible image in memory.collected_images
+ * \param[in] stride The number of images per row in memory.collected_images
+ * \param[in] cols The number of visible columns
+ * \param[in] rows The number of visible rows
+ * \param[in] mip The mip size used to draw the thumbnails
+ */
+static void _prefetch_thumbnails(dt_library_t *lib, const int32_t offset, const int stride, const int cols,
+                                 const int rows, const dt_mipmap_size_t mip)
+{
+  const double now = dt_get_wtime();
+  const double dt = now - lib->prefetch.time;
+  const int32_t moved = offset - lib->prefetch.offset;
+  lib->prefetch.offset = offset;
+  lib->prefetch.time = now;
+
+  if(moved != 0)
+  {
+    const int direction = moved > 0 ? 1 : -1;
+    const float velocity = dt > 0.0 ? fabsf(moved / (float)stride) / dt : 0.0f;
+    if(direction != lib->prefetch.direction)
+    {
+      // turned around, whatever is still queued for the old direction is wasted effort now
+      __sync_fetch_and_add(&_prefetch_serial, 1);
+      lib->prefetch.velocity = velocity;
+    }
+    else
+      lib->prefetch.velocity = 0.5f * (lib->prefetch.velocity + velocity);
+    lib->prefetch.direction = direction;
+  }
+  else if(dt > 1.0)
+    lib->prefetch.velocity = 0.0f;
+
+  const int budget = dt_conf_get_int("plugins/lighttable/prefetch_rows");
+  if(budget <= 0 || lib->prefetch.direction == 0 || mip >= DT_MIPMAP_F || !lib->statements.main_query) return;
+
+  // look half a second ahead, but at least one row
+  const int depth = MIN(budget, 1 + (int)(lib->prefetch.velocity * 0.5f));
+
+  // farthest row first, so the nearest ones end up on top of the job stack
+  for(int r = depth - 1; r >= 0; r--)
+  {
+    const int32_t start = lib->prefetch.direction > 0 ? offset + (rows + r) * stride : offset - (r + 1) * stride;
+    if(start < 0 || start >= lib->collection_count) continue;
+
+    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
+    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, start);
+    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, cols);
+    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+    {
+      const int32_t imgid = sqlite3_column_int(lib->statements.main_query, 0);
+
+      // don't bother the job queue with what we already have
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_TESTLOCK, 'r');
+      const gboolean cached = buf.buf != NULL;
+      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+      if(cached) continue;
+
+      dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG,
+                         dt_image_prefetch_job_create(imgid, mip, &_prefetch_serial));
+    }
+  }
+}
+
 static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t pointerx,
                                int32_t pointery)
 {
@@ -607,6 +697,9 @@ static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32
   if(iir > 1) shown_rows += max_rows - 2;
   dt_view_set_scrollbar(self, 0, 1, 1, offset, shown_rows * iir, (max_rows - 1) * iir);
 
+  _prefetch_thumbnails(lib, offset, iir, iir, max_rows,
+                       dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, 0.9f * wd, 0.9f * ht));
+
   /* let's reset and reuse the main_query statement */
   DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
   DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
@@ -1165,6 +1258,11 @@ static int expose_zoomable(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
   dt_view_set_scrollbar(self, MAX(0, offset_i), DT_LIBRARY_MAX_ZOOM, zoom, DT_LIBRARY_MAX_ZOOM * offset_j,
                         lib->collection_count, DT_LIBRARY_MAX_ZOOM * max_cols);
 
+  // in 1:1 mode the rows of the grid aren't what is scrolled through
+  if(zoom != 1)
+    _prefetch_thumbnails(lib, offset, DT_LIBRARY_MAX_ZOOM, max_cols, max_rows,
+                         dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, 0.9f * wd, 0.9f * ht));
+
   cairo_translate(cr, -offset_x * wd, -offset_y * ht);
   cairo_translate(cr, -MIN(offset_i * wd, 0.0), 0.0);
 
@@ -71,6 +71,11 @@ void dt_view_manager_init(dt_view_manager_t *vm)
       "SELECT id FROM main.images WHERE group_id = (SELECT group_id FROM main.images WHERE id=?1) AND id != ?2",
       -1, &vm->statements.get_grouped, NULL);
 
+  vm->thumb_surfaces.entries = NULL;
+  vm->thumb_surfaces.cost = 0;
+  vm->thumb_surfaces.max_cost = (size_t)MAX(dt_conf_get_int("cache_thumbnail_surfaces"), 0) * 1024 * 1024;
+  vm->thumb_surfaces.display_transforms_generation = 0;
+
   dt_view_manager_load_modules(vm);
 
   // Modules loaded, let's handle specific cases
@@ -96,9 +101,14 @@ void dt_view_manager_gui_init(dt_view_manager_t *vm)
   }
 }
 
+static void _thumb_surface_free(gpointer data);
+
 void dt_view_manager_cleanup(dt_view_manager_t *vm)
 {
   for(GList *iter = vm->views; iter; iter = g_list_next(iter)) dt_view_unload_module((dt_view_t *)iter->data);
+  g_list_free_full(vm->thumb_surfaces.entries, _thumb_surface_free);
+  vm->thumb_surfaces.entries = NULL;
+  vm->thumb_surfaces.cost = 0;
 }
 
 const dt_view_t *dt_view_manager_get_current_view(dt_view_manager_t *vm)
@@ -808,6 +818,214 @@ int32_t dt_view_get_image_to_act_on()
   }
 }
 
+/* a thumbnail as it is handed to cairo: converted to CAIRO_FORMAT_RGB24 (and color managed)
+ * once, and for the downscaling case already resampled to the device pixels it covers on screen.
+ * that way exposing the lighttable or filmstrip doesn't need to touch any pixels nor allocate
+ * anything as long as neither the mip nor the zoom level changes. */
+typedef struct dt_view_thumb_surface_t
+{
+  uint32_t imgid;
+  dt_mipmap_size_t mip;
+  uint32_t generation;
+  dt_colorspaces_color_profile_type_t color_space;
+  gboolean color_managed;
+  int32_t width, height; // size of the surface in device pixels
+  size_t cost;
+  cairo_surface_t *surface;
+} dt_view_thumb_surface_t;
+
+static void _thumb_surface_free(gpointer data)
+{
+  dt_view_thumb_surface_t *s = (dt_view_thumb_surface_t *)data;
+  cairo_surface_destroy(s->surface);
+  free(s);
+}
+
+static void _thumb_surface_remove(dt_view_manager_t *vm, GList *link)
+{
+  dt_view_thumb_surface_t *s = (dt_view_thumb_surface_t *)link->data;
+  vm->thumb_surfaces.cost -= s->cost;
+  vm->thumb_surfaces.entries = g_list_delete_link(vm->thumb_surfaces.entries, link);
+  _thumb_surface_free(s);
+}
+
+static cairo_surface_t *_thumb_surface_convert(const dt_mipmap_buffer_t *buf, cmsHTRANSFORM transform)
+{
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, buf->width, buf->height);
+  if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+  {
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+
+  uint8_t *rgbbuf = cairo_image_surface_get_data(surface);
+  const int32_t stride = cairo_image_surface_get_stride(surface);
+  cairo_surface_flush(surface);
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform)
+#endif
+  for(int i = 0; i < buf->height; i++)
+  {
+    const uint8_t *in = buf->buf + (size_t)i * buf->width * 4;
+    uint8_t *out = rgbbuf + (size_t)i * stride;
+
+    if(transform)
+    {
+      cmsDoTransform(transform, in, out, buf->width);
+    }
+    else
+    {
+      for(int j = 0; j < buf->width; j++, in += 4, out += 4)
+      {
+        out[0] = in[2];
+        out[1] = in[1];
+        out[2] = in[0];
+      }
+    }
+  }
+  cairo_surface_mark_dirty(surface);
+
+  return surface;
+}
+
+// returns a surface owned by the cache, valid until the next call.
+static cairo_surface_t *_thumb_surface_get(dt_view_manager_t *vm, const dt_mipmap_buffer_t *buf, const float scale)
+{
+  gboolean have_lock = FALSE;
+  cmsHTRANSFORM transform = NULL;
+
+  if(dt_conf_get_bool("cache_color_managed"))
+  {
+    pthread_rwlock_rdlock(&darktable.color_profiles->xprofile_lock);
+    have_lock = TRUE;
+
+    // the display profile or intent changed since the surfaces were converted
+    if(vm->thumb_surfaces.display_transforms_generation
+       != darktable.color_profiles->display_transforms_generation)
+    {
+      g_list_free_full(vm->thumb_surfaces.entries, _thumb_surface_free);
+      vm->thumb_surfaces.entries = NULL;
+      vm->thumb_surfaces.cost = 0;
+      vm->thumb_surfaces.display_transforms_generation = darktable.color_profiles->display_transforms_generation;
+    }
+
+    // we only color manage when a thumbnail is sRGB or AdobeRGB. everything else just gets dumped to the screen
+    if(buf->color_space == DT_COLORSPACE_SRGB &&
+       darktable.color_profiles->transform_srgb_to_display)
+    {
+      transform = darktable.color_profiles->transform_srgb_to_display;
+    }
+    else if(buf->color_space == DT_COLORSPACE_ADOBERGB &&
+            darktable.color_profiles->transform_adobe_rgb_to_display)
+    {
+      transform = darktable.color_profiles->transform_adobe_rgb_to_display;
+    }
+    else
+    {
+      pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
+      have_lock = FALSE;
+      if(buf->color_space == DT_COLORSPACE_NONE)
+      {
+        fprintf(stderr, "oops, there seems to be a code path not setting the color space of thumbnails!\n");
+      }
+      else if(buf->color_space != DT_COLORSPACE_DISPLAY)
+      {
+        fprintf(stderr, "oops, there seems to be a code path setting an unhandled color space of thumbnails (%s)!\n",
+                dt_colorspaces_get_name(buf->color_space, "from file"));
+      }
+    }
+  }
+
+  // only pre-scale when shrinking, skulls and 1:1 mips are drawn as they are.
+  const double ppd = darktable.gui ? darktable.gui->ppd : 1.0;
+  int32_t width = buf->width, height = buf->height;
+  if(buf->width > 8 && buf->height > 8 && scale * ppd < 0.99)
+  {
+    width = MAX(1, (int32_t)(buf->width * scale * ppd + 0.5));
+    height = MAX(1, (int32_t)(buf->height * scale * ppd + 0.5));
+  }
+
+  for(GList *iter = vm->thumb_surfaces.entries; iter; iter = g_list_next(iter))
+  {
+    dt_view_thumb_surface_t *s = (dt_view_thumb_surface_t *)iter->data;
+    if(s->imgid == buf->imgid && s->mip == buf->size && s->generation == buf->generation
+       && s->color_space == buf->color_space && s->color_managed == (transform != NULL) && s->width == width
+       && s->height == height)
+    {
+      if(have_lock) pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
+      // move to front, so eviction hits the ones not shown any more
+      if(iter != vm->thumb_surfaces.entries)
+      {
+        vm->thumb_surfaces.entries = g_list_remove_link(vm->thumb_surfaces.entries, iter);
+        vm->thumb_surfaces.entries = g_list_concat(iter, vm->thumb_surfaces.entries);
+      }
+      return s->surface;
+    }
+  }
+
+  cairo_surface_t *surface = _thumb_surface_convert(buf, transform);
+  if(have_lock) pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
+  if(!surface) return NULL;
+
+  if(width != buf->width || height != buf->height)
+  {
+    cairo_surface_t *scaled = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    if(cairo_surface_status(scaled) == CAIRO_STATUS_SUCCESS)
+    {
+      cairo_t *cr = cairo_create(scaled);
+      cairo_scale(cr, width / (double)buf->width, height / (double)buf->height);
+      cairo_set_source_surface(cr, surface, 0, 0);
+      cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+      cairo_paint(cr);
+      cairo_destroy(cr);
+      cairo_surface_destroy(surface);
+      surface = scaled;
+    }
+    else
+    {
+      // keep the unscaled one, cairo will scale it on the fly
+      cairo_surface_destroy(scaled);
+      width = buf->width;
+      height = buf->height;
+    }
+  }
+
+  // drop stale versions of this thumbnail, they will never be hit again
+  for(GList *iter = vm->thumb_surfaces.entries; iter;)
+  {
+    GList *next = g_list_next(iter);
+    dt_view_thumb_surface_t *s = (dt_view_thumb_surface_t *)iter->data;
+    if(s->imgid == buf->imgid && s->mip == buf->size && s->generation != buf->generation)
+      _thumb_surface_remove(vm, iter);
+    iter = next;
+  }
+
+  dt_view_thumb_surface_t *s = (dt_view_thumb_surface_t *)malloc(sizeof(dt_view_thumb_surface_t));
+  if(!s)
+  {
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+  s->imgid = buf->imgid;
+  s->mip = buf->size;
+  s->generation = buf->generation;
+  s->color_space = buf->color_space;
+  s->color_managed = transform != NULL;
+  s->width = width;
+  s->height = height;
+  s->cost = (size_t)cairo_image_surface_get_stride(surface) * height;
+  s->surface = surface;
+  vm->thumb_surfaces.entries = g_list_prepend(vm->thumb_surfaces.entries, s);
+  vm->thumb_surfaces.cost += s->cost;
+
+  // evict least recently used surfaces, but never the one we are about to draw
+  while(vm->thumb_surfaces.cost > vm->thumb_surfaces.max_cost && g_list_next(vm->thumb_surfaces.entries))
+    _thumb_surface_remove(vm, g_list_last(vm->thumb_surfaces.entries));
+
+  return surface;
+}
+
 int dt_view_image_expose(dt_view_image_over_t *image_over, uint32_t imgid, cairo_t *cr, int32_t width,
                          int32_t height, int32_t zoom, int32_t px, int32_t py, gboolean full_preview, gboolean image_only)
 {
@@ -946,76 +1164,8 @@ int dt_view_image_expose(dt_view_image_over_t *image_over, uint32_t imgid, cairo
     float scale = 1.0;
 
     cairo_surface_t *surface = NULL;
-    uint8_t *rgbbuf = NULL;
     if(buf.buf)
     {
-      rgbbuf = (uint8_t *)calloc(buf.width * buf.height * 4, sizeof(uint8_t));
-      if(rgbbuf)
-      {
-        gboolean have_lock = FALSE;
-        cmsHTRANSFORM transform = NULL;
-
-        if(dt_conf_get_bool("cache_color_managed"))
-        {
-          pthread_rwlock_rdlock(&darktable.color_profiles->xprofile_lock);
-          have_lock = TRUE;
-
-          // we only color manage when a thumbnail is sRGB or AdobeRGB. everything else just gets dumped to the screen
-          if(buf.color_space == DT_COLORSPACE_SRGB &&
-             darktable.color_profiles->transform_srgb_to_display)
-          {
-            transform = darktable.color_profiles->transform_srgb_to_display;
-          }
-          else if(buf.color_space == DT_COLORSPACE_ADOBERGB &&
-                  darktable.color_profiles->transform_adobe_rgb_to_display)
-          {
-            transform = darktable.color_profiles->transform_adobe_rgb_to_display;
-          }
-          else
-          {
-            pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
-            have_lock = FALSE;
-            if(buf.color_space == DT_COLORSPACE_NONE)
-            {
-              fprintf(stderr, "oops, there seems to be a code path not setting the color space of thumbnails!\n");
-            }
-            else if(buf.color_space != DT_COLORSPACE_DISPLAY)
-            {
-              fprintf(stderr, "oops, there seems to be a code path setting an unhandled color space of thumbnails (%s)!\n",
-                      dt_colorspaces_get_name(buf.color_space, "from file"));
-            }
-          }
-        }
-
-#ifdef _OPENMP
-  #pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform)
-#endif
-        for(int i = 0; i < buf.height; i++)
-        {
-          const uint8_t *in = buf.buf + i * buf.width * 4;
-          uint8_t *out = rgbbuf + i * buf.width * 4;
-
-          if(transform)
-          {
-            cmsDoTransform(transform, in, out, buf.width);
-          }
-          else
-          {
-            for(int j = 0; j < buf.width; j++, in += 4, out += 4)
-            {
-              out[0] = in[2];
-              out[1] = in[1];
-              out[2] = in[0];
-            }
-          }
-        }
-        if(have_lock) pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
-
-        const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf.width);
-        surface
-          = cairo_image_surface_create_for_data(rgbbuf, CAIRO_FORMAT_RGB24, buf.width, buf.height, stride);
-      }
-
       if(zoom == 1 && !image_only)
       {
         const int32_t tb = DT_PIXEL_APPLY_DPI(dt_conf_get_int("plugins/darkroom/ui/border_size"));
@@ -1023,6 +1173,8 @@ int dt_view_image_expose(dt_view_image_over_t *image_over, uint32_t imgid, cairo
       }
       else
         scale = fminf(width * imgwd / (float)buf.width, height * imgwd / (float)buf.height);
+
+      surface = _thumb_surface_get(darktable.view_manager, &buf, scale);
     }
 
     // draw centered and fitted:
@@ -1038,22 +1190,34 @@ int dt_view_image_expose(dt_view_image_over_t *image_over, uint32_t imgid, cairo
     if(buf.buf && surface)
     {
       if (!image_only) cairo_translate(cr, -0.5 * buf.width, -0.5 * buf.height);
-      cairo_set_source_surface(cr, surface, 0, 0);
-      // set filter no nearest:
-      // in skull mode, we want to see big pixels.
-      // in 1 iir mode for the right mip, we want to see exactly what the pipe gave us, 1:1 pixel for pixel.
-      // in between, filtering just makes stuff go unsharp.
-      if((buf.width <= 8 && buf.height <= 8) || fabsf(scale - 1.0f) < 0.01f)
-        cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
-      cairo_rectangle(cr, 0, 0, buf.width, buf.height);
-      cairo_fill(cr);
-      cairo_surface_destroy(surface);
+      const int32_t sw = cairo_image_surface_get_width(surface);
+      const int32_t sh = cairo_image_surface_get_height(surface);
+      if(sw != buf.width || sh != buf.height)
+      {
+        // pre-scaled to device pixels already, this maps it (close to) 1:1 onto the screen
+        cairo_save(cr);
+        cairo_scale(cr, buf.width / (double)sw, buf.height / (double)sh);
+        cairo_set_source_surface(cr, surface, 0, 0);
+        cairo_rectangle(cr, 0, 0, sw, sh);
+        cairo_fill(cr);
+        cairo_restore(cr);
+      }
+      else
+      {
+        cairo_set_source_surface(cr, surface, 0, 0);
+        // set filter no nearest:
+        // in skull mode, we want to see big pixels.
+        // in 1 iir mode for the right mip, we want to see exactly what the pipe gave us, 1:1 pixel for pixel.
+        // in between, filtering just makes stuff go unsharp.
+        if((buf.width <= 8 && buf.height <= 8) || fabsf(scale - 1.0f) < 0.01f)
+          cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+        cairo_rectangle(cr, 0, 0, buf.width, buf.height);
+        cairo_fill(cr);
+      }
 
       cairo_rectangle(cr, 0, 0, buf.width, buf.height);
     }
 
-    free(rgbbuf);
-
     if (image_only)
     {
       cairo_restore(cr);
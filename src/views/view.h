@@ -187,6 +187,14 @@ typedef struct dt_view_manager_t
     sqlite3_stmt *get_grouped;
   } statements;
 
+  /* converted and pre-scaled thumbnail surfaces, most recently used first.
+   * only ever touched from the gui thread, so no locking. */
+  struct
+  {
+    GList *entries;
+    size_t cost, max_cost;
+    uint32_t display_transforms_generation; // of darktable.color_profiles the entries were converted with
+  } thumb_surfaces;
 
   /*
    * Proxy